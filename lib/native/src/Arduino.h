@@ -0,0 +1,276 @@
+#ifndef ESPARKLE_NATIVE_ARDUINO_H
+#define ESPARKLE_NATIVE_ARDUINO_H
+
+/**
+ * Host stand-in for the ESP8266 Arduino core, just what ESParkle uses
+ *
+ * Time is virtual (see native.h): it only moves on yield(), delay() and
+ * nativeAdvance(), so that runs are repeatable and faster than real time.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+// SDK c_types.h
+typedef uint8_t uint8;
+typedef uint16_t uint16;
+typedef uint32_t uint32;
+typedef int8_t sint8;
+typedef int16_t sint16;
+typedef int32_t sint32;
+
+#define ICACHE_RAM_ATTR
+#define IRAM_ATTR
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define FPSTR(p) (reinterpret_cast<const __FlashStringHelper *>(p))
+#define F(s) FPSTR(s)
+
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define pgm_read_ptr(p) (*(void *const *)(p))
+#define memcpy_P memcpy
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strncasecmp_P strncasecmp
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strlcpy_P strlcpy
+#define sprintf_P sprintf
+#define snprintf_P snprintf
+#define vsnprintf_P vsnprintf
+
+#define HEX 16
+#define DEC 10
+#define LOW 0
+#define HIGH 1
+#define RISING 1
+#define FALLING 2
+#define CHANGE 3
+
+// D1 mini pins
+#define A0 17
+#define D0 16
+#define D1 5
+#define D2 4
+#define D3 0
+#define D4 2
+#define D5 14
+#define D6 12
+#define D7 13
+#define D8 15
+
+class __FlashStringHelper;
+
+using std::min;
+using std::max;
+
+template<class T, class L, class H>
+T constrain(T x, L lo, H hi) { return x < lo ? lo : (x > hi ? hi : x); }
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+inline int digitalPinToInterrupt(int pin) { return pin; }
+inline void attachInterrupt(int, void (*)(), int) {}
+inline void detachInterrupt(int) {}
+inline void pinMode(int, int) {}
+inline int digitalRead(int) { return LOW; }
+inline void digitalWrite(int, int) {}
+
+// Not in glibc before 2.38
+#if !defined(__GLIBC__) || __GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38)
+size_t strlcpy(char *dst, const char *src, size_t size);
+size_t strlcat(char *dst, const char *src, size_t size);
+#endif
+
+char *dtostrf(double number, signed char width, unsigned char prec, char *s);
+
+class String {
+public:
+    String() {}
+    String(const char *s) : s(s ? s : "") {}
+    String(const __FlashStringHelper *s) : s(s ? (const char *)s : "") {}
+    String(char c) : s(1, c) {}
+    String(int v, unsigned char base = DEC) { format(base == HEX ? "%x" : "%d", v); }
+    String(unsigned v, unsigned char base = DEC) { format(base == HEX ? "%x" : "%u", v); }
+    String(long v, unsigned char base = DEC) { format(base == HEX ? "%lx" : "%ld", v); }
+    String(unsigned long v, unsigned char base = DEC) { format(base == HEX ? "%lx" : "%lu", v); }
+    String(double v, unsigned char decimals = 2) { format("%.*f", decimals, v); }
+
+    const char *c_str() const { return s.c_str(); }
+    unsigned length() const { return s.size(); }
+    bool reserve(unsigned size) {
+        s.reserve(size);
+        return true;
+    }
+    char operator[](unsigned i) const { return i < s.size() ? s[i] : 0; }
+    bool operator==(const String &o) const { return s == o.s; }
+    bool operator==(const char *o) const { return s == (o ? o : ""); }
+    bool operator!=(const char *o) const { return !(*this == o); }
+    bool equalsIgnoreCase(const String &o) const { return strcasecmp(c_str(), o.c_str()) == 0; }
+    bool startsWith(const String &o) const { return s.compare(0, o.s.size(), o.s) == 0; }
+    bool endsWith(const String &o) const {
+        return s.size() >= o.s.size() && s.compare(s.size() - o.s.size(), o.s.size(), o.s) == 0;
+    }
+    int indexOf(char c, unsigned from = 0) const {
+        size_t at = s.find(c, from);
+        return at == std::string::npos ? -1 : (int)at;
+    }
+    String substring(unsigned from, unsigned to = UINT32_MAX) const {
+        return from < s.size() ? String(s.substr(from, min<size_t>(to, s.size()) - from).c_str()) : String();
+    }
+    void remove(unsigned from, unsigned count = UINT32_MAX) {
+        if (from < s.size()) {
+            s.erase(from, count);
+        }
+    }
+    long toInt() const { return atol(c_str()); }
+    void toLowerCase() {
+        for (char &c : s) {
+            c = tolower(c);
+        }
+    }
+    String &operator+=(const String &o) {
+        s += o.s;
+        return *this;
+    }
+    String &operator+=(const char *o) {
+        s += o ? o : "";
+        return *this;
+    }
+    String &operator+=(char c) {
+        s += c;
+        return *this;
+    }
+    bool concat(const char *o, unsigned len) {
+        s.append(o, len);
+        return true;
+    }
+
+private:
+    template<class... A>
+    void format(const char *fmt, A... args) {
+        char buf[40];
+        snprintf(buf, sizeof(buf), fmt, args...);
+        s = buf;
+    }
+
+    std::string s;
+};
+
+inline String operator+(const String &a, const String &b) { return String(a) += b; }
+inline String operator+(const String &a, const char *b) { return String(a) += b; }
+inline String operator+(const String &a, char b) { return String(a) += b; }
+inline String operator+(const char *a, const String &b) { return String(a) += b; }
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buf, size_t size) {
+        size_t n = 0;
+        while (size-- && write(*buf++)) {
+            n++;
+        }
+        return n;
+    }
+    size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+    size_t write(const char *buf, size_t size) { return write((const uint8_t *)buf, size); }
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+
+    size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+    size_t printf_P(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+    size_t print(const char *s) { return write(s); }
+    size_t print(const String &s) { return write(s.c_str()); }
+    size_t print(const __FlashStringHelper *s) { return write((const char *)s); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int v, int base = DEC) { return print((long)v, base); }
+    size_t print(unsigned v, int base = DEC) { return print((unsigned long)v, base); }
+    size_t print(long v, int base = DEC) { return print(String(v, base)); }
+    size_t print(unsigned long v, int base = DEC) { return print(String(v, base)); }
+    size_t print(double v, int decimals = 2) { return print(String(v, decimals)); }
+    size_t println() { return write("\r\n"); }
+    template<class T>
+    size_t println(const T &v) { return print(v) + println(); }
+    template<class T>
+    size_t println(const T &v, int base) { return print(v, base) + println(); }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual size_t readBytes(char *buf, size_t len);
+    size_t readBytes(uint8_t *buf, size_t len) { return readBytes((char *)buf, len); }
+    void setTimeout(unsigned long ms) { timeoutMs = ms; }
+
+protected:
+    unsigned long timeoutMs = 1000;
+};
+
+// Serial output goes to stderr, stdout is left to the replay report
+class HardwareSerial : public Stream {
+public:
+    void begin(unsigned long) {}
+    size_t write(uint8_t c) override { return fputc(c, stderr) == EOF ? 0 : 1; }
+    size_t write(const uint8_t *buf, size_t size) override { return fwrite(buf, 1, size, stderr); }
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+// Heap figures are constants, the host heap says nothing of the device one
+class EspClass {
+public:
+    uint32_t getFreeHeap() { return 40000; }
+    uint32_t getMaxFreeBlockSize() { return 30000; }
+    uint8_t getHeapFragmentation() { return 10; }
+    void getHeapStats(uint32_t *free, uint16_t *maxBlock, uint8_t *frag) {
+        *free = getFreeHeap();
+        *maxBlock = getMaxFreeBlockSize();
+        *frag = getHeapFragmentation();
+    }
+    uint32_t getFreeSketchSpace() { return 1 << 20; }
+    uint32_t getSketchSize() { return 1 << 19; }
+    uint32_t getFlashChipRealSize() { return 4 << 20; }
+    const char *getSdkVersion() { return "native"; }
+    String getCoreVersion() { return "native"; }
+    String getResetReason() { return "Power On"; }
+    uint32_t getChipId() { return 0xC0FFEE; }
+    uint8_t getCpuFreqMHz() { return 160; }
+    uint32_t getCycleCount() { return micros() * 160; }
+    uint32_t random() { return ::random(0x7FFFFFFF); }
+    bool rtcUserMemoryRead(uint32_t, uint32_t *, size_t) { return false; }
+    bool rtcUserMemoryWrite(uint32_t, uint32_t *, size_t) { return false; }
+    void restart();
+};
+
+extern EspClass ESP;
+
+#endif //ESPARKLE_NATIVE_ARDUINO_H
@@ -0,0 +1,32 @@
+#ifndef ESPARKLE_NATIVE_AUDIOFILESOURCEFS_H
+#define ESPARKLE_NATIVE_AUDIOFILESOURCEFS_H
+
+#include <FS.h>
+#include "AudioFileSource.h"
+
+class AudioFileSourceFS : public AudioFileSource {
+public:
+    explicit AudioFileSourceFS(FS &fs) : filesystem(&fs) {}
+    AudioFileSourceFS(FS &fs, const char *filename) : filesystem(&fs) { open(filename); }
+    ~AudioFileSourceFS() override { close(); }
+
+    bool open(const char *filename) override {
+        f = filesystem->open(filename, "r");
+        return f;
+    }
+    uint32_t read(void *data, uint32_t len) override { return f.read((uint8_t *)data, len); }
+    bool seek(int32_t pos, int dir) override { return f.seek(pos, (SeekMode)dir); }
+    bool close() override {
+        f.close();
+        return true;
+    }
+    bool isOpen() override { return f; }
+    uint32_t getSize() override { return f ? f.size() : 0; }
+    uint32_t getPos() override { return f ? f.position() : 0; }
+
+private:
+    FS *filesystem;
+    File f;
+};
+
+#endif //ESPARKLE_NATIVE_AUDIOFILESOURCEFS_H
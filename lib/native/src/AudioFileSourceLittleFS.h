@@ -0,0 +1,13 @@
+#ifndef ESPARKLE_NATIVE_AUDIOFILESOURCELITTLEFS_H
+#define ESPARKLE_NATIVE_AUDIOFILESOURCELITTLEFS_H
+
+#include <LittleFS.h>
+#include "AudioFileSourceFS.h"
+
+class AudioFileSourceLittleFS : public AudioFileSourceFS {
+public:
+    AudioFileSourceLittleFS() : AudioFileSourceFS(LittleFS) {}
+    explicit AudioFileSourceLittleFS(const char *filename) : AudioFileSourceFS(LittleFS, filename) {}
+};
+
+#endif //ESPARKLE_NATIVE_AUDIOFILESOURCELITTLEFS_H
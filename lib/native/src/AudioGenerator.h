@@ -0,0 +1,28 @@
+#ifndef ESPARKLE_NATIVE_AUDIOGENERATOR_H
+#define ESPARKLE_NATIVE_AUDIOGENERATOR_H
+
+#include <Arduino.h>
+#include "AudioFileSource.h"
+#include "AudioOutput.h"
+#include "AudioStatus.h"
+
+class AudioGenerator {
+public:
+    AudioGenerator() {}
+    virtual ~AudioGenerator() {}
+    virtual bool begin(AudioFileSource *, AudioOutput *) { return false; }
+    virtual bool loop() { return false; }
+    virtual bool stop() { return false; }
+    virtual bool isRunning() { return false; }
+    virtual bool RegisterMetadataCB(AudioStatus::metadataCBFn f, void *data) { return cb.RegisterMetadataCB(f, data); }
+    virtual bool RegisterStatusCB(AudioStatus::statusCBFn f, void *data) { return cb.RegisterStatusCB(f, data); }
+
+protected:
+    bool running = false;
+    AudioFileSource *file = nullptr;
+    AudioOutput *output = nullptr;
+    int16_t lastSample[2];
+    AudioStatus cb;
+};
+
+#endif //ESPARKLE_NATIVE_AUDIOGENERATOR_H
@@ -0,0 +1,79 @@
+#ifndef ESPARKLE_NATIVE_AUDIOGENERATORMP3_H
+#define ESPARKLE_NATIVE_AUDIOGENERATORMP3_H
+
+#include "AudioGenerator.h"
+#include "native.h"
+
+#define MP3_FRAME_BYTES   418  // 128 kbps at 44.1 kHz
+#define MP3_FRAME_SAMPLES 1152
+#define MP3_HUM_LEVEL     64   // Sample value played, digital silence would hide the clip start
+
+/**
+ * Host stand-in for the MP3 decoder: no decoding, each MP3_FRAME_BYTES read
+ * play as a frame of quiet hum
+ *
+ * Timing is what matters here: input is read, and output written, at the
+ * pace of a 128 kbps clip, and playback ends on the first empty read, as
+ * with libmad.
+ */
+class AudioGeneratorMP3 : public AudioGenerator {
+public:
+    AudioGeneratorMP3() {}
+    AudioGeneratorMP3(void *, int) {}
+    ~AudioGeneratorMP3() override {}
+
+    bool begin(AudioFileSource *source, AudioOutput *out) override {
+        if (!source || !out) {
+            return false;
+        }
+        file = source;
+        output = out;
+        left = 0;
+        if (!file->isOpen() || !output->SetRate(44100) || !output->SetBitsPerSample(16) || !output->SetChannels(2)
+            || !output->begin()) {
+            return false;
+        }
+        running = true;
+        nativeClipBegin();
+        return true;
+    }
+
+    bool loop() override {
+        while (running) {
+            if (!left) {
+                uint8_t frame[MP3_FRAME_BYTES];
+                uint32_t got = 0;
+                uint32_t n;
+                while (got < sizeof(frame) && (n = file->read(frame + got, sizeof(frame) - got)) > 0) {
+                    got += n;
+                }
+                if (!got) {
+                    running = false;
+                    break;
+                }
+                left = MP3_FRAME_SAMPLES * got / sizeof(frame);
+            }
+            int16_t hum[2] = {MP3_HUM_LEVEL, MP3_HUM_LEVEL};
+            if (!output->ConsumeSample(hum)) {
+                break;
+            }
+            left--;
+        }
+        file->loop();
+        output->loop();
+        return running;
+    }
+
+    bool stop() override {
+        running = false;
+        output->stop();
+        return file->close();
+    }
+
+    bool isRunning() override { return running; }
+
+private:
+    uint32_t left = 0; // Samples of the current frame left to play
+};
+
+#endif //ESPARKLE_NATIVE_AUDIOGENERATORMP3_H
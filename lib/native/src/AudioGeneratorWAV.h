@@ -0,0 +1,102 @@
+#ifndef ESPARKLE_NATIVE_AUDIOGENERATORWAV_H
+#define ESPARKLE_NATIVE_AUDIOGENERATORWAV_H
+
+#include "AudioGenerator.h"
+#include "native.h"
+
+// 16 bit PCM only, which is what tools/transcode.py writes
+class AudioGeneratorWAV : public AudioGenerator {
+public:
+    AudioGeneratorWAV() {}
+    ~AudioGeneratorWAV() override {}
+
+    bool begin(AudioFileSource *source, AudioOutput *out) override {
+        if (!source || !out || !source->isOpen()) {
+            return false;
+        }
+        file = source;
+        output = out;
+        if (!readHeader() || !output->SetRate(rate) || !output->SetBitsPerSample(16) || !output->SetChannels(channels)
+            || !output->begin()) {
+            return false;
+        }
+        running = true;
+        nativeClipBegin();
+        return true;
+    }
+
+    bool loop() override {
+        while (running) {
+            if (!have) {
+                uint8_t buf[4];
+                uint32_t size = channels * 2;
+                if (left < size || file->read(buf, size) != size) {
+                    running = false;
+                    break;
+                }
+                left -= size;
+                lastSample[0] = (int16_t)(buf[0] | buf[1] << 8);
+                lastSample[1] = channels == 2 ? (int16_t)(buf[2] | buf[3] << 8) : lastSample[0];
+                have = true;
+            }
+            if (!output->ConsumeSample(lastSample)) {
+                break;
+            }
+            have = false;
+        }
+        file->loop();
+        output->loop();
+        return running;
+    }
+
+    bool stop() override {
+        running = false;
+        output->stop();
+        return file->close();
+    }
+
+    bool isRunning() override { return running; }
+
+    void SetBufferSize(int) {}
+
+private:
+    static uint32_t le32(const uint8_t *p) { return p[0] | p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24; }
+
+    bool readHeader() {
+        uint8_t buf[16];
+        if (file->read(buf, 12) != 12 || memcmp(buf, "RIFF", 4) != 0 || memcmp(buf + 8, "WAVE", 4) != 0) {
+            return false;
+        }
+        rate = 0;
+        while (file->read(buf, 8) == 8) {
+            uint32_t len = le32(buf + 4);
+            if (memcmp(buf, "data", 4) == 0) {
+                left = len;
+                have = false;
+                return rate != 0;
+            }
+            if (memcmp(buf, "fmt ", 4) == 0 && len >= 16) {
+                if (file->read(buf, 16) != 16 || (buf[0] | buf[1] << 8) != 1 || (buf[14] | buf[15] << 8) != 16) {
+                    return false;
+                }
+                channels = buf[2] | buf[3] << 8;
+                rate = le32(buf + 4);
+                if (channels < 1 || channels > 2) {
+                    return false;
+                }
+                len -= 16;
+            }
+            if (!file->seek(len + (len & 1), SEEK_CUR)) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    uint32_t rate = 0;
+    uint16_t channels = 1;
+    uint32_t left = 0; // Data bytes
+    bool have = false;
+};
+
+#endif //ESPARKLE_NATIVE_AUDIOGENERATORWAV_H
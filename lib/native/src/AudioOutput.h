@@ -0,0 +1,75 @@
+#ifndef ESPARKLE_NATIVE_AUDIOOUTPUT_H
+#define ESPARKLE_NATIVE_AUDIOOUTPUT_H
+
+#include <Arduino.h>
+#include "AudioStatus.h"
+
+// As ESP8266Audio 1.7
+class AudioOutput {
+public:
+    AudioOutput() {}
+    virtual ~AudioOutput() {}
+    virtual bool SetRate(int hz) {
+        hertz = hz;
+        return true;
+    }
+    virtual bool SetBitsPerSample(int bits) {
+        bps = bits;
+        return true;
+    }
+    virtual bool SetChannels(int chan) {
+        channels = chan;
+        return true;
+    }
+    virtual bool SetGain(float f) {
+        f = constrain(f, 0.0f, 4.0f);
+        gainF2P6 = (uint8_t)(f * (1 << 6));
+        return true;
+    }
+    virtual bool begin() { return false; }
+
+    typedef enum {
+        LEFTCHANNEL = 0,
+        RIGHTCHANNEL = 1
+    } SampleIndex;
+
+    virtual bool ConsumeSample(int16_t[2]) { return false; }
+    virtual uint16_t ConsumeSamples(int16_t *samples, uint16_t count) {
+        for (uint16_t i = 0; i < count; i++) {
+            if (!ConsumeSample(samples)) {
+                return i;
+            }
+            samples += 2;
+        }
+        return count;
+    }
+    virtual bool stop() { return false; }
+    virtual void flush() {}
+    virtual bool loop() { return true; }
+    virtual bool RegisterMetadataCB(AudioStatus::metadataCBFn f, void *data) { return cb.RegisterMetadataCB(f, data); }
+    virtual bool RegisterStatusCB(AudioStatus::statusCBFn f, void *data) { return cb.RegisterStatusCB(f, data); }
+
+protected:
+    void MakeSampleStereo16(int16_t sample[2]) {
+        if (bps == 8) {
+            sample[0] = ((sample[0] & 0xff) - 128) << 8;
+            sample[1] = ((sample[1] & 0xff) - 128) << 8;
+        }
+        if (channels == 1) {
+            sample[1] = sample[0];
+        }
+    }
+
+    inline int16_t Amplify(int16_t s) {
+        int32_t v = (s * gainF2P6) >> 6;
+        return constrain(v, -32767, 32767);
+    }
+
+    uint16_t hertz = 0;
+    uint8_t bps = 16;
+    uint8_t channels = 2;
+    uint8_t gainF2P6 = 1 << 6;
+    AudioStatus cb;
+};
+
+#endif //ESPARKLE_NATIVE_AUDIOOUTPUT_H
@@ -0,0 +1,53 @@
+#ifndef ESPARKLE_NATIVE_AUDIOOUTPUTI2S_H
+#define ESPARKLE_NATIVE_AUDIOOUTPUTI2S_H
+
+#include <i2s.h>
+#include "AudioOutput.h"
+
+// Samples go to the I2S stand-in, which plays them in virtual time
+class AudioOutputI2S : public AudioOutput {
+public:
+    AudioOutputI2S(int = 0, int = 0, int = 8, int = 0) {}
+    ~AudioOutputI2S() override { stop(); }
+
+    bool SetRate(int hz) override {
+        hertz = hz;
+        if (running) {
+            i2s_set_rate(hz);
+        }
+        return true;
+    }
+    bool SetOutputModeMono(bool mono) {
+        this->mono = mono;
+        return true;
+    }
+    bool begin() override {
+        if (!running) {
+            i2s_begin();
+            i2s_set_rate(hertz ? hertz : 44100);
+            running = true;
+        }
+        return true;
+    }
+    bool ConsumeSample(int16_t sample[2]) override {
+        int16_t ms[2] = {sample[0], sample[1]};
+        MakeSampleStereo16(ms);
+        if (mono) {
+            ms[0] = ms[1] = ((int32_t)ms[0] + ms[1]) / 2;
+        }
+        return i2s_write_sample_nb((uint16_t)Amplify(ms[1]) << 16 | (uint16_t)Amplify(ms[0]));
+    }
+    bool stop() override {
+        if (running) {
+            i2s_end();
+            running = false;
+        }
+        return true;
+    }
+
+private:
+    bool mono = false;
+    bool running = false;
+};
+
+#endif //ESPARKLE_NATIVE_AUDIOOUTPUTI2S_H
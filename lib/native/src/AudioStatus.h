@@ -0,0 +1,42 @@
+#ifndef ESPARKLE_NATIVE_AUDIOSTATUS_H
+#define ESPARKLE_NATIVE_AUDIOSTATUS_H
+
+#include <Arduino.h>
+
+class AudioStatus {
+public:
+    typedef void (*metadataCBFn)(void *data, const char *type, bool isUnicode, const char *str);
+    typedef void (*statusCBFn)(void *data, int code, const char *string);
+
+    bool RegisterMetadataCB(metadataCBFn f, void *data) {
+        mdFn = f;
+        mdData = data;
+        return true;
+    }
+
+    bool RegisterStatusCB(statusCBFn f, void *data) {
+        stFn = f;
+        stData = data;
+        return true;
+    }
+
+    void md(const char *type, bool isUnicode, const char *str) {
+        if (mdFn) {
+            mdFn(mdData, type, isUnicode, str);
+        }
+    }
+
+    void st(int code, const char *string) {
+        if (stFn) {
+            stFn(stData, code, string);
+        }
+    }
+
+private:
+    metadataCBFn mdFn = nullptr;
+    void *mdData = nullptr;
+    statusCBFn stFn = nullptr;
+    void *stData = nullptr;
+};
+
+#endif //ESPARKLE_NATIVE_AUDIOSTATUS_H
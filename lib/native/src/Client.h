@@ -0,0 +1,18 @@
+#ifndef ESPARKLE_NATIVE_CLIENT_H
+#define ESPARKLE_NATIVE_CLIENT_H
+
+#include <Arduino.h>
+#include <IPAddress.h>
+
+class Client : public Stream {
+public:
+    virtual int connect(IPAddress ip, uint16_t port) = 0;
+    virtual int connect(const char *host, uint16_t port) = 0;
+    virtual int read(uint8_t *buf, size_t size) = 0;
+    virtual void stop() = 0;
+    virtual uint8_t connected() = 0;
+    virtual operator bool() = 0;
+    using Stream::read;
+};
+
+#endif //ESPARKLE_NATIVE_CLIENT_H
@@ -0,0 +1,10 @@
+#ifndef ESPARKLE_NATIVE_ESP8266HTTPCLIENT_H
+#define ESPARKLE_NATIVE_ESP8266HTTPCLIENT_H
+
+#include <ESP8266WiFi.h>
+
+// Status codes only, ESParkle speaks HTTP itself (see connpool.h)
+#define HTTP_CODE_OK              200
+#define HTTP_CODE_PARTIAL_CONTENT 206
+
+#endif //ESPARKLE_NATIVE_ESP8266HTTPCLIENT_H
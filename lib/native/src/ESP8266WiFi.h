@@ -0,0 +1,101 @@
+#ifndef ESPARKLE_NATIVE_ESP8266WIFI_H
+#define ESPARKLE_NATIVE_ESP8266WIFI_H
+
+/**
+ * Host stand-in for the ESP8266 WiFi stack: no access point is ever in range
+ *
+ * The firmware runs its offline paths, local clips and LED alerts, and
+ * commands come in through the MQTT stand-in (see native.h). A test can report
+ * the link up (nativeWifiLink()), connections still fail.
+ */
+
+#include <Arduino.h>
+#include <Client.h>
+#include <IPAddress.h>
+
+typedef enum {
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_SCAN_COMPLETED = 2,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+enum WiFiMode_t {
+    WIFI_OFF,
+    WIFI_STA,
+    WIFI_AP,
+    WIFI_AP_STA
+};
+
+#define WIFI_SCAN_RUNNING (-1)
+#define WIFI_SCAN_FAILED  (-2)
+
+struct WifiAPEntry {
+    char *ssid;
+    char *passphrase;
+};
+
+class ClientContext;
+
+// Never connects
+class WiFiClient : public Client {
+public:
+    WiFiClient() {}
+
+    int connect(IPAddress, uint16_t) override { return 0; }
+    int connect(const char *, uint16_t) override { return 0; }
+    size_t write(uint8_t) override { return 0; }
+    size_t write(const uint8_t *, size_t) override { return 0; }
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int read(uint8_t *, size_t) override { return -1; }
+    int peek() override { return -1; }
+    void stop() override {}
+    uint8_t connected() override { return 0; }
+    operator bool() override { return false; }
+    void setNoDelay(bool) {}
+    IPAddress remoteIP() { return IPAddress(); }
+    uint16_t remotePort() { return 0; }
+    using Print::write;
+
+protected:
+    // Over an established connection, as WiFiServer makes them
+    WiFiClient(ClientContext *) {}
+};
+
+class ESP8266WiFiClass {
+public:
+    bool persistent(bool) { return true; }
+    bool setAutoReconnect(bool) { return true; }
+    bool hostname(const char *) { return true; }
+    bool mode(WiFiMode_t) { return true; }
+    wl_status_t begin(const char *, const char * = nullptr, int32_t = 0, const uint8_t * = nullptr, bool = true) {
+        return WL_DISCONNECTED;
+    }
+    wl_status_t status() { return link; }
+    bool isConnected() { return link == WL_CONNECTED; }
+    bool disconnect(bool = false) { return true; }
+    int8_t scanNetworks(bool = false, bool = false) { return 0; }
+    int8_t scanComplete() { return 0; }
+    void scanDelete() {}
+    String SSID(uint8_t = 0) { return String(); }
+    int32_t RSSI(uint8_t = 0) { return 0; }
+    uint8_t *BSSID(uint8_t = 0) { return bssid; }
+    int32_t channel(uint8_t = 0) { return 0; }
+    IPAddress localIP() { return IPAddress(); }
+    String macAddress() { return "00:00:00:00:00:00"; }
+    String softAPmacAddress() { return "00:00:00:00:00:00"; }
+    int hostByName(const char *, IPAddress &, uint32_t = 0) { return 0; }
+
+    wl_status_t link = WL_NO_SSID_AVAIL; // See nativeWifiLink()
+
+private:
+    uint8_t bssid[6] = {};
+};
+
+extern ESP8266WiFiClass WiFi;
+
+#endif //ESPARKLE_NATIVE_ESP8266WIFI_H
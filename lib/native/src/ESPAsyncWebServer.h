@@ -0,0 +1,93 @@
+#ifndef ESPARKLE_NATIVE_ESPASYNCWEBSERVER_H
+#define ESPARKLE_NATIVE_ESPASYNCWEBSERVER_H
+
+/**
+ * Host stand-in for ESPAsyncWebServer: the LAN endpoint listens, but no
+ * client ever comes
+ */
+
+#include <Arduino.h>
+#include <functional>
+
+typedef enum {
+    WS_EVT_CONNECT,
+    WS_EVT_DISCONNECT,
+    WS_EVT_PONG,
+    WS_EVT_ERROR,
+    WS_EVT_DATA
+} AwsEventType;
+
+typedef struct {
+    uint8_t message_opcode;
+    uint32_t num;
+    uint8_t final;
+    uint8_t masked;
+    uint8_t opcode;
+    uint64_t len;
+    uint8_t mask[4];
+    uint64_t index;
+} AwsFrameInfo;
+
+#define WS_TEXT   0x01
+#define WS_BINARY 0x02
+
+typedef enum {
+    HTTP_GET = 0b00000001,
+    HTTP_POST = 0b00000010,
+    HTTP_ANY = 0b01111111
+} WebRequestMethod;
+
+class AsyncWebSocketMessageBuffer {
+public:
+    uint8_t *get() { return nullptr; }
+    size_t length() { return 0; }
+};
+
+class AsyncWebSocketClient {
+public:
+    uint32_t id() { return 0; }
+    void text(const char *) {}
+};
+
+class AsyncWebServerRequest {
+public:
+    bool authenticate(const char *, const char *) { return false; }
+    void requestAuthentication() {}
+    void send(int) {}
+    size_t contentLength() { return 0; }
+};
+
+class AsyncWebSocket;
+
+typedef std::function<void(AsyncWebSocket *, AsyncWebSocketClient *, AwsEventType, void *, uint8_t *, size_t)> AwsEventHandler;
+typedef std::function<void(AsyncWebServerRequest *)> ArRequestHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest *, const String &, size_t, uint8_t *, size_t, bool)> ArUploadHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest *, uint8_t *, size_t, size_t, size_t)> ArBodyHandlerFunction;
+
+class AsyncWebHandler {
+public:
+    virtual ~AsyncWebHandler() {}
+};
+
+class AsyncWebSocket : public AsyncWebHandler {
+public:
+    explicit AsyncWebSocket(const String &) {}
+    void onEvent(AwsEventHandler) {}
+    void setAuthentication(const char *, const char *) {}
+    size_t count() const { return 0; }
+    void cleanupClients(uint16_t = 8) {}
+    void textAll(const char *) {}
+    void textAll(AsyncWebSocketMessageBuffer *) {}
+    void binaryAll(AsyncWebSocketMessageBuffer *) {}
+    AsyncWebSocketMessageBuffer *makeBuffer(size_t) { return nullptr; }
+};
+
+class AsyncWebServer {
+public:
+    explicit AsyncWebServer(uint16_t) {}
+    void begin() {}
+    AsyncWebHandler &addHandler(AsyncWebHandler *handler) { return *handler; }
+    void on(const char *, WebRequestMethod, ArRequestHandlerFunction, ArUploadHandlerFunction, ArBodyHandlerFunction) {}
+};
+
+#endif //ESPARKLE_NATIVE_ESPASYNCWEBSERVER_H
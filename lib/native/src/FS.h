@@ -0,0 +1,107 @@
+#ifndef ESPARKLE_NATIVE_FS_H
+#define ESPARKLE_NATIVE_FS_H
+
+/**
+ * Host stand-in for the ESP8266 core file system API, over a host directory
+ * (see nativeFsRoot() in native.h)
+ *
+ * Copies of a File share its handle, as on the device.
+ */
+
+#include <Arduino.h>
+#include <time.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum SeekMode {
+    SeekSet = 0,
+    SeekCur = 1,
+    SeekEnd = 2
+};
+
+struct FSInfo {
+    size_t totalBytes;
+    size_t usedBytes;
+    size_t blockSize;
+    size_t pageSize;
+    size_t maxOpenFiles;
+    size_t maxPathLength;
+};
+
+class File : public Stream {
+public:
+    File() {}
+    File(FILE *f, const char *path) : f(f, fclose), path(path) {}
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t size) override { return f ? fwrite(buf, 1, size, f.get()) : 0; }
+    int available() override { return f ? size() - position() : 0; }
+    int read() override {
+        uint8_t c;
+        return read(&c, 1) == 1 ? c : -1;
+    }
+    size_t read(uint8_t *buf, size_t size) { return f ? fread(buf, 1, size, f.get()) : 0; }
+    int peek() override {
+        int c = read();
+        if (c >= 0) {
+            seek(-1, SeekCur);
+        }
+        return c;
+    }
+    bool seek(int32_t pos, SeekMode mode = SeekSet) { return f && fseek(f.get(), pos, mode) == 0; }
+    size_t position() const { return f ? ftell(f.get()) : 0; }
+    size_t size() const;
+    void flush() override {
+        if (f) {
+            fflush(f.get());
+        }
+    }
+    void close() { f.reset(); }
+    operator bool() const { return (bool)f; }
+    const char *name() const;
+    const char *fullName() const { return path.c_str(); }
+    using Print::write;
+
+private:
+    std::shared_ptr<FILE> f;
+    std::string path;
+};
+
+class Dir {
+public:
+    Dir() {}
+    Dir(const std::string &path, std::vector<std::string> names) : path(path), names(std::move(names)) {}
+
+    bool next() { return ++at < names.size(); }
+    String fileName() { return names[at].c_str(); }
+    size_t fileSize();
+    bool isFile();
+    bool isDirectory() { return !isFile(); }
+    File openFile(const char *mode);
+
+private:
+    std::string entry() const { return path + "/" + names[at]; }
+
+    std::string path;
+    std::vector<std::string> names;
+    size_t at = SIZE_MAX;
+};
+
+class FS {
+public:
+    bool begin();
+    File open(const char *path, const char *mode);
+    File open(const String &path, const char *mode) { return open(path.c_str(), mode); }
+    bool exists(const char *path);
+    bool exists(const String &path) { return exists(path.c_str()); }
+    Dir openDir(const char *path);
+    Dir openDir(const String &path) { return openDir(path.c_str()); }
+    bool remove(const char *path);
+    bool remove(const String &path) { return remove(path.c_str()); }
+    bool rename(const char *from, const char *to);
+    bool mkdir(const char *path);
+    bool info(FSInfo &info);
+};
+
+#endif //ESPARKLE_NATIVE_FS_H
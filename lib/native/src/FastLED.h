@@ -0,0 +1,116 @@
+#ifndef ESPARKLE_NATIVE_FASTLED_H
+#define ESPARKLE_NATIVE_FASTLED_H
+
+/**
+ * Host stand-in for FastLED: colors are computed, frames shown go nowhere
+ * (but are counted, see FastLED.frames())
+ */
+
+#include <Arduino.h>
+
+struct CHSV {
+    union {
+        struct {
+            uint8_t hue;
+            uint8_t sat;
+            uint8_t val;
+        };
+        uint8_t raw[3];
+    };
+
+    CHSV() : hue(0), sat(0), val(0) {}
+    CHSV(uint8_t h, uint8_t s, uint8_t v) : hue(h), sat(s), val(v) {}
+};
+
+struct CRGB {
+    union {
+        struct {
+            uint8_t r;
+            uint8_t g;
+            uint8_t b;
+        };
+        uint8_t raw[3];
+    };
+
+    typedef enum {
+        Black = 0x000000,
+        Blue = 0x0000FF,
+        Green = 0x008000,
+        Red = 0xFF0000,
+        White = 0xFFFFFF
+    } HTMLColorCode;
+
+    CRGB() : r(0), g(0), b(0) {}
+    CRGB(uint8_t r, uint8_t g, uint8_t b) : r(r), g(g), b(b) {}
+    CRGB(uint32_t code) : r(code >> 16), g(code >> 8), b(code) {}
+    CRGB(HTMLColorCode code) : CRGB((uint32_t)code) {}
+    CRGB(const CHSV &hsv);
+
+    CRGB &nscale8(uint8_t scale) {
+        r = (uint16_t)r * (scale + 1) >> 8;
+        g = (uint16_t)g * (scale + 1) >> 8;
+        b = (uint16_t)b * (scale + 1) >> 8;
+        return *this;
+    }
+
+    CRGB &fadeToBlackBy(uint8_t amount) { return nscale8(255 - amount); }
+
+    bool operator==(const CRGB &o) const { return r == o.r && g == o.g && b == o.b; }
+    bool operator!=(const CRGB &o) const { return !(*this == o); }
+};
+
+enum EOrder {
+    RGB = 0012,
+    RBG = 0021,
+    GRB = 0102,
+    GBR = 0120,
+    BRG = 0201,
+    BGR = 0210
+};
+
+template<uint8_t DATA_PIN, EOrder RGB_ORDER>
+class WS2812B {};
+
+template<uint8_t DATA_PIN, EOrder RGB_ORDER>
+class WS2801 {};
+
+template<uint8_t DATA_PIN, EOrder RGB_ORDER>
+class APA102 {};
+
+class CFastLED {
+public:
+    template<template<uint8_t, EOrder> class CHIPSET, uint8_t DATA_PIN, EOrder RGB_ORDER>
+    void addLeds(CRGB *data, int count) {
+        leds = data;
+        numLeds = count;
+    }
+
+    void show() { shown++; }
+    void setBrightness(uint8_t scale) { brightness = scale; }
+    uint8_t getBrightness() { return brightness; }
+    void setMaxPowerInVoltsAndMilliamps(uint8_t, uint32_t) {}
+
+    // Frames shown so far
+    uint32_t frames() const { return shown; }
+
+    const CRGB *pixels() const { return leds; }
+
+private:
+    CRGB *leds = nullptr;
+    int numLeds = 0;
+    uint8_t brightness = 255;
+    uint32_t shown = 0;
+};
+
+extern CFastLED FastLED;
+
+#define LEDS FastLED
+
+void fill_solid(CRGB *leds, int count, const CRGB &color);
+void fill_solid(CRGB *leds, int count, const CHSV &color);
+uint8_t sin8(uint8_t theta);
+uint8_t random8();
+uint8_t random8(uint8_t lim);
+CHSV rgb2hsv_approximate(const CRGB &rgb);
+
+#endif //ESPARKLE_NATIVE_FASTLED_H
@@ -0,0 +1,42 @@
+#ifndef ESPARKLE_NATIVE_IPADDRESS_H
+#define ESPARKLE_NATIVE_IPADDRESS_H
+
+#include <Arduino.h>
+
+struct ip_addr_t {
+    uint32_t addr;
+};
+
+// IPv4 only, network byte order as on the device
+class IPAddress {
+public:
+    IPAddress() {}
+    IPAddress(uint32_t addr) : addr(addr) {}
+    IPAddress(const ip_addr_t *ip) : addr(ip ? ip->addr : 0) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : addr(a | b << 8 | c << 16 | (uint32_t)d << 24) {}
+
+    operator uint32_t() const { return addr; }
+
+    bool isSet() const { return addr != 0; }
+
+    bool fromString(const char *s) {
+        unsigned a, b, c, d;
+        char end;
+        if (sscanf(s, "%u.%u.%u.%u%c", &a, &b, &c, &d, &end) != 4 || a > 255 || b > 255 || c > 255 || d > 255) {
+            return false;
+        }
+        *this = IPAddress(a, b, c, d);
+        return true;
+    }
+
+    String toString() const {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%u.%u.%u.%u", addr & 0xFF, addr >> 8 & 0xFF, addr >> 16 & 0xFF, addr >> 24);
+        return buf;
+    }
+
+private:
+    uint32_t addr = 0;
+};
+
+#endif //ESPARKLE_NATIVE_IPADDRESS_H
@@ -0,0 +1,6 @@
+#ifndef ESPARKLE_NATIVE_LITTLEFS_COMPAT_H
+#define ESPARKLE_NATIVE_LITTLEFS_COMPAT_H
+
+#include <LittleFS.h>
+
+#endif //ESPARKLE_NATIVE_LITTLEFS_COMPAT_H
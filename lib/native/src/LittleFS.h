@@ -0,0 +1,8 @@
+#ifndef ESPARKLE_NATIVE_LITTLEFS_H
+#define ESPARKLE_NATIVE_LITTLEFS_H
+
+#include <FS.h>
+
+extern FS LittleFS;
+
+#endif //ESPARKLE_NATIVE_LITTLEFS_H
@@ -0,0 +1,37 @@
+#ifndef ESPARKLE_NATIVE_MPU6050_H
+#define ESPARKLE_NATIVE_MPU6050_H
+
+/**
+ * Host stand-in for the I2Cdevlib MPU6050 driver: no sensor answers
+ * Gesture detection is fed recorded samples directly, see gesture.h
+ */
+
+#include <Arduino.h>
+#include <Wire.h>
+
+#define MPU6050_ACCEL_FS_2  0
+#define MPU6050_ACCEL_FS_4  1
+#define MPU6050_ACCEL_FS_8  2
+#define MPU6050_ACCEL_FS_16 3
+
+#define MPU6050_DLPF_BW_256 0
+#define MPU6050_DLPF_BW_188 1
+#define MPU6050_DLPF_BW_98  2
+#define MPU6050_DLPF_BW_42  3
+#define MPU6050_DLPF_BW_20  4
+
+class MPU6050 {
+public:
+    void initialize() {}
+    bool testConnection() { return false; }
+    void setFullScaleAccelRange(uint8_t) {}
+    void setDLPFMode(uint8_t) {}
+    void setRate(uint8_t) {}
+    void setAccelFIFOEnabled(bool) {}
+    void setFIFOEnabled(bool) {}
+    void resetFIFO() {}
+    uint16_t getFIFOCount() { return 0; }
+    void getFIFOBytes(uint8_t *data, uint8_t length) { memset(data, 0, length); }
+};
+
+#endif //ESPARKLE_NATIVE_MPU6050_H
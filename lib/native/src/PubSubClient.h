@@ -0,0 +1,68 @@
+#ifndef ESPARKLE_NATIVE_PUBSUBCLIENT_H
+#define ESPARKLE_NATIVE_PUBSUBCLIENT_H
+
+/**
+ * Host stand-in for PubSubClient: never connected to a broker, but commands
+ * are delivered to the callback by nativeMqttIn(), and whatever is published
+ * goes to the nativeMqttOut hook (see native.h)
+ */
+
+#include <Arduino.h>
+#include <Client.h>
+#include <functional>
+#include <string>
+
+#define MQTT_CALLBACK_SIGNATURE std::function<void(char *, uint8_t *, unsigned int)> callback
+
+typedef void (*NativeMqttOut)(const char *topic, const uint8_t *payload, size_t length);
+
+class PubSubClient : public Print {
+public:
+    explicit PubSubClient(Client &) {}
+
+    PubSubClient &setServer(const char *, uint16_t) { return *this; }
+    PubSubClient &setCallback(MQTT_CALLBACK_SIGNATURE);
+    bool setBufferSize(uint16_t size) {
+        bufferSize = size;
+        return true;
+    }
+    uint16_t getBufferSize() { return bufferSize; }
+    PubSubClient &setSocketTimeout(uint16_t) { return *this; }
+
+    bool connect(const char *, const char *, const char *) { return false; }
+    bool connected() { return false; }
+    bool loop() { return false; }
+    bool subscribe(const char *) { return false; }
+    void disconnect() {}
+
+    bool publish(const char *topic, const char *payload, bool = false) {
+        return publish(topic, (const uint8_t *)payload, strlen(payload));
+    }
+    bool publish(const char *topic, const uint8_t *payload, unsigned int length, bool = false);
+    bool beginPublish(const char *topic, unsigned int length, bool) {
+        pendingTopic = topic;
+        pending.clear();
+        pending.reserve(length);
+        return true;
+    }
+    size_t write(uint8_t c) override {
+        pending += (char)c;
+        return 1;
+    }
+    size_t write(const uint8_t *buf, size_t size) override {
+        pending.append((const char *)buf, size);
+        return size;
+    }
+    // Streamed, no buffer size limit
+    int endPublish() { return deliver(pendingTopic.c_str(), (const uint8_t *)pending.data(), pending.size()); }
+    using Print::write;
+
+private:
+    bool deliver(const char *topic, const uint8_t *payload, unsigned int length);
+
+    uint16_t bufferSize = 256;
+    std::string pendingTopic;
+    std::string pending;
+};
+
+#endif //ESPARKLE_NATIVE_PUBSUBCLIENT_H
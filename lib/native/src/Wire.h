@@ -0,0 +1,14 @@
+#ifndef ESPARKLE_NATIVE_WIRE_H
+#define ESPARKLE_NATIVE_WIRE_H
+
+#include <Arduino.h>
+
+class TwoWire {
+public:
+    void begin() {}
+    void setClock(uint32_t) {}
+};
+
+extern TwoWire Wire;
+
+#endif //ESPARKLE_NATIVE_WIRE_H
@@ -0,0 +1,26 @@
+#ifndef ESPARKLE_NATIVE_BASE64_H
+#define ESPARKLE_NATIVE_BASE64_H
+
+#include <Arduino.h>
+
+class base64 {
+public:
+    static String encode(const uint8_t *data, size_t length, bool = true) {
+        static const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        String out;
+        for (size_t i = 0; i < length; i += 3) {
+            uint32_t v = data[i] << 16 | (i + 1 < length ? data[i + 1] << 8 : 0) | (i + 2 < length ? data[i + 2] : 0);
+            out += chars[v >> 18 & 63];
+            out += chars[v >> 12 & 63];
+            out += i + 1 < length ? chars[v >> 6 & 63] : '=';
+            out += i + 2 < length ? chars[v & 63] : '=';
+        }
+        return out;
+    }
+
+    static String encode(const String &text, bool newlines = true) {
+        return encode((const uint8_t *)text.c_str(), text.length(), newlines);
+    }
+};
+
+#endif //ESPARKLE_NATIVE_BASE64_H
@@ -0,0 +1,22 @@
+#ifndef ESPARKLE_NATIVE_I2S_H
+#define ESPARKLE_NATIVE_I2S_H
+
+/**
+ * Host stand-in for the I2S driver: a DMA buffer of I2S_FRAMES frames,
+ * drained at the sample rate in virtual time
+ */
+
+#include <stdint.h>
+
+#define I2S_FRAMES 512 // 8 buffers of 64 frames, as the ESP8266 core
+
+void i2s_begin();
+void i2s_end();
+void i2s_set_rate(uint32_t rate);
+uint32_t i2s_get_real_rate();
+bool i2s_write_sample_nb(uint32_t sample);
+bool i2s_is_empty();
+bool i2s_is_full();
+int16_t i2s_available();
+
+#endif //ESPARKLE_NATIVE_I2S_H
@@ -0,0 +1,27 @@
+#ifndef ESPARKLE_NATIVE_CLIENTCONTEXT_H
+#define ESPARKLE_NATIVE_CLIENTCONTEXT_H
+
+#include <lwip/tcp.h>
+
+class ClientContext;
+
+typedef void (*discard_cb_t)(void *, ClientContext *);
+
+// Connection behind a WiFiClient, never made offline
+class ClientContext {
+public:
+    ClientContext(tcp_pcb *, discard_cb_t, void *) {}
+
+    void ref() { refcnt++; }
+
+    void unref() {
+        if (--refcnt == 0) {
+            delete this;
+        }
+    }
+
+private:
+    int refcnt = 0;
+};
+
+#endif //ESPARKLE_NATIVE_CLIENTCONTEXT_H
@@ -0,0 +1,12 @@
+#ifndef ESPARKLE_NATIVE_LWIP_DNS_H
+#define ESPARKLE_NATIVE_LWIP_DNS_H
+
+#include <IPAddress.h>
+#include "err.h"
+
+typedef void (*dns_found_callback)(const char *name, const ip_addr_t *ipaddr, void *callback_arg);
+
+// Offline: every lookup fails at once
+inline err_t dns_gethostbyname(const char *, ip_addr_t *, dns_found_callback, void *) { return ERR_ARG; }
+
+#endif //ESPARKLE_NATIVE_LWIP_DNS_H
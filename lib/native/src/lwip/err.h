@@ -0,0 +1,13 @@
+#ifndef ESPARKLE_NATIVE_LWIP_ERR_H
+#define ESPARKLE_NATIVE_LWIP_ERR_H
+
+#include <stdint.h>
+
+typedef int8_t err_t;
+
+#define ERR_OK         0
+#define ERR_INPROGRESS -5
+#define ERR_ABRT       -13
+#define ERR_ARG        -16
+
+#endif //ESPARKLE_NATIVE_LWIP_ERR_H
@@ -0,0 +1,24 @@
+#ifndef ESPARKLE_NATIVE_LWIP_TCP_H
+#define ESPARKLE_NATIVE_LWIP_TCP_H
+
+#include <IPAddress.h>
+#include "err.h"
+
+struct tcp_pcb;
+
+typedef err_t (*tcp_connected_fn)(void *arg, tcp_pcb *pcb, err_t err);
+typedef void (*tcp_err_fn)(void *arg, err_t err);
+
+// Offline: no pcb to connect with
+inline tcp_pcb *tcp_new() { return nullptr; }
+
+inline void tcp_arg(tcp_pcb *, void *) {}
+
+inline void tcp_err(tcp_pcb *, tcp_err_fn) {}
+
+// Takes the address as the device's IPAddress converts to ip_addr_t *
+inline err_t tcp_connect(tcp_pcb *, const IPAddress &, uint16_t, tcp_connected_fn) { return ERR_ARG; }
+
+inline void tcp_abort(tcp_pcb *) {}
+
+#endif //ESPARKLE_NATIVE_LWIP_TCP_H
@@ -0,0 +1,507 @@
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <new>
+#include <ArduinoOTA.h>
+#include <ESP8266WiFi.h>
+#include <FastLED.h>
+#include <LittleFS.h>
+#include <Wire.h>
+#include <i2s.h>
+#include "native.h"
+
+#define NATIVE_FS_SIZE  (1 << 20) // As the 4M1M layout of a D1 mini
+#define NATIVE_FS_BLOCK 4096
+
+HardwareSerial Serial;
+EspClass ESP;
+ESP8266WiFiClass WiFi;
+ArduinoOTAClass ArduinoOTA;
+TwoWire Wire;
+FS LittleFS;
+CFastLED FastLED;
+
+//############################################################################
+// TIME
+//############################################################################
+
+static uint64_t clockUs = 0;
+
+void nativeAdvance(uint32_t us) { clockUs += us; }
+
+void nativeAdvanceTo(uint32_t ms) { clockUs = max<uint64_t>(clockUs, (uint64_t)ms * 1000); }
+
+uint64_t nativeMicros() { return clockUs; }
+
+unsigned long micros() { return (uint32_t)clockUs; }
+
+unsigned long millis() { return (uint32_t)(clockUs / 1000); }
+
+void delay(unsigned long ms) { clockUs += (uint64_t)ms * 1000; }
+
+void yield() { clockUs += NATIVE_YIELD_US; }
+
+void EspClass::restart() {
+    fprintf(stderr, "ESP.restart()\n");
+    exit(0);
+}
+
+//############################################################################
+// LIBC
+//############################################################################
+
+#if !defined(__GLIBC__) || __GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38)
+size_t strlcpy(char *dst, const char *src, size_t size) {
+    size_t len = strlen(src);
+    if (size) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = 0;
+    }
+    return len;
+}
+
+size_t strlcat(char *dst, const char *src, size_t size) {
+    size_t len = strnlen(dst, size);
+    return len == size ? len + strlen(src) : len + strlcpy(dst + len, src, size - len);
+}
+#endif
+
+char *dtostrf(double number, signed char width, unsigned char prec, char *s) {
+    sprintf(s, "%*.*f", width, prec, number);
+    return s;
+}
+
+// Same sequence on every run
+static uint32_t seed = 1;
+
+void randomSeed(unsigned long s) {
+    if (s) {
+        seed = s;
+    }
+}
+
+long random(long max) {
+    seed = seed * 1103515245 + 12345;
+    return max > 0 ? (long)((seed >> 1) % (unsigned long)max) : 0;
+}
+
+long random(long min, long max) { return min < max ? min + random(max - min) : min; }
+
+//############################################################################
+// PRINT
+//############################################################################
+
+static size_t vprint(Print &p, const char *fmt, va_list args) {
+    char buf[256];
+    va_list copy;
+    va_copy(copy, args);
+    int len = vsnprintf(buf, sizeof(buf), fmt, copy);
+    va_end(copy);
+    if (len < 0) {
+        return 0;
+    }
+    if ((size_t)len < sizeof(buf)) {
+        return p.write((const uint8_t *)buf, len);
+    }
+    std::string big(len + 1, 0);
+    vsnprintf(&big[0], big.size(), fmt, args);
+    return p.write((const uint8_t *)big.data(), len);
+}
+
+size_t Print::printf(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    size_t n = vprint(*this, fmt, args);
+    va_end(args);
+    return n;
+}
+
+size_t Print::printf_P(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    size_t n = vprint(*this, fmt, args);
+    va_end(args);
+    return n;
+}
+
+// Nothing ever arrives late on the host: no timeout wait
+size_t Stream::readBytes(char *buf, size_t len) {
+    size_t n = 0;
+    int c;
+    while (n < len && (c = read()) >= 0) {
+        buf[n++] = c;
+    }
+    return n;
+}
+
+//############################################################################
+// LITTLEFS
+//############################################################################
+
+static std::string fsRoot = ".pio/fsdata";
+
+static std::string hostPath(const char *path) { return fsRoot + (path[0] == '/' ? "" : "/") + path; }
+
+static bool makeDirs(const std::string &path) {
+    for (size_t at = path.find('/', 1); at != std::string::npos; at = path.find('/', at + 1)) {
+        if (mkdir(path.substr(0, at).c_str(), 0755) != 0 && errno != EEXIST) {
+            return false;
+        }
+    }
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+static size_t usedBlocks(const std::string &dir) {
+    size_t blocks = 1;
+    DIR *d = opendir(dir.c_str());
+    if (!d) {
+        return 0;
+    }
+    while (struct dirent *e = readdir(d)) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) {
+            continue;
+        }
+        std::string path = dir + "/" + e->d_name;
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0) {
+            blocks += S_ISDIR(st.st_mode) ? usedBlocks(path) : (st.st_size + NATIVE_FS_BLOCK - 1) / NATIVE_FS_BLOCK;
+        }
+    }
+    closedir(d);
+    return blocks;
+}
+
+void nativeWifiLink(bool up) { WiFi.link = up ? WL_CONNECTED : WL_NO_SSID_AVAIL; }
+
+void nativeFsRoot(const char *dir) {
+    fsRoot = dir;
+    while (fsRoot.size() > 1 && fsRoot.back() == '/') {
+        fsRoot.pop_back();
+    }
+    makeDirs(fsRoot);
+}
+
+size_t File::size() const {
+    struct stat st;
+    if (!f) {
+        return 0;
+    }
+    fflush(f.get());
+    return fstat(fileno(f.get()), &st) == 0 ? st.st_size : 0;
+}
+
+const char *File::name() const {
+    size_t slash = path.rfind('/');
+    return path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+}
+
+size_t Dir::fileSize() {
+    struct stat st;
+    return stat(entry().c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+bool Dir::isFile() {
+    struct stat st;
+    return stat(entry().c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+File Dir::openFile(const char *mode) {
+    return LittleFS.open((path.substr(fsRoot.size()) + "/" + names[at]).c_str(), mode);
+}
+
+bool FS::begin() { return makeDirs(fsRoot); }
+
+File FS::open(const char *path, const char *mode) {
+    std::string host = hostPath(path);
+    struct stat st;
+    if (stat(host.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+        return File();
+    }
+    if (mode[0] != 'r') {
+        size_t slash = host.rfind('/');
+        makeDirs(host.substr(0, slash));
+    }
+    std::string m = std::string(mode) + "b";
+    FILE *f = fopen(host.c_str(), m.c_str());
+    return f ? File(f, path) : File();
+}
+
+bool FS::exists(const char *path) {
+    struct stat st;
+    return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+Dir FS::openDir(const char *path) {
+    std::string host = hostPath(path);
+    while (host.size() > fsRoot.size() && host.back() == '/') {
+        host.pop_back();
+    }
+    std::vector<std::string> names;
+    DIR *d = opendir(host.c_str());
+    if (d) {
+        while (struct dirent *e = readdir(d)) {
+            if (strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0) {
+                names.push_back(e->d_name);
+            }
+        }
+        closedir(d);
+    }
+    std::sort(names.begin(), names.end());
+    return Dir(host, names);
+}
+
+bool FS::remove(const char *path) { return ::remove(hostPath(path).c_str()) == 0; }
+
+bool FS::rename(const char *from, const char *to) { return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0; }
+
+bool FS::mkdir(const char *path) { return makeDirs(hostPath(path)); }
+
+bool FS::info(FSInfo &info) {
+    info = {};
+    info.totalBytes = NATIVE_FS_SIZE;
+    info.usedBytes = min<size_t>(usedBlocks(fsRoot) * NATIVE_FS_BLOCK, NATIVE_FS_SIZE);
+    info.blockSize = NATIVE_FS_BLOCK;
+    info.pageSize = 256;
+    info.maxOpenFiles = 5;
+    info.maxPathLength = 32;
+    return true;
+}
+
+//############################################################################
+// MQTT
+//############################################################################
+
+static MQTT_CALLBACK_SIGNATURE;
+static NativeMqttOut mqttOut = nullptr;
+
+PubSubClient &PubSubClient::setCallback(std::function<void(char *, uint8_t *, unsigned int)> fn) {
+    callback = fn;
+    return *this;
+}
+
+bool PubSubClient::publish(const char *topic, const uint8_t *payload, unsigned int length, bool) {
+    return length <= bufferSize && deliver(topic, payload, length);
+}
+
+bool PubSubClient::deliver(const char *topic, const uint8_t *payload, unsigned int length) {
+    if (mqttOut) {
+        mqttOut(topic, payload, length);
+    }
+    return true;
+}
+
+void nativeMqttIn(const char *topic, const uint8_t *payload, size_t length) {
+    if (callback) {
+        std::string t(topic);
+        std::string p((const char *)payload, length);
+        callback(&t[0], (uint8_t *)&p[0], length);
+    }
+}
+
+void nativeMqttOut(NativeMqttOut hook) { mqttOut = hook; }
+
+//############################################################################
+// I2S
+//############################################################################
+
+static struct {
+    bool started;
+    uint32_t rate;
+    uint16_t queued;     // Frames in the DMA buffers
+    uint64_t drainedUs;  // Virtual time frames were played up to
+    uint64_t playedUs;
+    uint32_t underruns;
+    bool sound;          // Last frame written wasn't silent
+    bool clipBegun;      // A decoder stand-in began a clip, its first sound is next
+    uint64_t onsetUs;    // Virtual time the last clip's first sound plays
+} i2s = {};
+
+// Play the frames due since the last call
+static void i2sDrain() {
+    if (!i2s.started) {
+        return;
+    }
+    uint64_t due = (clockUs - i2s.drainedUs) * i2s.rate / 1000000;
+    if (due < i2s.queued) {
+        i2s.queued -= due;
+        i2s.drainedUs += due * 1000000 / i2s.rate;
+        i2s.playedUs += due * 1000000 / i2s.rate;
+        return;
+    }
+    if (i2s.queued) {
+        i2s.underruns += due > i2s.queued;
+        i2s.playedUs += (uint64_t)i2s.queued * 1000000 / i2s.rate;
+        i2s.queued = 0;
+    }
+    i2s.drainedUs = clockUs;
+    i2s.sound = false; // Ran dry
+}
+
+void i2s_begin() {
+    i2s.started = true;
+    i2s.sound = false;
+    i2s.queued = 0;
+    i2s.drainedUs = clockUs;
+    if (!i2s.rate) {
+        i2s.rate = 44100;
+    }
+}
+
+void i2s_end() {
+    i2sDrain();
+    i2s.started = false;
+    i2s.queued = 0;
+}
+
+void i2s_set_rate(uint32_t rate) {
+    i2sDrain();
+    i2s.rate = rate ? rate : 44100;
+}
+
+uint32_t i2s_get_real_rate() { return i2s.rate; }
+
+bool i2s_write_sample_nb(uint32_t sample) {
+    i2sDrain();
+    if (!i2s.started || i2s.queued == I2S_FRAMES) {
+        return false;
+    }
+    if (!i2s.queued) {
+        i2s.drainedUs = clockUs;
+    }
+    if (sample && (!i2s.sound || i2s.clipBegun)) {
+        i2s.onsetUs = i2s.drainedUs + (uint64_t)i2s.queued * 1000000 / i2s.rate;
+        i2s.clipBegun = false;
+    }
+    i2s.sound = sample;
+    i2s.queued++;
+    return true;
+}
+
+bool i2s_is_empty() {
+    i2sDrain();
+    return i2s.queued == 0;
+}
+
+bool i2s_is_full() {
+    i2sDrain();
+    return i2s.queued == I2S_FRAMES;
+}
+
+int16_t i2s_available() {
+    i2sDrain();
+    return I2S_FRAMES - i2s.queued;
+}
+
+uint64_t nativeI2sPlayedUs() {
+    i2sDrain();
+    return i2s.playedUs;
+}
+
+uint32_t nativeI2sUnderruns() { return i2s.underruns; }
+
+void nativeClipBegin() { i2s.clipBegun = true; }
+
+uint64_t nativeI2sOnsetUs() { return i2s.onsetUs; }
+
+//############################################################################
+// HEAP
+//############################################################################
+
+static size_t heapUsed = 0;
+static size_t heapPeak = 0;
+static uint32_t heapAllocs = 0;
+
+// Block size is kept in front of each block, max_align_t aligned
+static const size_t HEAP_HEADER = alignof(max_align_t);
+
+void *operator new(size_t size) {
+    uint8_t *p = (uint8_t *)malloc(size + HEAP_HEADER);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    *(size_t *)p = size;
+    heapUsed += size;
+    heapPeak = max(heapPeak, heapUsed);
+    heapAllocs++;
+    return p + HEAP_HEADER;
+}
+
+void operator delete(void *ptr) noexcept {
+    if (ptr) {
+        uint8_t *p = (uint8_t *)ptr - HEAP_HEADER;
+        heapUsed -= *(size_t *)p;
+        free(p);
+    }
+}
+
+size_t nativeHeapUsed() { return heapUsed; }
+
+size_t nativeHeapPeak() { return heapPeak; }
+
+uint32_t nativeHeapAllocs() { return heapAllocs; }
+
+//############################################################################
+// FASTLED
+//############################################################################
+
+// Spectrum conversion, close enough to FastLED's rainbow for rendering tests
+CRGB::CRGB(const CHSV &hsv) {
+    uint8_t region = hsv.hue / 43;
+    uint8_t rem = (hsv.hue - region * 43) * 6;
+    uint8_t p = hsv.val * (255 - hsv.sat) >> 8;
+    uint8_t q = hsv.val * (255 - (hsv.sat * rem >> 8)) >> 8;
+    uint8_t t = hsv.val * (255 - (hsv.sat * (255 - rem) >> 8)) >> 8;
+    switch (region) {
+        case 0:
+            r = hsv.val, g = t, b = p;
+            break;
+        case 1:
+            r = q, g = hsv.val, b = p;
+            break;
+        case 2:
+            r = p, g = hsv.val, b = t;
+            break;
+        case 3:
+            r = p, g = q, b = hsv.val;
+            break;
+        case 4:
+            r = t, g = p, b = hsv.val;
+            break;
+        default:
+            r = hsv.val, g = p, b = q;
+            break;
+    }
+}
+
+void fill_solid(CRGB *leds, int count, const CRGB &color) {
+    for (int i = 0; i < count; i++) {
+        leds[i] = color;
+    }
+}
+
+void fill_solid(CRGB *leds, int count, const CHSV &color) { fill_solid(leds, count, CRGB(color)); }
+
+uint8_t sin8(uint8_t theta) { return 128 + lround(127 * sin(theta * 2 * M_PI / 256)); }
+
+uint8_t random8() { return random(256); }
+
+uint8_t random8(uint8_t lim) { return random(lim); }
+
+CHSV rgb2hsv_approximate(const CRGB &rgb) {
+    uint8_t hi = max(rgb.r, max(rgb.g, rgb.b));
+    uint8_t lo = min(rgb.r, min(rgb.g, rgb.b));
+    uint8_t delta = hi - lo;
+    if (!delta) {
+        return CHSV(0, 0, hi);
+    }
+    int32_t h;
+    if (hi == rgb.r) {
+        h = 43 * (rgb.g - rgb.b) / delta;
+    } else if (hi == rgb.g) {
+        h = 85 + 43 * (rgb.b - rgb.r) / delta;
+    } else {
+        h = 171 + 43 * (rgb.r - rgb.g) / delta;
+    }
+    return CHSV((uint8_t)h, delta * 255 / hi, hi);
+}
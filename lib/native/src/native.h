@@ -0,0 +1,56 @@
+#ifndef ESPARKLE_NATIVE_H
+#define ESPARKLE_NATIVE_H
+
+/**
+ * Host side of the native stand-ins: virtual clock, file system root,
+ * MQTT in and out, audio played, heap used
+ *
+ * The firmware sees the device APIs (Arduino.h, LittleFS.h, PubSubClient.h,
+ * ...), a driver (replay.cpp) or a test uses these to feed and watch it.
+ */
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+
+#define NATIVE_YIELD_US 10           // Virtual time taken by yield()
+#define NATIVE_LATE_MS  0x80000000UL // Past 2^31 ms, about 24.8 days of uptime
+
+// Move the virtual clock forward, micros() starts at 0
+void nativeAdvance(uint32_t us);
+
+// Move the virtual clock forward to ms since boot, unless it's past it
+void nativeAdvanceTo(uint32_t ms);
+
+uint64_t nativeMicros();
+
+// Report the WiFi link up or down (at start), connections fail either way
+void nativeWifiLink(bool up);
+
+// Host directory LittleFS files live in, created if needed
+void nativeFsRoot(const char *dir);
+
+// Deliver a message to the callback set with PubSubClient::setCallback()
+void nativeMqttIn(const char *topic, const uint8_t *payload, size_t length);
+
+// Get every published message, nullptr to drop them
+void nativeMqttOut(NativeMqttOut hook);
+
+// Audio played by the I2S stand-in, and times it ran dry while started
+uint64_t nativeI2sPlayedUs();
+uint32_t nativeI2sUnderruns();
+
+// Virtual time the last clip's first sample played, 0 if none yet: the first sound out of
+// silence, or the first one after a decoder stand-in began (gapless, give or take the
+// mixer's buffer)
+uint64_t nativeI2sOnsetUs();
+
+// Called by the decoder stand-ins when a clip begins
+void nativeClipBegin();
+
+// Bytes held through operator new (the firmware and the stand-ins), their peak, and
+// allocations made. The host heap can't show the device's free block sizes.
+size_t nativeHeapUsed();
+size_t nativeHeapPeak();
+uint32_t nativeHeapAllocs();
+
+#endif //ESPARKLE_NATIVE_H
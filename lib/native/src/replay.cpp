@@ -0,0 +1,204 @@
+/**
+ * Command replay on the host, through the firmware's own setup() and loop()
+ *
+ * This is a build tool for ESParkle
+ * See <https://github.com/CosmicMac/ESParkle>
+ *
+ * BUILD
+ *  - pio run -e native
+ *    src/config.h is needed, as for the device build.
+ *
+ * USE
+ *  - .pio/build/native/program [-f <fs dir>] [-s <settle ms>] [-p <pass us>] <trace>
+ *    Boot the firmware with LittleFS over <fs dir> (.pio/fsdata by default, as staged by
+ *    tools/transcode.py), deliver each command of <trace> as an MQTT message at its time
+ *    offset, and run until <settle ms> (10000 by default) after the last one.
+ *    <trace> is a recording of {"cmd":"record"} (*.bin, copied from /trace.bin), or a text
+ *    file of one command per line, optionally prefixed with "@<ms> " (time offset from
+ *    boot, lines without one follow the previous line). "-" reads text from stdin.
+ *    Published messages are printed on stdout with their virtual time in ms, firmware
+ *    Serial output goes to stderr. Each loop() pass takes <pass us> (100 by default) of
+ *    virtual time, audio plays in virtual time too: replays run faster than real time,
+ *    and the same way every time.
+ *    Each command is then reported on stderr: its dispatch time (host time taken to parse
+ *    and run it) and its time to first audio sample (virtual time from the command to the
+ *    first sound out of silence played by the I2S stand-in, before the next command),
+ *    followed by totals and the peak heap held through operator new.
+ *
+ * CHANGES
+ *  - 20261017 V1.0 Initial version
+ */
+
+#ifndef UNIT_TEST
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include "native.h"
+
+void setup();
+void loop();
+
+#define REPLAY_TOPIC "esparkle/in" // Callback ignores the topic
+
+struct TraceCmd {
+    uint32_t atMs;
+    std::string payload;
+};
+
+// Outcome of a replayed command
+struct CmdResult {
+    uint64_t atUs;          // Virtual time it was delivered
+    double dispatchUs;      // Host time taken by its delivery
+    uint64_t onsetUs;       // nativeI2sOnsetUs() before it
+    uint64_t firstSampleUs; // Virtual time to first audio sample, 0 if none
+};
+
+static void report(size_t n, const TraceCmd &cmd, const CmdResult &r) {
+    fprintf(stderr, "replay: #%u @%u ms %.40s: dispatch %.1f us, ", (unsigned)n + 1, cmd.atMs, cmd.payload.c_str(),
+            r.dispatchUs);
+    if (r.firstSampleUs) {
+        fprintf(stderr, "first sample %.3f ms\n", r.firstSampleUs / 1000.0);
+    } else {
+        fprintf(stderr, "no audio\n");
+    }
+}
+
+static bool readBinary(FILE *f, std::vector<TraceCmd> &cmds) {
+    uint8_t header[6];
+    while (fread(header, 1, sizeof(header), f) == sizeof(header)) {
+        TraceCmd cmd;
+        cmd.atMs = header[0] | header[1] << 8 | (uint32_t)header[2] << 16 | (uint32_t)header[3] << 24;
+        cmd.payload.resize(header[4] | header[5] << 8);
+        if (fread(&cmd.payload[0], 1, cmd.payload.size(), f) != cmd.payload.size()) {
+            return false;
+        }
+        cmds.push_back(cmd);
+    }
+    return true;
+}
+
+static bool readText(FILE *f, std::vector<TraceCmd> &cmds) {
+    char line[4096];
+    uint32_t atMs = 0;
+    while (fgets(line, sizeof(line), f)) {
+        char *p = line;
+        char *end = p + strcspn(p, "\r\n");
+        *end = 0;
+        if (*p == '@') {
+            atMs = strtoul(p + 1, &p, 10);
+            p += strspn(p, " \t");
+        }
+        if (*p && *p != '#') {
+            cmds.push_back({atMs, std::string(p, end)});
+        }
+    }
+    return true;
+}
+
+static void published(const char *topic, const uint8_t *payload, size_t length) {
+    printf("%8.3f %s ", nativeMicros() / 1000.0, topic);
+    bool text = true;
+    for (size_t i = 0; i < length && text; i++) {
+        text = payload[i] >= 0x20 || payload[i] == '\t' || payload[i] == '\n';
+    }
+    if (text) {
+        fwrite(payload, 1, length, stdout);
+    } else {
+        for (size_t i = 0; i < length; i++) {
+            printf("%02x", payload[i]);
+        }
+    }
+    putchar('\n');
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    const char *fsDir = ".pio/fsdata";
+    uint32_t settleMs = 10000;
+    uint32_t passUs = 100;
+    int i = 1;
+    for (; i + 1 < argc && argv[i][0] == '-' && argv[i][1]; i += 2) {
+        if (strcmp(argv[i], "-f") == 0) {
+            fsDir = argv[i + 1];
+        } else if (strcmp(argv[i], "-s") == 0) {
+            settleMs = strtoul(argv[i + 1], nullptr, 10);
+        } else if (strcmp(argv[i], "-p") == 0) {
+            passUs = max(1UL, strtoul(argv[i + 1], nullptr, 10));
+        } else {
+            break;
+        }
+    }
+    if (i + 1 != argc) {
+        fprintf(stderr, "Usage: %s [-f <fs dir>] [-s <settle ms>] [-p <pass us>] <trace.bin|trace.txt|->\n", argv[0]);
+        return 1;
+    }
+
+    const char *path = argv[i];
+    size_t pathLen = strlen(path);
+    bool binary = pathLen > 4 && strcmp(path + pathLen - 4, ".bin") == 0;
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, binary ? "rb" : "r");
+    std::vector<TraceCmd> cmds;
+    if (!f || !(binary ? readBinary(f, cmds) : readText(f, cmds))) {
+        fprintf(stderr, "%s: unreadable trace\n", path);
+        return 1;
+    }
+    if (f != stdin) {
+        fclose(f);
+    }
+
+    nativeFsRoot(fsDir);
+    nativeMqttOut(published);
+    setup();
+
+    // Offsets count from the end of boot, as recordings do from their start
+    uint64_t startUs = nativeMicros();
+    uint64_t endUs = startUs + ((cmds.empty() ? 0 : (uint64_t)cmds.back().atMs) + settleMs) * 1000;
+    uint64_t passes = 0;
+    std::vector<CmdResult> results;
+    for (size_t next = 0; nativeMicros() < endUs; passes++) {
+        while (next < cmds.size() && nativeMicros() - startUs >= (uint64_t)cmds[next].atMs * 1000) {
+            if (!results.empty()) {
+                report(results.size() - 1, cmds[results.size() - 1], results.back());
+            }
+            const TraceCmd &cmd = cmds[next++];
+            CmdResult r = {nativeMicros(), 0, nativeI2sOnsetUs(), 0};
+            auto t = std::chrono::steady_clock::now();
+            nativeMqttIn(REPLAY_TOPIC, (const uint8_t *)cmd.payload.data(), cmd.payload.size());
+            r.dispatchUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t).count();
+            results.push_back(r);
+        }
+        loop();
+        nativeAdvance(passUs);
+        // The first sound out of silence following a command is credited to it
+        if (!results.empty() && !results.back().firstSampleUs && nativeI2sOnsetUs() != results.back().onsetUs) {
+            results.back().firstSampleUs = max<uint64_t>(1, nativeI2sOnsetUs() - results.back().atUs);
+        }
+    }
+    if (!results.empty()) {
+        report(results.size() - 1, cmds[results.size() - 1], results.back());
+    }
+
+    double dispatchUs = 0, dispatchMaxUs = 0;
+    uint64_t firstSampleUs = 0, firstSampleMaxUs = 0;
+    unsigned sounding = 0;
+    for (const CmdResult &r : results) {
+        dispatchUs += r.dispatchUs;
+        dispatchMaxUs = max(dispatchMaxUs, r.dispatchUs);
+        if (r.firstSampleUs) {
+            firstSampleUs += r.firstSampleUs;
+            firstSampleMaxUs = max(firstSampleMaxUs, r.firstSampleUs);
+            sounding++;
+        }
+    }
+    fprintf(stderr, "replay: %u commands, dispatch %.1f us host time each, %.1f us max\n", (unsigned)results.size(),
+            results.empty() ? 0 : dispatchUs / results.size(), dispatchMaxUs);
+    fprintf(stderr, "replay: %u commands played audio, first sample after %.3f ms each, %.3f ms max\n", sounding,
+            sounding ? firstSampleUs / 1000.0 / sounding : 0, firstSampleMaxUs / 1000.0);
+    fprintf(stderr, "replay: %llu passes, %.3f s of audio played, %u I2S underruns, heap peak %u bytes, %u held at end\n",
+            (unsigned long long)passes, nativeI2sPlayedUs() / 1e6, nativeI2sUnderruns(), (unsigned)nativeHeapPeak(),
+            (unsigned)nativeHeapUsed());
+    return 0;
+}
+
+#endif
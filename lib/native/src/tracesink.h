@@ -0,0 +1,55 @@
+#ifndef ESPARKLE_NATIVE_TRACESINK_H
+#define ESPARKLE_NATIVE_TRACESINK_H
+
+#include <string>
+#include "cmdparser.h"
+
+/**
+ * Command scanner sink writing events as text, for tests: key, then {, [, } for
+ * containers, =string, #number, ?bool, ~null
+ *
+ * Numbers are written by value, JSON and MessagePack spell them differently.
+ */
+struct TraceSink {
+    std::string trace;
+
+    void value(const CmdValue &v) {
+        if (v.type != CMD_STRING || v.first) {
+            trace += v.key;
+        }
+        char num[24];
+        switch (v.type) {
+            case CMD_OBJECT:
+                trace += "{ ";
+                return;
+            case CMD_ARRAY:
+                trace += "[ ";
+                return;
+            case CMD_END:
+                trace += "} ";
+                return;
+            case CMD_STRING:
+                if (v.first) {
+                    trace += '=';
+                }
+                trace.append(v.str, v.len);
+                if (v.last) {
+                    trace += ' ';
+                }
+                return;
+            case CMD_NUMBER:
+                snprintf(num, sizeof(num), "#%g", v.toFloat());
+                trace += num;
+                break;
+            case CMD_BOOL:
+                trace += v.boolean ? "?1" : "?0";
+                break;
+            case CMD_NULL:
+                trace += '~';
+                break;
+        }
+        trace += ' ';
+    }
+};
+
+#endif //ESPARKLE_NATIVE_TRACESINK_H
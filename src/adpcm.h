@@ -0,0 +1,119 @@
+#ifndef ESPARKLE_ADPCM_H
+#define ESPARKLE_ADPCM_H
+
+#include <Arduino.h>
+#include <AudioGenerator.h>
+#include "imaadpcm.h"
+
+/**
+ * Player of ADPCM clips, a few additions and shifts per sample
+ *
+ * A block is read at once, then decoded sample by sample as the output takes
+ * them. Each block restarts from its own header, so a damaged one can't spoil
+ * the rest of the clip.
+ */
+class AudioGeneratorAdpcm : public AudioGenerator {
+public:
+    AudioGeneratorAdpcm() {
+        running = false;
+        file = nullptr;
+        output = nullptr;
+    }
+
+    ~AudioGeneratorAdpcm() override {}
+
+    bool begin(AudioFileSource *source, AudioOutput *out) override {
+        if (!source || !out || !source->isOpen()) {
+            return false;
+        }
+        file = source;
+        output = out;
+
+        uint8_t header[ADPCM_HEADER_SIZE];
+        if (file->read(header, sizeof(header)) != sizeof(header) || memcmp(header, ADPCM_MAGIC, 4) != 0) {
+            return false;
+        }
+        uint16_t rate = header[4] | header[5] << 8;
+        uint16_t blockSamples = header[6] | header[7] << 8;
+        left = header[8] | header[9] << 8 | (uint32_t)header[10] << 16 | (uint32_t)header[11] << 24;
+        blockSize = ADPCM_BLOCK_HEADER + (blockSamples - 1) / 2;
+        if (!rate || !blockSamples || blockSize > sizeof(block)) {
+            return false;
+        }
+        pos = len = 0;
+        have = false;
+        if (!output->SetRate(rate) || !output->SetBitsPerSample(16) || !output->SetChannels(2) || !output->begin()) {
+            return false;
+        }
+        running = true;
+        return true;
+    }
+
+    bool loop() override {
+        while (running) {
+            if (!have) {
+                if (!next(sample)) {
+                    running = false;
+                    break;
+                }
+                have = true;
+            }
+            int16_t s[2] = {sample, sample};
+            if (!output->ConsumeSample(s)) {
+                break;
+            }
+            have = false;
+        }
+        file->loop();
+        output->loop();
+        return running;
+    }
+
+    // Closes the output even once the clip ran out, loop() only clears running
+    bool stop() override {
+        if (!file || !output) {
+            return false;
+        }
+        running = false;
+        output->stop();
+        return file->close();
+    }
+
+    bool isRunning() override { return running; }
+
+private:
+    bool next(int16_t &s) {
+        if (!left) {
+            return false;
+        }
+        if (pos == len) {
+            len = file->read(block, blockSize);
+            if (len <= ADPCM_BLOCK_HEADER) {
+                return false;
+            }
+            codec.predictor = block[0] | block[1] << 8;
+            codec.index = min<uint8_t>(block[2], 88);
+            pos = ADPCM_BLOCK_HEADER;
+            high = false;
+            s = codec.predictor;
+        } else {
+            uint8_t code = high ? block[pos++] >> 4 : block[pos] & 0x0F;
+            high = !high;
+            s = codec.decode(code);
+        }
+        left--;
+        return true;
+    }
+
+    ImaAdpcm codec;
+    uint8_t block[ADPCM_MAX_BLOCK];
+    uint16_t blockSize = 0;
+    uint16_t pos = 0;
+    uint16_t len = 0;
+    bool high = false;  // Next code is the high nibble
+    uint32_t left = 0;  // Samples left in the clip
+    int16_t sample = 0; // Decoded, not taken by the output yet
+    bool have = false;
+};
+
+#endif //ESPARKLE_ADPCM_H
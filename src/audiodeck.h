@@ -0,0 +1,175 @@
+#ifndef ESPARKLE_AUDIODECK_H
+#define ESPARKLE_AUDIODECK_H
+
+#include <AudioFileSourceLittleFS.h>
+#include "audioslot.h"
+#include "clientsource.h"
+#include "clipcache.h"
+#include "connpool.h"
+#include "jitterbuffer.h"
+
+/**
+ * MP3 source chain of one clip: HTTP stream or response already under way
+ * (optionally through the cache tee) and its jitter buffer, or LittleFS file
+ *
+ * Streams are requested over the pool's connections, and left there when read to their end.
+ *
+ * Two decks let the next clip be opened and buffered while the current one plays,
+ * its stream opened a step per loop so that the current one doesn't run dry.
+ */
+template<typename Cache>
+class AudioDeck {
+public:
+    typedef AudioFileSourceCacheTee<Cache> Tee;
+
+    AudioDeck(ConnPool &pool, uint8_t *buffer, uint32_t bufferSize, uint32_t prebuffer, uint32_t coverMs)
+            : pool(pool), request(pool), buffer(buffer), bufferSize(bufferSize), prebuffer(prebuffer), coverMs(coverMs) {}
+
+    AudioDeck(const AudioDeck &) = delete;
+    AudioDeck &operator=(const AudioDeck &) = delete;
+
+    /**
+     * Start opening stream, it's opened by openStep()
+     * url must stay valid until it's open
+     */
+    void startStream(const char *url, Cache *cache, uint32_t cacheKey, uint8_t resumeRetries) {
+        close();
+        request.start(url);
+        pendingUrl = url;
+        pendingCache = cache;
+        pendingKey = cacheKey;
+        pendingRetries = resumeRetries;
+    }
+
+    // Stream started, not open yet
+    bool opening() const { return request.busy(); }
+
+    /**
+     * Advance the stream being opened one step
+     * Return the head of the chain once open, nullptr meanwhile, or if the server
+     * doesn't answer with the file (opening() is then false, the deck closed)
+     */
+    AudioFileSource *openStep() {
+        if (!request.poll()) {
+            return nullptr;
+        }
+        if (request.status() != HTTP_CODE_OK) {
+            request.cancel();
+            return nullptr;
+        }
+        uint32_t size = request.response().length;
+        bool reusable = request.response().reusable();
+        AudioFileSource *src = openClient(request.take(), size, reusable, pendingCache, pendingKey);
+        clientSlot.get()->resumable(pendingUrl, pendingRetries, request);
+        return src;
+    }
+
+    // Same for the body of a response whose headers are read, size 0 if unknown
+    AudioFileSource *openClient(const WiFiClient &client, uint32_t size, bool reusable, Cache *cache, uint32_t cacheKey) {
+        close();
+        return buffered(clientSlot.create(client, size, pool, reusable), cache, cacheKey);
+    }
+
+    AudioFileSource *openFile(const char *path) {
+        close();
+        return fileSlot.create(path);
+    }
+
+    void close() {
+        request.cancel();
+        if (buffSlot.get()) {
+            buffSlot.get()->close();
+            buffSlot.destroy();
+        }
+        if (teeSlot.get()) {
+            teeSlot.get()->close();
+            teeSlot.destroy();
+        }
+        if (fileSlot.get()) {
+            fileSlot.get()->close();
+            fileSlot.destroy();
+        }
+        if (clientSlot.get()) {
+            clientSlot.get()->close();
+            clientSlot.destroy();
+        }
+    }
+
+    bool isOpen() const { return buffSlot.get() || fileSlot.get(); }
+
+    bool isStream() const { return clientSlot.get(); }
+
+    // Stream that survives a connection loss, up to its retry budget
+    bool isResumable() const { return clientSlot.get() && clientSlot.get()->canResume(); }
+
+    AudioFileSourceClient *stream() const { return clientSlot.get(); }
+
+    // Head of the chain, to be handed to the decoder
+    AudioFileSource *source() const {
+        return buffSlot.get() ? (AudioFileSource *)buffSlot.get() : (AudioFileSource *)fileSlot.get();
+    }
+
+    Tee *tee() const { return teeSlot.get(); }
+
+    JitterBuffer *jitter() const { return buffSlot.get(); }
+
+    // False while a stream is (re)buffering, the decoder must not read it meanwhile
+    bool ready() const { return !buffSlot.get() || !buffSlot.get()->waiting(); }
+
+    // Bytes not yet read from file or network, UINT32_MAX if unknown
+    uint32_t remaining() const {
+        AudioFileSource *src = clientSlot.get() ? (AudioFileSource *)clientSlot.get() : (AudioFileSource *)fileSlot.get();
+        if (!src || !src->getSize()) {
+            return UINT32_MAX;
+        }
+        return src->getSize() - src->getPos();
+    }
+
+    /**
+     * Take the larger ring of other deck, which must be closed, in exchange for this one
+     * The prefetched clip only needs a small one until it plays
+     */
+    void takeBuffer(AudioDeck &other) {
+        if (other.bufferSize <= bufferSize) {
+            return;
+        }
+        std::swap(buffer, other.buffer);
+        std::swap(bufferSize, other.bufferSize);
+        if (buffSlot.get()) {
+            buffSlot.get()->move(buffer, bufferSize);
+        }
+    }
+
+    // Keep filling the buffer, every loop whether the deck is played yet or not
+    void loop() {
+        if (buffSlot.get()) {
+            buffSlot.get()->loop();
+        }
+    }
+
+private:
+    AudioFileSource *buffered(AudioFileSource *src, Cache *cache, uint32_t cacheKey) {
+        if (cache && cache->reserve(src->getSize())) {
+            src = teeSlot.create(src, *cache, cacheKey);
+        }
+        return buffSlot.create(src, buffer, bufferSize, prebuffer, coverMs);
+    }
+
+    ConnPool &pool;
+    HttpGet request;
+    const char *pendingUrl = nullptr;
+    Cache *pendingCache = nullptr;
+    uint32_t pendingKey = 0;
+    uint8_t pendingRetries = 0;
+    uint8_t *buffer;
+    uint32_t bufferSize;
+    uint32_t prebuffer;
+    uint32_t coverMs;
+
+    AudioSlot<AudioFileSourceClient> clientSlot;
+    AudioSlot<AudioFileSourceLittleFS> fileSlot;
+    AudioSlot<Tee> teeSlot;
+    AudioSlot<JitterBuffer> buffSlot;
+};
+
+#endif //ESPARKLE_AUDIODECK_H
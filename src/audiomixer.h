@@ -0,0 +1,211 @@
+#ifndef ESPARKLE_AUDIOMIXER_H
+#define ESPARKLE_AUDIOMIXER_H
+
+#include <AudioOutput.h>
+
+#define MIXER_FRAMES    128  // Frames buffered per channel, power of 2
+#define MIXER_DUCK_RAMP 8    // Duck gain step per frame, Q15 (~90 ms full swing at 44.1 kHz)
+
+template<uint8_t N>
+class AudioMixer;
+
+/**
+ * Mixer input, generators output to it as to any AudioOutput
+ */
+template<uint8_t N>
+class MixerChannel : public AudioOutput {
+public:
+    bool SetRate(int hz) override {
+        hertz = hz;
+        mixer->channelRate(this);
+        return true;
+    }
+
+    bool SetGain(float f) override {
+        gainQ8 = constrain(f, 0.0f, 4.0f) * 256;
+        return true;
+    }
+
+    bool begin() override {
+        if (!active) {
+            head = tail = 0;
+            mixed = 0;
+            active = true;
+        }
+        return mixer->channelBegin();
+    }
+
+    bool ConsumeSample(int16_t sample[2]) override {
+        if (available() == MIXER_FRAMES) {
+            mixer->pump(); // Make room by moving mixed frames to the output
+            if (available() == MIXER_FRAMES) {
+                return false;
+            }
+        }
+        int16_t *frame = frames[head++ & (MIXER_FRAMES - 1)];
+        frame[0] = sample[LEFTCHANNEL];
+        frame[1] = sample[RIGHTCHANNEL];
+        MakeSampleStereo16(frame);
+        return true;
+    }
+
+    bool stop() override {
+        if (holding) {
+            holding = false; // Handoff, next generator takes over buffered frames and output
+            return true;
+        }
+        active = false;
+        head = tail = 0;
+        mixed = 0;
+        mixer->channelStop();
+        return true;
+    }
+
+    // Let the next stop() keep channel and output running, for a gapless generator swap
+    void hold() { holding = true; }
+
+    // Write silence as far as channel and output take it, to keep them running without a generator
+    void silence() {
+        int16_t zero[2] = {0, 0};
+        while (ConsumeSample(zero)) {
+        }
+    }
+
+    bool isActive() const { return active; }
+
+    uint16_t available() const { return head - tail; }
+
+    uint16_t rate() const { return hertz; }
+
+    // Frames written to the output since the channel started
+    uint32_t played() const { return mixed; }
+
+private:
+    friend class AudioMixer<N>;
+
+    const int16_t *peek() const { return frames[tail & (MIXER_FRAMES - 1)]; }
+
+    AudioMixer<N> *mixer = nullptr;
+    int16_t frames[MIXER_FRAMES][2];
+    uint16_t head = 0; // Free running, wrap is fine as MIXER_FRAMES divides 65536
+    uint16_t tail = 0;
+    uint32_t mixed = 0;
+    uint16_t gainQ8 = 256;
+    bool active = false;
+    bool holding = false;
+};
+
+/**
+ * Fixed point mixer of N channels into one output
+ *
+ * Channel 0 is the background, it's ducked while any other channel plays.
+ * Frames are mixed only when every active channel has one, so channels stay
+ * in sync, summing saturates instead of wrapping. Channels must run at the
+ * same rate, the output follows channel 0, or the overlay when alone.
+ */
+template<uint8_t N>
+class AudioMixer {
+public:
+    explicit AudioMixer(uint16_t duckGain) : duckTarget(duckGain) {
+        for (uint8_t i = 0; i < N; i++) {
+            channels[i].mixer = this;
+        }
+    }
+
+    void begin(AudioOutput *out) { output = out; }
+
+    MixerChannel<N> &channel(uint8_t i) { return channels[i]; }
+
+    /**
+     * Mix and write frames until a channel runs dry or output is full
+     */
+    void pump() {
+        if (!output || !running) {
+            return;
+        }
+        bool overlay = false;
+        uint16_t count = UINT16_MAX;
+        for (uint8_t i = 0; i < N; i++) {
+            if (channels[i].active) {
+                count = min(count, channels[i].available());
+                overlay |= i > 0;
+            }
+        }
+        if (count == UINT16_MAX) {
+            return;
+        }
+
+        uint16_t target = overlay ? duckTarget : 32768;
+        while (count--) {
+            if (duck < target) {
+                duck = min<uint32_t>(duck + MIXER_DUCK_RAMP, target);
+            } else if (duck > target) {
+                duck = max<int32_t>(duck - MIXER_DUCK_RAMP, target);
+            }
+
+            int32_t left = 0;
+            int32_t right = 0;
+            for (uint8_t i = 0; i < N; i++) {
+                MixerChannel<N> &ch = channels[i];
+                if (!ch.active) {
+                    continue;
+                }
+                int32_t gain = i ? ch.gainQ8 : (ch.gainQ8 * duck) >> 15;
+                const int16_t *frame = ch.peek();
+                left += (frame[0] * gain) >> 8;
+                right += (frame[1] * gain) >> 8;
+            }
+            int16_t mixed[2] = {saturate(left), saturate(right)};
+            if (!output->ConsumeSample(mixed)) {
+                return;
+            }
+            for (uint8_t i = 0; i < N; i++) {
+                if (channels[i].active) {
+                    channels[i].tail++;
+                    channels[i].mixed++;
+                }
+            }
+        }
+    }
+
+    bool isActive() const { return running; }
+
+private:
+    friend class MixerChannel<N>;
+
+    static int16_t saturate(int32_t v) {
+        return v > 32767 ? 32767 : (v < -32768 ? -32768 : v);
+    }
+
+    bool channelBegin() {
+        if (!running) {
+            running = output->begin();
+        }
+        return running;
+    }
+
+    // Output stops when the last channel does, e.g. overlay keeps it running after main ends
+    void channelStop() {
+        for (uint8_t i = 0; i < N; i++) {
+            if (channels[i].active) {
+                return;
+            }
+        }
+        output->stop();
+        running = false;
+    }
+
+    void channelRate(const MixerChannel<N> *ch) {
+        if (ch == &channels[0] || !channels[0].active) {
+            output->SetRate(ch->rate());
+        }
+    }
+
+    MixerChannel<N> channels[N];
+    AudioOutput *output = nullptr;
+    bool running = false;
+    uint16_t duck = 32768; // Background gain, Q15
+    uint16_t duckTarget;
+};
+
+#endif //ESPARKLE_AUDIOMIXER_H
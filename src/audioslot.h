@@ -0,0 +1,41 @@
+#ifndef ESPARKLE_AUDIOSLOT_H
+#define ESPARKLE_AUDIOSLOT_H
+
+#include <new>
+#include <utility>
+
+/**
+ * Static storage for a single audio pipeline object
+ *
+ * The object is constructed in place and destroyed explicitly, so playing a
+ * clip never allocates or frees the object itself on the heap.
+ */
+template<typename T>
+class AudioSlot {
+public:
+    AudioSlot() = default;
+    AudioSlot(const AudioSlot &) = delete;
+    AudioSlot &operator=(const AudioSlot &) = delete;
+
+    template<typename... Args>
+    T *create(Args &&... args) {
+        destroy();
+        obj = new(storage) T(std::forward<Args>(args)...);
+        return obj;
+    }
+
+    void destroy() {
+        if (obj) {
+            obj->~T();
+            obj = nullptr;
+        }
+    }
+
+    T *get() const { return obj; }
+
+private:
+    alignas(T) uint8_t storage[sizeof(T)];
+    T *obj = nullptr;
+};
+
+#endif //ESPARKLE_AUDIOSLOT_H
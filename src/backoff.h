@@ -0,0 +1,43 @@
+#ifndef ESPARKLE_BACKOFF_H
+#define ESPARKLE_BACKOFF_H
+
+#include <Arduino.h>
+
+/**
+ * Exponential retry backoff with jitter
+ *
+ * Each failure doubles the delay, up to maxMs; the actual wait is drawn
+ * between half and all of it, so that a fleet of devices losing the same
+ * access point or broker does not retry in lockstep.
+ */
+class Backoff {
+public:
+    Backoff(uint32_t minMs, uint32_t maxMs) : minMs(minMs), maxMs(maxMs), curMs(minMs) {}
+
+    // Always due until a failure, then once its wait is over, however long ago it was
+    bool due(uint32_t now) const { return !failures || now - failedMs >= waitMs; }
+
+    void success() {
+        curMs = minMs;
+        failures = 0;
+    }
+
+    void failure(uint32_t now) {
+        failedMs = now;
+        waitMs = random(curMs / 2, curMs + 1);
+        curMs = min(curMs * 2, maxMs);
+        failures++;
+    }
+
+    uint32_t consecutiveFailures() const { return failures; }
+
+private:
+    uint32_t minMs;
+    uint32_t maxMs;
+    uint32_t curMs;
+    uint32_t failedMs = 0;
+    uint32_t waitMs = 0;
+    uint32_t failures = 0;
+};
+
+#endif //ESPARKLE_BACKOFF_H
@@ -0,0 +1,166 @@
+#ifndef ESPARKLE_CLIENTSOURCE_H
+#define ESPARKLE_CLIENTSOURCE_H
+
+#include <AudioFileSource.h>
+#include <ESP8266WiFi.h>
+#include "backoff.h"
+#include "connpool.h"
+
+#define CLIENT_STALL_MS 3000 // Resumable stream without data this long is reconnected
+#define CLIENT_URL_SIZE 256
+#define RESUME_MIN_MS     250   // First resume attempt delay, doubles after each failure
+#define RESUME_MAX_MS     4000
+#define RESUME_OFFLINE_MS 30000 // Max wait for WiFi to come back, attempts aren't spent meanwhile
+
+/**
+ * Audio source reading the body of an HTTP response already under way
+ *
+ * The client is handed over once the response headers are read, so that the
+ * body plays from the connection that requested it, without a second request.
+ * A reusable connection is parked in the pool if the body was read to its end.
+ *
+ * Reads never wait for the network, they return what has arrived. A resumable
+ * stream (GET of known length) cut or stalled before its end is requested again
+ * from the byte it stopped at, with a Range request, up to a retry budget spent
+ * on requests sent only: while WiFi is down it waits, RESUME_OFFLINE_MS at most. The
+ * request is advanced a step per loop(), the jitter buffer in front drains
+ * meanwhile, then holds the decoder paused. The decoder gets the same bytes it
+ * would have, so it goes on with the next frame.
+ */
+class AudioFileSourceClient : public AudioFileSource {
+public:
+    // size is the body length, 0 if unknown (connection closed at its end)
+    AudioFileSourceClient(const WiFiClient &client, uint32_t size, ConnPool &pool, bool reusable)
+            : client(client), size(size), pool(pool), reusable(reusable), retry(RESUME_MIN_MS, RESUME_MAX_MS) {
+        dataMs = millis();
+    }
+
+    ~AudioFileSourceClient() override { close(); }
+
+    /**
+     * Allow resuming from url, retries times at most, with request
+     * request must be left to this stream until it's closed
+     */
+    void resumable(const char *streamUrl, uint8_t retries, HttpGet &request) {
+        if (size) {
+            strlcpy(url, streamUrl, sizeof(url));
+            budget = retries;
+            resumer = &request;
+        }
+    }
+
+    // Short of len while data is on its way, see stalled()
+    uint32_t read(void *data, uint32_t len) override { return readNonBlock(data, len); }
+
+    uint32_t readNonBlock(void *data, uint32_t len) override {
+        if (size) {
+            len = min(len, size - pos);
+        }
+        len = min(len, (uint32_t)client.available());
+        if (!len) {
+            return 0;
+        }
+        int n = client.read((uint8_t *)data, len);
+        if (n <= 0) {
+            return 0;
+        }
+        pos += n;
+        dataMs = millis();
+        return n;
+    }
+
+    bool close() override {
+        if (stalled()) {
+            resumer->cancel();
+        }
+        if (reusable && size && pos == size) {
+            pool.release(client);
+        } else {
+            client.stop();
+        }
+        budget = 0;
+        return true;
+    }
+
+    bool isOpen() override {
+        return (!size || pos < size) && (client.available() || client.connected() || budget || stalled());
+    }
+
+    uint32_t getSize() override { return size; }
+
+    uint32_t getPos() override { return pos; }
+
+    // Drop a stalled connection, reconnect a lost one a step at a time
+    bool loop() override {
+        if (stalled()) {
+            resume();
+            return true;
+        }
+        if (client.available()) {
+            dataMs = millis(); // Full buffer holds data back, that's no stall
+        } else if (budget && pos < size && client.connected() && millis() - dataMs > CLIENT_STALL_MS) {
+            client.stop();
+        }
+        if (!lost()) {
+            offline = false;
+        } else if (WiFi.status() != WL_CONNECTED) {
+            if (!offline) {
+                offline = true;
+                offlineMs = millis();
+            } else if (millis() - offlineMs > RESUME_OFFLINE_MS) {
+                budget = 0; // Stream ends with what's buffered
+            }
+        } else if (retry.due(millis())) {
+            offline = false;
+            budget--;
+            resumer->start(url, pos);
+        }
+        return true;
+    }
+
+    bool canResume() const { return *url; }
+
+    // Being requested again, no data until then
+    bool stalled() const { return resumer && resumer->busy(); }
+
+    // Successful resumes of this stream
+    uint8_t resumes() const { return resumed; }
+
+private:
+    bool lost() { return budget && pos < size && !client.connected() && !client.available(); }
+
+    // Advance the resume request, switch to its connection once the rest of the body comes
+    void resume() {
+        if (!resumer->poll()) {
+            return;
+        }
+        if (resumer->status() == HTTP_CODE_PARTIAL_CONTENT && resumer->response().length == size - pos) {
+            reusable = resumer->response().reusable();
+            client.stop();
+            client = resumer->take();
+            resumed++;
+            dataMs = millis();
+            retry.success();
+            return;
+        }
+        resumer->cancel();
+        retry.failure(millis());
+    }
+
+    WiFiClient client;
+    uint32_t size;
+    uint32_t pos = 0;
+    ConnPool &pool;
+    bool reusable;
+
+    char url[CLIENT_URL_SIZE] = "";
+    HttpGet *resumer = nullptr;
+    uint8_t budget = 0; // Resume attempts left
+    uint8_t resumed = 0;
+    bool offline = false; // Lost while WiFi is down, since offlineMs
+    uint32_t offlineMs = 0;
+    uint32_t dataMs;
+    Backoff retry;
+};
+
+#endif //ESPARKLE_CLIENTSOURCE_H
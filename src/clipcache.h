@@ -0,0 +1,272 @@
+#ifndef ESPARKLE_CLIPCACHE_H
+#define ESPARKLE_CLIPCACHE_H
+
+#include <LittleFS.h>
+#include <AudioFileSource.h>
+
+#define CACHE_DIR       "/cache"
+#define CACHE_TMP_FILE  CACHE_DIR "/tmp"
+#define CACHE_INDEX     CACHE_DIR "/index"
+#define CACHE_FS_MARGIN 16384 // LittleFS space always left free
+
+struct CacheStats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t bytesSaved; // Bytes played from flash instead of network
+    uint32_t stored;
+    uint32_t evictions;
+};
+
+/**
+ * FNV-1a hash, used as cache key
+ * Chain calls to hash several strings
+ */
+inline uint32_t clipHash(const char *str, uint32_t h = 2166136261UL) {
+    while (*str) {
+        h = (h ^ (uint8_t)*str++) * 16777619UL;
+    }
+    return h ?: 1;
+}
+
+/**
+ * LRU cache of MP3 clips on LittleFS
+ *
+ * Clips are keyed by a hash of their URL (or of TTS voice and text) and
+ * stored as /cache/<key>.mp3, within a size budget. Least recently used
+ * clips are evicted first.
+ */
+template<uint8_t N>
+class ClipCache {
+public:
+    explicit ClipCache(uint32_t budget) : budget(budget) {}
+
+    static void path(uint32_t key, char *out, size_t len) {
+        snprintf_P(out, len, PSTR(CACHE_DIR "/%08x.mp3"), (unsigned)key);
+    }
+
+    /**
+     * Load cache index from LittleFS, dropping leftovers of interrupted downloads
+     */
+    void begin() {
+        LittleFS.remove(CACHE_TMP_FILE);
+
+        count = 0;
+        used = 0;
+        Dir dir = LittleFS.openDir(CACHE_DIR);
+        while (dir.next() && count < N) {
+            unsigned key;
+            if (sscanf(dir.fileName().c_str(), "%08x.mp3", &key) == 1) {
+                entries[count++] = {key, (uint32_t)dir.fileSize(), 0};
+                used += dir.fileSize();
+            }
+        }
+
+        // Restore LRU order
+        File f = LittleFS.open(CACHE_INDEX, "r");
+        uint32_t rec[2];
+        while (f && f.read((uint8_t *)rec, sizeof(rec)) == sizeof(rec)) {
+            Entry *e = find(rec[0]);
+            if (e) {
+                e->lastUse = rec[1];
+                tick = max(tick, rec[1]);
+            }
+        }
+    }
+
+    /**
+     * Look for clip, return true and its path on hit
+     */
+    bool lookup(uint32_t key, char *out, size_t len) {
+        Entry *e = find(key);
+        if (!e) {
+            st.misses++;
+            return false;
+        }
+        e->lastUse = ++tick;
+        st.hits++;
+        st.bytesSaved += e->size;
+        path(key, out, len);
+        return true;
+    }
+
+    /**
+     * Make room for a new clip of given size, return false if it can't be cached
+     */
+    bool reserve(uint32_t size) {
+        if (!size || size > budget) {
+            return false;
+        }
+        FSInfo info;
+        LittleFS.info(info);
+        while (count && (count == N || used + size > budget || info.usedBytes + size + CACHE_FS_MARGIN > info.totalBytes)) {
+            evict();
+            LittleFS.info(info);
+        }
+        return used + size <= budget && info.usedBytes + size + CACHE_FS_MARGIN <= info.totalBytes;
+    }
+
+    /**
+     * Turn completely downloaded temp file into cached clip
+     */
+    void commit(uint32_t key, uint32_t size) {
+        char p[24];
+        path(key, p, sizeof(p));
+        LittleFS.remove(p);
+        Entry *e = find(key);
+        if (e) {
+            used -= e->size;
+            *e = entries[--count];
+        }
+        if (count == N || !LittleFS.rename(CACHE_TMP_FILE, p)) {
+            LittleFS.remove(CACHE_TMP_FILE);
+            return;
+        }
+        entries[count++] = {key, size, ++tick};
+        used += size;
+        st.stored++;
+        save();
+    }
+
+    uint8_t size() const { return count; }
+
+    uint32_t bytes() const { return used; }
+
+    const CacheStats &stats() const { return st; }
+
+private:
+    struct Entry {
+        uint32_t key;
+        uint32_t size;
+        uint32_t lastUse;
+    };
+
+    Entry *find(uint32_t key) {
+        for (uint8_t i = 0; i < count; i++) {
+            if (entries[i].key == key) {
+                return &entries[i];
+            }
+        }
+        return nullptr;
+    }
+
+    void evict() {
+        uint8_t lru = 0;
+        for (uint8_t i = 1; i < count; i++) {
+            if (entries[i].lastUse < entries[lru].lastUse) {
+                lru = i;
+            }
+        }
+        char p[24];
+        path(entries[lru].key, p, sizeof(p));
+        LittleFS.remove(p);
+        used -= entries[lru].size;
+        entries[lru] = entries[--count];
+        st.evictions++;
+        save();
+    }
+
+    // Hits only update the index in RAM, it is saved when clips are added or evicted
+    void save() {
+        File f = LittleFS.open(CACHE_INDEX, "w");
+        for (uint8_t i = 0; f && i < count; i++) {
+            uint32_t rec[2] = {entries[i].key, entries[i].lastUse};
+            f.write((const uint8_t *)rec, sizeof(rec));
+        }
+    }
+
+    Entry entries[N];
+    uint8_t count = 0;
+    uint32_t used = 0;
+    uint32_t budget;
+    uint32_t tick = 0;
+    CacheStats st = {};
+};
+
+/**
+ * Source wrapper writing everything read from the upstream source into
+ * the cache temp file
+ *
+ * The clip is committed by finish() once the decoder reached the end of
+ * the stream, and discarded if playback is interrupted.
+ */
+template<typename Cache>
+class AudioFileSourceCacheTee : public AudioFileSource {
+public:
+    AudioFileSourceCacheTee(AudioFileSource *src, Cache &cache, uint32_t key)
+            : src(src), cache(cache), key(key), expected(src->getSize()) {
+        tmp = LittleFS.open(CACHE_TMP_FILE, "w");
+    }
+
+    ~AudioFileSourceCacheTee() override { abort(); }
+
+    uint32_t read(void *data, uint32_t len) override {
+        return tee(data, src->read(data, len));
+    }
+
+    uint32_t readNonBlock(void *data, uint32_t len) override {
+        return tee(data, src->readNonBlock(data, len));
+    }
+
+    bool seek(int32_t pos, int dir) override {
+        abort(); // Cached copy would be inconsistent
+        return src->seek(pos, dir);
+    }
+
+    bool close() override {
+        abort();
+        return src->close();
+    }
+
+    bool isOpen() override { return src->isOpen(); }
+
+    uint32_t getSize() override { return src->getSize(); }
+
+    uint32_t getPos() override { return src->getPos(); }
+
+    bool loop() override { return src->loop(); }
+
+    /**
+     * Playback reached end of stream: fetch what the decoder left behind
+     * (trailing tags) and commit the clip if complete
+     */
+    void finish() {
+        uint8_t buf[256];
+        while (tmp && written < expected && src->isOpen()) {
+            uint32_t n = src->read(buf, min((uint32_t)sizeof(buf), expected - written));
+            if (!n) {
+                break;
+            }
+            tee(buf, n);
+        }
+        if (tmp && written == expected) {
+            tmp.close();
+            cache.commit(key, written);
+        }
+        abort();
+    }
+
+private:
+    uint32_t tee(void *data, uint32_t len) {
+        if (tmp && len && tmp.write((const uint8_t *)data, len) != len) {
+            abort(); // Flash full
+        }
+        written += len;
+        return len;
+    }
+
+    void abort() {
+        if (tmp) {
+            tmp.close();
+            LittleFS.remove(CACHE_TMP_FILE);
+        }
+    }
+
+    AudioFileSource *src;
+    Cache &cache;
+    uint32_t key;
+    uint32_t expected;
+    uint32_t written = 0;
+    File tmp;
+};
+
+#endif //ESPARKLE_CLIPCACHE_H
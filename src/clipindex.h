@@ -0,0 +1,224 @@
+#ifndef ESPARKLE_CLIPINDEX_H
+#define ESPARKLE_CLIPINDEX_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "clipcache.h"
+#include "imaadpcm.h"
+#include "mp3probe.h"
+
+#define CLIP_DIR "/mp3"
+
+enum ClipCodec : uint8_t {
+    CLIP_OTHER,
+    CLIP_MP3,
+    CLIP_ADPCM,
+    CLIP_WAV
+};
+
+struct ClipInfo {
+    uint32_t hash;       // clipHash() of its path
+    uint32_t size;
+    uint32_t durationMs; // 0 if unknown
+    uint16_t sampleRate; // Hz, 0 if unknown
+    uint16_t kbps;
+    uint16_t name;       // Offset of its file name in the name pool
+    ClipCodec codec;
+};
+
+/**
+ * LittleFS clips, indexed once at boot (the clip directory only changes with
+ * a new file system image, flashed before a restart)
+ *
+ * Clips are numbered from 1 in name order, and looked up by path hash with a
+ * binary search, so that playing or listing them needs no directory walk nor
+ * file probe. Names are packed in a pool of POOL bytes.
+ */
+template<uint8_t N, uint16_t POOL>
+class ClipIndex {
+public:
+    /**
+     * Index files of CLIP_DIR, return the number of clips
+     * Files beyond N clips or POOL name bytes are left out, see dropped()
+     */
+    uint8_t build() {
+        uint32_t start = millis();
+        count = 0;
+        used = 0;
+        skipped = 0;
+        uint32_t dirHash = clipHash(CLIP_DIR "/");
+        Dir dir = LittleFS.openDir(CLIP_DIR);
+        while (dir.next()) {
+            if (!dir.isFile()) {
+                continue;
+            }
+            String fileName = dir.fileName();
+            size_t len = fileName.length() + 1;
+            if (count == N || used + len > POOL) {
+                skipped++;
+                continue;
+            }
+            ClipInfo &clip = clips[count++];
+            memcpy(names + used, fileName.c_str(), len);
+            clip = {};
+            clip.name = used;
+            clip.hash = clipHash(names + used, dirHash);
+            clip.size = dir.fileSize();
+            used += len;
+            File file = dir.openFile("r");
+            if (file) {
+                probe(file, names + clip.name, clip);
+            }
+            file.close();
+        }
+
+        // Insertion sorts, only a few dozen clips
+        for (uint8_t i = 1; i < count; i++) {
+            ClipInfo clip = clips[i];
+            uint8_t j = i;
+            for (; j && strcmp(names + clips[j - 1].name, names + clip.name) > 0; j--) {
+                clips[j] = clips[j - 1];
+            }
+            clips[j] = clip;
+        }
+        for (uint8_t i = 0; i < count; i++) {
+            uint8_t j = i;
+            for (; j && clips[byHash[j - 1]].hash > clips[i].hash; j--) {
+                byHash[j] = byHash[j - 1];
+            }
+            byHash[j] = i;
+        }
+        buildMs = millis() - start;
+        return count;
+    }
+
+    uint8_t size() const { return count; }
+
+    uint8_t dropped() const { return skipped; }
+
+    uint32_t lastBuildMs() const { return buildMs; }
+
+    // Clip by id, from 1 to size()
+    const ClipInfo &clip(uint8_t id) const { return clips[id - 1]; }
+
+    const char *name(uint8_t id) const { return names + clips[id - 1].name; }
+
+    /**
+     * Clip path by id, return false if there's no such clip
+     */
+    bool path(uint8_t id, char *out, size_t size) const {
+        return id && id <= count
+               && (size_t)snprintf_P(out, size, PSTR(CLIP_DIR "/%s"), names + clips[id - 1].name) < size;
+    }
+
+    /**
+     * Id of clip at path, 0 if not indexed
+     */
+    uint8_t find(const char *path) const {
+        if (strncmp(path, CLIP_DIR "/", sizeof(CLIP_DIR)) != 0) {
+            return 0;
+        }
+        uint32_t hash = clipHash(path);
+        uint8_t lo = 0;
+        uint8_t hi = count;
+        while (lo < hi) {
+            uint8_t mid = (lo + hi) / 2;
+            if (clips[byHash[mid]].hash < hash) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        for (; lo < count && clips[byHash[lo]].hash == hash; lo++) {
+            if (strcmp(names + clips[byHash[lo]].name, path + sizeof(CLIP_DIR)) == 0) {
+                return byHash[lo] + 1;
+            }
+        }
+        return 0;
+    }
+
+    static const char *codecName(ClipCodec codec) {
+        switch (codec) {
+            case CLIP_MP3:
+                return "mp3";
+            case CLIP_ADPCM:
+                return "adpcm";
+            case CLIP_WAV:
+                return "wav";
+            default:
+                return "";
+        }
+    }
+
+private:
+    static uint32_t le32(const uint8_t *p) {
+        return p[0] | p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    }
+
+    // Codec and duration from the file header, by extension
+    static void probe(File &file, const char *name, ClipInfo &clip) {
+        const char *ext = strrchr(name, '.');
+        if (!ext) {
+            return;
+        }
+        uint8_t buf[ADPCM_HEADER_SIZE];
+        if (strcmp(ext, ".mp3") == 0) {
+            Mp3Info info;
+            if (mp3Probe(file, info)) {
+                clip.codec = CLIP_MP3;
+                clip.durationMs = info.durationMs;
+                clip.sampleRate = info.sampleRate;
+                clip.kbps = info.bitrate;
+            }
+        } else if (strcmp(ext, ".adp") == 0) {
+            if (file.read(buf, sizeof(buf)) == sizeof(buf) && memcmp(buf, ADPCM_MAGIC, 4) == 0) {
+                clip.codec = CLIP_ADPCM;
+                clip.sampleRate = buf[4] | buf[5] << 8;
+                uint32_t samples = le32(buf + 8);
+                if (clip.sampleRate) {
+                    clip.durationMs = (uint64_t)samples * 1000 / clip.sampleRate;
+                }
+                if (clip.durationMs) {
+                    clip.kbps = (uint64_t)clip.size * 8 / clip.durationMs;
+                }
+            }
+        } else if (strcmp(ext, ".wav") == 0) {
+            probeWav(file, clip);
+        }
+    }
+
+    // 16 bit PCM WAV: format chunk, then data chunk size
+    static void probeWav(File &file, ClipInfo &clip) {
+        uint8_t buf[16];
+        if (file.read(buf, 12) != 12 || memcmp(buf, "RIFF", 4) != 0 || memcmp(buf + 8, "WAVE", 4) != 0) {
+            return;
+        }
+        uint32_t byteRate = 0;
+        uint32_t at = 12;
+        while (file.seek(at) && file.read(buf, 8) == 8) {
+            uint32_t len = le32(buf + 4);
+            if (memcmp(buf, "fmt ", 4) == 0 && len >= 16 && file.read(buf, 16) == 16) {
+                clip.sampleRate = buf[4] | buf[5] << 8;
+                byteRate = le32(buf + 8);
+            } else if (memcmp(buf, "data", 4) == 0 && byteRate) {
+                clip.codec = CLIP_WAV;
+                clip.durationMs = (uint64_t)len * 1000 / byteRate;
+                clip.kbps = byteRate * 8 / 1000;
+                return;
+            }
+            at += 8 + len + (len & 1);
+        }
+    }
+
+    static_assert(N < UINT8_MAX, "Clip ids are 8 bit, 0 meaning none");
+
+    ClipInfo clips[N];
+    uint8_t byHash[N]; // Clip positions, by hash
+    char names[POOL];
+    uint8_t count = 0;
+    uint16_t used = 0;
+    uint8_t skipped = 0;
+    uint32_t buildMs = 0;
+};
+
+#endif //ESPARKLE_CLIPINDEX_H
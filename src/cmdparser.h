@@ -0,0 +1,900 @@
+#ifndef ESPARKLE_CMDPARSER_H
+#define ESPARKLE_CMDPARSER_H
+
+#include <Arduino.h>
+
+#define CMD_KEY_SIZE     16
+#define CMD_SCRATCH_SIZE 64
+#define CMD_MAX_DEPTH    8
+
+enum CmdFormat : uint8_t {
+    CMD_JSON,
+    CMD_MSGPACK
+};
+
+enum CmdValueType : uint8_t {
+    CMD_STRING,
+    CMD_NUMBER,
+    CMD_BOOL,
+    CMD_NULL,
+    CMD_OBJECT, // Object begins
+    CMD_ARRAY,  // Array begins
+    CMD_END     // Object or array ends
+};
+
+/**
+ * Value event emitted by command scanners
+ *
+ * Strings are delivered in chunks of up to CMD_SCRATCH_SIZE bytes, flagged
+ * first and last, so that values of any length can be streamed.
+ */
+struct CmdValue {
+    CmdValueType type;
+    uint8_t depth;   // Nesting level of the value, 1 for members of the top object
+    const char *key; // Member name, empty for array items
+    const char *str; // String chunk or number text, not null terminated
+    uint16_t len;
+    size_t offset;   // Input offset of CMD_OBJECT/CMD_ARRAY first byte, or one past CMD_END last byte
+    bool first;
+    bool last;
+    bool boolean;
+
+    // Decimal, "010" is 10
+    long toInt() const {
+        char buf[CMD_SCRATCH_SIZE + 1];
+        return strtol(text(buf), nullptr, 10);
+    }
+
+    // Decimal, or hexadecimal with 0x prefix (colors: "0xff0000")
+    uint32_t toUInt() const {
+        char buf[CMD_SCRATCH_SIZE + 1];
+        const char *t = text(buf);
+        while (isspace(*t)) {
+            t++;
+        }
+        return strtoul(t, nullptr, t[0] == '0' && (t[1] | 0x20) == 'x' ? 16 : 10);
+    }
+
+    float toFloat() const {
+        char buf[CMD_SCRATCH_SIZE + 1];
+        return atof(text(buf));
+    }
+
+    // Append string chunk to dst, truncating if needed
+    void appendTo(char *dst, size_t size) const {
+        size_t cur = first ? 0 : strnlen(dst, size - 1);
+        size_t n = min((size_t)len, size - 1 - cur);
+        memcpy(dst + cur, str, n);
+        dst[cur + n] = 0;
+    }
+
+private:
+    const char *text(char *buf) const {
+        if (type == CMD_BOOL) {
+            return boolean ? "1" : "0";
+        }
+        memcpy(buf, str, len);
+        buf[len] = 0;
+        return buf;
+    }
+};
+
+/**
+ * Key table entry, tables are sorted by name so they can be binary searched
+ */
+template<typename T>
+struct CmdEntry {
+    const char *name;
+    T target;
+};
+
+constexpr bool cmdNameLess(const char *a, const char *b) {
+    return *a == *b ? (*a && cmdNameLess(a + 1, b + 1)) : (uint8_t)*a < (uint8_t)*b;
+}
+
+template<typename T>
+constexpr bool cmdTableSorted(const CmdEntry<T> *table, size_t n) {
+    return n < 2 || (cmdNameLess(table[0].name, table[1].name) && cmdTableSorted(table + 1, n - 1));
+}
+
+template<typename T, size_t N>
+const CmdEntry<T> *cmdLookup(const CmdEntry<T> (&table)[N], const char *name, size_t len) {
+    size_t lo = 0;
+    size_t hi = N;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int c = strncmp(table[mid].name, name, len);
+        if (c == 0 && table[mid].name[len]) {
+            c = 1;
+        }
+        if (c == 0) {
+            return &table[mid];
+        }
+        if (c < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Push JSON scanner
+ *
+ * Input may be fed in pieces of any size, it's parsed in a single pass with
+ * fixed memory, and every value is reported to sink.value(const CmdValue &).
+ *
+ * As lenient as ArduinoJson, which commands were parsed with before:
+ * single quoted strings and unquoted keys ({cmd:'break'}) are accepted.
+ */
+template<typename Sink>
+class JsonScanner {
+public:
+    explicit JsonScanner(Sink &sink) : sink(sink) { reset(); }
+
+    void reset() {
+        state = S_VALUE;
+        depth = 0;
+        containers = 0;
+        offset = 0;
+        key[0] = 0;
+        keyLen = 0;
+        inKey = false;
+        quote = '"';
+        scratchLen = 0;
+    }
+
+    /**
+     * Feed input, return false on syntax error
+     */
+    bool feed(const uint8_t *data, size_t len) {
+        for (size_t i = 0; i < len && state != S_ERROR; i++) {
+            if (!step(data[i])) {
+                state = S_ERROR;
+            }
+            offset++;
+        }
+        return state != S_ERROR;
+    }
+
+    /**
+     * Signal end of input, return true if a complete document was parsed
+     */
+    bool finish() {
+        if (state == S_NUMBER) {
+            flushNumber();
+        }
+        return state == S_DONE;
+    }
+
+    size_t errorOffset() const { return offset; }
+
+private:
+    enum State : uint8_t {
+        S_VALUE,          // Expect value
+        S_VALUE_OR_END,   // Expect value or ']' (array just opened)
+        S_KEY,            // Expect key, quoted or not
+        S_KEY_OR_END,     // Expect key or '}' (object just opened)
+        S_BARE_KEY,       // Unquoted key
+        S_COLON,
+        S_COMMA_OR_END,
+        S_STRING,
+        S_ESCAPE,
+        S_UNICODE,
+        S_NUMBER,
+        S_LITERAL,
+        S_DONE,
+        S_ERROR
+    };
+
+    bool inObject() const { return containers & (1 << (depth - 1)); }
+
+    // Characters of unquoted keys, as ArduinoJson allows them
+    static bool isBareKeyChar(uint8_t c) { return isalnum(c) || c == '_' || c == '-' || c == '.' || c == '+'; }
+
+    bool step(uint8_t c) {
+        switch (state) {
+            case S_STRING:
+                if (c == quote) {
+                    return endString();
+                }
+                if (c == '\\') {
+                    state = S_ESCAPE;
+                    return true;
+                }
+                if (c < 0x20) {
+                    return false;
+                }
+                putChar(c);
+                return true;
+
+            case S_ESCAPE:
+                state = S_STRING;
+                switch (c) {
+                    case 'b':
+                        putChar('\b');
+                        return true;
+                    case 'f':
+                        putChar('\f');
+                        return true;
+                    case 'n':
+                        putChar('\n');
+                        return true;
+                    case 'r':
+                        putChar('\r');
+                        return true;
+                    case 't':
+                        putChar('\t');
+                        return true;
+                    case 'u':
+                        state = S_UNICODE;
+                        unicode = 0;
+                        hexDigits = 0;
+                        return true;
+                    case '"':
+                    case '\'':
+                    case '\\':
+                    case '/':
+                        putChar(c);
+                        return true;
+                    default:
+                        return false;
+                }
+
+            case S_UNICODE: {
+                int8_t d = isdigit(c) ? c - '0' : (isxdigit(c) ? (c | 0x20) - 'a' + 10 : -1);
+                if (d < 0) {
+                    return false;
+                }
+                unicode = (unicode << 4) | d;
+                if (++hexDigits == 4) {
+                    putUtf8(unicode);
+                    state = S_STRING;
+                }
+                return true;
+            }
+
+            case S_NUMBER:
+                if (isdigit(c) || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E') {
+                    if (scratchLen >= CMD_SCRATCH_SIZE) {
+                        return false;
+                    }
+                    scratch[scratchLen++] = c;
+                    return true;
+                }
+                if (!flushNumber()) {
+                    return false;
+                }
+                return step(c); // Character ends number, process it
+
+            case S_BARE_KEY:
+                if (isBareKeyChar(c)) {
+                    putChar(c);
+                    return true;
+                }
+                endString();
+                return step(c); // Character ends key, process it
+
+            case S_LITERAL:
+                if (c != literal[scratchLen]) {
+                    return false;
+                }
+                if (literal[++scratchLen] == 0) {
+                    CmdValue v = event(literal[0] == 'n' ? CMD_NULL : CMD_BOOL);
+                    v.boolean = literal[0] == 't';
+                    sink.value(v);
+                    return afterValue();
+                }
+                return true;
+
+            default:
+                break;
+        }
+
+        if (isspace(c)) {
+            return true;
+        }
+
+        switch (state) {
+            case S_VALUE_OR_END:
+                if (c == ']') {
+                    return close(false);
+                }
+                // fall through
+            case S_VALUE:
+                return beginValue(c);
+
+            case S_KEY_OR_END:
+                if (c == '}') {
+                    return close(true);
+                }
+                // fall through
+            case S_KEY:
+                inKey = true;
+                keyLen = 0;
+                if (c == '"' || c == '\'') {
+                    quote = c;
+                    state = S_STRING;
+                    return true;
+                }
+                if (!isBareKeyChar(c)) {
+                    return false;
+                }
+                putChar(c);
+                state = S_BARE_KEY;
+                return true;
+
+            case S_COLON:
+                if (c != ':') {
+                    return false;
+                }
+                state = S_VALUE;
+                return true;
+
+            case S_COMMA_OR_END:
+                if (c == ',') {
+                    state = inObject() ? S_KEY : S_VALUE;
+                    if (!inObject()) {
+                        key[0] = 0;
+                    }
+                    return true;
+                }
+                if (c == '}' || c == ']') {
+                    return close(c == '}');
+                }
+                return false;
+
+            default:
+                return false; // Trailing garbage or previous error
+        }
+    }
+
+    bool beginValue(uint8_t c) {
+        switch (c) {
+            case '{':
+            case '[':
+                if (depth == CMD_MAX_DEPTH) {
+                    return false;
+                }
+                sink.value(event(c == '{' ? CMD_OBJECT : CMD_ARRAY));
+                if (c == '{') {
+                    containers |= 1 << depth;
+                } else {
+                    containers &= ~(1 << depth);
+                }
+                depth++;
+                key[0] = 0;
+                state = c == '{' ? S_KEY_OR_END : S_VALUE_OR_END;
+                return true;
+            case '"':
+            case '\'':
+                quote = c;
+                inKey = false;
+                first = true;
+                scratchLen = 0;
+                state = S_STRING;
+                return true;
+            case 't':
+                literal = "true";
+                break;
+            case 'f':
+                literal = "false";
+                break;
+            case 'n':
+                literal = "null";
+                break;
+            default:
+                if (!isdigit(c) && c != '-') {
+                    return false;
+                }
+                scratch[0] = c;
+                scratchLen = 1;
+                state = S_NUMBER;
+                return true;
+        }
+        scratchLen = 1;
+        state = S_LITERAL;
+        return true;
+    }
+
+    bool close(bool object) {
+        if (!depth || inObject() != object) {
+            return false;
+        }
+        depth--;
+        key[0] = 0;
+        CmdValue v = event(CMD_END);
+        v.offset++;
+        sink.value(v);
+        return afterValue();
+    }
+
+    bool afterValue() {
+        state = depth ? S_COMMA_OR_END : S_DONE;
+        return true;
+    }
+
+    void putChar(uint8_t c) {
+        if (inKey) {
+            if (keyLen < CMD_KEY_SIZE - 1) {
+                key[keyLen++] = c;
+            } else {
+                keyLen = CMD_KEY_SIZE; // Too long, matches no known key
+            }
+            return;
+        }
+        if (scratchLen == CMD_SCRATCH_SIZE) {
+            flushString(false);
+        }
+        scratch[scratchLen++] = c;
+    }
+
+    void putUtf8(uint16_t u) {
+        if (u < 0x80) {
+            putChar(u);
+        } else if (u < 0x800) {
+            putChar(0xC0 | (u >> 6));
+            putChar(0x80 | (u & 0x3F));
+        } else {
+            putChar(0xE0 | (u >> 12));
+            putChar(0x80 | ((u >> 6) & 0x3F));
+            putChar(0x80 | (u & 0x3F));
+        }
+    }
+
+    void flushString(bool last) {
+        CmdValue v = event(CMD_STRING);
+        v.str = scratch;
+        v.len = scratchLen;
+        v.first = first;
+        v.last = last;
+        sink.value(v);
+        first = false;
+        scratchLen = 0;
+    }
+
+    bool endString() {
+        if (inKey) {
+            key[keyLen < CMD_KEY_SIZE ? keyLen : 0] = 0;
+            if (keyLen == CMD_KEY_SIZE) {
+                strcpy(key, "?");
+            }
+            inKey = false;
+            state = S_COLON;
+            return true;
+        }
+        flushString(true);
+        return afterValue();
+    }
+
+    bool flushNumber() {
+        CmdValue v = event(CMD_NUMBER);
+        v.str = scratch;
+        v.len = scratchLen;
+        sink.value(v);
+        return afterValue();
+    }
+
+    CmdValue event(CmdValueType type) {
+        CmdValue v;
+        v.type = type;
+        v.depth = depth;
+        v.key = key;
+        v.str = scratch;
+        v.len = 0;
+        v.first = true;
+        v.last = true;
+        v.boolean = false;
+        v.offset = offset;
+        return v;
+    }
+
+    Sink &sink;
+    State state = S_VALUE;
+    uint8_t depth = 0;
+    uint8_t containers = 0; // Bit set: object, bit clear: array, one bit per depth
+    size_t offset = 0;
+
+    char key[CMD_KEY_SIZE];
+    uint8_t keyLen = 0;
+    bool inKey = false;
+    uint8_t quote = '"'; // Quote ending the string being read
+
+    char scratch[CMD_SCRATCH_SIZE];
+    uint8_t scratchLen = 0;
+    bool first = true;
+
+    const char *literal = nullptr;
+    uint16_t unicode = 0;
+    uint8_t hexDigits = 0;
+};
+
+/**
+ * Push MessagePack scanner
+ *
+ * Same contract as JsonScanner: input in pieces of any size, fixed memory,
+ * values reported to sink.value(const CmdValue &). Numbers are reported as
+ * text, binaries as strings, extension types are skipped.
+ */
+template<typename Sink>
+class MsgPackScanner {
+public:
+    explicit MsgPackScanner(Sink &sink) : sink(sink) { reset(); }
+
+    void reset() {
+        state = S_HEADER;
+        depth = 0;
+        offset = 0;
+        key[0] = 0;
+    }
+
+    bool feed(const uint8_t *data, size_t len) {
+        for (size_t i = 0; i < len && state != S_ERROR; i++) {
+            if (!step(data[i])) {
+                state = S_ERROR;
+            }
+            offset++;
+        }
+        return state != S_ERROR;
+    }
+
+    bool finish() { return state == S_DONE; }
+
+    size_t errorOffset() const { return offset; }
+
+private:
+    enum State : uint8_t {
+        S_HEADER, // Expect type byte
+        S_FIXED,  // Collect big endian length or number bytes
+        S_STRING,
+        S_SKIP,
+        S_DONE,
+        S_ERROR
+    };
+
+    // What the collected fixed bytes are
+    enum Pending : uint8_t {
+        P_UINT,
+        P_INT,
+        P_FLOAT,
+        P_DOUBLE,
+        P_STR_LEN,
+        P_ARRAY_LEN,
+        P_MAP_LEN,
+        P_SKIP_LEN
+    };
+
+    struct Level {
+        uint32_t remaining; // Items left, map members count twice (key and value)
+        bool map;
+    };
+
+    bool atKey() const { return depth && stack[depth - 1].map && (stack[depth - 1].remaining & 1) == 0; }
+
+    bool step(uint8_t c) {
+        switch (state) {
+            case S_HEADER:
+                return header(c);
+            case S_FIXED:
+                fixed = (fixed << 8) | c;
+                return --need ? true : fixedDone();
+            case S_STRING:
+                putChar(c);
+                return --need ? true : endString();
+            case S_SKIP:
+                return --need ? true : afterValue();
+            default:
+                return false;
+        }
+    }
+
+    bool header(uint8_t c) {
+        valueStart = offset;
+        if (c <= 0x7F) {
+            return number(c, false);
+        }
+        if (c >= 0xE0) {
+            return number((int8_t)c, true);
+        }
+        if ((c & 0xF0) == 0x80) {
+            return beginContainer(c & 0x0F, true);
+        }
+        if ((c & 0xF0) == 0x90) {
+            return beginContainer(c & 0x0F, false);
+        }
+        if ((c & 0xE0) == 0xA0) {
+            return beginString(c & 0x1F);
+        }
+        switch (c) {
+            case 0xC0:
+            case 0xC2:
+            case 0xC3: {
+                if (atKey()) {
+                    return unknownKey();
+                }
+                CmdValue v = event(c == 0xC0 ? CMD_NULL : CMD_BOOL);
+                v.boolean = c == 0xC3;
+                sink.value(v);
+                return afterValue();
+            }
+            case 0xC4:
+            case 0xD9:
+                return collect(1, P_STR_LEN);
+            case 0xC5:
+            case 0xDA:
+                return collect(2, P_STR_LEN);
+            case 0xC6:
+            case 0xDB:
+                return collect(4, P_STR_LEN);
+            case 0xC7:
+                return collect(1, P_SKIP_LEN, 1);
+            case 0xC8:
+                return collect(2, P_SKIP_LEN, 1);
+            case 0xC9:
+                return collect(4, P_SKIP_LEN, 1);
+            case 0xCA:
+                return collect(4, P_FLOAT);
+            case 0xCB:
+                return collect(8, P_DOUBLE);
+            case 0xCC:
+            case 0xCD:
+            case 0xCE:
+            case 0xCF:
+                return collect(1 << (c - 0xCC), P_UINT);
+            case 0xD0:
+            case 0xD1:
+            case 0xD2:
+            case 0xD3:
+                return collect(1 << (c - 0xD0), P_INT);
+            case 0xD4:
+            case 0xD5:
+            case 0xD6:
+            case 0xD7:
+            case 0xD8:
+                return skip(1 + (1 << (c - 0xD4)));
+            case 0xDC:
+                return collect(2, P_ARRAY_LEN);
+            case 0xDD:
+                return collect(4, P_ARRAY_LEN);
+            case 0xDE:
+                return collect(2, P_MAP_LEN);
+            case 0xDF:
+                return collect(4, P_MAP_LEN);
+            default:
+                return false; // 0xC1 is never used
+        }
+    }
+
+    bool collect(uint8_t n, Pending p, uint8_t extra = 0) {
+        fixed = 0;
+        need = n;
+        pending = p;
+        skipExtra = extra;
+        intWidth = n;
+        state = S_FIXED;
+        return true;
+    }
+
+    bool fixedDone() {
+        switch (pending) {
+            case P_UINT:
+                return number(fixed, false);
+            case P_INT: {
+                // Sign extend from collected width
+                uint8_t bits = 64 - 8 * intWidth;
+                return number((int64_t)(fixed << bits) >> bits, true);
+            }
+            case P_FLOAT: {
+                uint32_t u = fixed;
+                float f;
+                memcpy(&f, &u, sizeof(f));
+                return real(f);
+            }
+            case P_DOUBLE: {
+                double d;
+                memcpy(&d, &fixed, sizeof(d));
+                return real(d);
+            }
+            case P_STR_LEN:
+                return beginString(fixed);
+            case P_ARRAY_LEN:
+                return beginContainer(fixed, false);
+            case P_MAP_LEN:
+                return beginContainer(fixed, true);
+            case P_SKIP_LEN:
+                return skip(fixed + skipExtra);
+        }
+        return false;
+    }
+
+    bool number(int64_t n, bool isSigned) {
+        if (atKey()) {
+            return unknownKey();
+        }
+        // printf has no 64-bit conversions on every core, format by hand
+        char buf[24];
+        char *p = buf + sizeof(buf) - 1;
+        bool negative = isSigned && n < 0;
+        uint64_t u = negative ? 0 - (uint64_t)n : (uint64_t)n;
+        *p = 0;
+        do {
+            *--p = '0' + u % 10;
+            u /= 10;
+        } while (u);
+        if (negative) {
+            *--p = '-';
+        }
+        return emitNumber(p);
+    }
+
+    bool real(double d) {
+        if (atKey()) {
+            return unknownKey();
+        }
+        char buf[24];
+        dtostrf(d, 1, 6, buf);
+        return emitNumber(buf);
+    }
+
+    bool emitNumber(const char *text) {
+        CmdValue v = event(CMD_NUMBER);
+        v.str = text;
+        v.len = strlen(text);
+        sink.value(v);
+        return afterValue();
+    }
+
+    bool beginString(uint32_t len) {
+        inKey = atKey();
+        if (inKey) {
+            keyLen = 0;
+        }
+        first = true;
+        scratchLen = 0;
+        need = len;
+        if (!len) {
+            return endString();
+        }
+        state = S_STRING;
+        return true;
+    }
+
+    void putChar(uint8_t c) {
+        if (inKey) {
+            if (keyLen < CMD_KEY_SIZE - 1) {
+                key[keyLen++] = c;
+            } else {
+                keyLen = CMD_KEY_SIZE;
+            }
+            return;
+        }
+        if (scratchLen == CMD_SCRATCH_SIZE) {
+            flushString(false);
+        }
+        scratch[scratchLen++] = c;
+    }
+
+    void flushString(bool last) {
+        CmdValue v = event(CMD_STRING);
+        v.str = scratch;
+        v.len = scratchLen;
+        v.first = first;
+        v.last = last;
+        sink.value(v);
+        first = false;
+        scratchLen = 0;
+    }
+
+    bool endString() {
+        if (inKey) {
+            inKey = false;
+            if (keyLen == CMD_KEY_SIZE) {
+                strcpy(key, "?");
+            } else {
+                key[keyLen] = 0;
+            }
+            return afterValue();
+        }
+        flushString(true);
+        return afterValue();
+    }
+
+    bool unknownKey() {
+        strcpy(key, "?");
+        return afterValue();
+    }
+
+    bool skip(uint32_t n) {
+        if (!n) {
+            return afterValue();
+        }
+        need = n;
+        state = S_SKIP;
+        return true;
+    }
+
+    bool beginContainer(uint32_t count, bool map) {
+        if (depth == CMD_MAX_DEPTH || (map && count > UINT32_MAX / 2)) {
+            return false;
+        }
+        if (atKey()) {
+            return false; // Containers as map keys are not supported
+        }
+        CmdValue v = event(map ? CMD_OBJECT : CMD_ARRAY);
+        v.offset = valueStart;
+        sink.value(v);
+        stack[depth].remaining = map ? count * 2 : count;
+        stack[depth].map = map;
+        depth++;
+        key[0] = 0;
+        state = S_HEADER;
+        return closeFinished();
+    }
+
+    bool afterValue() {
+        state = S_HEADER;
+        if (!depth) {
+            state = S_DONE;
+            return true;
+        }
+        stack[depth - 1].remaining--;
+        return closeFinished();
+    }
+
+    bool closeFinished() {
+        while (depth && stack[depth - 1].remaining == 0) {
+            depth--;
+            key[0] = 0;
+            CmdValue v = event(CMD_END);
+            v.offset++;
+            sink.value(v);
+            if (!depth) {
+                state = S_DONE;
+                return true;
+            }
+            stack[depth - 1].remaining--;
+        }
+        if (depth && !stack[depth - 1].map) {
+            key[0] = 0;
+        }
+        return true;
+    }
+
+    CmdValue event(CmdValueType type) {
+        CmdValue v;
+        v.type = type;
+        v.depth = depth;
+        v.key = key;
+        v.str = scratch;
+        v.len = 0;
+        v.first = true;
+        v.last = true;
+        v.boolean = false;
+        v.offset = offset;
+        return v;
+    }
+
+    Sink &sink;
+    State state = S_HEADER;
+    Level stack[CMD_MAX_DEPTH];
+    uint8_t depth = 0;
+    size_t offset = 0;
+    size_t valueStart = 0; // Offset of current value type byte
+
+    uint64_t fixed = 0;
+    uint32_t need = 0;
+    Pending pending = P_UINT;
+    uint8_t skipExtra = 0; // Ext type byte to skip after the data length
+    uint8_t intWidth = 0;  // Byte count of signed integer being collected
+
+    char key[CMD_KEY_SIZE];
+    uint8_t keyLen = 0;
+    bool inKey = false;
+
+    char scratch[CMD_SCRATCH_SIZE];
+    uint8_t scratchLen = 0;
+    bool first = true;
+};
+
+#endif //ESPARKLE_CMDPARSER_H
@@ -0,0 +1,199 @@
+#ifndef ESPARKLE_CMDTRACE_H
+#define ESPARKLE_CMDTRACE_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include "loopprof.h"
+
+#define TRACE_HEADER_SIZE 6    // Offset from recording start (ms, 32 bit), payload length (16 bit), little endian
+#define TRACE_SETTLE_MS   10000 // Replay ends this long after the last command, if its audio didn't start
+
+// Outcome of a replayed command
+struct TraceResult {
+    uint16_t n;             // Command number in the trace, from 1
+    const char *label;      // Command kind, see cmdLabel()
+    uint32_t dispatchUs;    // Parse and execution time
+    uint32_t firstSampleUs; // Time from command to first audio sample of the clip it started, 0 if none
+};
+
+struct ReplayStats {
+    uint16_t commands;
+    ProfHist dispatch;
+    ProfHist firstSample;
+    uint32_t maxLateMs;   // Lag behind recorded timing
+    uint32_t minFreeHeap;
+    uint16_t minMaxBlock;
+};
+
+/**
+ * Command trace recorder and player
+ *
+ * Commands are recorded as received, with their time offset, then replayed at the
+ * same pace through the same dispatcher, to measure the notification path on real
+ * traffic. The first audio sample following a replayed command is credited to it.
+ */
+class CmdTrace {
+public:
+    bool startRecording(File file) {
+        stop();
+        f = file;
+        if (!f) {
+            return false;
+        }
+        mode = MODE_RECORDING;
+        startMs = millis();
+        count = 0;
+        return true;
+    }
+
+    void record(const uint8_t *payload, size_t len) {
+        if (mode != MODE_RECORDING) {
+            return;
+        }
+        uint32_t at = millis() - startMs;
+        const uint8_t header[TRACE_HEADER_SIZE] = {(uint8_t)at, (uint8_t)(at >> 8), (uint8_t)(at >> 16), (uint8_t)(at >> 24),
+                                                   (uint8_t)len, (uint8_t)(len >> 8)};
+        f.write(header, sizeof(header));
+        f.write(payload, len);
+        count++;
+    }
+
+    bool startReplay(File file) {
+        stop();
+        f = file;
+        if (!f) {
+            return false;
+        }
+        mode = MODE_REPLAYING;
+        startMs = millis();
+        stats = {};
+        stats.minFreeHeap = UINT32_MAX;
+        stats.minMaxBlock = UINT16_MAX;
+        current = {};
+        reported = true;
+        haveNext = readHeader();
+        return haveNext;
+    }
+
+    /**
+     * Copy next command into buf if it's due, return its length, 0 if none is
+     * Commands longer than size are skipped
+     */
+    size_t due(uint32_t now, uint8_t *buf, size_t size) {
+        while (mode == MODE_REPLAYING && haveNext && (int32_t)(now - startMs - nextAt) >= 0) {
+            stats.maxLateMs = max(stats.maxLateMs, now - startMs - nextAt);
+            size_t len = nextLen;
+            size_t n = len <= size ? f.read(buf, len) : 0;
+            if (len > size) {
+                f.seek(len, SeekCur);
+            }
+            haveNext = readHeader();
+            if (n == len) {
+                return n;
+            }
+        }
+        return 0;
+    }
+
+    // Call right after a replayed command ran
+    void dispatched(const char *label, uint32_t startUs, uint32_t endUs) {
+        current.n = ++stats.commands;
+        current.label = label;
+        current.dispatchUs = endUs - startUs;
+        current.firstSampleUs = 0;
+        reported = false;
+        cmdUs = startUs;
+        lastMs = millis();
+        stats.dispatch.add(current.dispatchUs);
+    }
+
+    // Call when a new clip outputs its first sample
+    void firstSample(uint32_t nowUs) {
+        if (mode == MODE_REPLAYING && !reported && !current.firstSampleUs) {
+            current.firstSampleUs = max<uint32_t>(1, nowUs - cmdUs);
+            stats.firstSample.add(current.firstSampleUs);
+        }
+    }
+
+    // Call when a clip starts on a mixer input, then clipFrames() until its first frame is out
+    void clipStarted(uint8_t input) { clips |= 1 << input; }
+
+    void clipFrames(uint8_t input, uint32_t frames) {
+        if ((clips & 1 << input) && frames) {
+            clips &= ~(1 << input);
+            firstSample(micros());
+        }
+    }
+
+    void sampleHeap(uint32_t freeHeap, uint16_t maxBlock) {
+        stats.minFreeHeap = min(stats.minFreeHeap, freeHeap);
+        stats.minMaxBlock = min(stats.minMaxBlock, maxBlock);
+    }
+
+    /**
+     * Outcome of last replayed command, once: when its audio started, or when forced
+     * (next command, end of replay)
+     */
+    bool result(TraceResult &r, bool force) {
+        if (reported || (!force && !current.firstSampleUs)) {
+            return false;
+        }
+        r = current;
+        reported = true;
+        return true;
+    }
+
+    // No more command, and last one is done or given up
+    bool replayDone(uint32_t now) const {
+        return mode == MODE_REPLAYING && !haveNext && (reported || current.firstSampleUs || now - lastMs >= TRACE_SETTLE_MS);
+    }
+
+    void stop() {
+        f.close();
+        mode = MODE_IDLE;
+    }
+
+    bool recording() const { return mode == MODE_RECORDING; }
+
+    bool replaying() const { return mode == MODE_REPLAYING; }
+
+    // Commands recorded
+    uint16_t recorded() const { return count; }
+
+    const ReplayStats &replayStats() const { return stats; }
+
+private:
+    enum Mode : uint8_t {
+        MODE_IDLE,
+        MODE_RECORDING,
+        MODE_REPLAYING
+    };
+
+    bool readHeader() {
+        uint8_t header[TRACE_HEADER_SIZE];
+        if (f.read(header, sizeof(header)) != sizeof(header)) {
+            return false;
+        }
+        nextAt = header[0] | header[1] << 8 | (uint32_t)header[2] << 16 | (uint32_t)header[3] << 24;
+        nextLen = header[4] | header[5] << 8;
+        return true;
+    }
+
+    File f;
+    Mode mode = MODE_IDLE;
+    uint32_t startMs = 0;
+    uint16_t count = 0;
+
+    bool haveNext = false;
+    uint32_t nextAt = 0;
+    uint16_t nextLen = 0;
+
+    TraceResult current = {};
+    bool reported = true;
+    uint32_t cmdUs = 0;
+    uint32_t lastMs = 0;
+    uint8_t clips = 0; // Mixer inputs waiting for the first frame of a new clip
+    ReplayStats stats = {};
+};
+
+#endif //ESPARKLE_CMDTRACE_H
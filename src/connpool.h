@@ -0,0 +1,609 @@
+#ifndef ESPARKLE_CONNPOOL_H
+#define ESPARKLE_CONNPOOL_H
+
+#include <ESP8266HTTPClient.h>
+#include <ESP8266WiFi.h>
+#include <lwip/dns.h>
+#include <lwip/tcp.h>
+#include <include/ClientContext.h>
+
+#define CONN_HOST_SIZE       64
+#define CONN_DNS_SIZE        4    // Cached host names
+#define CONN_IDLE_SIZE       2    // Kept-alive connections waiting for a request
+#define CONN_CONNECT_MS      2000 // TCP handshake timeout
+#define CONN_HEAD_TIMEOUT_MS 5000 // Max wait for a response head
+
+/**
+ * Split http://host[:port]/path URL, return path ("/" if none), host is truncated to size
+ */
+inline const char *splitUrl(const char *url, char *host, size_t size, uint16_t &port) {
+    const char *p = strstr(url, "://");
+    p = p ? p + 3 : url;
+
+    const char *slash = strchr(p, '/');
+    size_t hostLen = slash ? slash - p : strlen(p);
+
+    port = 80;
+    const char *colon = (const char *)memchr(p, ':', hostLen);
+    if (colon) {
+        port = atoi(colon + 1);
+        hostLen = colon - p;
+    }
+    if (hostLen >= size) {
+        hostLen = size - 1;
+    }
+    memcpy(host, p, hostLen);
+    host[hostLen] = 0;
+    return slash ? slash : "/";
+}
+
+/**
+ * Incremental HTTP response head parser, fed byte by byte
+ */
+class HttpHead {
+public:
+    void begin() {
+        status = 0;
+        length = 0;
+        keepAlive = false;
+        audio = false;
+        lineLen = 0;
+    }
+
+    // Return true once the blank line ending the head is read
+    bool feed(char c) {
+        if (c == '\r') {
+            return false;
+        }
+        if (c != '\n') {
+            if (lineLen < sizeof(line) - 1) {
+                line[lineLen++] = c;
+            }
+            return false;
+        }
+        line[lineLen] = 0;
+        if (lineLen == 0) {
+            return true;
+        }
+        lineLen = 0;
+        if (status == 0 && strncmp("HTTP/", line, 5) == 0) {
+            const char *sp = strchr(line, ' ');
+            status = sp ? atoi(sp + 1) : -3;
+        } else if (strncasecmp_P(line, PSTR("Content-Type: audio/"), 20) == 0) {
+            audio = true;
+        } else if (strncasecmp_P(line, PSTR("Content-Length:"), 15) == 0) {
+            length = atol(line + 15);
+        } else if (strncasecmp_P(line, PSTR("Connection: keep-alive"), 22) == 0) {
+            keepAlive = true;
+        }
+        return false;
+    }
+
+    // Connection can carry a next request once length bytes of body are read
+    bool reusable() const { return keepAlive && length; }
+
+    int status = 0;      // 0 until status line is read
+    uint32_t length = 0; // Content-Length, 0 if none
+    bool keepAlive = false;
+    bool audio = false;  // Content-Type audio/*
+
+private:
+    char line[128];
+    size_t lineLen = 0;
+};
+
+struct ConnPoolStats {
+    uint32_t lookups;        // Host names resolved...
+    uint32_t dnsHits;        // ...from cache
+    uint32_t dnsMs;          // Time spent resolving, total
+    uint32_t connects;       // New TCP connections...
+    uint32_t connectMs;      // ...time spent connecting, total
+    uint32_t reused;         // Requests sent over a kept-alive connection
+    uint32_t failures;
+    uint32_t resumes;        // Streams requested again from where they were cut...
+    uint32_t resumeFailures; // ...or not, server or network failing
+};
+
+/**
+ * Resolved addresses cache and kept-alive connections, shared by HTTP clients
+ *
+ * Requests are HTTP/1.0 with "Connection: keep-alive": the server either keeps
+ * the connection and sends a Content-Length, or closes it at the end of the body,
+ * never a chunked body. lwIP doesn't expose DNS TTLs, names are kept dnsTtlMs.
+ * Idle connections are dropped after idleMs, below usual server keep-alive
+ * timeouts, as a request on a connection the server is closing is lost.
+ */
+class ConnPool {
+public:
+    ConnPool(uint32_t dnsTtlMs, uint32_t idleMs) : dnsTtlMs(dnsTtlMs), idleMs(idleMs) {}
+
+    /**
+     * Resolve host without blocking, lwIP calls back when the name server answers
+     * Return 1 once resolved, 0 while the lookup is under way (call again), -1 on failure
+     * One lookup at a time, another host waits for the current one
+     */
+    int8_t resolveAsync(const char *host, IPAddress &ip) {
+        if (lookup.state == LOOKUP_PENDING && strcmp(lookup.host, host) != 0) {
+            return 0;
+        }
+        if (lookup.state == LOOKUP_IDLE || strcmp(lookup.host, host) != 0) {
+            // Result left over by a cancelled request is dropped
+            lookup.state = LOOKUP_IDLE;
+            if (ip.fromString(host) || cached(host, ip)) {
+                return 1;
+            }
+            strlcpy(lookup.host, host, sizeof(lookup.host));
+            lookup.startMs = millis();
+            lookup.state = LOOKUP_PENDING;
+            ip_addr_t addr;
+            err_t err = dns_gethostbyname(lookup.host, &addr, dnsFound, this);
+            if (err == ERR_OK) {
+                dnsFound(lookup.host, &addr, this);
+            } else if (err != ERR_INPROGRESS) {
+                dnsFound(lookup.host, nullptr, this);
+            }
+        }
+        if (lookup.state == LOOKUP_PENDING) {
+            return 0;
+        }
+        bool found = lookup.state == LOOKUP_FOUND;
+        lookup.state = LOOKUP_IDLE;
+        if (!found) {
+            stat.failures++;
+            return -1;
+        }
+        ip = lookup.ip;
+        stat.dnsMs += millis() - lookup.startMs;
+        remember(host, ip);
+        return 1;
+    }
+
+    /**
+     * Connect client to resolved host without blocking, over an idle kept-alive connection unless fresh
+     * reused tells which, a failed request on a reused one is worth a fresh retry
+     * Return 1 once connected, 0 while the handshake is under way (call again), -1 on failure
+     * One handshake at a time, another host waits for the current one
+     *
+     * WiFiClient::connect() waits for the handshake, so it's made on a raw lwIP pcb,
+     * then handed to a WiFiClient once established.
+     */
+    int8_t acquireAsync(const IPAddress &ip, uint16_t port, WiFiClient &client, bool &reused, bool fresh) {
+        reused = false;
+        if (!fresh) {
+            for (Idle &c : idle) {
+                if (c.used && c.ip == ip && c.port == port) {
+                    WiFiClient parked = c.client;
+                    uint32_t sinceMs = c.sinceMs;
+                    drop(c, false);
+                    if (millis() - sinceMs < idleMs && parked.connected() && !parked.available()) {
+                        client = parked;
+                        stat.reused++;
+                        reused = true;
+                        return 1;
+                    }
+                    parked.stop();
+                }
+            }
+        }
+        bool same = handshake.ip == ip && handshake.port == port;
+        if (handshake.state == HANDSHAKE_PENDING && !same) {
+            return 0;
+        }
+        if (handshake.state == HANDSHAKE_IDLE || !same) {
+            // Connection left over by a cancelled request is closed
+            dropHandshake();
+            if (!startConnect(ip, port)) {
+                stat.failures++;
+                return -1;
+            }
+        }
+        if (handshake.state == HANDSHAKE_PENDING) {
+            if (millis() - handshake.startMs < CONN_CONNECT_MS) {
+                return 0;
+            }
+            dropHandshake();
+            stat.failures++;
+            return -1;
+        }
+        if (handshake.state == HANDSHAKE_FAILED) {
+            handshake.state = HANDSHAKE_IDLE;
+            stat.failures++;
+            return -1;
+        }
+        client = PcbClient(handshake.ctx);
+        handshake.ctx->unref();
+        handshake.ctx = nullptr;
+        handshake.state = HANDSHAKE_IDLE;
+        client.setNoDelay(true);
+        stat.connects++;
+        stat.connectMs += millis() - handshake.startMs;
+        return 1;
+    }
+
+    // Drop the handshake to ip:port under way or not taken yet, its request was cancelled
+    void cancelConnect(const IPAddress &ip, uint16_t port) {
+        if (handshake.state != HANDSHAKE_IDLE && handshake.ip == ip && handshake.port == port) {
+            dropHandshake();
+        }
+    }
+
+    /**
+     * Park a connection whose response was completely read, for the next request
+     */
+    void release(WiFiClient &client) {
+        if (!client.connected() || client.available()) {
+            client.stop();
+            return;
+        }
+        Idle *slot = &idle[0];
+        for (Idle &c : idle) {
+            if (!c.used) {
+                slot = &c;
+                break;
+            }
+            if ((int32_t)(c.sinceMs - slot->sinceMs) < 0) {
+                slot = &c;
+            }
+        }
+        drop(*slot, true);
+        slot->client = client;
+        slot->ip = client.remoteIP();
+        slot->port = client.remotePort();
+        slot->sinceMs = millis();
+        slot->used = true;
+        client = WiFiClient();
+    }
+
+    // Write a GET request for path, from a byte offset if from isn't 0
+    static void sendGet(WiFiClient &client, const char *host, const char *path, uint32_t from) {
+        client.printf_P(PSTR("GET %s HTTP/1.0\r\n"
+                             "Host: %s\r\n"
+                             "Connection: keep-alive\r\n"), path, host);
+        if (from) {
+            client.printf_P(PSTR("Range: bytes=%u-\r\n"), (unsigned)from);
+        }
+        client.print(F("\r\n"));
+    }
+
+    // Close idle connections, e.g. when WiFi is lost
+    void flush() {
+        for (Idle &c : idle) {
+            drop(c, true);
+        }
+        dropHandshake();
+    }
+
+    const ConnPoolStats &stats() const { return stat; }
+
+    // Estimated time saved by cached names and reused connections
+    uint32_t savedMs() const {
+        uint32_t resolved = stat.lookups - stat.dnsHits;
+        uint32_t saved = resolved ? stat.dnsHits * (stat.dnsMs / resolved) : 0;
+        return saved + (stat.connects ? stat.reused * (stat.connectMs / stat.connects) : 0);
+    }
+
+private:
+    friend class HttpGet;
+
+    enum LookupState : uint8_t {
+        LOOKUP_IDLE,
+        LOOKUP_PENDING,
+        LOOKUP_FOUND,
+        LOOKUP_FAILED
+    };
+
+    // Fresh cached address of host
+    bool cached(const char *host, IPAddress &ip) {
+        stat.lookups++;
+        for (DnsEntry &e : names) {
+            if (e.expiresMs && (int32_t)(millis() - e.expiresMs) < 0 && strcmp(e.host, host) == 0) {
+                stat.dnsHits++;
+                ip = e.ip;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void remember(const char *host, const IPAddress &ip) {
+        // Replace same host, or first expired, or oldest entry
+        DnsEntry *slot = &names[0];
+        for (DnsEntry &e : names) {
+            if (strcmp(e.host, host) == 0 || !e.expiresMs) {
+                slot = &e;
+                break;
+            }
+            if ((int32_t)(e.expiresMs - slot->expiresMs) < 0) {
+                slot = &e;
+            }
+        }
+        strlcpy(slot->host, host, sizeof(slot->host));
+        slot->ip = ip;
+        slot->expiresMs = millis() + dnsTtlMs;
+        if (!slot->expiresMs) {
+            slot->expiresMs = 1;
+        }
+    }
+
+    enum HandshakeState : uint8_t {
+        HANDSHAKE_IDLE,
+        HANDSHAKE_PENDING,
+        HANDSHAKE_DONE,
+        HANDSHAKE_FAILED
+    };
+
+    // WiFiClient over an established connection, as WiFiServer makes them
+    class PcbClient : public WiFiClient {
+    public:
+        explicit PcbClient(ClientContext *ctx) : WiFiClient(ctx) {}
+    };
+
+    void dropHandshake() {
+        if (handshake.pcb) {
+            tcp_arg(handshake.pcb, nullptr);
+            tcp_err(handshake.pcb, nullptr);
+            tcp_abort(handshake.pcb);
+            handshake.pcb = nullptr;
+        }
+        if (handshake.ctx) {
+            handshake.ctx->unref(); // Last reference, closes it
+            handshake.ctx = nullptr;
+        }
+        handshake.state = HANDSHAKE_IDLE;
+    }
+
+    bool startConnect(const IPAddress &ip, uint16_t port) {
+        tcp_pcb *pcb = tcp_new();
+        if (!pcb) {
+            return false;
+        }
+        handshake.ip = ip;
+        handshake.port = port;
+        handshake.startMs = millis();
+        handshake.pcb = pcb;
+        handshake.state = HANDSHAKE_PENDING;
+        tcp_arg(pcb, this);
+        tcp_err(pcb, tcpError);
+        if (tcp_connect(pcb, ip, port, tcpConnected) != ERR_OK) {
+            dropHandshake();
+            return false;
+        }
+        return true;
+    }
+
+    // lwIP callbacks of the handshake: the context takes the pcb over once established
+    static err_t tcpConnected(void *arg, tcp_pcb *pcb, err_t) {
+        ConnPool *pool = (ConnPool *)arg;
+        pool->handshake.pcb = nullptr;
+        pool->handshake.ctx = new ClientContext(pcb, nullptr, nullptr);
+        pool->handshake.ctx->ref();
+        pool->handshake.state = HANDSHAKE_DONE;
+        return ERR_OK;
+    }
+
+    // pcb is already freed
+    static void tcpError(void *arg, err_t) {
+        ConnPool *pool = (ConnPool *)arg;
+        pool->handshake.pcb = nullptr;
+        pool->handshake.state = HANDSHAKE_FAILED;
+    }
+
+    // lwIP callback, ipaddr is null if the name wasn't found
+    static void dnsFound(const char *, const ip_addr_t *ipaddr, void *arg) {
+        ConnPool *pool = (ConnPool *)arg;
+        if (pool->lookup.state != LOOKUP_PENDING) {
+            return;
+        }
+        if (ipaddr) {
+            pool->lookup.ip = IPAddress(ipaddr);
+            pool->lookup.state = LOOKUP_FOUND;
+        } else {
+            pool->lookup.state = LOOKUP_FAILED;
+        }
+    }
+
+    void resumed(bool ok) {
+        if (ok) {
+            stat.resumes++;
+        } else {
+            stat.resumeFailures++;
+        }
+    }
+
+    struct DnsEntry {
+        char host[CONN_HOST_SIZE];
+        IPAddress ip;
+        uint32_t expiresMs; // 0 for a free entry
+    };
+
+    struct Idle {
+        WiFiClient client;
+        IPAddress ip;
+        uint16_t port = 0;
+        uint32_t sinceMs = 0;
+        bool used = false;
+    };
+
+    void drop(Idle &c, bool close) {
+        if (c.used && close) {
+            c.client.stop();
+        }
+        c.client = WiFiClient();
+        c.used = false;
+    }
+
+    uint32_t dnsTtlMs;
+    uint32_t idleMs;
+    DnsEntry names[CONN_DNS_SIZE] = {};
+    Idle idle[CONN_IDLE_SIZE];
+    ConnPoolStats stat = {};
+
+    struct {
+        char host[CONN_HOST_SIZE];
+        IPAddress ip;
+        uint32_t startMs;
+        volatile LookupState state;
+    } lookup = {};
+
+    struct {
+        IPAddress ip;
+        uint16_t port;
+        uint32_t startMs;
+        tcp_pcb *pcb;       // While pending
+        ClientContext *ctx; // Once established, until taken
+        volatile HandshakeState state;
+    } handshake = {};
+};
+
+/**
+ * GET over the pool's connections, advanced one step per poll() so that the
+ * caller's loop keeps running: name lookup, connect, request, response head
+ *
+ * Kept-alive connections skip the lookup and the TCP handshake.
+ */
+class HttpGet {
+public:
+    enum State : uint8_t {
+        IDLE,
+        RESOLVE,
+        CONNECT,
+        SEND,
+        HEADERS,
+        DONE
+    };
+
+    explicit HttpGet(ConnPool &pool) : pool(pool) {}
+
+    HttpGet(const HttpGet &) = delete;
+    HttpGet &operator=(const HttpGet &) = delete;
+
+    /**
+     * Start requesting url, from a byte offset if from isn't 0 (206 if the server can)
+     * url must stay valid until the request is over
+     */
+    void start(const char *url, uint32_t from = 0) {
+        cancel();
+        path = splitUrl(url, host, sizeof(host), port);
+        offset = from;
+        code = 0;
+        fresh = false;
+        state = RESOLVE;
+    }
+
+    // Request under way, poll() it
+    bool busy() const { return state != IDLE && state != DONE; }
+
+    /**
+     * Advance request one step
+     * Return true once it's over: status() tells how, and on success take() the
+     * connection, positioned at the start of the body
+     */
+    bool poll() {
+        switch (state) {
+            case RESOLVE: {
+                int8_t found = pool.resolveAsync(host, ip);
+                if (found < 0) {
+                    return finish(-2);
+                }
+                if (found) {
+                    state = CONNECT;
+                }
+                break;
+            }
+
+            case CONNECT: {
+                int8_t connected = pool.acquireAsync(ip, port, client, reused, fresh);
+                if (connected < 0) {
+                    return finish(-2);
+                }
+                if (connected) {
+                    state = SEND;
+                }
+                break;
+            }
+
+            case SEND:
+                ConnPool::sendGet(client, host, path, offset);
+                head.begin();
+                headBytes = 0;
+                sentMs = millis();
+                state = HEADERS;
+                break;
+
+            case HEADERS:
+                while (client.available()) {
+                    headBytes++;
+                    if (head.feed(client.read())) {
+                        return finish(head.status ?: -3);
+                    }
+                }
+                if (!client.connected() || millis() - sentMs > CONN_HEAD_TIMEOUT_MS) {
+                    client.stop();
+                    if (reused && !headBytes) {
+                        // Kept-alive connection closed by the server meanwhile
+                        fresh = true;
+                        state = CONNECT;
+                        break;
+                    }
+                    pool.stat.failures++;
+                    return finish(-3);
+                }
+                break;
+
+            default:
+                break;
+        }
+        return false;
+    }
+
+    // HTTP status of the request over, negative on failure
+    int status() const { return code; }
+
+    const HttpHead &response() const { return head; }
+
+    // Hand the connection over, the request is left idle
+    WiFiClient take() {
+        WiFiClient taken = client;
+        client = WiFiClient();
+        state = IDLE;
+        return taken;
+    }
+
+    void cancel() {
+        if (state == CONNECT) {
+            pool.cancelConnect(ip, port);
+        }
+        client.stop();
+        state = IDLE;
+    }
+
+private:
+    bool finish(int status) {
+        code = status;
+        if (status < 0) {
+            client.stop();
+        }
+        if (offset) {
+            pool.resumed(status == HTTP_CODE_PARTIAL_CONTENT);
+        }
+        state = DONE;
+        return true;
+    }
+
+    ConnPool &pool;
+    WiFiClient client;
+    HttpHead head;
+    char host[CONN_HOST_SIZE] = "";
+    const char *path = "/";
+    uint16_t port = 80;
+    IPAddress ip;
+    uint32_t offset = 0;
+    uint32_t sentMs = 0;
+    uint32_t headBytes = 0;
+    int code = 0;
+    bool reused = false;
+    bool fresh = false; // Retry on a new connection
+    State state = IDLE;
+};
+
+#endif //ESPARKLE_CONNPOOL_H
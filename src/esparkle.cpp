@@ -1,50 +1,197 @@
 #include <Arduino.h>
 #include <LITTLEFS.h>
-#include <ESP8266WiFiMulti.h>
+#include <ESP8266WiFi.h>
 #include <PubSubClient.h>
-#include <ArduinoJson.h>
 #include <ArduinoOTA.h>
+#include <ESPAsyncWebServer.h>
 #include <MPU6050.h>
 #include <FastLED.h>
-#include <Ticker.h>
-#include <AudioFileSourceHTTPStream.h>
 #include <AudioFileSourceLittleFS.h>
-#include <AudioFileSourcePROGMEM.h>
-#include <AudioFileSourceBuffer.h>
-#include <AudioGeneratorRTTTL.h>
 #include <AudioGeneratorMP3.h>
+#include <AudioGeneratorWAV.h>
 #include <AudioOutputI2S.h>
+#include <i2s.h>
+#include "adpcm.h"
+#include "audiodeck.h"
+#include "audiomixer.h"
+#include "audioslot.h"
+#include "backoff.h"
+#include "clipcache.h"
+#include "clipindex.h"
+#include "connpool.h"
+#include "gesture.h"
+#include "heapmon.h"
+#include "cmdparser.h"
+#include "cmdtrace.h"
+#include "ledengine.h"
+#include "loopprof.h"
+#include "mailbox.h"
+#include "mp3probe.h"
+#include "notifqueue.h"
+#include "playlist.h"
+#include "replywriter.h"
+#include "scheduler.h"
+#include "timeline.h"
+#include "ttsclient.h"
+#include "tunes.h"
 #include "esparkle.h"
 #include "config.h"
 
+// Loop profiler, PROF(...) compiles to nothing when disabled
+#if LOOP_PROFILER
+LoopProfiler prof;
+#define PROF(call) prof.call
+#else
+#define PROF(call)
+#endif
+
+// Command trace, TRACE(...) compiles to nothing when disabled
+#if CMD_TRACE
+CmdTrace cmdTrace;
+uint8_t traceBuf[TRACE_CMD_SIZE]; // Command being replayed
+#define TRACE(call) cmdTrace.call
+#else
+#define TRACE(call)
+#endif
+
 // Misc global variables
 bool otaInProgress = false;
-bool ledActionInProgress = false;
-bool newAudioSource = false;
-volatile bool mpuInterrupt = false;
+bool wifiIsConnected = false;
+
+Scheduler<10> sched;
 
-CRGB leds[NUM_LEDS];
-int curColor;
-uint32_t curDelay;
+LedEngine<NUM_LEDS> led(LED_MAX_FPS);
 
-char audioSource[256] = "";
+char sourceBuffers[2][AUDIO_SOURCE_SIZE]; // Sources being played and prefetched, must outlive playback
+char *audioSource = sourceBuffers[0];
+char *nextSource = sourceBuffers[1];
 uint8_t msgPriority = 0;
+uint8_t curPriority = 0;
 float onceGain = 0;
 
-ESP8266WiFiMulti wifiMulti;
+ClipCache<CACHE_MAX_ENTRIES> clipCache(CACHE_BUDGET);
+#if CLIP_INDEX
+ClipIndex<CLIP_INDEX_MAX, CLIP_INDEX_POOL> clipIndex;
+#endif
+ProfHist clipOpenHist = {}; // LittleFS clips, from play request to decoder started
+NotifQueue<Notification, NOTIF_QUEUE_SIZE> notifQueue;
+uint32_t notifDrops = 0;
+uint32_t notifPreemptions = 0;
+
+Timeline<TIMELINE_SIZE, TIMELINE_POOL> timeline;
+
+HeapMon<HEAP_RING_SIZE> heapMon(HEAP_WARN_FREE, HEAP_WARN_BLOCK, HEAP_WARN_FRAG);
+
+Command cmdIn;
+File cmdSpool; // Tune being compiled from a received RTTTL song
+RtttlCompiler rtttlCompiler;
+CmdFormat replyFormat = CMD_JSON;
+
+TtsClient ttsClient;
+NotifQueue<TtsJob, TTS_QUEUE_SIZE> ttsQueue;
+TtsJob ttsJob; // Request in flight
+
+// Last AP we connected to, kept in RTC memory across restarts for fast reconnect
+struct WifiRtcData {
+    uint32_t crc;
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t ap;
+};
+
+WifiState wifiState = WIFI_DOWN;
+WifiRtcData wifiLast = {};
+bool wifiFast = false;
+bool wifiOfflineLed = false;
+uint32_t wifiAttemptMillis = 0;
+uint32_t wifiDownMillis = 0;
+Backoff wifiBackoff(WIFI_BACKOFF_MIN_MS, WIFI_BACKOFF_MAX_MS);
+ConnStats wifiStats;
+
+Backoff mqttBackoff(MQTT_BACKOFF_MIN_MS, MQTT_BACKOFF_MAX_MS);
+ConnStats mqttStats;
+
 WiFiClient espClient;
 PubSubClient mqttClient(espClient);
-Ticker ledActionTimer;
+
+// LAN command endpoint: server callbacks only copy commands to the mailbox, taskLan() runs them
+#if LAN_ENDPOINT
+AsyncWebServer lanServer(LAN_PORT);
+AsyncWebSocket lanWs("/ws");
+Mailbox<LAN_MAILBOX_SLOTS, MQTT_BUFF_SIZE> lanMailbox;
+LanStats lanStats;
+uint32_t lanLiveMillis = 0;
+#endif
 MPU6050 mpu;
 
-AudioFileSourceHTTPStream *stream = nullptr;
-AudioFileSourceLittleFS *file = nullptr;
-AudioFileSourceBuffer *buff = nullptr;
-AudioFileSourcePROGMEM *string = nullptr;
+// Accelerometer is read from the MPU FIFO in bursts, samples go through the gesture classifier
+#define MPU_FIFO_SIZE   1024
+#define MPU_BURST_SIZE  120 // Whole 6 bytes samples, within Wire buffer
+#define MPU_LSB_PER_G   8192 // +/-4 g range
+
+const GestureConfig gestureConfig = {MPU_RATE_HZ, MPU_LSB_PER_G, GESTURE_TAP_MG, GESTURE_TAP_MAX_MS, GESTURE_TAP_WINDOW_MS,
+                                     GESTURE_SHAKE_MG, GESTURE_SHAKE_REVERSALS, GESTURE_SHAKE_WINDOW_MS, GESTURE_TILT_HOLD_MS};
+GestureClassifier gestures(gestureConfig);
+bool mpuReady = false;
+MpuStats mpuStats;
+
+// Audio pipeline arena: every object and buffer is reserved once, then reused clip after clip,
+// so that playing notifications does not fragment the heap over time
+#define MP3_CODEC_SIZE 29192 // MP3 decoder working memory, see ESP8266Audio StreamMP3FromHTTP example
+
+alignas(4) uint8_t streamBuffer[AUDIO_BUFFER_SIZE];
+alignas(4) uint8_t prefetchBuffer[PREFETCH_BUFFER_SIZE];
+alignas(4) uint8_t mp3Codec[MP3_CODEC_SIZE];
+
+// Companion host names and kept-alive connections, shared by streams and TTS
+ConnPool connPool(DNS_TTL_MS, KEEPALIVE_MS);
+
+// MP3 source chains, the current clip plays from deck while the next one is opened on nextDeck,
+// into the smaller ring: handoff trades rings, deck always plays from the larger one
+typedef AudioDeck<ClipCache<CACHE_MAX_ENTRIES>> Deck;
+Deck decks[2] = {{connPool, streamBuffer, sizeof(streamBuffer), JITTER_PREBUFFER, JITTER_COVER_MS},
+                  {connPool, prefetchBuffer, sizeof(prefetchBuffer), JITTER_PREBUFFER, JITTER_COVER_MS}};
+Deck *deck = &decks[0];
+Deck *nextDeck = &decks[1];
+
+AudioSlot<AudioGeneratorMP3> mp3Slot;
+AudioSlot<AudioGeneratorTune> tuneSlot;
+AudioSlot<AudioGeneratorWAV> wavSlot;
+AudioSlot<AudioGeneratorAdpcm> adpcmSlot;
+AudioSlot<AudioOutputI2S> outSlot;
+
 AudioGeneratorMP3 *mp3 = nullptr;
-AudioGeneratorRTTTL *rtttl = nullptr;
+AudioGeneratorTune *tune = nullptr;
+AudioGenerator *pcm = nullptr; // WAV or ADPCM clip, transcoded at build time (tools/transcode.py)
 AudioOutputI2S *out = nullptr;
 
+// Generators output to mixer channels: main source, ducked while an overlay (tune chime) plays on top
+enum MixerInput : uint8_t {
+    MIX_MAIN,
+    MIX_OVERLAY,
+    MIX_INPUTS
+};
+AudioMixer<MIX_INPUTS> mixer(MIXER_DUCK_GAIN * 32768);
+AudioOutput *mainOut = &mixer.channel(MIX_MAIN);
+AudioOutput *overlayOut = &mixer.channel(MIX_OVERLAY);
+
+char overlaySource[AUDIO_SOURCE_SIZE] = "";
+AudioSlot<AudioFileSourceLittleFS> overlayFileSlot;
+AudioSlot<AudioGeneratorTune> overlayTuneSlot;
+AudioFileSourceLittleFS *overlayFile = nullptr;
+AudioGeneratorTune *overlayTune = nullptr;
+
+// Gapless playback: next clip of the playlist, or next queued notification, is prefetched
+// on nextDeck near the end of the current one, then the decoder is handed over to it
+Playlist<PLAYLIST_POOL> playlist;
+uint32_t nextId = 0; // Hash of the queued notification being prefetched
+bool nextFromQueue = false;
+bool prefetchTried = false;
+bool handoffPending = false; // Current clip over, next one still opening
+uint32_t handoffEndUs = 0;
+float curGain = 0;
+GaplessStats gaplessStats;
+
 //############################################################################
 // SETUP
 //############################################################################
@@ -55,20 +202,37 @@ void setup() {
 
     // INIT LittleFS
     LittleFS.begin();
+    LittleFS.mkdir(TUNE_DIR);
+    clipCache.begin();
+#if CLIP_INDEX
+    clipIndex.build();
+    Serial.printf_P(PSTR("Clip index: %u clips (%u left out) in %u ms\n"), clipIndex.size(), clipIndex.dropped(),
+                    (unsigned)clipIndex.lastBuildMs());
+#endif
 
     // INIT WIFI
+    // Connection is driven from loop(), see wifiLoop()
+    WiFi.persistent(false);
+    WiFi.setAutoReconnect(false);
     WiFi.hostname(ESP_NAME);
     WiFi.mode(WIFI_STA);
-    for (auto i : AP_LIST) {
-        wifiMulti.addAP(i.ssid, i.passphrase);
+    randomSeed(ESP.random());
+    if (ESP.rtcUserMemoryRead(0, (uint32_t *)&wifiLast, sizeof(wifiLast))
+        && (wifiLast.crc != crc32(&wifiLast.bssid, sizeof(wifiLast) - sizeof(wifiLast.crc))
+            || wifiLast.ap >= sizeof(AP_LIST) / sizeof(AP_LIST[0]))) {
+        wifiLast = {};
     }
-    wifiConnect();
 
     // INIT MQTT
+    // Connection is driven from loop(), with bounded blocking time
+    espClient.setTimeout(MQTT_TIMEOUT_MS);
     mqttClient.setServer(MQTT_HOST, MQTT_PORT);
     mqttClient.setCallback(mqttCallback);
     mqttClient.setBufferSize(MQTT_BUFF_SIZE);
-    mqttConnect(true);
+    mqttClient.setSocketTimeout(MQTT_TIMEOUT_MS / 1000);
+
+    // INIT TTS
+    ttsClient.begin(connPool, TTS_PROXY_URL, TTS_PROXY_USER, TTS_PROXY_PASSWORD, TTS_TIMEOUT_MS, TTS_STREAM);
 
     // INIT OTA
     ArduinoOTA.setHostname(ESP_NAME);
@@ -99,29 +263,68 @@ void setup() {
     });
     ArduinoOTA.begin();
 
+#if LAN_ENDPOINT
+    // INIT LAN
+    // Listens whatever the WiFi state, commands work without the MQTT broker
+    lanBegin();
+#endif
+
     // INIT MPU
+    // Accelerometer only, into the FIFO at MPU_RATE_HZ (1 kHz / (1 + divider) with DLPF on)
     Wire.begin();
+    Wire.setClock(400000);
     Serial.println(F("Initializing MPU6050..."));
     mpu.initialize();
     if (mpu.testConnection()) {
         Serial.println(F("MPU6050 connection successful"));
-        mpu.setIntMotionEnabled(true);
-        mpu.setMotionDetectionThreshold(MOTION_DETECTION_THRESHOLD);
-        mpu.setMotionDetectionDuration(MOTION_DETECTION_DURATION);
-        attachInterrupt(digitalPinToInterrupt(MPU_INTERRUPT_PIN), ISRoutine, RISING);
+        mpu.setFullScaleAccelRange(MPU6050_ACCEL_FS_4);
+        mpu.setDLPFMode(MPU6050_DLPF_BW_98);
+        mpu.setRate(1000 / MPU_RATE_HZ - 1);
+        mpu.setAccelFIFOEnabled(true);
+        mpu.setFIFOEnabled(true);
+        mpu.resetFIFO();
+        mpuReady = true;
     } else {
         Serial.println(F("MPU6050 connection failed"));
     }
 
+    // INIT AUDIO
+    out = outSlot.create();
+    out->SetOutputModeMono(true);
+    mixer.begin(out);
+
     // INIT LED
-    LEDS.addLeds<LED_TYPE, LED_DATA_PIN, COLOR_ORDER>(leds, NUM_LEDS);
+    LEDS.addLeds<LED_TYPE, LED_DATA_PIN, COLOR_ORDER>(led.pixels(), NUM_LEDS);
     FastLED.setBrightness(max_bright);
     FastLED.setMaxPowerInVoltsAndMilliamps(5, 500);
+    led.resetStats();
     ledDefault();
 
     // READY SOUND
-    strlcpy(audioSource, "/mp3/bullfrog.mp3", sizeof(audioSource));
-    newAudioSource = true;
+    Notification ready = {};
+    strlcpy(ready.source, "/mp3/bullfrog.mp3", sizeof(ready.source));
+    notify(ready);
+
+    // TASKS
+    // Period (ms, 0 for every pass) and budget (µs), audio also runs between tasks when I2S runs low
+    uint8_t audioTask = sched.add("audio", taskAudio, 0, 3000);
+    sched.setUrgent(audioTask, audioHungry);
+    sched.add("wifi", taskWifi, 10, 2000);
+    sched.add("mqtt", taskMqtt, 0, 5000);
+#if LAN_ENDPOINT
+    sched.add("lan", taskLan, 0, 5000);
+#endif
+    sched.add("mpu", taskMpu, MPU_POLL_MS, 1500);
+    sched.add("tts", taskTts, 10, 5000);
+    sched.add("timeline", taskTimeline, 0, 5000); // Every pass, steps run on their millisecond
+    sched.add("notif", taskNotif, 10, 20000); // Starting a clip opens its file or starts its request
+    sched.add("led", taskLed, 1000 / LED_MAX_FPS, 1000);
+#if CMD_TRACE
+    sched.add("trace", taskTrace, 10, 20000);
+#endif
+    sched.reset();
+
+    PROF(reset());
 }
 
 //############################################################################
@@ -129,150 +332,414 @@ void setup() {
 //############################################################################
 
 void loop() {
+    // OTA update takes over
+    if (otaInProgress) {
+        ArduinoOTA.handle();
+        return;
+    }
 
-    unsigned long curMillis = millis();
+    PROF(begin());
+    sched.loop();
+    PROF(end());
+}
 
-    // HANDLE Wifi
+// Decoded audio is running low: I2S DMA has at least AUDIO_WATERMARK free samples
+bool audioHungry() {
+    return mixer.isActive() && i2s_available() >= AUDIO_WATERMARK;
+}
 
-    static unsigned long lastWifiMillis = 0;
-    bool wifiIsConnected = WiFi.isConnected();
-    if (!wifiIsConnected) {
-        stopPlaying();
-        /*
-        if (mp3 && mp3->isRunning()) {
-            mp3->stop();
-        } else if (rtttl && rtttl->isRunning()) {
-            rtttl->stop();
-        }
-        */
-        ledBlink(50, 0xFF0000);
-        if (curMillis - lastWifiMillis > 60000) {
-            if (wifiConnect()) {
-                ledDefault();
+void taskAudio(uint32_t) {
+    if (mp3 && mp3->isRunning()) {
+        deck->loop();
+    }
+    if (!mp3 && deck->opening()) {
+        // Stream of playAudio() opened a step per run, decoder starts once it's open
+        AudioFileSource *src = deck->openStep();
+        if (src) {
+            startMp3(src);
+        } else if (!deck->opening()) {
+            stopPlaying();
+        }
+    } else if (handoffPending) {
+        // Main channel plays silence until the next clip is open
+        mixer.channel(MIX_MAIN).silence();
+        handoffLoop();
+    } else if (mp3 && mp3->isRunning() && !deck->ready()) {
+        // Stream is (re)buffering, decoder waits instead of running dry
+        PROF(audioIdle());
+    } else if (mp3 && mp3->isRunning()) {
+        PROF(i2sState(i2s_is_empty()));
+        PROF(audioTick());
+        if (!mp3->loop()) {
+            //mp3->stop();
+            handoffEndUs = micros();
+            if (deck->tee()) {
+                deck->tee()->finish();
+            }
+            handoffLoop();
+            //Serial.println(F("MP3 done"));
+        } else {
+            prefetchLoop();
+        }
+    } else {
+        PROF(audioIdle());
+        if (tune && tune->isRunning()) {
+            if (!tune->loop()) {
+                stopPlaying();
             }
-            lastWifiMillis = curMillis;
+        }
+        if (pcm && pcm->isRunning()) {
+            if (!pcm->loop()) {
+                stopPlaying();
+            }
+        }
+    }
+    if (overlayTune && overlayTune->isRunning()) {
+        if (!overlayTune->loop()) {
+            stopOverlay();
         }
     }
+    mixer.pump();
+    TRACE(clipFrames(MIX_MAIN, mixer.channel(MIX_MAIN).played()));
+    TRACE(clipFrames(MIX_OVERLAY, mixer.channel(MIX_OVERLAY).played()));
+}
 
-    // HANDLE OTA
-    if (wifiIsConnected) {
-        ArduinoOTA.handle();
-        if (otaInProgress) {
-            return;
+// Hand over to the next clip, stop if there's none
+void handoffLoop() {
+    HandoffState state = handoff(handoffEndUs);
+    handoffPending = state == HANDOFF_PENDING;
+    if (state == HANDOFF_NONE) {
+        stopPlaying();
+    }
+}
+
+// Never blocks: local clips and LED alerts keep working while offline
+void taskWifi(uint32_t now) {
+    wifiIsConnected = wifiLoop(now);
+    if (!wifiIsConnected) {
+        // Resumable streams play on from their buffer meanwhile, and reconnect when WiFi is back
+        if (deck->isStream() && !deck->isResumable()) {
+            stopPlaying();
+        } else if (nextDeck->opening() || (nextDeck->isStream() && !nextDeck->isResumable())) {
+            nextDeck->close();
         }
+        connPool.flush();
+        if (!led.busy()) {
+            ledBlink(50, 0xFF0000);
+            wifiOfflineLed = true;
+        }
+        return;
     }
+    if (wifiOfflineLed) {
+        wifiOfflineLed = false;
+        ledDefault();
+    }
+    ArduinoOTA.handle();
+}
 
-    // HANDLE MQTT
-    static unsigned long lastMqttConnMillis = 0;
-    if (wifiIsConnected) {
-        if (!mqttClient.connected()) {
-            if (curMillis - lastMqttConnMillis > 5000) {
-                Serial.println(F("Disconnected from MQTT"));
-                mqttConnect();
-                lastMqttConnMillis = curMillis;
-            }
+void taskMqtt(uint32_t now) {
+    static bool mqttFirstConnection = true;
+    if (!wifiIsConnected) {
+        return;
+    }
+    if (mqttClient.connected()) {
+        mqttClient.loop();
+    } else if (mqttBackoff.due(now)) {
+        if (mqttConnect(mqttFirstConnection)) {
+            mqttFirstConnection = false;
+            mqttBackoff.success();
         } else {
-            mqttClient.loop();
+            mqttBackoff.failure(now);
         }
     }
+}
 
-    // HANDLE MPU
-    static unsigned long lastMpuTapMillis = 0;
-    static uint8_t mpuTapCount = 0;
-    if (mpuInterrupt) {
-        mpuInterrupt = false;
-        if (curMillis - lastMpuTapMillis > MPU_INTERRUPT_INTERVAL_MS) {
-
-            // Handle multi-tap
-            if (curMillis - lastMpuTapMillis > MPU_MULTITAP_INTERVAL_MS) {
-                mpuTapCount = 0;
-            }
-            Serial.printf_P(PSTR("MPU interrupt %d\n"), ++mpuTapCount);
-
-            if (mpuTapCount == MPU_MULTITAP_RESTART) {
-                beep();
-                Serial.println(F("Restarting ESP..."));
-                ESP.restart();
-                delay(500);
-            }
+void taskMpu(uint32_t) {
+    if (mpuReady) {
+        mpuLoop();
+    }
+}
 
-            if (mpuTapCount < 3) {
-                // If something is running, stop it...
-                bool stopped = stopPlaying();
-                /*
-                if (mp3 && mp3->isRunning()) {
-                    mp3->stop();
-                    stopped = true;
-                } else if (rtttl && rtttl->isRunning()) {
-                    rtttl->stop();
-                    stopped = true;
-                }
-                */
+void taskTts(uint32_t) {
+    // A streamed answer is held a few seconds only, it's requested when its notification comes next
+    if (wifiIsConnected && !ttsClient.busy() && !ttsQueue.empty() && (!TTS_STREAM || ttsDueToPlay(ttsQueue.top()))
+        && ttsQueue.pop(ttsJob)) {
+        uint32_t heapBefore = heapMon.mark();
+        ttsClient.start(ttsJob.text, ttsJob.voice);
+        heapSample("ttsreq", heapBefore);
+    }
+    if (ttsClient.loop()) {
+        ttsDone();
+    }
+}
 
-                if (ledActionInProgress) {
-                    msgPriority = 0;
-                    ledDefault();
-                    stopped = true;
-                }
+void taskTimeline(uint32_t now) {
+    // Every step due, in order; a step may schedule or cancel others, those due at once
+    // run in the same pass, up to a timeline's worth
+    for (uint8_t n = 0; n < TIMELINE_SIZE && timeline.due(now); n++) {
+        const TimelineStep &step = timeline.top();
+        uint16_t seq = step.seq;
+        if (cmdParse(timeline.data(step), step.len, cmdIn)) {
+            cmdExecute(cmdIn);
+        }
+        timeline.remove(seq);
+    }
+}
 
-                // ...otherwise, play random MP3 from stream
-                if (!stopped) {
-                    strlcpy(audioSource, RANDOM_STREAM_URL, sizeof(audioSource));
-                    newAudioSource = true;
-                }
+void taskNotif(uint32_t) {
+    // Start next notification when idle, or preempt current one for a higher priority
+    if (!notifQueue.empty()) {
+        bool playing = isPlaying();
+        if (!playing || notifQueue.top().priority > curPriority) {
+            Notification notif;
+            notifQueue.pop(notif);
+            if (playing) {
+                notifPreemptions++;
+                notifyEvent("preempted", notif);
             }
-            lastMpuTapMillis = curMillis;
+            startNotification(notif);
         }
     }
+}
 
-    // HANDLE MP3
-    if (newAudioSource) {
-        playAudio();
-    } else if (mp3 && mp3->isRunning()) {
-        if (!mp3->loop()) {
-            //mp3->stop();
-            stopPlaying();
-            //Serial.println(F("MP3 done"));
-        }
-    } else if (rtttl && rtttl->isRunning()) {
-        if (!rtttl->loop()) {
-            //rtttl->stop();
-            stopPlaying();
-            //Serial.println(F("RTTTL done"));
+#if CMD_TRACE
+// Replay: commands run at their recorded pace, their outcome is published as soon as known
+void taskTrace(uint32_t now) {
+    if (!cmdTrace.replaying()) {
+        return;
+    }
+    cmdTrace.sampleHeap(ESP.getFreeHeap(), ESP.getMaxFreeBlockSize());
+    size_t len = cmdTrace.due(now, traceBuf, sizeof(traceBuf));
+    bool done = !len && cmdTrace.replayDone(now);
+    TraceResult result;
+    if (cmdTrace.result(result, len || done)) {
+        traceResult(result);
+    }
+    if (len) {
+        uint32_t start = micros();
+        cmdDispatch(traceBuf, len);
+        cmdTrace.dispatched(cmdLabel(cmdIn), start, micros());
+        cmdTrace.sampleHeap(ESP.getFreeHeap(), ESP.getMaxFreeBlockSize());
+    } else if (done) {
+        cmdTrace.stop();
+        traceReport();
+    }
+}
+#endif
+
+#if LAN_ENDPOINT
+// One command per run, so that a burst of them doesn't hold audio back
+void taskLan(uint32_t now) {
+    size_t len;
+    uint32_t postedUs;
+    const uint8_t *cmd = lanMailbox.peek(len, postedUs);
+    if (cmd) {
+        lanStats.commands++;
+        lanStats.lastWaitUs = micros() - postedUs;
+        lanStats.maxWaitUs = max(lanStats.maxWaitUs, lanStats.lastWaitUs);
+        Serial.printf_P(PSTR("LAN in: %u bytes\n"), (unsigned)len);
+        cmdDispatch(cmd, len);
+        lanMailbox.pop();
+    }
+    if (now - lanLiveMillis >= LAN_LIVE_MS) {
+        lanLiveMillis = now;
+        lanWs.cleanupClients(LAN_MAX_CLIENTS);
+        if (lanWs.count()) {
+            lanLive();
         }
     }
+}
+#endif
 
-    // HANDLE LED
-    FastLED.show();
+void taskLed(uint32_t now) {
+    led.loop(now);
 }
 
 //############################################################################
-// ISRoutine
+// MPU
 //############################################################################
 
-void ISRoutine() {
-    mpuInterrupt = true;
+/**
+ * Read accelerometer samples from the MPU FIFO, in a few I2C bursts instead of a transaction per sample
+ */
+void mpuLoop() {
+    uint16_t count = mpu.getFIFOCount();
+    mpuStats.reads++;
+    mpuStats.bytes += 2;
+    if (count >= MPU_FIFO_SIZE) {
+        // Samples were lost, and the FIFO may no longer start on a sample boundary
+        mpu.resetFIFO();
+        mpuStats.overflows++;
+        return;
+    }
+
+    uint8_t buf[MPU_BURST_SIZE];
+    count -= count % 6;
+    while (count) {
+        uint8_t len = min<uint16_t>(count, sizeof(buf));
+        mpu.getFIFOBytes(buf, len);
+        mpuStats.reads++;
+        mpuStats.bytes += len;
+        count -= len;
+        for (uint8_t i = 0; i < len; i += 6) {
+            Gesture g;
+            mpuStats.samples++;
+            if (gestures.add(buf[i] << 8 | buf[i + 1], buf[i + 2] << 8 | buf[i + 3], buf[i + 4] << 8 | buf[i + 5], g)) {
+                gestureEvent(g);
+            }
+        }
+    }
+}
+
+/**
+ * Publish gesture to MQTT out topic, then run the command it's mapped to, if any
+ */
+void gestureEvent(const Gesture &g) {
+    static const char *const types[] = {"none", "tap", "doubletap", "multitap", "shake", "tilt"};
+    static const char *const sides[] = {"unknown", "up", "down", "right", "left", "front", "back"};
+
+    char msg[96];
+    snprintf_P(msg, sizeof(msg), PSTR("{\"event\":\"gesture\",\"type\":\"%s\",\"count\":%u,\"orientation\":\"%s\"}"),
+               types[g.type], g.count, sides[g.orientation]);
+    Serial.println(msg);
+    publishEvent(msg);
+
+    const char *cmd = "";
+    switch (g.type) {
+        case GESTURE_TAP:
+            cmd = GESTURE_TAP_CMD;
+            break;
+        case GESTURE_DOUBLE_TAP:
+            cmd = GESTURE_DOUBLE_TAP_CMD;
+            break;
+        case GESTURE_MULTI_TAP:
+            if (g.count == MPU_MULTITAP_RESTART) {
+                beep();
+                Serial.println(F("Restarting ESP..."));
+                ESP.restart();
+                delay(500);
+            }
+            cmd = GESTURE_MULTI_TAP_CMD;
+            break;
+        case GESTURE_SHAKE:
+            cmd = GESTURE_SHAKE_CMD;
+            break;
+        case GESTURE_TILT:
+            cmd = g.orientation == ORIENT_DOWN ? GESTURE_FACE_DOWN_CMD : GESTURE_TILT_CMD;
+            break;
+        default:
+            break;
+    }
+    if (cmd[0] && cmdParse((const uint8_t *)cmd, strlen(cmd), cmdIn)) {
+        cmdExecute(cmdIn);
+    }
 }
 
 //############################################################################
 // WIFI
 //############################################################################
 
-bool wifiConnect() {
-    Serial.print(F("Connecting to WiFi"));
-    uint8_t count = 10;
-    while (count-- && (wifiMulti.run() != WL_CONNECTED)) {
-        Serial.print(".");
-        delay(1000);
+/**
+ * Drive WiFi connection without blocking
+ * Try last known AP first (no scan), otherwise scan asynchronously and join the strongest known AP,
+ * with exponential backoff between failed attempts
+ * Return true if connected
+ */
+bool wifiLoop(uint32_t now) {
+    switch (wifiState) {
+
+        case WIFI_UP:
+            if (WiFi.isConnected()) {
+                return true;
+            }
+            Serial.println(F("Disconnected from WiFi"));
+            wifiDownMillis = now;
+            wifiState = WIFI_DOWN;
+            break;
+
+        case WIFI_DOWN:
+            if (!wifiBackoff.due(now)) {
+                break;
+            }
+            wifiAttemptMillis = now;
+            if (wifiLast.channel) {
+                const WifiAPEntry &ap = AP_LIST[wifiLast.ap];
+                Serial.printf_P(PSTR("Reconnecting to %s (channel %d)\n"), ap.ssid, wifiLast.channel);
+                WiFi.begin(ap.ssid, ap.passphrase, wifiLast.channel, wifiLast.bssid);
+                wifiFast = true;
+                wifiState = WIFI_CONNECTING;
+            } else {
+                Serial.println(F("Scanning WiFi"));
+                WiFi.scanNetworks(true);
+                wifiState = WIFI_SCANNING;
+            }
+            break;
+
+        case WIFI_SCANNING: {
+            int8_t n = WiFi.scanComplete();
+            if (n == WIFI_SCAN_RUNNING) {
+                break;
+            }
+            int8_t best = -1;
+            for (int8_t i = 0; i < n; i++) {
+                for (uint8_t a = 0; a < sizeof(AP_LIST) / sizeof(AP_LIST[0]); a++) {
+                    if (strcmp(WiFi.SSID(i).c_str(), AP_LIST[a].ssid) == 0 && (best < 0 || WiFi.RSSI(i) > WiFi.RSSI(best))) {
+                        best = i;
+                        wifiLast.ap = a;
+                    }
+                }
+            }
+            if (best >= 0) {
+                const WifiAPEntry &ap = AP_LIST[wifiLast.ap];
+                memcpy(wifiLast.bssid, WiFi.BSSID(best), sizeof(wifiLast.bssid));
+                wifiLast.channel = WiFi.channel(best);
+                Serial.printf_P(PSTR("Connecting to %s (channel %d)\n"), ap.ssid, wifiLast.channel);
+                WiFi.begin(ap.ssid, ap.passphrase, wifiLast.channel, wifiLast.bssid);
+                wifiFast = false;
+                wifiState = WIFI_CONNECTING;
+            } else {
+                Serial.println(F("No known WiFi found"));
+                wifiFailed(now);
+            }
+            WiFi.scanDelete();
+            break;
+        }
+
+        case WIFI_CONNECTING: {
+            wl_status_t status = WiFi.status();
+            if (status == WL_CONNECTED) {
+                Serial.println(F("Connected to WiFi"));
+                wifiStats.connects++;
+                wifiStats.lastConnectMs = now - wifiAttemptMillis;
+                wifiStats.lastOutageMs = wifiDownMillis ? now - wifiDownMillis : 0;
+                if (wifiFast) {
+                    wifiStats.fastConnects++;
+                }
+                wifiLast.crc = crc32(&wifiLast.bssid, sizeof(wifiLast) - sizeof(wifiLast.crc));
+                ESP.rtcUserMemoryWrite(0, (uint32_t *)&wifiLast, sizeof(wifiLast));
+                wifiBackoff.success();
+                wifiState = WIFI_UP;
+                return true;
+            }
+            if (status == WL_CONNECT_FAILED || status == WL_NO_SSID_AVAIL
+                || now - wifiAttemptMillis > WIFI_CONNECT_TIMEOUT_MS) {
+                Serial.println(F("Unable to connect to WiFi"));
+                WiFi.disconnect();
+                wifiFailed(now);
+            }
+            break;
+        }
     }
+    return false;
+}
 
-    if (WiFi.isConnected()) {
-        Serial.println(F("\nConnected to WiFi"));
-        return true;
-    } else {
-        Serial.println(F("\nUnable to connect to WiFi"));
-        return false;
+void wifiFailed(uint32_t now) {
+    wifiStats.failures++;
+    if (wifiFast) {
+        wifiLast.channel = 0; // Forget last AP, scan next time
     }
+    wifiBackoff.failure(now);
+    wifiState = WIFI_DOWN;
 }
 
 //############################################################################
@@ -281,9 +748,12 @@ bool wifiConnect() {
 
 bool mqttConnect(bool about) {
 
+    uint32_t start = millis();
     String cltName = String(ESP_NAME) + '_' + String(ESP.getChipId(), HEX);
     if (mqttClient.connect(cltName.c_str(), MQTT_USER, MQTT_PASSWORD)) {
         Serial.println(F("Connected to MQTT"));
+        mqttStats.connects++;
+        mqttStats.lastConnectMs = millis() - start;
         if (about) {
             mqttCmdAbout();
         } else {
@@ -292,134 +762,65 @@ bool mqttConnect(bool about) {
         mqttClient.subscribe(MQTT_IN_TOPIC);
     } else {
         Serial.println(F("Unable to connect to MQTT"));
+        mqttStats.failures++;
     }
     return mqttClient.connected();
 }
 
-void mqttCallback(char *topic, byte *payload, unsigned int length) {
-
-    StaticJsonDocument<512> jsonInDoc;
-    DeserializationError err = deserializeJson(jsonInDoc, payload);
-
-    if (err) {
-        mqttClient.publish(MQTT_OUT_TOPIC, PSTR("{event:\"deserializeJson(jsonInDoc, payload) failed\"}"));
-        mqttClient.publish(MQTT_OUT_TOPIC, err.c_str());
-        return;
-    }
-
-    serializeJsonPretty(jsonInDoc, Serial);
-    Serial.println();
-
-    // Simple commands
-    if (jsonInDoc.containsKey("cmd")) {
-        if (strcmp("break", jsonInDoc["cmd"]) == 0) { // Break current action: {cmd:"break"}
-            stopPlaying();
-            /*
-            if (mp3 && mp3->isRunning()) {
-                mp3->stop();
-            } else if (rtttl && rtttl->isRunning()) {
-                rtttl->stop();
-            }
-             */
-            if (ledActionInProgress) {
-                msgPriority = 0;
-                ledDefault();
-            }
-        } else if (strcmp("restart", jsonInDoc["cmd"]) == 0) { // Restart ESP: {cmd:"restart"}
-            ESP.restart();
-            delay(500);
-        } else if (strcmp("about", jsonInDoc["cmd"]) == 0) { // About: {cmd:"about"}
-            mqttCmdAbout();
-        } else if (strcmp("list", jsonInDoc["cmd"]) == 0) { // List LittleFS files: {cmd:"list"}
-            mqttCmdList();
-        }
-        return;
-    }
-
-    // Set max brightness: {bright:255}
-    if (jsonInDoc.containsKey("bright")) {
-        uint8_t b = jsonInDoc["bright"].as<uint8_t>();
-        if (b >= 0 && b <= 255) {
-            FastLED.setBrightness(b);
-        }
-    }
-
-    // Set default gain: {"gain":1.2}
-    if (jsonInDoc.containsKey("gain")) {
-        float g = jsonInDoc["gain"].as<float>();
-        if (g > 0.01 && g < 3.0) {
-            defaultGain = g;
-        }
-    }
-
-    // Set once gain: {oncegain:1.2}
-    if (jsonInDoc.containsKey("oncegain")) {
-        float g = jsonInDoc["oncegain"].as<float>();
-        if (g > 0.01 && g < 3.0) {
-            onceGain = g;
-        }
-    }
+void mqttCallback(char *, byte *payload, unsigned int length) {
 
-    // Set new MP3 source
-    // - from stream: {"mp3":"http://www.universal-soundbank.com/sounds/7340.mp3"}
-    // - from LittleFS: {"mp3":"/mp3/song.mp3"}
-    if (jsonInDoc.containsKey("mp3")) {
-        strlcpy(audioSource, jsonInDoc["mp3"], sizeof(audioSource));
-        newAudioSource = true;
-    }
+    Serial.printf_P(PSTR("MQTT in: %u bytes\n"), length);
+    cmdDispatch(payload, length);
+}
 
-    // Set new MP3 source from TTS proxy {"tts":"May the force be with you"}
-    if (jsonInDoc.containsKey("tts")) {
-        tts(jsonInDoc["tts"], jsonInDoc.containsKey("voice") ? jsonInDoc["voice"] : String());
+/**
+ * Publish message to MQTT out topic, and to LAN WebSocket clients
+ */
+void publishEvent(const char *msg) {
+    mqttClient.publish(MQTT_OUT_TOPIC, msg);
+#if LAN_ENDPOINT
+    if (lanWs.count()) {
+        lanWs.textAll(msg);
     }
+#endif
+}
 
-    // Set new Rtttl source {"rtttl":"Xfiles:d=4,o=5,b=160:e,b,a,b,d6,2b."}
-    if (jsonInDoc.containsKey("rtttl")) {
-        strlcpy(audioSource, jsonInDoc["rtttl"], sizeof(audioSource));
-        newAudioSource = true;
+/**
+ * Publish reply written by writeReply(ReplyWriter &), in the current reply format
+ * Reply is written twice, to size it, then straight into the MQTT packet:
+ * it must not change in between, and it needs no memory whatever its size
+ * (but a copy for LAN WebSocket clients, if any)
+ */
+template<typename Writer>
+bool mqttPublishReply(Writer writeReply, bool echo = false) {
+    CountingPrint counter;
+    ReplyWriter sizer(counter, replyFormat);
+    writeReply(sizer);
+
+    if (echo) {
+        ReplyWriter serial(Serial, CMD_JSON);
+        writeReply(serial);
+        Serial.println();
     }
 
-    // Set new message priority : {"led":"Blink",color:"0xff0000",delay:50,priority:9}
-    // LED pattern is considered only if msg priority is >= to previous msg priority
-    // This is to avoid masking an important LED alert with a minor one
-    if (jsonInDoc.containsKey("priority")) {
-        uint8_t thisPriority = jsonInDoc["priority"].as<uint8_t>();
-        if (thisPriority < msgPriority) {
-            return;
-        }
-        msgPriority = thisPriority;
+#if LAN_ENDPOINT
+    AsyncWebSocketMessageBuffer *lanBuf = lanBuffer(counter.count);
+    if (lanBuf) {
+        MemoryPrint mem(lanBuf->get(), counter.count);
+        ReplyWriter lan(mem, replyFormat);
+        writeReply(lan);
+        lanSend(lanBuf);
     }
+#endif
 
-    // Set led pattern: {"led":"Blink",color:"0xff0000",delay:50}
-    if (jsonInDoc.containsKey("led")) {
-        uint32_t d = 100;
-        if (jsonInDoc.containsKey("delay")) {
-            d = jsonInDoc["delay"].as<uint32_t>();
-        }
-
-        int c = 0xFFFFFF;
-        if (jsonInDoc.containsKey("color")) {
-            c = (int)strtol(jsonInDoc["color"], nullptr, 0);
-        }
-
-        if (strcmp("Rainbow", jsonInDoc["led"]) == 0) {
-            ledRainbow(d);
-        } else if (strcmp("Blink", jsonInDoc["led"]) == 0) {
-            ledBlink(d, c);
-        } else if (strcmp("Sine", jsonInDoc["led"]) == 0) {
-            ledSine(d, c);
-        } else if (strcmp("Pulse", jsonInDoc["led"]) == 0) {
-            ledPulse(d, c);
-        } else if (strcmp("Disco", jsonInDoc["led"]) == 0) {
-            ledDisco(d);
-        } else if (strcmp("Solid", jsonInDoc["led"]) == 0) {
-            ledSolid(c);
-        } else if (strcmp("Off", jsonInDoc["led"]) == 0) {
-            ledOff();
-        } else {
-            ledDefault();
-        }
+    if (!mqttClient.beginPublish(MQTT_OUT_TOPIC, counter.count, false)) {
+        return false;
     }
+    BufferedPrint<MQTT_WRITE_CHUNK> out(mqttClient);
+    ReplyWriter writer(out, replyFormat);
+    writeReply(writer);
+    out.flush();
+    return mqttClient.endPublish();
 }
 
 /**
@@ -427,307 +828,1780 @@ void mqttCallback(char *topic, byte *payload, unsigned int length) {
  */
 void mqttCmdAbout() {
 
-    char uptimeBuffer[15];
-    getUptimeDhms(uptimeBuffer, sizeof(uptimeBuffer));
+    // Snapshot, reply is written more than once
+    char uptime[15];
+    getUptimeDhms(uptime, sizeof(uptime));
 
-    String freeSpace;
-    prettyBytes(ESP.getFreeSketchSpace(), freeSpace);
+    char freeSpace[12];
+    prettyBytes(ESP.getFreeSketchSpace(), freeSpace, sizeof(freeSpace));
 
-    String sketchSize;
-    prettyBytes(ESP.getSketchSize(), sketchSize);
+    char sketchSize[12];
+    prettyBytes(ESP.getSketchSize(), sketchSize, sizeof(sketchSize));
 
-    String chipSize;
-    prettyBytes(ESP.getFlashChipRealSize(), chipSize);
+    char chipSize[12];
+    prettyBytes(ESP.getFlashChipRealSize(), chipSize, sizeof(chipSize));
 
-    String freeHeap;
-    prettyBytes(ESP.getFreeHeap(), freeHeap);
+    uint32_t heapFree;
+    uint16_t heapMaxBlock;
+    uint8_t heapFrag;
+    ESP.getHeapStats(&heapFree, &heapMaxBlock, &heapFrag);
 
-    Serial.println(F("Preparing about..."));
+    char freeHeap[12];
+    prettyBytes(heapFree, freeHeap, sizeof(freeHeap));
+
+    char maxFreeBlock[12];
+    prettyBytes(heapMaxBlock, maxFreeBlock, sizeof(maxFreeBlock));
+
+    char chipId[9];
+    snprintf_P(chipId, sizeof(chipId), PSTR("%x"), (unsigned)ESP.getChipId());
+
+    String coreVersion = ESP.getCoreVersion();
+    String resetReason = ESP.getResetReason();
+    String ssid = WiFi.SSID();
+    String ip = WiFi.localIP().toString();
+    String staMac = WiFi.macAddress();
+    String apMac = WiFi.softAPmacAddress();
 
-    DynamicJsonDocument jsonDoc(1024);
+    const CacheStats cacheStats = clipCache.stats();
+    const GaplessStats gapless = gaplessStats;
 
-    jsonDoc[F("version")] = ESPARKLE_VERSION;
-    jsonDoc[F("sdkVersion")] = ESP.getSdkVersion();
-    jsonDoc[F("coreVersion")] = ESP.getCoreVersion();
-    jsonDoc[F("resetReason")] = ESP.getResetReason();
-    jsonDoc[F("ssid")] = WiFi.SSID();
-    jsonDoc[F("ip")] = WiFi.localIP().toString();
-    jsonDoc[F("staMac")] = WiFi.macAddress();
-    jsonDoc[F("apMac")] = WiFi.softAPmacAddress();
-    jsonDoc[F("chipId")] = String(ESP.getChipId(), HEX);
-    jsonDoc[F("chipSize")] = chipSize;
-    jsonDoc[F("sketchSize")] = sketchSize;
-    jsonDoc[F("freeSpace")] = freeSpace;
-    jsonDoc[F("freeHeap")] = freeHeap;
-    jsonDoc[F("uptime")] = uptimeBuffer;
-    jsonDoc[F("defaultGain")] = defaultGain;
+    // LED output cost since previous report
+    const LedStats ledStats = led.stats();
+    uint32_t ledWindowMs = millis() - ledStats.sinceMs;
+    led.resetStats();
 
-    String mqttMsg;
-    serializeJsonPretty(jsonDoc, mqttMsg);
-    Serial.println(mqttMsg.c_str());
+    Serial.println(F("Preparing about..."));
 
-    mqttClient.publish(MQTT_OUT_TOPIC, mqttMsg.c_str());
+    mqttPublishReply([&](ReplyWriter &w) {
+        w.beginObject(23);
+        w.member(F("version"), ESPARKLE_VERSION);
+        w.member(F("sdkVersion"), ESP.getSdkVersion());
+        w.member(F("coreVersion"), coreVersion.c_str());
+        w.member(F("resetReason"), resetReason.c_str());
+        w.member(F("ssid"), ssid.c_str());
+        w.member(F("ip"), ip.c_str());
+        w.member(F("staMac"), staMac.c_str());
+        w.member(F("apMac"), apMac.c_str());
+        w.member(F("chipId"), chipId);
+        w.member(F("chipSize"), chipSize);
+        w.member(F("sketchSize"), sketchSize);
+        w.member(F("freeSpace"), freeSpace);
+        w.member(F("freeHeap"), freeHeap);
+        w.member(F("maxFreeBlock"), maxFreeBlock);
+        w.member(F("heapFragmentation"), heapFrag);
+        w.member(F("uptime"), uptime);
+        w.member(F("defaultGain"), defaultGain);
+
+        w.key(F("wifi"));
+        w.beginObject(5);
+        w.member(F("connects"), wifiStats.connects);
+        w.member(F("fastConnects"), wifiStats.fastConnects);
+        w.member(F("failures"), wifiStats.failures);
+        w.member(F("lastConnectMs"), wifiStats.lastConnectMs);
+        w.member(F("lastOutageMs"), wifiStats.lastOutageMs);
+        w.endObject();
+
+        w.key(F("mqtt"));
+        w.beginObject(3);
+        w.member(F("connects"), mqttStats.connects);
+        w.member(F("failures"), mqttStats.failures);
+        w.member(F("lastConnectMs"), mqttStats.lastConnectMs);
+        w.endObject();
+
+        w.key(F("cache"));
+        w.beginObject(6);
+        w.member(F("clips"), clipCache.size());
+        w.member(F("bytes"), clipCache.bytes());
+        w.member(F("hits"), cacheStats.hits);
+        w.member(F("misses"), cacheStats.misses);
+        w.member(F("bytesSaved"), cacheStats.bytesSaved);
+        w.member(F("evictions"), cacheStats.evictions);
+        w.endObject();
+
+        w.key(F("queue"));
+        w.beginObject(4);
+        w.member(F("depth"), notifQueue.size());
+        w.member(F("timeline"), timeline.size());
+        w.member(F("drops"), notifDrops);
+        w.member(F("preemptions"), notifPreemptions);
+        w.endObject();
+
+        w.key(F("gapless"));
+        w.beginObject(4);
+        w.member(F("handoffs"), gapless.handoffs);
+        w.member(F("lastGapUs"), gapless.lastGapUs);
+        w.member(F("maxGapUs"), gapless.maxGapUs);
+        w.member(F("underruns"), gapless.underruns);
+        w.endObject();
+
+        w.key(F("led"));
+        w.beginObject(4);
+        w.member(F("frames"), ledStats.frames);
+        w.member(F("pushes"), ledStats.pushes);
+        w.member(F("showUsMax"), ledStats.showUsMax);
+        w.member(F("showLoadPct"), ledWindowMs ? ledStats.showUs / (ledWindowMs * 10.0) : 0.0);
+        w.endObject();
+
+        w.endObject();
+    }, true);
 }
 
+#if CLIP_INDEX
+/**
+ * Publish clip index, LIST_PAGE_SIZE clips per message, with ids to play them by ({"clip":7}):
+ * {"page":1,"pages":2,"files":[{"id":1,"name":"toad.mp3","size":12345,"ms":2610,"codec":"mp3","kbps":32},...]}
+ */
 void mqttCmdList() {
+    uint8_t total = clipIndex.size();
+    uint16_t pages = total ? (total + LIST_PAGE_SIZE - 1) / LIST_PAGE_SIZE : 1;
+    for (uint16_t page = 1; page <= pages; page++) {
+        uint8_t first = (page - 1) * LIST_PAGE_SIZE + 1;
+        uint8_t count = min<uint8_t>(LIST_PAGE_SIZE, total - first + 1);
+        if (!total) {
+            count = 0;
+        }
+        mqttPublishReply([&](ReplyWriter &w) {
+            w.beginObject(3);
+            w.member(F("page"), page);
+            w.member(F("pages"), pages);
+            w.key(F("files"));
+            w.beginArray(count);
+            for (uint16_t id = first; id < first + count; id++) {
+                const ClipInfo &clip = clipIndex.clip(id);
+                w.beginObject(6);
+                w.member(F("id"), (uint32_t)id);
+                w.member(F("name"), clipIndex.name(id));
+                w.member(F("size"), clip.size);
+                w.member(F("ms"), clip.durationMs);
+                w.member(F("codec"), clipIndex.codecName(clip.codec));
+                w.member(F("kbps"), (uint32_t)clip.kbps);
+                w.endObject();
+            }
+            w.endArray();
+            w.endObject();
+        });
+    }
+}
+#else
+struct ListEntry {
+    char name[32];
+    uint32_t size;
+    uint32_t durationMs; // 0 if unknown
+};
 
-    DynamicJsonDocument jsonDoc(1024);
-
-    JsonArray array = jsonDoc.to<JsonArray>();
+/**
+ * Publish LittleFS /mp3 content, LIST_PAGE_SIZE files per message:
+ * {"page":1,"pages":2,"files":[{"name":"toad.mp3","size":12345,"ms":2610},...]}
+ */
+void mqttCmdList() {
 
+    uint16_t total = 0;
     Dir dir = LittleFS.openDir("/mp3");
     while (dir.next()) {
-        array.add(dir.fileName());
+        total += dir.isFile();
     }
+    uint16_t pages = total ? (total + LIST_PAGE_SIZE - 1) / LIST_PAGE_SIZE : 1;
+
+    dir = LittleFS.openDir("/mp3");
+    for (uint16_t page = 1; page <= pages; page++) {
+        ListEntry entries[LIST_PAGE_SIZE];
+        uint8_t count = 0;
+        while (count < LIST_PAGE_SIZE && dir.next()) {
+            if (!dir.isFile()) {
+                continue;
+            }
+            ListEntry &entry = entries[count++];
+            strlcpy(entry.name, dir.fileName().c_str(), sizeof(entry.name));
+            entry.size = dir.fileSize();
+            entry.durationMs = 0;
+            File file = dir.openFile("r");
+            Mp3Info info;
+            if (file && mp3Probe(file, info)) {
+                entry.durationMs = info.durationMs;
+            }
+            file.close();
+        }
 
-    String mqttMsg;
-    serializeJsonPretty(jsonDoc, mqttMsg);
-
-    mqttClient.publish(MQTT_OUT_TOPIC, mqttMsg.c_str());
+        mqttPublishReply([&](ReplyWriter &w) {
+            w.beginObject(3);
+            w.member(F("page"), page);
+            w.member(F("pages"), pages);
+            w.key(F("files"));
+            w.beginArray(count);
+            for (uint8_t i = 0; i < count; i++) {
+                w.beginObject(3);
+                w.member(F("name"), entries[i].name);
+                w.member(F("size"), entries[i].size);
+                w.member(F("ms"), entries[i].durationMs);
+                w.endObject();
+            }
+            w.endArray();
+            w.endObject();
+        });
+    }
+}
+#endif
+
+static void writeHeapSample(ReplyWriter &w, const HeapSample &sample) {
+    w.beginObject(6);
+    w.member(F("ms"), sample.ms);
+    w.member(F("op"), sample.label);
+    w.member(F("free"), sample.freeHeap);
+    w.member(F("delta"), sample.delta);
+    w.member(F("maxBlock"), (uint32_t)sample.maxBlock);
+    w.member(F("frag"), (uint32_t)sample.frag);
+    w.endObject();
 }
 
-//############################################################################
-// AUDIO
-//############################################################################
-
-void playAudio() {
-    newAudioSource = false;
+/**
+ * Publish heap low-water marks and last samples, oldest first
+ * Written straight into the MQTT packet, a reply about the heap shouldn't need a heap block
+ */
+void mqttCmdHeap() {
+    mqttPublishReply([&](ReplyWriter &w) {
+        w.beginObject(4);
+        w.key(F("lowestFree"));
+        writeHeapSample(w, heapMon.lowestFree());
+        w.key(F("lowestMaxBlock"));
+        writeHeapSample(w, heapMon.lowestBlock());
+        w.key(F("highestFrag"));
+        writeHeapSample(w, heapMon.highestFrag());
+        w.key(F("samples"));
+        w.beginArray(heapMon.size());
+        for (uint8_t i = 0; i < heapMon.size(); i++) {
+            writeHeapSample(w, heapMon.at(i));
+        }
+        w.endArray();
+        w.endObject();
+    });
+}
 
-    if (audioSource[0] == 0) {
+/**
+ * Record heap state after an operation, publish an event if it went below thresholds
+ */
+void heapSample(const char *label, uint32_t before) {
+    if (!heapMon.sample(label, before)) {
         return;
     }
+    const HeapSample &sample = heapMon.last();
+    char msg[128];
+    snprintf_P(msg, sizeof(msg), PSTR("{\"event\":\"heap\",\"op\":\"%s\",\"free\":%u,\"delta\":%d,\"maxBlock\":%u,\"frag\":%u}"),
+               sample.label, (unsigned)sample.freeHeap, (int)sample.delta, sample.maxBlock, sample.frag);
+    Serial.println(msg);
+    publishEvent(msg);
+}
 
-    stopPlaying();
+static void writeHist(ReplyWriter &w, const ProfHist &hist) {
+    w.beginObject(4);
+    w.member(F("n"), hist.count);
+    w.member(F("avgUs"), hist.avgUs());
+    w.member(F("maxUs"), hist.maxUs);
+    w.key(F("log2Us"));
+    w.beginArray(hist.used());
+    for (uint8_t i = 0; i < hist.used(); i++) {
+        w.value((uint32_t)hist.buckets[i]);
+    }
+    w.endArray();
+    w.endObject();
+}
 
-    Serial.printf_P(PSTR("\nFree heap: %d\n"), ESP.getFreeHeap());
-
-    if (!out) {
-        out = new AudioOutputI2S();
-        out->SetOutputModeMono(true);
-    }
-    out->SetGain(onceGain ?: defaultGain);
-    onceGain = 0;
-
-    if (strncmp("http", audioSource, 4) == 0) {
-        // Get MP3 from stream
-        Serial.printf_P(PSTR("**MP3 stream: %s\n"), audioSource);
-        stream = new AudioFileSourceHTTPStream(audioSource);
-        buff = new AudioFileSourceBuffer(stream, 1024 * 2);
-        //buff = new AudioFileSourceBuffer(stream, preallocateBuffer, preallocateBufferSize);
-        mp3 = new AudioGeneratorMP3();
-        mp3->begin(buff, out);
-        if (!mp3->isRunning()) {
-            //Serial.println(F("Unable to play MP3"));
-            stopPlaying();
-        }
-    } else if (strncmp("/mp3/", audioSource, 5) == 0) {
-        // Get MP3 from LittleFS
-        Serial.printf_P(PSTR("**MP3 file: %s\n"), audioSource);
-        file = new AudioFileSourceLittleFS(audioSource);
-        mp3 = new AudioGeneratorMP3();
-        mp3->begin(file, out);
-        if (!mp3->isRunning()) {
-            //Serial.println(F("Unable to play MP3"));
-            stopPlaying();
-        }
-    } else {
-        // Get RTTTL
-        Serial.printf_P(PSTR("**RTTL file: %s\n"), audioSource);
-        string = new AudioFileSourcePROGMEM(audioSource, strlen(audioSource));
-        rtttl = new AudioGeneratorRTTTL();
-        rtttl->begin(string, out);
-        if (!rtttl->isRunning()) {
-            //Serial.println(F("Unable to play RTTTL"));
-            stopPlaying();
+/**
+ * Publish task and loop profile since previous report, then reset it
+ * Written straight into the MQTT packet, profiles are only reset once it's sent
+ */
+void mqttCmdStats() {
+    uint32_t windowMs = millis() - sched.since();
+
+    // I2C bus time at 400 kHz, 9 bits per byte, plus device address and register per read
+    uint32_t busUs = (uint64_t)(mpuStats.reads * 3 + mpuStats.bytes) * 9 * 1000000 / 400000;
+    const MpuStats mpu = mpuStats;
+#if LAN_ENDPOINT
+    const LanStats lan = lanStats;
+    uint32_t lanClients = lanWs.count();
+#endif
+    const ConnPoolStats cs = connPool.stats();
+
+    mqttPublishReply([&](ReplyWriter &w) {
+        w.beginObject((LOOP_PROFILER ? 11 : 8) + LAN_ENDPOINT + CLIP_INDEX);
+        w.member(F("cpuMHz"), (uint32_t)ESP.getCpuFreqMHz());
+        w.member(F("windowMs"), windowMs);
+        w.member(F("idlePct"), (uint32_t)sched.idlePct());
+        w.member(F("audioExtraRuns"), sched.extraRuns());
+
+        w.key(F("tasks"));
+        w.beginObject(sched.size());
+        for (uint8_t i = 0; i < sched.size(); i++) {
+            const Task &task = sched.task(i);
+            w.key(task.name);
+            w.beginObject(6);
+            w.member(F("n"), task.hist.count);
+            w.member(F("avgUs"), task.hist.avgUs());
+            w.member(F("maxUs"), task.hist.maxUs);
+            w.key(F("log2Us"));
+            w.beginArray(task.hist.used());
+            for (uint8_t b = 0; b < task.hist.used(); b++) {
+                w.value((uint32_t)task.hist.buckets[b]);
+            }
+            w.endArray();
+            w.member(F("budgetUs"), (uint32_t)task.budgetUs);
+            w.member(F("overruns"), task.overruns);
+            w.endObject();
         }
-    }
+        w.endObject();
+
+#if LOOP_PROFILER
+        w.key(F("loop"));
+        writeHist(w, prof.loops());
+        w.key(F("mp3Gap"));
+        writeHist(w, prof.gaps());
+        w.member(F("i2sStarvations"), prof.i2sStarvations());
+#endif
+
+        w.key(F("mpu"));
+        w.beginObject(5);
+        w.member(F("samples"), mpu.samples);
+        w.member(F("reads"), mpu.reads);
+        w.member(F("bytes"), mpu.bytes);
+        w.member(F("overflows"), mpu.overflows);
+        w.member(F("busUsPerSec"), windowMs ? (uint32_t)((uint64_t)busUs * 1000 / windowMs) : 0);
+        w.endObject();
+
+#if LAN_ENDPOINT
+        w.key(F("lan"));
+        w.beginObject(6);
+        w.member(F("commands"), lan.commands);
+        w.member(F("connects"), lan.connects);
+        w.member(F("dropped"), lanMailbox.dropped());
+        w.member(F("clients"), lanClients);
+        w.member(F("lastWaitUs"), lan.lastWaitUs);
+        w.member(F("maxWaitUs"), lan.maxWaitUs);
+        w.endObject();
+#endif
+
+        w.key(F("conn"));
+        w.beginObject(10);
+        w.member(F("lookups"), cs.lookups);
+        w.member(F("dnsHits"), cs.dnsHits);
+        w.member(F("dnsMs"), cs.dnsMs);
+        w.member(F("connects"), cs.connects);
+        w.member(F("connectMs"), cs.connectMs);
+        w.member(F("reused"), cs.reused);
+        w.member(F("failures"), cs.failures);
+        w.member(F("resumes"), cs.resumes);
+        w.member(F("resumeFailures"), cs.resumeFailures);
+        w.member(F("savedMs"), connPool.savedMs());
+        w.endObject();
+
+        w.key(F("clipOpen"));
+        writeHist(w, clipOpenHist);
+#if CLIP_INDEX
+        w.member(F("clipIndexMs"), clipIndex.lastBuildMs()); // At boot
+#endif
+
+        w.endObject();
+    });
+
+    sched.reset();
+#if LOOP_PROFILER
+    prof.reset();
+#endif
+    mpuStats = {};
+#if LAN_ENDPOINT
+    lanStats.maxWaitUs = 0;
+#endif
+    clipOpenHist = {};
 }
 
-bool stopPlaying() {
-    bool stopped = false;
-    if (rtttl) {
-        rtttl->stop();
-        delete rtttl;
-        rtttl = nullptr;
-        stopped = true;
-    }
-    if (mp3) {
-        mp3->stop();
-        delete mp3;
-        mp3 = nullptr;
-        stopped = true;
-    }
-    if (buff) {
-        buff->close();
-        delete buff;
-        buff = nullptr;
-    }
-    if (file) {
-        file->close();
-        delete file;
-        file = nullptr;
-    }
-    if (stream) {
-        stream->close();
-        delete stream;
-        stream = nullptr;
+#if CMD_TRACE
+/**
+ * Start recording MQTT and LAN commands to TRACE_FILE, or stop it if recording
+ */
+void mqttCmdRecord() {
+    if (cmdTrace.recording()) {
+        cmdTrace.stop();
+        traceEvent("recorded", cmdTrace.recorded());
+    } else if (cmdTrace.startRecording(LittleFS.open(TRACE_FILE, "w"))) {
+        traceEvent("recording", 0);
     }
+}
 
-    return stopped;
+/**
+ * Replay recorded commands, at their recorded pace
+ */
+void mqttCmdReplay() {
+    cmdTrace.stop();
+    traceEvent(cmdTrace.startReplay(LittleFS.open(TRACE_FILE, "r")) ? "replaying" : "empty", 0);
 }
 
-void tts(String text, String voice) {
-    if (text.length()) {
-        String query = String("text=") + text;
-        if (voice.length()) {
-            query += "&voice=" + voice;
-        }
-        Serial.println(query.c_str());
-        HTTPClient http;
-        http.begin(espClient, TTS_PROXY_URL);
-        http.setAuthorization(TTS_PROXY_USER, TTS_PROXY_PASSWORD);
-        http.addHeader("Content-Type", "application/x-www-form-urlencoded");
-        int httpCode = http.POST(query);
-        if (httpCode == HTTP_CODE_OK) {
-            String payload = http.getString();
-            Serial.println(payload.c_str());
-            if (payload.endsWith(".mp3")) {
-                strlcpy(audioSource, payload.c_str(), sizeof(audioSource));
-                newAudioSource = true;
-            }
-        } else {
-            String payload = http.getString();
-            Serial.println(payload.c_str());
-        }
-    }
+void traceEvent(const char *state, uint16_t commands) {
+    char msg[80];
+    snprintf_P(msg, sizeof(msg), PSTR("{\"event\":\"trace\",\"state\":\"%s\",\"commands\":%u}"), state, commands);
+    Serial.println(msg);
+    publishEvent(msg);
 }
 
-void beep(uint8_t repeat) {
-    strlcpy(audioSource, "/mp3/nasty-error-long.mp3", sizeof(audioSource));
+// Outcome of a replayed command
+void traceResult(const TraceResult &r) {
+    char msg[128];
+    snprintf_P(msg, sizeof(msg), PSTR("{\"event\":\"replayed\",\"n\":%u,\"cmd\":\"%s\",\"dispatchUs\":%u,\"firstSampleUs\":%u}"),
+               r.n, r.label, (unsigned)r.dispatchUs, (unsigned)r.firstSampleUs);
+    Serial.println(msg);
+    publishEvent(msg);
+}
 
-    for (uint8_t i = 0; i < repeat; i++) {
-        playAudio();
-        while (mp3->isRunning()) {
-            if (!mp3->loop()) {
-                //mp3->stop();
-                stopPlaying();
-                //Serial.println(F("MP3 done"));
-            }
-            yield();
-        }
-    }
+/**
+ * Publish replay summary: command times, time to first audio sample, heap low-water marks
+ */
+void traceReport() {
+    const ReplayStats &stats = cmdTrace.replayStats();
+    mqttPublishReply([&](ReplyWriter &w) {
+        w.beginObject(7);
+        w.member(F("event"), "replay");
+        w.member(F("commands"), (uint32_t)stats.commands);
+        w.key(F("dispatch"));
+        writeHist(w, stats.dispatch);
+        w.key(F("firstSample"));
+        writeHist(w, stats.firstSample);
+        w.member(F("maxLateMs"), stats.maxLateMs);
+        w.member(F("minFreeHeap"), stats.minFreeHeap);
+        w.member(F("minMaxBlock"), (uint32_t)stats.minMaxBlock);
+        w.endObject();
+    });
 }
+#endif
 
 //############################################################################
-// LED
+// LAN
 //############################################################################
-void ledDefault(uint32_t delay) {
 
-    ledActionTimer.detach();
-    ledActionTimer.attach_ms(delay, []() {
-        ledActionInProgress = false;
-        static uint8_t hue = 0;
-        fill_solid(leds, NUM_LEDS, CHSV(hue++, 255, 255));
-    });
+#if LAN_ENDPOINT
+void lanBegin() {
+    if (LAN_USER[0]) {
+        lanWs.setAuthentication(LAN_USER, LAN_PASSWORD);
+    }
+    lanWs.onEvent(lanWsEvent);
+    lanServer.addHandler(&lanWs);
+    lanServer.on("/cmd", HTTP_POST, lanCmdRequest, nullptr, lanCmdBody);
+    lanServer.begin();
 }
 
-void ledRainbow(uint32_t delay) {
-
-    ledActionTimer.detach();
-    ledActionTimer.attach_ms(delay, []() {
-        ledActionInProgress = true;
-        static uint8_t hue = 0;
-        fill_solid(leds, NUM_LEDS, CHSV(hue, 255, 255));
-        hue = (hue + 1) % 255;
-    });
+bool lanAuthorized(AsyncWebServerRequest *request) {
+    return !LAN_USER[0] || request->authenticate(LAN_USER, LAN_PASSWORD);
 }
 
-void ledBlink(uint32_t delay, int color) {
+/**
+ * POST /cmd body, the command itself (JSON or MessagePack), in one or more parts
+ * Runs in system context: it's only copied, taskLan() executes it
+ */
+void lanCmdBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    if (lanAuthorized(request)) {
+        lanMailbox.write(request, data, len, index, total);
+    }
+}
 
-    curColor = color;
+// Replies come later, as events, to WebSocket clients and MQTT
+void lanCmdRequest(AsyncWebServerRequest *request) {
+    if (!lanAuthorized(request)) {
+        request->requestAuthentication();
+    } else if (lanMailbox.holds(request)) {
+        request->send(202);
+    } else if (request->contentLength() > MQTT_BUFF_SIZE) {
+        request->send(413);
+    } else {
+        request->send(request->contentLength() ? 503 : 400);
+    }
+}
 
-    Serial.println(curColor, HEX);
+/**
+ * WebSocket /ws: commands in, replies and events out
+ * Runs in system context, like lanCmdBody()
+ */
+void lanWsEvent(AsyncWebSocket *, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
+    if (type == WS_EVT_CONNECT) {
+        lanStats.connects++;
+    } else if (type == WS_EVT_DATA) {
+        // Unfragmented messages only, they may still come in several parts
+        AwsFrameInfo *info = (AwsFrameInfo *)arg;
+        if (info->num == 0 && info->final && !lanMailbox.write(client, data, len, info->index, info->len) && info->index == 0) {
+            client->text("{\"event\":\"lan busy\"}");
+        }
+    }
+}
 
-    ledActionTimer.detach();
-    ledActionTimer.attach_ms(delay, []() {
-        ledActionInProgress = true;
-        static bool t = true;
-        fill_solid(leds, NUM_LEDS, t ? curColor : CRGB::Black);
-        t = !t;
-    });
+/**
+ * Buffer for a copy of an out message to LAN WebSocket clients, nullptr if there's none
+ */
+AsyncWebSocketMessageBuffer *lanBuffer(size_t len) {
+    return lanWs.count() ? lanWs.makeBuffer(len) : nullptr;
 }
 
-void ledSine(uint32_t delay, int color) {
+void lanSend(AsyncWebSocketMessageBuffer *buf) {
+    if (replyFormat == CMD_MSGPACK) {
+        lanWs.binaryAll(buf);
+    } else {
+        lanWs.textAll(buf);
+    }
+}
+
+// Live stats for WebSocket clients, cheap enough to be sent every second
+void lanLive() {
+    char msg[160];
+    snprintf_P(msg, sizeof(msg), PSTR("{\"event\":\"live\",\"ms\":%u,\"idlePct\":%u,\"freeHeap\":%u,\"playing\":%s,\"queue\":%u,\"rssi\":%d}"),
+               (unsigned)millis(), sched.idlePct(), ESP.getFreeHeap(), isPlaying() ? "true" : "false", notifQueue.size(),
+               wifiIsConnected ? WiFi.RSSI() : 0);
+    lanWs.textAll(msg);
+}
+#endif
+
+//############################################################################
+// COMMANDS
+//############################################################################
+
+/*
+ * Key handlers, called for each top level member of a command while it's scanned
+ * Strings come in chunks (see CmdValue)
+ */
+
+void cmdKeyBright(Command &cmd, const CmdValue &v) {
+    cmd.fields |= CMD_F_BRIGHT;
+    cmd.bright = v.toInt();
+}
+
+// Cancel steps scheduled under this id: {"cancel":"door"}
+void cmdKeyCancel(Command &cmd, const CmdValue &v) {
+    cmd.fields |= CMD_F_CANCEL;
+    v.appendTo(cmd.cancel, sizeof(cmd.cancel));
+}
+
+#if CLIP_INDEX
+// Indexed LittleFS clip, by id: {"clip":7}
+void cmdKeyClip(Command &cmd, const CmdValue &v) {
+    cmd.fields |= CMD_F_MP3;
+    if (!clipIndex.path(v.toInt(), cmd.source, sizeof(cmd.source))) {
+        cmd.source[0] = 0;
+    }
+}
+#endif
+
+void cmdKeyCmd(Command &cmd, const CmdValue &v) {
+    cmd.fields |= CMD_F_CMD;
+    v.appendTo(cmd.cmd, sizeof(cmd.cmd));
+}
+
+void cmdKeyColor(Command &cmd, const CmdValue &v) {
+    cmd.fields |= CMD_F_COLOR;
+    cmd.color = v.toUInt();
+}
+
+void cmdKeyDelay(Command &cmd, const CmdValue &v) {
+    cmd.fields |= CMD_F_DELAY;
+    cmd.delay = v.toUInt();
+}
+
+void cmdKeyGain(Command &cmd, const CmdValue &v) {
+    cmd.fields |= CMD_F_GAIN;
+    cmd.gain = v.toFloat();
+}
+
+void cmdKeyLed(Command &cmd, const CmdValue &v) {
+    cmd.fields |= CMD_F_LED;
+    v.appendTo(cmd.led, sizeof(cmd.led));
+}
+
+void cmdKeyId(Command &cmd, const CmdValue &v) {
+    cmd.fields |= CMD_F_ID;
+    v.appendTo(cmd.id, sizeof(cmd.id));
+}
+
+// Reply in the command's own format (JSON or MessagePack): {"cmd":"about","mirror":true}
+void cmdKeyMirror(Command &cmd, const CmdValue &v) {
+    if (v.toInt()) {
+        cmd.fields |= CMD_F_MIRROR;
+    }
+}
+
+void cmdKeyMp3(Command &cmd, const CmdValue &v) {
+    cmd.fields |= CMD_F_MP3;
+    v.appendTo(cmd.source, sizeof(cmd.source));
+}
+
+void cmdKeyOnceGain(Command &cmd, const CmdValue &v) {
+    cmd.fields |= CMD_F_ONCEGAIN;
+    cmd.onceGain = v.toFloat();
+}
+
+void cmdKeyOverlay(Command &cmd, const CmdValue &v) {
+    if (v.toInt()) {
+        cmd.fields |= CMD_F_OVERLAY;
+    }
+}
 
-    curColor = color;
+void cmdKeyPriority(Command &cmd, const CmdValue &v) {
+    cmd.fields |= CMD_F_PRIORITY;
+    cmd.priority = v.toInt();
+}
+
+// Songs of any length are compiled to a LittleFS tune as they come, named after their title
+void cmdKeyRtttl(Command &cmd, const CmdValue &v) {
+    cmd.fields |= CMD_F_RTTTL;
+    if (v.first) {
+        cmdSpool.close();
+        cmdSpool = LittleFS.open(TUNE_SPOOL_FILE, "w");
+        rtttlCompiler.begin(cmdSpool);
+        cmd.source[0] = 0;
+    }
+    if (!cmdSpool) {
+        return;
+    }
+    rtttlCompiler.feed(v.str, v.len);
+    if (v.last) {
+        tuneSave(rtttlCompiler, cmdSpool, rtttlCompiler.title(), cmd.source, sizeof(cmd.source));
+    }
+}
 
-    ledActionTimer.detach();
-    ledActionTimer.attach_ms(delay, []() {
-        ledActionInProgress = true;
+void cmdKeyTts(Command &cmd, const CmdValue &v) {
+    cmd.fields |= CMD_F_TTS;
+    v.appendTo(cmd.tts, sizeof(cmd.tts));
+}
 
-        static uint8_t i = 0;
-        static CHSV hsvColor;
-        if (curColor) {
-            hsvColor = rgb2hsv_approximate(curColor);
-            curColor = 0;
+// Tune compiled earlier, by name: {"tune":"starwars"}
+void cmdKeyTune(Command &cmd, const CmdValue &v) {
+    cmd.fields |= CMD_F_RTTTL;
+    v.appendTo(cmd.source, TUNE_NAME_SIZE);
+    if (v.last) {
+        char name[TUNE_NAME_SIZE];
+        strlcpy(name, cmd.source, sizeof(name));
+        if (!tunePath(name, cmd.source, sizeof(cmd.source))) {
+            cmd.source[0] = 0;
         }
-        hsvColor.value = sin8(i);
-        fill_solid(leds, NUM_LEDS, hsvColor);
-        i = (i + 1) % 255;
-    });
+    }
 }
 
-void ledPulse(uint32_t delay, int color) {
+void cmdKeyVoice(Command &cmd, const CmdValue &v) {
+    cmd.fields |= CMD_F_VOICE;
+    v.appendTo(cmd.voice, sizeof(cmd.voice));
+}
+
+typedef void (*CmdKeyHandler)(Command &cmd, const CmdValue &v);
+typedef void (*CmdAction)();
+
+// Command keys, sorted by name
+constexpr CmdEntry<CmdKeyHandler> CMD_KEYS[] = {
+        {"bright",   cmdKeyBright},
+        {"cancel",   cmdKeyCancel},
+#if CLIP_INDEX
+        {"clip",     cmdKeyClip},
+#endif
+        {"cmd",      cmdKeyCmd},
+        {"color",    cmdKeyColor},
+        {"delay",    cmdKeyDelay},
+        {"gain",     cmdKeyGain},
+        {"id",       cmdKeyId},
+        {"led",      cmdKeyLed},
+        {"mirror",   cmdKeyMirror},
+        {"mp3",      cmdKeyMp3},
+        {"oncegain", cmdKeyOnceGain},
+        {"overlay",  cmdKeyOverlay},
+        {"priority", cmdKeyPriority},
+        {"rtttl",    cmdKeyRtttl},
+        {"tts",      cmdKeyTts},
+        {"tune",     cmdKeyTune},
+        {"voice",    cmdKeyVoice}
+};
+static_assert(cmdTableSorted(CMD_KEYS, sizeof(CMD_KEYS) / sizeof(CMD_KEYS[0])), "CMD_KEYS must be sorted");
+
+// Simple commands {"cmd":"..."}, sorted by name
+constexpr CmdEntry<CmdAction> CMD_ACTIONS[] = {
+        {"about",   mqttCmdAbout}, // About: {cmd:"about"}
+        {"break",   cmdBreak},     // Break current action: {cmd:"break"}
+        {"heap",    mqttCmdHeap},  // Heap telemetry: {cmd:"heap"}
+        {"list",    mqttCmdList},  // List LittleFS files: {cmd:"list"}
+#if CMD_TRACE
+        {"record",  mqttCmdRecord},// Record commands until sent again: {cmd:"record"}
+        {"replay",  mqttCmdReplay},// Replay recorded commands, publish their timings: {cmd:"replay"}
+#endif
+        {"restart", cmdRestart},   // Restart ESP: {cmd:"restart"}
+        {"stats",   mqttCmdStats}, // Loop profile: {cmd:"stats"}
+        {"toggle",  cmdToggle}     // Stop current notification, or play random MP3: {cmd:"toggle"}
+};
+static_assert(cmdTableSorted(CMD_ACTIONS, sizeof(CMD_ACTIONS) / sizeof(CMD_ACTIONS[0])), "CMD_ACTIONS must be sorted");
+
+// LED patterns, sorted by name
+constexpr CmdEntry<LedEffect> LED_EFFECTS[] = {
+        {"Blink",   LED_BLINK},
+        {"Disco",   LED_DISCO},
+        {"Off",     LED_OFF},
+        {"Pulse",   LED_PULSE},
+        {"Rainbow", LED_RAINBOW},
+        {"Sine",    LED_SINE},
+        {"Solid",   LED_SOLID}
+};
+static_assert(cmdTableSorted(LED_EFFECTS, sizeof(LED_EFFECTS) / sizeof(LED_EFFECTS[0])), "LED_EFFECTS must be sorted");
+
+/**
+ * Scanner sink dispatching top level members to their key handler,
+ * and collecting the steps array and the playlist as payload slices
+ */
+class CmdDecoder {
+public:
+    explicit CmdDecoder(Command &cmd) : cmd(cmd) {}
+
+    void value(const CmdValue &v) {
+        if (inSteps) {
+            step(v);
+            return;
+        }
+        if (inPlaylist) {
+            if (v.depth == 1 && v.type == CMD_END) {
+                cmd.playlistLen = v.offset - cmd.playlistOffset;
+                inPlaylist = false;
+            }
+            return;
+        }
+        if (v.depth != 1 || v.type == CMD_END) {
+            return;
+        }
+        if (v.type == CMD_ARRAY && strcmp(v.key, "steps") == 0) {
+            cmd.fields |= CMD_F_STEPS;
+            inSteps = true;
+            return;
+        }
+        if (v.type == CMD_ARRAY && strcmp(v.key, "playlist") == 0) {
+            cmd.fields |= CMD_F_PLAYLIST;
+            cmd.playlistOffset = v.offset;
+            inPlaylist = true;
+            return;
+        }
+        const CmdEntry<CmdKeyHandler> *e = cmdLookup(CMD_KEYS, v.key, strlen(v.key));
+        if (e) {
+            e->target(cmd, v);
+        }
+    }
+
+private:
+    /*
+     * Steps: [{"at":0,...},{"after":1500,...}]
+     * "at" is relative to command execution, "after" to previous step, default is after 0
+     */
+    void step(const CmdValue &v) {
+        if (v.depth == 1) {
+            inSteps = false; // End of steps
+        } else if (v.depth == 2 && v.type == CMD_OBJECT) {
+            stepStart = v.offset;
+            stepAt = lastAt;
+        } else if (v.depth == 3 && (v.type == CMD_NUMBER || v.type == CMD_STRING)) {
+            if (strcmp(v.key, "at") == 0) {
+                stepAt = v.toUInt();
+            } else if (strcmp(v.key, "after") == 0) {
+                stepAt = lastAt + v.toUInt();
+            }
+        } else if (v.depth == 2 && v.type == CMD_END) {
+            if (cmd.stepCount < CMD_MAX_STEPS) {
+                CmdStep &s = cmd.steps[cmd.stepCount++];
+                s.offset = stepStart;
+                s.len = v.offset - stepStart;
+                s.at = stepAt;
+            } else {
+                cmd.stepsDropped++;
+            }
+            lastAt = stepAt;
+        }
+    }
 
-    curColor = color;
-    curDelay = delay;
+    Command &cmd;
+    bool inSteps = false;
+    bool inPlaylist = false;
+    size_t stepStart = 0;
+    uint32_t stepAt = 0;
+    uint32_t lastAt = 0;
+};
+
+template<typename Scanner>
+bool cmdScan(Scanner &scanner, const uint8_t *payload, size_t length, size_t &errorOffset) {
+    if (scanner.feed(payload, length) && scanner.finish()) {
+        return true;
+    }
+    errorOffset = scanner.errorOffset();
+    return false;
+}
 
-    ledActionTimer.detach();
-    ledActionTimer.attach_ms(delay, []() {
-        ledActionInProgress = true;
+/**
+ * Short command type name, to relate heap samples to commands
+ */
+const char *cmdLabel(const Command &cmd) {
+    if (cmd.fields & CMD_F_CMD) {
+        return cmd.cmd;
+    }
+    if (cmd.fields & CMD_F_TTS) {
+        return "tts";
+    }
+    if (cmd.fields & CMD_F_MP3) {
+        return "mp3";
+    }
+    if (cmd.fields & CMD_F_RTTTL) {
+        return "rtttl";
+    }
+    if (cmd.fields & CMD_F_LED) {
+        return "led";
+    }
+    if (cmd.fields & CMD_F_STEPS) {
+        return "steps";
+    }
+    if (cmd.fields & CMD_F_PLAYLIST) {
+        return "clips";
+    }
+    return "set";
+}
 
-        static uint16_t blackCountdown = 0;
+/**
+ * Run command received over MQTT or LAN, both accept the same commands
+ */
+void cmdDispatch(const uint8_t *payload, size_t length) {
+    uint32_t heapBefore = heapMon.mark();
+    if (!cmdParse(payload, length, cmdIn)) {
+        return;
+    }
+#if CMD_TRACE
+    // Trace controls are not part of the trace
+    if (!(cmdIn.fields & CMD_F_CMD) || (strcmp(cmdIn.cmd, "record") != 0 && strcmp(cmdIn.cmd, "replay") != 0)) {
+        cmdTrace.record(payload, length);
+    }
+#endif
+    cmdExecute(cmdIn);
+    heapSample(cmdLabel(cmdIn), heapBefore);
+}
 
-        if (blackCountdown) {
-            blackCountdown--;
+/**
+ * Decode command payload in a single pass, without dynamic memory
+ * Payload is MessagePack if it starts with a map header, JSON otherwise
+ */
+bool cmdParse(const uint8_t *payload, size_t length, Command &cmd) {
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.payload = payload;
+    cmd.format = length && ((payload[0] & 0xF0) == 0x80 || payload[0] == 0xDE || payload[0] == 0xDF) ? CMD_MSGPACK : CMD_JSON;
+
+    CmdDecoder decoder(cmd);
+    size_t errorOffset = 0;
+    if (cmd.format == CMD_MSGPACK) {
+        MsgPackScanner<CmdDecoder> scanner(decoder);
+        if (cmdScan(scanner, payload, length, errorOffset)) {
+            return true;
+        }
+    } else {
+        JsonScanner<CmdDecoder> scanner(decoder);
+        if (cmdScan(scanner, payload, length, errorOffset)) {
+            return true;
+        }
+    }
+
+    cmdSpool.close();
+    char msg[64];
+    snprintf_P(msg, sizeof(msg), PSTR("{\"event\":\"parse error\",\"offset\":%u}"), (unsigned)errorOffset);
+    Serial.println(msg);
+    publishEvent(msg);
+    return false;
+}
+
+void cmdExecute(const Command &cmd) {
+
+    replyFormat = cmd.fields & CMD_F_MIRROR ? cmd.format : CMD_JSON;
+
+    // Schedule steps: {"id":"door","steps":[{"mp3":"/mp3/chime.mp3"},{"after":1500,"tts":"Door open"}]}
+    uint16_t mark = timeline.mark();
+    if (cmd.fields & CMD_F_STEPS) {
+        cmdSchedule(cmd);
+    }
+
+    cmdApply(cmd);
+
+    // Cancel steps scheduled before this command: {"cancel":"door"}
+    // Last, as it compacts the timeline pool, which holds the payload of a step being run
+    if (cmd.fields & CMD_F_CANCEL) {
+        timeline.cancel(cmd.cancel, mark);
+    }
+}
+
+void cmdApply(const Command &cmd) {
+    // Simple commands
+    if (cmd.fields & CMD_F_CMD) {
+        const CmdEntry<CmdAction> *e = cmdLookup(CMD_ACTIONS, cmd.cmd, strlen(cmd.cmd));
+        if (e) {
+            e->target();
+        }
+        return;
+    }
+
+    // Set max brightness: {bright:255}
+    if (cmd.fields & CMD_F_BRIGHT) {
+        led.setBrightness(cmd.bright);
+    }
+
+    // Set default gain: {"gain":1.2}
+    if (cmd.fields & CMD_F_GAIN) {
+        if (cmd.gain > 0.01 && cmd.gain < 3.0) {
+            defaultGain = cmd.gain;
+        }
+    }
+
+    // Set once gain: {oncegain:1.2}
+    if (cmd.fields & CMD_F_ONCEGAIN) {
+        if (cmd.onceGain > 0.01 && cmd.onceGain < 3.0) {
+            onceGain = cmd.onceGain;
+        }
+    }
+
+    Notification notif = {};
+
+    // Set new message priority : {"led":"Blink",color:"0xff0000",delay:50,priority:9}
+    // Audio with higher priority preempts the one being played, lower priority waits or is dropped (NOTIF_LOW_PRIORITY)
+    // LED pattern is considered only if msg priority is >= to previous msg priority
+    // This is to avoid masking an important LED alert with a minor one
+    if (cmd.fields & CMD_F_PRIORITY) {
+        notif.priority = cmd.priority;
+        notif.hasPriority = true;
+    }
+
+    // Set led pattern: {"led":"Blink",color:"0xff0000",delay:50}
+    if (cmd.fields & CMD_F_LED) {
+        notif.hasLed = true;
+        notif.ledDelay = (cmd.fields & CMD_F_DELAY) ? cmd.delay : 100;
+        notif.ledColor = (cmd.fields & CMD_F_COLOR) ? cmd.color : 0xFFFFFF;
+
+        const CmdEntry<LedEffect> *e = cmdLookup(LED_EFFECTS, cmd.led, strlen(cmd.led));
+        if (e) {
+            notif.ledEffect = e->target;
+        } else {
+            notif.ledEffect = LED_DEFAULT;
+            notif.ledDelay = 500;
+        }
+    }
+
+    // Set new audio source
+    // - MP3 from stream: {"mp3":"http://www.universal-soundbank.com/sounds/7340.mp3"}
+    // - MP3 from LittleFS: {"mp3":"/mp3/song.mp3"}
+    // - RTTTL, compiled to a tune named after its title: {"rtttl":"Xfiles:d=4,o=5,b=180:e,b,a,b,d6,2b."}
+    // - Tune compiled earlier: {"tune":"xfiles"}
+    strlcpy(notif.source, cmd.source, sizeof(notif.source));
+
+    // Play clips back to back, without gap between MP3 clips: {"playlist":["/mp3/one.mp3","/mp3/two.mp3"]}
+    // Only one playlist is kept, a new one replaces it
+    if (cmd.fields & CMD_F_PLAYLIST) {
+        if (playlist.load(cmd.payload + cmd.playlistOffset, cmd.playlistLen, cmd.format)) {
+            playlist.item(0, notif.source, sizeof(notif.source));
+            notif.playlist = true;
+        }
+    }
+
+    // Audio notifications are queued and bring their LED pattern along,
+    // LED only notifications are applied right away
+    // Tune overlays play at once over current audio: {"rtttl":"Beep:d=8,o=6,b=200:c,e,g","overlay":true}
+    if ((cmd.fields & CMD_F_OVERLAY) && (cmd.fields & CMD_F_RTTTL)) {
+        playOverlay(notif.source, onceGain);
+        onceGain = 0;
+        if (notif.hasLed) {
+            notifyLed(notif);
+        }
+    } else if (notif.source[0]) {
+        notif.gain = onceGain;
+        onceGain = 0;
+        notify(notif);
+    } else if (cmd.fields & CMD_F_TTS) {
+        // Set new MP3 source from TTS proxy {"tts":"May the force be with you"}
+        // The request runs in the background, the notification is queued when the MP3 URL comes back
+        notif.gain = onceGain;
+        onceGain = 0;
+        tts(cmd.tts, cmd.voice, notif);
+    } else if (notif.hasLed) {
+        notifyLed(notif);
+    }
+}
+
+/**
+ * Copy command steps to the timeline, report steps that didn't fit
+ */
+void cmdSchedule(const Command &cmd) {
+    uint32_t now = millis();
+    uint8_t dropped = cmd.stepsDropped;
+    for (uint8_t i = 0; i < cmd.stepCount; i++) {
+        const CmdStep &step = cmd.steps[i];
+        if (!timeline.add(cmd.id, now + step.at, cmd.payload + step.offset, step.len)) {
+            dropped++;
+        }
+    }
+    if (dropped) {
+        char msg[96];
+        snprintf_P(msg, sizeof(msg), PSTR("{\"event\":\"timeline full\",\"id\":\"%s\",\"dropped\":%u,\"steps\":%u}"),
+                   cmd.id, dropped, timeline.size());
+        Serial.println(msg);
+        publishEvent(msg);
+    }
+}
+
+void cmdBreak() {
+    timeline.clear();
+    stopPlaying();
+    stopOverlay();
+    notifQueue.clear();
+    ttsQueue.clear();
+    if (led.busy()) {
+        msgPriority = 0;
+        ledDefault();
+    }
+}
+
+void cmdRestart() {
+    ESP.restart();
+    delay(500);
+}
+
+void cmdToggle() {
+    // If something is running, stop it...
+    bool stopped = stopPlaying();
+    stopped |= stopOverlay();
+
+    if (led.busy()) {
+        msgPriority = 0;
+        ledDefault();
+        stopped = true;
+    }
+
+    // ...otherwise, play random MP3 from stream
+    if (!stopped) {
+        Notification random = {};
+        strlcpy(random.source, RANDOM_STREAM_URL, sizeof(random.source));
+        notify(random);
+    }
+}
+
+//############################################################################
+// NOTIFICATIONS
+//############################################################################
+
+/**
+ * Queue audio notification
+ */
+void notify(const Notification &notif) {
+    if (NOTIF_LOW_PRIORITY == NOTIF_DROP && isPlaying() && notif.priority < curPriority) {
+        notifDrops++;
+        notifyEvent("dropped", notif);
+        return;
+    }
+
+    // Report the entry that won't play: the evicted one, or the rejected one
+    Notification evicted;
+    switch (notifQueue.push(notif, &evicted)) {
+        case NOTIF_EVICTED:
+            notifDrops++;
+            notifyEvent("dropped", evicted);
+            break;
+        case NOTIF_REJECTED:
+            notifDrops++;
+            notifyEvent("dropped", notif);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Apply notification LED pattern, unless a higher priority one is displayed
+ */
+void notifyLed(const Notification &notif) {
+    if (notif.hasPriority) {
+        if (notif.priority < msgPriority) {
             return;
         }
+        msgPriority = notif.priority;
+    }
+    wifiOfflineLed = false;
+    led.start(notif.ledEffect, notif.ledDelay, notif.ledColor);
+}
+
+/**
+ * Publish notification queue event to MQTT out topic, with the priority and source of notif
+ */
+void notifyEvent(const char *event, const Notification &notif) {
+    char msg[128 + AUDIO_SOURCE_SIZE];
+    MemoryPrint mem((uint8_t *)msg, sizeof(msg) - 1);
+    ReplyWriter w(mem, CMD_JSON);
+    w.beginObject(6);
+    w.member(F("event"), event);
+    w.member(F("priority"), (uint32_t)notif.priority);
+    w.member(F("source"), notif.source);
+    w.member(F("depth"), (uint32_t)notifQueue.size());
+    w.member(F("drops"), notifDrops);
+    w.member(F("preemptions"), notifPreemptions);
+    w.endObject();
+    msg[mem.length()] = 0;
+    Serial.println(msg);
+    publishEvent(msg);
+}
+
+void startNotification(const Notification &notif) {
+    if (notif.hasLed) {
+        notifyLed(notif);
+    }
+    curPriority = notif.priority;
+    curGain = notif.gain;
+    playAudio(notif.source, notif.gain, notif.cacheKey);
+    if (notif.playlist && isPlaying()) {
+        playlist.start();
+    }
+}
 
-        static uint8_t i = 0;
-        CRGB rgbColor = curColor;
+//############################################################################
+// AUDIO
+//############################################################################
 
-        rgbColor.fadeToBlackBy(i);
-        fill_solid(leds, NUM_LEDS, rgbColor);
-        i = (i + 1) % 255;
+bool isMp3Source(const char *source) {
+    return strncmp("http", source, 4) == 0 || (source[0] == '/' && !isTuneSource(source) && !isPcmSource(source))
+           || strcmp(source, TTS_STREAM_SOURCE) == 0;
+}
 
-        if (i == 0) {
-            blackCountdown = 750 / curDelay; // Stay black during 750ms
+// LittleFS clip transcoded at build time: 16 bit PCM WAV or ADPCM
+bool isPcmSource(const char *source) {
+    const char *ext = strrchr(source, '.');
+    return source[0] == '/' && ext && (strcmp(ext, ".wav") == 0 || strcmp(ext, ".adp") == 0);
+}
+
+/**
+ * LittleFS file lookup, from the clip index for clips
+ */
+bool clipExists(const char *path) {
+#if CLIP_INDEX
+    if (strncmp(path, CLIP_DIR "/", sizeof(CLIP_DIR)) == 0) {
+        return clipIndex.find(path);
+    }
+#endif
+    return LittleFS.exists(path);
+}
+
+/**
+ * Replace missing LittleFS MP3 clip path with its transcoded clip path, if any
+ * The file system image holds either, so commands and playlists keep naming clips .mp3
+ */
+bool pcmResolve(char *source) {
+    char *ext = strrchr(source, '.');
+    if (source[0] != '/' || !ext || strcmp(ext, ".mp3") != 0 || clipExists(source)) {
+        return false;
+    }
+    static const char *const EXTS[] = {".adp", ".wav"};
+    for (const char *e : EXTS) {
+        strcpy(ext, e);
+        if (clipExists(source)) {
+            return true;
         }
-    });
+    }
+    strcpy(ext, ".mp3");
+    return false;
+}
+
+// Compiled tune, or RTTTL song file compiled on first play
+bool isTuneSource(const char *source) {
+    const char *ext = strrchr(source, '.');
+    return ext && (strcmp(ext, ".tune") == 0 || strcmp(ext, ".rtttl") == 0);
+}
+
+/**
+ * Build tune path from name, keeping only its letters (lowercased), digits, '-' and '_'
+ * Return false if nothing is left
+ */
+bool tunePath(const char *name, char *path, size_t size) {
+    char clean[TUNE_NAME_SIZE];
+    size_t len = 0;
+    for (; *name && len < sizeof(clean) - 1; name++) {
+        if (isalnum(*name) || *name == '-' || *name == '_') {
+            clean[len++] = tolower(*name);
+        }
+    }
+    clean[len] = 0;
+    return len && (size_t)snprintf_P(path, size, PSTR(TUNE_DIR "/%s.tune"), clean) < size;
+}
+
+bool sameFile(const char *pathA, const char *pathB) {
+    File a = LittleFS.open(pathA, "r");
+    File b = LittleFS.open(pathB, "r");
+    if (!a || !b || a.size() != b.size()) {
+        return false;
+    }
+    uint8_t bufA[32];
+    uint8_t bufB[32];
+    size_t n;
+    while ((n = a.read(bufA, sizeof(bufA))) > 0) {
+        if (b.read(bufB, n) != n || memcmp(bufA, bufB, n) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Close spooled tune being compiled, and move it to its named path
+ * Unnamed songs are saved under TUNE_DEFAULT_NAME
+ */
+bool tuneSave(RtttlCompiler &compiler, File &spool, const char *name, char *path, size_t size) {
+    bool ok = compiler.end();
+    spool.close();
+    if (!tunePath(name, path, size)) {
+        tunePath(TUNE_DEFAULT_NAME, path, size);
+    }
+    if (!ok) {
+        Serial.println(F("**Invalid RTTTL song"));
+        path[0] = 0;
+        return false;
+    }
+    // Songs sent again and again (chimes) don't wear the flash, nor replace a tune being played
+    if (sameFile(TUNE_SPOOL_FILE, path)) {
+        LittleFS.remove(TUNE_SPOOL_FILE);
+    } else {
+        if (overlayTune && strcmp(path, overlaySource) == 0) {
+            stopOverlay();
+        }
+        if (tune && strcmp(path, audioSource) == 0) {
+            stopPlaying();
+        }
+        if (!LittleFS.rename(TUNE_SPOOL_FILE, path)) {
+            path[0] = 0;
+            return false;
+        }
+    }
+    Serial.printf_P(PSTR("**Tune: %s, %u notes, %u ms\n"), path, compiler.count(), (unsigned)compiler.lengthMs());
+    return true;
+}
+
+/**
+ * Replace LittleFS RTTTL song path with its tune path, compiling it if not done yet
+ * Tunes are named after the song file, so uploading a new file system image recompiles them
+ */
+bool tuneResolve(char *source) {
+    const char *ext = strrchr(source, '.');
+    if (!ext) {
+        return false;
+    }
+    if (strcmp(ext, ".tune") == 0) {
+        return true;
+    }
+    const char *slash = strrchr(source, '/');
+    const char *base = slash ? slash + 1 : source;
+    char name[TUNE_NAME_SIZE];
+    strlcpy(name, base, min<size_t>(ext - base + 1, sizeof(name)));
+    char path[AUDIO_SOURCE_SIZE];
+    if (!tunePath(name, path, sizeof(path))) {
+        return false;
+    }
+    if (!LittleFS.exists(path)) {
+        File song = LittleFS.open(source, "r");
+        File spool = LittleFS.open(TUNE_SPOOL_FILE, "w");
+        if (!song || !spool) {
+            return false;
+        }
+        RtttlCompiler compiler;
+        compiler.begin(spool);
+        char buf[64];
+        while (song.available()) {
+            size_t n = song.read((uint8_t *)buf, sizeof(buf));
+            compiler.feed(buf, n);
+        }
+        song.close();
+        if (!tuneSave(compiler, spool, name, path, sizeof(path))) {
+            return false;
+        }
+    }
+    strlcpy(source, path, AUDIO_SOURCE_SIZE);
+    return true;
+}
+
+/**
+ * Open MP3 source chain on deck, source is replaced by the cached copy path if any
+ * Stream is cached while it plays if withCache, only one stream at a time can be
+ * A stream is only started, to be opened by Deck::openStep()
+ */
+AudioFileSource *openClip(Deck &d, char *source, uint32_t cacheKey, bool withCache) {
+    // Streamed TTS answer, played from the connection that requested it, if still held for this notification
+    if (strcmp(source, TTS_STREAM_SOURCE) == 0) {
+        if (!ttsClient.held() || cacheKey != ttsJob.cacheKey) {
+            Serial.println(F("**TTS stream expired"));
+            Notification lost = {};
+            strlcpy(lost.source, source, sizeof(lost.source));
+            lost.priority = curPriority;
+            notifDrops++;
+            notifyEvent("dropped", lost);
+            return nullptr;
+        }
+        uint32_t size;
+        bool reusable;
+        WiFiClient client = ttsClient.take(size, reusable);
+        Serial.printf_P(PSTR("**MP3 TTS stream: %u bytes\n"), (unsigned)size);
+        return d.openClient(client, size, reusable, withCache ? &clipCache : nullptr, cacheKey);
+    }
+
+    // URLs with a query string (e.g. random MP3) are dynamic, they're never cached
+    bool cacheable = cacheKey || !strchr(source, '?');
+    uint32_t key = cacheKey ?: clipHash(source);
+    char cachePath[24];
+    if (cacheable && strncmp("http", source, 4) == 0 && clipCache.lookup(key, cachePath, sizeof(cachePath))) {
+        Serial.printf_P(PSTR("**MP3 cached: %s\n"), source);
+        strlcpy(source, cachePath, AUDIO_SOURCE_SIZE);
+    }
+
+    if (strncmp("http", source, 4) == 0) {
+        Serial.printf_P(PSTR("**MP3 stream: %s\n"), source);
+        d.startStream(source, cacheable && withCache ? &clipCache : nullptr, key, STREAM_RESUME_RETRIES);
+        return nullptr;
+    }
+    Serial.printf_P(PSTR("**MP3 file: %s\n"), source);
+    return d.openFile(source);
+}
+
+/**
+ * Play MP3 from URL or LittleFS, or tune, or transcoded clip
+ * Streams are played from cache when available, cached while they play otherwise,
+ * under cacheKey if provided, or under a hash of their URL if it has no query string
+ */
+void playAudio(const char *source, float gain, uint32_t cacheKey) {
+
+    if (source[0] == 0) {
+        return;
+    }
+
+    stopPlaying();
+
+    uint32_t heapBefore = heapMon.mark();
+
+    if (source != audioSource) {
+        strlcpy(audioSource, source, AUDIO_SOURCE_SIZE);
+    }
+
+    mainOut->SetGain(gain ?: defaultGain);
+
+    uint32_t openStart = micros();
+    pcmResolve(audioSource);
+    if (isMp3Source(audioSource)) {
+        // Get MP3 from stream, cache or LittleFS, a stream starts playing from taskAudio once open
+        AudioFileSource *src = openClip(*deck, audioSource, cacheKey, true);
+        if (!deck->opening()) {
+            startMp3(src);
+        }
+    } else if (isTuneSource(audioSource) && tuneResolve(audioSource)) {
+        // Synthesize compiled tune from LittleFS
+        Serial.printf_P(PSTR("**Tune file: %s\n"), audioSource);
+        AudioFileSource *src = deck->openFile(audioSource);
+        tune = tuneSlot.create(TUNE_AMPLITUDE);
+        tune->begin(src, mainOut);
+        if (!tune->isRunning()) {
+            stopPlaying();
+        }
+    } else if (isPcmSource(audioSource)) {
+        // Transcoded clip from LittleFS, a fraction of the MP3 decoding time
+        Serial.printf_P(PSTR("**PCM file: %s\n"), audioSource);
+        AudioFileSource *src = deck->openFile(audioSource);
+        if (strcmp(strrchr(audioSource, '.'), ".adp") == 0) {
+            pcm = adpcmSlot.create();
+        } else {
+            pcm = wavSlot.create();
+        }
+        pcm->begin(src, mainOut);
+        if (!pcm->isRunning()) {
+            stopPlaying();
+        }
+    }
+
+    if (audioSource[0] == '/' && isPlaying()) {
+        clipOpenHist.add(micros() - openStart);
+    }
+    TRACE(clipStarted(MIX_MAIN));
+    heapSample("play", heapBefore);
+}
+
+void startMp3(AudioFileSource *src) {
+    mp3 = mp3Slot.create(mp3Codec, sizeof(mp3Codec));
+    mp3->begin(src, mainOut);
+    if (!mp3->isRunning()) {
+        //Serial.println(F("Unable to play MP3"));
+        stopPlaying();
+    }
+}
+
+bool stopPlaying() {
+    uint32_t heapBefore = heapMon.mark();
+    bool stopped = false;
+    if (tune) {
+        tune->stop();
+        tuneSlot.destroy();
+        tune = nullptr;
+        stopped = true;
+    }
+    if (pcm) {
+        pcm->stop();
+        adpcmSlot.destroy();
+        wavSlot.destroy();
+        pcm = nullptr;
+        stopped = true;
+    }
+    if (mp3) {
+        mp3->stop();
+        mp3Slot.destroy();
+        mp3 = nullptr;
+        stopped = true;
+    }
+    streamReport();
+    deck->close();
+    nextDeck->close();
+    playlist.stop();
+    prefetchTried = false;
+    handoffPending = false;
+
+    if (stopped) {
+        heapSample("stop", heapBefore);
+    }
+    return stopped;
+}
+
+/**
+ * Publish jitter buffer statistics of the stream being closed
+ */
+void streamReport() {
+    if (!deck->jitter()) {
+        return;
+    }
+    JitterStats js = deck->jitter()->report();
+    char msg[224];
+    snprintf_P(msg, sizeof(msg),
+               PSTR("{\"event\":\"stream\",\"kbps\":%u,\"netKbps\":%u,\"startMs\":%u,\"underruns\":%u,\"rebufferMs\":%u,"
+                    "\"target\":%u,\"minFill\":%u,\"avgFill\":%u,\"resumes\":%u}"),
+               (unsigned)(js.drainRate * 8 / 1000), (unsigned)(js.netRate * 8 / 1000), (unsigned)js.startMs,
+               (unsigned)js.underruns, (unsigned)js.rebufferMs, (unsigned)js.target, js.minFillPct, js.avgFillPct,
+               deck->stream() ? deck->stream()->resumes() : 0);
+    Serial.println(msg);
+    publishEvent(msg);
+}
+
+/**
+ * Open next clip on nextDeck when current one is about to end, so that its buffer fills meanwhile
+ * Next clip is the next playlist item, or the next queued notification if it would not preempt
+ */
+void prefetchLoop() {
+    if (nextDeck->opening()) {
+        // A step per pass, the current clip is decoded in between
+        nextDeck->openStep();
+        return;
+    }
+    if (nextDeck->isOpen()) {
+        nextDeck->loop();
+        return;
+    }
+    if (prefetchTried || deck->remaining() > PREFETCH_AHEAD_SIZE) {
+        return;
+    }
+    prefetchTried = true; // Once per clip, whatever the outcome
+
+    uint32_t cacheKey = 0;
+    if (playlist.hasNext()) {
+        playlist.item(playlist.position() + 1, nextSource, AUDIO_SOURCE_SIZE);
+        nextFromQueue = false;
+    } else if (!notifQueue.empty() && notifQueue.top().priority <= curPriority) {
+        const Notification &notif = notifQueue.top();
+        strlcpy(nextSource, notif.source, AUDIO_SOURCE_SIZE);
+        cacheKey = notif.cacheKey;
+        nextId = clipHash(notif.source);
+        nextFromQueue = true;
+    } else {
+        return;
+    }
+    pcmResolve(nextSource);
+    if (!isMp3Source(nextSource)) {
+        return;
+    }
+
+    uint32_t heapBefore = heapMon.mark();
+    // Cache tee writes a single temporary file, it belongs to the current clip
+    openClip(*nextDeck, nextSource, cacheKey, false);
+    heapSample("next", heapBefore);
+}
+
+/**
+ * Hand decoder over to the prefetched clip, keeping the mixer channel and I2S running
+ * endUs is when the current clip's decoder ran dry
+ * A clip still opening is advanced a step, HANDOFF_PENDING until it's open
+ */
+HandoffState handoff(uint32_t endUs) {
+    if (nextDeck->opening()) {
+        nextDeck->openStep();
+        if (nextDeck->opening()) {
+            return HANDOFF_PENDING;
+        }
+    }
+    if (!nextDeck->isOpen()) {
+        return HANDOFF_NONE;
+    }
+
+    // Playlist may have been replaced, queue may have changed since the prefetch
+    float gain = curGain;
+    if (nextFromQueue) {
+        if (notifQueue.empty() || clipHash(notifQueue.top().source) != nextId
+            || notifQueue.top().priority > curPriority) {
+            nextDeck->close();
+            return HANDOFF_NONE;
+        }
+        Notification notif;
+        notifQueue.pop(notif);
+        if (notif.hasLed) {
+            notifyLed(notif);
+        }
+        curPriority = notif.priority;
+        gain = curGain = notif.gain;
+        if (notif.playlist) {
+            playlist.start();
+        } else {
+            playlist.stop();
+        }
+    } else if (!playlist.hasNext()) {
+        nextDeck->close();
+        return HANDOFF_NONE;
+    } else {
+        playlist.advance();
+    }
+
+    mixer.channel(MIX_MAIN).hold();
+    mp3->stop();
+    mp3Slot.destroy();
+    streamReport();
+    deck->close();
+    std::swap(deck, nextDeck);
+    deck->takeBuffer(*nextDeck);
+    std::swap(audioSource, nextSource);
+    prefetchTried = false;
+
+    mainOut->SetGain(gain ?: defaultGain);
+    mp3 = mp3Slot.create(mp3Codec, sizeof(mp3Codec));
+    mp3->begin(deck->source(), mainOut);
+    if (!mp3->isRunning() || (deck->ready() && !mp3->loop())) {
+        return HANDOFF_NONE;
+    }
+    mixer.pump();
+    if (nextFromQueue) {
+        TRACE(firstSample(micros())); // Queued notification starts gapless
+    }
+
+    uint32_t gapUs = micros() - endUs;
+    bool underrun = i2s_is_empty();
+    gaplessStats.handoffs++;
+    gaplessStats.lastGapUs = gapUs;
+    gaplessStats.maxGapUs = max(gaplessStats.maxGapUs, gapUs);
+    gaplessStats.underruns += underrun;
+
+    Serial.printf_P(PSTR("**MP3 gapless: %s (%u us)\n"), audioSource, (unsigned)gapUs);
+    char msg[128];
+    snprintf_P(msg, sizeof(msg), PSTR("{\"event\":\"gapless\",\"gapUs\":%u,\"underrun\":%s,\"position\":%d}"),
+               (unsigned)gapUs, underrun ? "true" : "false", playlist.position());
+    publishEvent(msg);
+    return HANDOFF_DONE;
+}
+
+/**
+ * Play tune (or LittleFS .rtttl file) over current audio, which is ducked meanwhile
+ */
+void playOverlay(const char *source, float gain) {
+
+    if (source[0] == 0) {
+        return;
+    }
+
+    stopOverlay();
+    strlcpy(overlaySource, source, sizeof(overlaySource));
+
+    if (!isTuneSource(overlaySource) || !tuneResolve(overlaySource)) {
+        return;
+    }
+
+    overlayOut->SetGain(gain ?: defaultGain);
+    overlayTune = overlayTuneSlot.create(TUNE_AMPLITUDE);
+    if (mp3 && mp3->isRunning()) {
+        overlayTune->SetRate(mixer.channel(MIX_MAIN).rate()); // Mixer inputs share output rate
+    }
+
+    Serial.printf_P(PSTR("**Tune overlay: %s\n"), overlaySource);
+    overlayFile = overlayFileSlot.create(overlaySource);
+    overlayTune->begin(overlayFile, overlayOut);
+    if (!overlayTune->isRunning()) {
+        stopOverlay();
+    }
+    TRACE(clipStarted(MIX_OVERLAY));
+}
+
+bool stopOverlay() {
+    bool stopped = false;
+    if (overlayTune) {
+        overlayTune->stop();
+        overlayTuneSlot.destroy();
+        overlayTune = nullptr;
+        stopped = true;
+    }
+    if (overlayFile) {
+        overlayFile->close();
+        overlayFileSlot.destroy();
+        overlayFile = nullptr;
+    }
+    return stopped;
+}
+
+bool isPlaying() {
+    return handoffPending || deck->opening() || (mp3 && mp3->isRunning()) || (tune && tune->isRunning()) || (pcm && pcm->isRunning());
+}
+
+/**
+ * Queue TTS request, the MP3 (or its URL) is requested from the proxy in the background
+ */
+void tts(const char *text, const char *voice, const Notification &notif) {
+    if (!text || !text[0]) {
+        return;
+    }
+
+    voice = voice ? voice : "";
+
+    // Same voice and text always give the same MP3, play it from cache if already there
+    Notification cached = notif;
+    cached.cacheKey = clipHash(text, clipHash(voice, clipHash("tts:")));
+    if (clipCache.lookup(cached.cacheKey, cached.source, sizeof(cached.source))) {
+        notify(cached);
+        return;
+    }
+
+    TtsJob job;
+    static_cast<Notification &>(job) = cached;
+    strlcpy(job.text, text, sizeof(job.text));
+    strlcpy(job.voice, voice, sizeof(job.voice));
+    job.retried = false;
+
+    uint32_t heapBefore = heapMon.mark();
+    if (ttsQueue.push(job) != NOTIF_QUEUED) {
+        notifDrops++;
+        notifyEvent("ttsDropped", notif);
+    }
+    heapSample("tts", heapBefore);
+}
+
+/**
+ * Whether the notification of job would play next: now, by preempting the current one,
+ * or prefetched as the current MP3 nears its end
+ */
+bool ttsDueToPlay(const TtsJob &job) {
+    if (!notifQueue.empty() && notifQueue.top().priority >= job.priority) {
+        return false;
+    }
+    return !isPlaying() || job.priority > curPriority || (mp3 && deck->remaining() <= PREFETCH_AHEAD_SIZE);
+}
+
+/**
+ * Handle TTS proxy response and report request latency, up to the MP3 first bytes when streamed
+ */
+void ttsDone() {
+    bool streamed = ttsClient.held();
+    const char *url = ttsClient.body();
+    size_t len = strlen(url);
+    bool ok = streamed || (ttsClient.status() == HTTP_CODE_OK && len > 4 && strcmp(url + len - 4, ".mp3") == 0);
+
+    char msg[112];
+    snprintf_P(msg, sizeof(msg), PSTR("{\"event\":\"tts\",\"status\":%d,\"ms\":%u,\"stream\":%s,\"pending\":%u}"),
+               ttsClient.status(), (unsigned)ttsClient.latencyMs(), streamed ? "true" : "false", ttsQueue.size());
+    Serial.println(msg);
+    if (!ok) {
+        Serial.println(url);
+    }
+    publishEvent(msg);
+
+    if (ok) {
+        strlcpy(ttsJob.source, streamed ? TTS_STREAM_SOURCE : url, sizeof(ttsJob.source));
+        notify(ttsJob);
+    } else if (ttsClient.status() == TTS_HOLD_EXPIRED) {
+        ttsExpired();
+    }
+}
+
+/**
+ * Streamed answer not played within TTS_HOLD_MS, e.g. preempted meanwhile: its notification
+ * leaves the queue, and the text is requested again, once
+ */
+void ttsExpired() {
+    if (!notifQueue.remove([](const Notification &n) {
+        return n.cacheKey == ttsJob.cacheKey && strcmp(n.source, TTS_STREAM_SOURCE) == 0;
+    })) {
+        return; // Dropped from the queue already, and reported then
+    }
+    if (!ttsJob.retried) {
+        ttsJob.retried = true;
+        TtsJob evicted;
+        switch (ttsQueue.push(ttsJob, &evicted)) {
+            case NOTIF_EVICTED:
+                notifDrops++;
+                notifyEvent("ttsDropped", evicted);
+                // fall through
+            case NOTIF_QUEUED:
+                notifyEvent("ttsExpired", ttsJob);
+                return;
+            default:
+                break;
+        }
+    }
+    notifDrops++;
+    notifyEvent("ttsDropped", ttsJob);
+}
+
+/**
+ * Play error clip, blocking, whatever its format: the audio task runs until it ends
+ * Nothing is prefetched behind it, so queued notifications don't play meanwhile
+ */
+void beep(uint8_t repeat) {
+    for (uint8_t i = 0; i < repeat; i++) {
+        playAudio("/mp3/nasty-error-long.mp3");
+        prefetchTried = true;
+        while (isPlaying()) {
+            taskAudio(millis());
+            yield();
+        }
+    }
+}
+
+//############################################################################
+// LED
+//############################################################################
+void ledDefault(uint32_t delay) {
+    led.start(LED_DEFAULT, delay, CRGB::Black);
+}
+
+void ledRainbow(uint32_t delay) {
+    led.start(LED_RAINBOW, delay, CRGB::Black);
+}
+
+void ledBlink(uint32_t delay, int color) {
+    led.start(LED_BLINK, delay, color);
+}
+
+void ledSine(uint32_t delay, int color) {
+    led.start(LED_SINE, delay, color);
+}
+
+void ledPulse(uint32_t delay, int color) {
+    led.start(LED_PULSE, delay, color);
 }
 
 void ledDisco(uint32_t delay) {
-    ledActionTimer.detach();
-    ledActionTimer.attach_ms(delay, []() {
-        ledActionInProgress = true;
-        fill_solid(leds, NUM_LEDS, CHSV(random8(), 255, 255));
-    });
+    led.start(LED_DISCO, delay, CRGB::Black);
 }
 
 void ledSolid(int color) {
-    ledActionTimer.detach();
-    fill_solid(leds, NUM_LEDS, color);
+    led.start(LED_SOLID, 1000, color);
 }
 
 void ledOff() {
-    ledSolid(0x000000);
+    led.start(LED_OFF, 1000, CRGB::Black);
 }
 
 //############################################################################
 // HELPERS
 //############################################################################
 
-void prettyBytes(uint32_t bytes, String &output) {
+void prettyBytes(uint32_t bytes, char *output, size_t size) {
 
     const char *suffixes[7] = {"B", "KB", "MB", "GB", "TB", "PB", "EB"};
     uint8_t s = 0;
@@ -737,11 +2611,24 @@ void prettyBytes(uint32_t bytes, String &output) {
         s++;
         count /= 1024;
     }
-    if (count - floor(count) == 0.0) {
-        output = String((int)count) + suffixes[s];
+    uint32_t tenths = round(count * 10.0);
+    if (tenths % 10 == 0) {
+        snprintf_P(output, size, PSTR("%u%s"), (unsigned)(tenths / 10), suffixes[s]);
     } else {
-        output = String(round(count * 10.0) / 10.0, 1) + suffixes[s];
-    };
+        snprintf_P(output, size, PSTR("%u.%u%s"), (unsigned)(tenths / 10), (unsigned)(tenths % 10), suffixes[s]);
+    }
+}
+
+uint32_t crc32(const void *data, size_t length) {
+    const uint8_t *p = (const uint8_t *)data;
+    uint32_t crc = 0xFFFFFFFF;
+    while (length--) {
+        crc ^= *p++;
+        for (uint8_t i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
 }
 
 uint32_t getUptimeSecs() {
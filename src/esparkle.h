@@ -1,19 +1,222 @@
 #ifndef ESPARKLE_H
 #define ESPARKLE_H
 
-void ICACHE_RAM_ATTR ISRoutine();
+#include <ESPAsyncWebServer.h>
+#include <FS.h>
+#include "cmdparser.h"
+#include "cmdtrace.h"
+#include "gesture.h"
+#include "ledengine.h"
+#include "timeline.h"
+#include "tunes.h"
 
-bool wifiConnect();
+#define AUDIO_SOURCE_SIZE 256
 
-void playAudio();
+struct Notification {
+    char source[AUDIO_SOURCE_SIZE]; // MP3 URL or LittleFS path, or tune path
+    float gain;                     // Once gain, 0 for default gain
+    uint8_t priority;
+    bool hasPriority;
+    bool hasLed;
+    LedEffect ledEffect;
+    uint32_t ledDelay;
+    uint32_t ledColor;
+    uint32_t cacheKey;              // Clip cache key, 0 to use a hash of the source URL
+    bool playlist;                  // First item of the playlist, following items play gapless
+};
+
+#define TTS_TEXT_SIZE 256
+#define TTS_STREAM_SOURCE "tts:stream" // Source of a TTS notification played from the proxy answer
+
+struct TtsJob : Notification {
+    char text[TTS_TEXT_SIZE];
+    char voice[24];
+    bool retried; // Requested again, its streamed answer expired
+};
+
+bool audioHungry();
+void taskAudio(uint32_t now);
+void taskWifi(uint32_t now);
+void taskMqtt(uint32_t now);
+void taskLan(uint32_t now);
+void taskMpu(uint32_t now);
+void taskTts(uint32_t now);
+void taskTimeline(uint32_t now);
+void taskNotif(uint32_t now);
+void taskLed(uint32_t now);
+void taskTrace(uint32_t now);
+
+void mpuLoop();
+void gestureEvent(const Gesture &g);
+
+enum HandoffState : uint8_t {
+    HANDOFF_NONE,    // Nothing to play next
+    HANDOFF_PENDING, // Next clip still opening, try again on the next run
+    HANDOFF_DONE
+};
+
+enum WifiState : uint8_t {
+    WIFI_DOWN,
+    WIFI_SCANNING,
+    WIFI_CONNECTING,
+    WIFI_UP
+};
+
+struct ConnStats {
+    uint32_t connects;
+    uint32_t fastConnects;
+    uint32_t failures;
+    uint32_t lastConnectMs; // Time from attempt start to connected
+    uint32_t lastOutageMs;  // Time from link loss to connected
+};
+
+bool wifiLoop(uint32_t now);
+void wifiFailed(uint32_t now);
+
+void notify(const Notification &notif);
+void notifyLed(const Notification &notif);
+void notifyEvent(const char *event, const Notification &notif);
+void startNotification(const Notification &notif);
+
+struct MpuStats {
+    uint32_t samples;
+    uint32_t reads;     // I2C read transactions
+    uint32_t bytes;     // I2C bytes read
+    uint32_t overflows; // FIFO overflows, samples were lost
+};
+
+struct GaplessStats {
+    uint32_t handoffs;
+    uint32_t lastGapUs; // Time from decoder running dry to next clip decoding
+    uint32_t maxGapUs;
+    uint32_t underruns; // Handoffs that let I2S DMA buffers run empty
+};
+
+void playAudio(const char *source, float gain = 0, uint32_t cacheKey = 0);
+bool isMp3Source(const char *source);
+bool isTuneSource(const char *source);
+bool isPcmSource(const char *source);
+bool clipExists(const char *path);
+bool pcmResolve(char *source);
+bool tunePath(const char *name, char *path, size_t size);
+bool tuneSave(RtttlCompiler &compiler, File &spool, const char *name, char *path, size_t size);
+bool tuneResolve(char *source);
+void startMp3(AudioFileSource *src);
 bool stopPlaying();
-void tts(String text, String voice);
+void streamReport();
+void prefetchLoop();
+HandoffState handoff(uint32_t endUs);
+void handoffLoop();
+void playOverlay(const char *source, float gain = 0);
+bool stopOverlay();
+bool isPlaying();
+void tts(const char *text, const char *voice, const Notification &notif);
+bool ttsDueToPlay(const TtsJob &job);
+void ttsDone();
+void ttsExpired();
 void beep(uint8_t repeat = 1);
 
 bool mqttConnect(bool about = false);
 void mqttCallback(char *topic, byte *payload, unsigned int length);
+void publishEvent(const char *msg);
 void mqttCmdAbout();
 void mqttCmdList();
+void mqttCmdStats();
+void mqttCmdHeap();
+void heapSample(const char *label, uint32_t before);
+void mqttCmdRecord();
+void mqttCmdReplay();
+void traceEvent(const char *state, uint16_t commands);
+void traceResult(const TraceResult &r);
+void traceReport();
+
+#define TRACE_FILE "/trace.bin"
+
+struct LanStats {
+    uint32_t commands;
+    uint32_t connects;   // WebSocket clients
+    uint32_t lastWaitUs; // Time from command received to command run
+    uint32_t maxWaitUs;
+};
+
+void lanBegin();
+bool lanAuthorized(AsyncWebServerRequest *request);
+void lanCmdBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
+void lanCmdRequest(AsyncWebServerRequest *request);
+void lanWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len);
+AsyncWebSocketMessageBuffer *lanBuffer(size_t len);
+void lanSend(AsyncWebSocketMessageBuffer *buf);
+void lanLive();
+
+enum CmdField : uint32_t {
+    CMD_F_CMD = 1 << 0,
+    CMD_F_BRIGHT = 1 << 1,
+    CMD_F_GAIN = 1 << 2,
+    CMD_F_ONCEGAIN = 1 << 3,
+    CMD_F_PRIORITY = 1 << 4,
+    CMD_F_LED = 1 << 5,
+    CMD_F_DELAY = 1 << 6,
+    CMD_F_COLOR = 1 << 7,
+    CMD_F_MP3 = 1 << 8,
+    CMD_F_RTTTL = 1 << 9,
+    CMD_F_TTS = 1 << 10,
+    CMD_F_VOICE = 1 << 11,
+    CMD_F_MIRROR = 1 << 12,
+    CMD_F_ID = 1 << 13,
+    CMD_F_STEPS = 1 << 14,
+    CMD_F_CANCEL = 1 << 15,
+    CMD_F_OVERLAY = 1UL << 16,
+    CMD_F_PLAYLIST = 1UL << 17
+};
+
+#define CMD_MAX_STEPS 8
+
+// Timeline step of a command, as a slice of its payload
+struct CmdStep {
+    uint16_t offset;
+    uint16_t len;
+    uint32_t at; // Offset from command execution, ms
+};
+
+// Decoded command, fields are valid when their CMD_F_* bit is set
+struct Command {
+    uint32_t fields;
+    CmdFormat format; // Payload format, replies use it when CMD_F_MIRROR is set
+    char cmd[12];
+    uint8_t bright;
+    float gain;
+    float onceGain;
+    uint8_t priority;
+    char led[12];
+    uint32_t delay;
+    uint32_t color;
+    char source[AUDIO_SOURCE_SIZE]; // MP3 URL or path, or compiled tune path
+    char tts[TTS_TEXT_SIZE];
+    char voice[24];
+    char id[TIMELINE_ID_SIZE];     // Timeline id of steps
+    char cancel[TIMELINE_ID_SIZE]; // Timeline id to cancel
+    const uint8_t *payload;        // Steps source, only valid while payload buffer is
+    uint8_t stepCount;
+    uint8_t stepsDropped;          // Steps beyond CMD_MAX_STEPS
+    CmdStep steps[CMD_MAX_STEPS];
+    uint16_t playlistOffset;       // Playlist array, as a slice of payload
+    uint16_t playlistLen;
+};
+
+// RTTTL songs are compiled to TUNE_DIR/<name>.tune, named after their title or song file
+#define TUNE_DIR          "/tunes"
+#define TUNE_SPOOL_FILE   TUNE_DIR "/.spool"
+#define TUNE_DEFAULT_NAME "mqtt" // Songs without title
+
+void cmdDispatch(const uint8_t *payload, size_t length);
+bool cmdParse(const uint8_t *payload, size_t length, Command &cmd);
+const char *cmdLabel(const Command &cmd);
+void cmdExecute(const Command &cmd);
+void cmdApply(const Command &cmd);
+void cmdSchedule(const Command &cmd);
+void cmdBreak();
+void cmdRestart();
+void cmdToggle();
 
 void ledDefault(uint32_t delay = 500);
 void ledRainbow(uint32_t delay);
@@ -24,7 +227,8 @@ void ledDisco(uint32_t delay);
 void ledSolid(int color);
 void ledOff();
 
-void prettyBytes(uint32_t bytes, String &output);
+void prettyBytes(uint32_t bytes, char *output, size_t size);
+uint32_t crc32(const void *data, size_t length);
 uint32_t getUptimeSecs();
 void getUptimeDhms(char *output, size_t max_len);
 #endif //ESPARKLE_H
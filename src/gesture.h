@@ -0,0 +1,208 @@
+#ifndef ESPARKLE_GESTURE_H
+#define ESPARKLE_GESTURE_H
+
+#include <Arduino.h>
+
+enum GestureType : uint8_t {
+    GESTURE_NONE,
+    GESTURE_TAP,
+    GESTURE_DOUBLE_TAP,
+    GESTURE_MULTI_TAP,
+    GESTURE_SHAKE,
+    GESTURE_TILT
+};
+
+// Side facing up
+enum Orientation : uint8_t {
+    ORIENT_UNKNOWN,
+    ORIENT_UP,    // +Z
+    ORIENT_DOWN,  // -Z
+    ORIENT_RIGHT, // +X
+    ORIENT_LEFT,  // -X
+    ORIENT_FRONT, // +Y
+    ORIENT_BACK   // -Y
+};
+
+struct Gesture {
+    GestureType type;
+    uint8_t count;           // Taps
+    Orientation orientation; // Tilt
+};
+
+// Thresholds in mg, durations in ms
+struct GestureConfig {
+    uint16_t rateHz;
+    uint16_t lsbPerG;
+    uint16_t tapThreshold;   // Peak of the high-passed acceleration
+    uint16_t tapMaxMs;       // Longer peaks are motion, not taps
+    uint16_t tapWindowMs;    // Taps closer than this are counted together
+    uint16_t shakeThreshold;
+    uint8_t shakeReversals;  // Direction changes making a shake
+    uint16_t shakeWindowMs;  // Max time between reversals
+    uint16_t tiltHoldMs;     // Orientation must hold this long
+};
+
+/**
+ * Fixed point accelerometer gesture classifier, fed one sample at a time
+ *
+ * Gravity is tracked by a low-pass filter, its remainder is the motion signal.
+ * A tap is a short motion peak followed by quiet, taps are counted until
+ * tapWindowMs passes without a new one. A shake is a sequence of direction
+ * reversals of strong motion. Tilt reports the side facing up, once it holds.
+ */
+class GestureClassifier {
+public:
+    explicit GestureClassifier(const GestureConfig &cfg)
+            : tapHi(mgToLsb(cfg, cfg.tapThreshold)),
+              shakeHi(mgToLsb(cfg, cfg.shakeThreshold)),
+              tiltMin(mgToLsb(cfg, 800)), // ~37 degrees off the axis
+              tapMax(msToSamples(cfg, cfg.tapMaxMs)),
+              tapWindow(msToSamples(cfg, cfg.tapWindowMs)),
+              shakeWindow(msToSamples(cfg, cfg.shakeWindowMs)),
+              shakeMinGap(msToSamples(cfg, SHAKE_MIN_GAP_MS)),
+              tiltHold(msToSamples(cfg, cfg.tiltHoldMs)),
+              shakeReversals(cfg.shakeReversals) {}
+
+    /**
+     * Add raw sample, return true and fill g when it completes a gesture
+     */
+    bool add(int16_t x, int16_t y, int16_t z, Gesture &g) {
+        const int16_t a[3] = {x, y, z};
+        int32_t d[3];
+        int32_t peak = 0;
+        uint8_t peakAxis = 0;
+        for (uint8_t i = 0; i < 3; i++) {
+            if (!primed) {
+                gravity[i] = (int32_t)a[i] << GRAVITY_SHIFT;
+            }
+            gravity[i] += a[i] - (gravity[i] >> GRAVITY_SHIFT);
+            d[i] = a[i] - (gravity[i] >> GRAVITY_SHIFT);
+            if (abs(d[i]) > peak) {
+                peak = abs(d[i]);
+                peakAxis = i;
+            }
+        }
+        primed = true;
+        sample++;
+
+        g = {};
+        if (shake(d[peakAxis], peak, g) || tap(peak, g) || tilt(g)) {
+            return true;
+        }
+        return false;
+    }
+
+private:
+    // Gravity low-pass time constant: 2^GRAVITY_SHIFT samples
+    static const uint8_t GRAVITY_SHIFT = 6;
+    // A shake crosses zero smoothly, a tap rings: sign flips with less quiet in between don't count
+    static const uint16_t SHAKE_MIN_GAP_MS = 20;
+
+    static int32_t mgToLsb(const GestureConfig &cfg, uint16_t mg) { return (int32_t)mg * cfg.lsbPerG / 1000; }
+
+    static uint16_t msToSamples(const GestureConfig &cfg, uint16_t ms) {
+        return max<uint32_t>(1, (uint32_t)ms * cfg.rateHz / 1000);
+    }
+
+    bool tap(int32_t peak, Gesture &g) {
+        if (peak > tapHi) {
+            peakLen++;
+        } else if (peakLen) {
+            // Peak over, short enough to be a tap, and not part of a shake
+            if (peakLen <= tapMax && reversals < 2 && taps < UINT8_MAX) {
+                taps++;
+                lastTap = sample;
+            }
+            peakLen = 0;
+        }
+        if (taps && !peakLen && sample - lastTap > tapWindow) {
+            g.type = taps == 1 ? GESTURE_TAP : (taps == 2 ? GESTURE_DOUBLE_TAP : GESTURE_MULTI_TAP);
+            g.count = taps;
+            taps = 0;
+            return true;
+        }
+        return false;
+    }
+
+    bool shake(int32_t motion, int32_t peak, Gesture &g) {
+        if (reversals && sample - lastReversal > shakeWindow) {
+            reversals = 0;
+        }
+        if (peak <= shakeHi) {
+            return false;
+        }
+        int8_t sign = motion > 0 ? 1 : -1;
+        uint32_t quiet = sample - lastStrong;
+        lastStrong = sample;
+        if (sign != lastSign && (!lastSign || quiet >= shakeMinGap)) {
+            lastSign = sign;
+            lastReversal = sample;
+            if (++reversals >= shakeReversals) {
+                g.type = GESTURE_SHAKE;
+                reversals = 0;
+                taps = 0; // Shaking isn't tapping
+                peakLen = 0;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool tilt(Gesture &g) {
+        Orientation o = ORIENT_UNKNOWN;
+        for (uint8_t i = 0; i < 3; i++) {
+            int32_t v = gravity[i] >> GRAVITY_SHIFT;
+            if (abs(v) > tiltMin) {
+                static const Orientation SIDES[3][2] = {{ORIENT_RIGHT, ORIENT_LEFT},
+                                                        {ORIENT_FRONT, ORIENT_BACK},
+                                                        {ORIENT_UP,    ORIENT_DOWN}};
+                o = SIDES[i][v < 0];
+            }
+        }
+        if (o != candidate) {
+            candidate = o;
+            candidateSince = sample;
+            return false;
+        }
+        if (o == ORIENT_UNKNOWN || o == orientation || sample - candidateSince < tiltHold) {
+            return false;
+        }
+        bool first = orientation == ORIENT_UNKNOWN;
+        orientation = o;
+        if (first) {
+            return false; // Resting position at boot isn't a gesture
+        }
+        g.type = GESTURE_TILT;
+        g.orientation = o;
+        return true;
+    }
+
+    const int32_t tapHi;
+    const int32_t shakeHi;
+    const int32_t tiltMin;
+    const uint16_t tapMax;
+    const uint16_t tapWindow;
+    const uint16_t shakeWindow;
+    const uint16_t shakeMinGap;
+    const uint16_t tiltHold;
+    const uint8_t shakeReversals;
+
+    int32_t gravity[3] = {}; // Q(GRAVITY_SHIFT)
+    bool primed = false;
+    uint32_t sample = 0;
+
+    uint16_t peakLen = 0;
+    uint8_t taps = 0;
+    uint32_t lastTap = 0;
+
+    int8_t lastSign = 0;
+    uint8_t reversals = 0;
+    uint32_t lastReversal = 0;
+    uint32_t lastStrong = 0;
+
+    Orientation orientation = ORIENT_UNKNOWN;
+    Orientation candidate = ORIENT_UNKNOWN;
+    uint32_t candidateSince = 0;
+};
+
+#endif //ESPARKLE_GESTURE_H
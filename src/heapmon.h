@@ -0,0 +1,97 @@
+#ifndef ESPARKLE_HEAPMON_H
+#define ESPARKLE_HEAPMON_H
+
+#include <Arduino.h>
+
+#define HEAP_LABEL_SIZE 8
+
+struct HeapSample {
+    uint32_t ms;
+    uint32_t freeHeap;
+    int32_t delta;     // Free heap change across the sampled operation
+    uint16_t maxBlock; // Largest allocatable block
+    uint8_t frag;      // Fragmentation %
+    char label[HEAP_LABEL_SIZE];
+};
+
+/**
+ * Heap telemetry: last N samples, lifetime low-water marks and threshold crossing
+ */
+template<uint8_t N>
+class HeapMon {
+public:
+    HeapMon(uint32_t minFree, uint16_t minBlock, uint8_t maxFrag)
+            : minFree(minFree), minBlock(minBlock), maxFrag(maxFrag) {}
+
+    // Free heap before an operation, to be handed back to sample()
+    uint32_t mark() const { return ESP.getFreeHeap(); }
+
+    /**
+     * Record heap state after an operation
+     * Return true when a threshold has just been crossed (not on every sample below it)
+     */
+    bool sample(const char *label, uint32_t before) {
+        HeapSample &s = ring[head];
+        head = (head + 1) % N;
+        if (count < N) {
+            count++;
+        }
+
+        uint32_t freeHeap;
+        uint16_t maxBlock;
+        uint8_t frag;
+        ESP.getHeapStats(&freeHeap, &maxBlock, &frag);
+
+        s.ms = millis();
+        s.freeHeap = freeHeap;
+        s.delta = (int32_t)freeHeap - (int32_t)before;
+        s.maxBlock = maxBlock;
+        s.frag = frag;
+        strlcpy(s.label, label, sizeof(s.label));
+
+        if (!lowFree.ms || freeHeap < lowFree.freeHeap) {
+            lowFree = s;
+        }
+        if (!lowBlock.ms || maxBlock < lowBlock.maxBlock) {
+            lowBlock = s;
+        }
+        if (!highFrag.ms || frag > highFrag.frag) {
+            highFrag = s;
+        }
+
+        bool below = freeHeap < minFree || maxBlock < minBlock || frag > maxFrag;
+        bool crossed = below && !alarm;
+        alarm = below;
+        return crossed;
+    }
+
+    uint8_t size() const { return count; }
+
+    // i-th sample, oldest first
+    const HeapSample &at(uint8_t i) const { return ring[(head + N - count + i) % N]; }
+
+    const HeapSample &last() const { return ring[(head + N - 1) % N]; }
+
+    // Samples holding the lifetime lowest free heap, lowest max block and highest fragmentation
+    const HeapSample &lowestFree() const { return lowFree; }
+
+    const HeapSample &lowestBlock() const { return lowBlock; }
+
+    const HeapSample &highestFrag() const { return highFrag; }
+
+private:
+    HeapSample ring[N] = {};
+    uint8_t head = 0;
+    uint8_t count = 0;
+
+    HeapSample lowFree = {};
+    HeapSample lowBlock = {};
+    HeapSample highFrag = {};
+
+    uint32_t minFree;
+    uint16_t minBlock;
+    uint8_t maxFrag;
+    bool alarm = false;
+};
+
+#endif //ESPARKLE_HEAPMON_H
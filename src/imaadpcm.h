@@ -0,0 +1,57 @@
+#ifndef ESPARKLE_IMAADPCM_H
+#define ESPARKLE_IMAADPCM_H
+
+#include <stdint.h>
+
+/*
+ * ADPCM clip: IMA ADPCM mono, as transcoded from MP3 by tools/transcode.py
+ *
+ * Header, little endian: "IMA1", sample rate (16 bit), samples per block (16 bit),
+ * total samples (32 bit). Then blocks as in IMA ADPCM WAV files: first sample
+ * (16 bit), step index (8 bit), 0, then 4 bit codes, low nibble first.
+ */
+#define ADPCM_MAGIC        "IMA1"
+#define ADPCM_HEADER_SIZE  12
+#define ADPCM_BLOCK_HEADER 4
+#define ADPCM_MAX_BLOCK    256 // Bytes, 505 samples per block
+
+/**
+ * IMA ADPCM decoder state, one 4 bit code in, one 16 bit sample out
+ *
+ * Plain C++, so that host tools decode exactly as the device does.
+ */
+struct ImaAdpcm {
+    int16_t predictor = 0;
+    uint8_t index = 0;
+
+    int16_t decode(uint8_t code) {
+        static const uint16_t STEPS[89] = {
+                7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+                50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+                337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+                2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+                15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+        };
+        static const int8_t INDEXES[8] = {-1, -1, -1, -1, 2, 4, 6, 8};
+
+        int32_t step = STEPS[index];
+        int32_t diff = step >> 3;
+        if (code & 4) {
+            diff += step;
+        }
+        if (code & 2) {
+            diff += step >> 1;
+        }
+        if (code & 1) {
+            diff += step >> 2;
+        }
+        int32_t sample = predictor + ((code & 8) ? -diff : diff);
+        predictor = sample > 32767 ? 32767 : sample < -32768 ? -32768 : sample;
+
+        int8_t next = index + INDEXES[code & 7];
+        index = next < 0 ? 0 : next > 88 ? 88 : next;
+        return predictor;
+    }
+};
+
+#endif //ESPARKLE_IMAADPCM_H
@@ -0,0 +1,225 @@
+#ifndef ESPARKLE_JITTERBUFFER_H
+#define ESPARKLE_JITTERBUFFER_H
+
+#include <Arduino.h>
+#include <AudioFileSource.h>
+
+#define JITTER_WINDOW_MS 1000 // Throughput measurement window
+#define JITTER_COVER_MAX 8    // Max growth factor of covered time after underruns
+#define JITTER_LOW_WATER 1536 // Decoding pauses below this level, the MP3 decoder's input buffer
+
+struct JitterStats {
+    uint32_t received;    // Bytes from the network
+    uint32_t startMs;     // Time to first sound
+    uint32_t underruns;
+    uint32_t rebufferMs;  // Time spent refilling after underruns
+    uint32_t netRate;     // Network throughput while it was the bottleneck, bytes/s, 0 if never
+    uint32_t drainRate;   // Decoder consumption, bytes/s
+    uint32_t target;      // Bytes to hold before (re)starting playback
+    uint8_t minFillPct;   // Lowest fill level while playing
+    uint8_t avgFillPct;
+};
+
+/**
+ * Ring buffer in front of a network source, sized from measured throughput
+ *
+ * Network reads never block. Playback starts once prebuffer bytes are in, and when
+ * the buffer runs low it pauses until refilled instead of stopping. Above the low
+ * water mark, a decoder refill is never short of a frame, so it never reads dry. The refill target
+ * covers coverMs of decoding, it grows after each underrun and when the network
+ * barely outruns the decoder. The ring itself is reserved once, at its max size.
+ */
+class JitterBuffer : public AudioFileSource {
+public:
+    JitterBuffer(AudioFileSource *src, uint8_t *buffer, uint32_t size, uint32_t prebuffer, uint32_t coverMs)
+            : src(src), buf(buffer), size(size), prebuffer(constrain(prebuffer, (uint32_t)JITTER_LOW_WATER, size)),
+              coverMs(coverMs), coverStart(coverMs) {
+        stats.target = this->prebuffer;
+        stats.minFillPct = 100;
+        startMs = windowMs = lastMs = millis();
+    }
+
+    uint32_t read(void *data, uint32_t len) override {
+        fill();
+        uint32_t n = pop((uint8_t *)data, len);
+        if (!n && len && !srcDone()) {
+            // Decoder ran the buffer dry, past the low water mark (e.g. resyncing):
+            // it gets what has arrived meanwhile, then waits until the buffer is refilled
+            rebuffer(millis());
+            n = src->read(data, len);
+            stats.received += n;
+            drained += n;
+        }
+        return n;
+    }
+
+    uint32_t readNonBlock(void *data, uint32_t len) override {
+        fill();
+        return pop((uint8_t *)data, len);
+    }
+
+    bool seek(int32_t, int) override { return false; }
+
+    bool close() override { return src->close(); }
+
+    bool isOpen() override { return src->isOpen() || level(); }
+
+    uint32_t getSize() override { return src->getSize(); }
+
+    uint32_t getPos() override { return src->getPos() - level(); }
+
+    /**
+     * Fill from the network, measure rates, and leave the waiting state when full enough
+     * Call every loop, the decoder must not run while waiting()
+     */
+    bool loop() override {
+        uint32_t now = millis();
+        uint32_t got = fill();
+        uint32_t fillLevel = level();
+
+        // Network is the bottleneck when it couldn't fill the buffer
+        if (fillLevel < size && !srcDone()) {
+            netBytes += got;
+            netMs += now - lastMs;
+        }
+        if (!paused) {
+            playMs += now - lastMs;
+        }
+        lastMs = now;
+
+        if (paused) {
+            if (fillLevel >= stats.target || srcDone()) {
+                paused = false;
+                if (started) {
+                    stats.rebufferMs += now - waitMs;
+                } else {
+                    started = true;
+                    stats.startMs = now - startMs;
+                }
+            }
+        } else if (fillLevel < JITTER_LOW_WATER && !srcDone()) {
+            rebuffer(now);
+        } else {
+            uint8_t pct = (uint64_t)fillLevel * 100 / size;
+            stats.minFillPct = min(stats.minFillPct, pct);
+            fillSum += pct;
+            fillCount++;
+        }
+
+        if (now - windowMs >= JITTER_WINDOW_MS) {
+            adapt(now);
+        }
+        return src->loop();
+    }
+
+    // Prebuffering or re-buffering, decoder must wait
+    bool waiting() const { return paused; }
+
+    // Carry buffered bytes over to another ring, at least as large
+    void move(uint8_t *buffer, uint32_t bufferSize) {
+        uint32_t n = level();
+        for (uint32_t done = 0; done < n;) {
+            uint32_t at = (tail + done) % size;
+            uint32_t chunk = min(n - done, size - at);
+            memcpy(buffer + done, buf + at, chunk);
+            done += chunk;
+        }
+        buf = buffer;
+        size = bufferSize;
+        tail = 0;
+        head = n;
+    }
+
+    JitterStats report() const {
+        JitterStats s = stats;
+        s.avgFillPct = fillCount ? fillSum / fillCount : 0;
+        return s;
+    }
+
+private:
+    uint32_t level() const { return head - tail; }
+
+    // Whole clip received, or connection lost
+    bool srcDone() { return !src->isOpen() || (src->getSize() && src->getPos() >= src->getSize()); }
+
+    uint32_t fill() {
+        uint32_t total = 0;
+        while (level() < size && !srcDone()) {
+            uint32_t at = head % size;
+            uint32_t n = src->readNonBlock(buf + at, min(size - level(), size - at));
+            if (!n) {
+                break;
+            }
+            head += n;
+            total += n;
+        }
+        stats.received += total;
+        return total;
+    }
+
+    uint32_t pop(uint8_t *data, uint32_t len) {
+        uint32_t n = min(len, level());
+        for (uint32_t done = 0; done < n;) {
+            uint32_t at = tail % size;
+            uint32_t chunk = min(n - done, size - at);
+            memcpy(data + done, buf + at, chunk);
+            tail += chunk;
+            done += chunk;
+        }
+        drained += n;
+        return n;
+    }
+
+    void rebuffer(uint32_t now) {
+        stats.underruns++;
+        coverMs = min(coverMs * 2, coverStart * JITTER_COVER_MAX);
+        paused = true;
+        waitMs = now;
+        adapt(now);
+    }
+
+    // Refill target: coverMs of decoding, doubled when the network has less than 50% headroom
+    void adapt(uint32_t now) {
+        if (playMs >= JITTER_WINDOW_MS / 2) {
+            stats.drainRate = (stats.drainRate + (uint64_t)drained * 1000 / playMs) / (stats.drainRate ? 2 : 1);
+            drained = playMs = 0;
+        }
+        if (netMs >= JITTER_WINDOW_MS / 2) {
+            stats.netRate = (stats.netRate + (uint64_t)netBytes * 1000 / netMs) / (stats.netRate ? 2 : 1);
+            netBytes = netMs = 0;
+        }
+        windowMs = now;
+
+        uint32_t need = (uint64_t)stats.drainRate * coverMs / 1000;
+        if (stats.netRate && stats.netRate < stats.drainRate + stats.drainRate / 2) {
+            need *= 2;
+        }
+        stats.target = constrain(need, prebuffer, size);
+    }
+
+    AudioFileSource *src;
+    uint8_t *buf;
+    uint32_t size;
+    uint32_t prebuffer;
+    uint32_t coverMs;
+    uint32_t coverStart;
+
+    uint32_t head = 0; // Free running, a clip never gets near 4 GB
+    uint32_t tail = 0;
+    bool paused = true;
+    bool started = false;
+
+    uint32_t startMs;
+    uint32_t waitMs = 0;
+    uint32_t windowMs;
+    uint32_t lastMs;
+    uint32_t drained = 0; // Rates are measured over time spent playing, or starved
+    uint32_t playMs = 0;
+    uint32_t netBytes = 0;
+    uint32_t netMs = 0;
+    uint32_t fillSum = 0;
+    uint32_t fillCount = 0;
+    JitterStats stats = {};
+};
+
+#endif //ESPARKLE_JITTERBUFFER_H
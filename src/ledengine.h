@@ -0,0 +1,208 @@
+#ifndef ESPARKLE_LEDENGINE_H
+#define ESPARKLE_LEDENGINE_H
+
+#include <FastLED.h>
+
+enum LedEffect : uint8_t {
+    LED_DEFAULT,
+    LED_RAINBOW,
+    LED_BLINK,
+    LED_SINE,
+    LED_PULSE,
+    LED_DISCO,
+    LED_SOLID,
+    LED_OFF
+};
+
+struct LedStats {
+    uint32_t frames = 0;     // Frames rendered
+    uint32_t pushes = 0;     // Frames actually pushed to the strip
+    uint32_t showUs = 0;     // Cumulated time spent in FastLED.show()
+    uint32_t showUsMax = 0;  // Longest FastLED.show()
+    uint32_t sinceMs = 0;    // Start of the measurement window
+};
+
+/**
+ * Frame based LED renderer
+ *
+ * Effects are pure functions of the time elapsed since they started, plus a
+ * small explicit state object, so frames may be rendered at any rate.
+ * Frames are rendered at most `fps` times per second, and pushed to the
+ * strip only when they differ from the last pushed frame.
+ */
+template<uint16_t N>
+class LedEngine {
+public:
+    explicit LedEngine(uint8_t fps) : frameMs(1000 / fps) {}
+
+    CRGB *pixels() { return frame; }
+
+    bool busy() const { return effect != LED_DEFAULT; }
+
+    void start(LedEffect e, uint32_t delay, CRGB color) {
+        if (delay == 0) {
+            delay = 1;
+        }
+        if (e == effect && delay == stepMs && color == curColor) {
+            return; // Already running, don't restart the animation
+        }
+
+        if (effect == LED_DEFAULT) {
+            defaultHue = currentHue(millis()); // Resume color cycling where it was left
+        }
+
+        effect = e;
+        stepMs = delay;
+        curColor = color;
+        startMs = millis();
+
+        switch (effect) {
+            case LED_DEFAULT:
+                state.hue.base = defaultHue;
+                break;
+            case LED_RAINBOW:
+                state.hue.base = 0;
+                break;
+            case LED_SINE: {
+                CHSV hsv = rgb2hsv_approximate(color);
+                state.sine.hue = hsv.hue;
+                state.sine.sat = hsv.sat;
+                break;
+            }
+            case LED_DISCO:
+                state.disco.step = UINT32_MAX;
+                break;
+            default:
+                break;
+        }
+        lastFrameMs = startMs - frameMs; // Render first frame immediately
+    }
+
+    void setBrightness(uint8_t b) {
+        FastLED.setBrightness(b);
+        dirty = true;
+    }
+
+    /**
+     * Render and push a frame if due
+     * Return true if the strip was updated
+     */
+    bool loop(uint32_t now) {
+        if (now - lastFrameMs < frameMs) {
+            return false;
+        }
+        lastFrameMs = now;
+
+        render(now);
+        st.frames++;
+
+        if (!dirty && memcmp(frame, shown, sizeof(frame)) == 0) {
+            return false;
+        }
+
+        uint32_t t = micros();
+        FastLED.show();
+        t = micros() - t;
+
+        memcpy(shown, frame, sizeof(frame));
+        dirty = false;
+
+        st.pushes++;
+        st.showUs += t;
+        if (t > st.showUsMax) {
+            st.showUsMax = t;
+        }
+        return true;
+    }
+
+    const LedStats &stats() const { return st; }
+
+    void resetStats() {
+        st = LedStats();
+        st.sinceMs = millis();
+    }
+
+private:
+    struct HueState {
+        uint8_t base;
+    };
+    struct SineState {
+        uint8_t hue;
+        uint8_t sat;
+    };
+    struct DiscoState {
+        uint32_t step;
+        uint8_t hue;
+    };
+
+    uint8_t currentHue(uint32_t now) const {
+        return state.hue.base + (now - startMs) / stepMs;
+    }
+
+    void render(uint32_t now) {
+        uint32_t elapsed = now - startMs;
+        uint32_t step = elapsed / stepMs;
+
+        switch (effect) {
+            case LED_DEFAULT:
+                fill_solid(frame, N, CHSV(currentHue(now), 255, 255));
+                break;
+            case LED_RAINBOW:
+                fill_solid(frame, N, CHSV(step % 255, 255, 255));
+                break;
+            case LED_BLINK:
+                fill_solid(frame, N, (step & 1) ? CRGB(CRGB::Black) : curColor);
+                break;
+            case LED_SINE:
+                fill_solid(frame, N, CHSV(state.sine.hue, state.sine.sat, sin8(step % 255)));
+                break;
+            case LED_PULSE: {
+                // Fade to black in 255 steps, then stay black during 750ms
+                uint32_t fadeMs = 255 * stepMs;
+                uint32_t pos = elapsed % (fadeMs + 750);
+                CRGB c = CRGB::Black;
+                if (pos < fadeMs) {
+                    c = curColor;
+                    c.fadeToBlackBy(pos / stepMs);
+                }
+                fill_solid(frame, N, c);
+                break;
+            }
+            case LED_DISCO:
+                if (step != state.disco.step) {
+                    state.disco.step = step;
+                    state.disco.hue = random8();
+                }
+                fill_solid(frame, N, CHSV(state.disco.hue, 255, 255));
+                break;
+            case LED_SOLID:
+                fill_solid(frame, N, curColor);
+                break;
+            case LED_OFF:
+                fill_solid(frame, N, CRGB::Black);
+                break;
+        }
+    }
+
+    CRGB frame[N];
+    CRGB shown[N];
+    bool dirty = true;
+
+    LedEffect effect = LED_DEFAULT;
+    uint32_t stepMs = 500;
+    CRGB curColor;
+    uint32_t startMs = 0;
+    uint8_t defaultHue = 0;
+    uint32_t frameMs;
+    uint32_t lastFrameMs = 0;
+
+    union {
+        HueState hue;
+        SineState sine;
+        DiscoState disco;
+    } state = {{0}};
+
+    LedStats st;
+};
+
+#endif //ESPARKLE_LEDENGINE_H
@@ -0,0 +1,114 @@
+#ifndef ESPARKLE_LOOPPROF_H
+#define ESPARKLE_LOOPPROF_H
+
+#include <Arduino.h>
+
+#define PROF_BUCKETS 16
+
+/**
+ * Duration histogram, bucket i counts durations in [2^i, 2^(i+1)) µs
+ * (bucket 0 also takes 0 µs, last bucket takes everything above)
+ */
+struct ProfHist {
+    uint32_t count;
+    uint32_t totalUs;
+    uint32_t maxUs;
+    uint16_t buckets[PROF_BUCKETS]; // Saturating
+
+    void add(uint32_t us) {
+        count++;
+        totalUs += us;
+        if (us > maxUs) {
+            maxUs = us;
+        }
+        uint8_t b = us ? 31 - __builtin_clz(us) : 0;
+        if (b >= PROF_BUCKETS) {
+            b = PROF_BUCKETS - 1;
+        }
+        if (buckets[b] != UINT16_MAX) {
+            buckets[b]++;
+        }
+    }
+
+    uint32_t avgUs() const { return count ? totalUs / count : 0; }
+
+    // Number of buckets up to the last non empty one
+    uint8_t used() const {
+        uint8_t n = PROF_BUCKETS;
+        while (n && !buckets[n - 1]) {
+            n--;
+        }
+        return n;
+    }
+};
+
+/**
+ * Loop and audio profiler based on the CPU cycle counter (tasks are timed by the scheduler)
+ *
+ * begin() at the top of loop(), end() at the bottom.
+ * Each loop must stay under one counter wrap (~26 s at 160 MHz).
+ */
+class LoopProfiler {
+public:
+    void begin() {
+        mhz = ESP.getCpuFreqMHz();
+        start = ESP.getCycleCount();
+    }
+
+    void end() {
+        total.add((ESP.getCycleCount() - start) / mhz);
+    }
+
+    // Call right before each decoder loop, gap is measured between consecutive calls
+    void audioTick() {
+        uint32_t now = ESP.getCycleCount();
+        if (audioRunning) {
+            audioGap.add((now - lastAudio) / mhz);
+        }
+        lastAudio = now;
+        audioRunning = true;
+    }
+
+    // Call when no decoder is running, so that the next gap doesn't span silence
+    void audioIdle() {
+        audioRunning = false;
+        i2sEmpty = true; // Buffer drains on every stop, don't count the next start
+    }
+
+    // Count transitions to an empty I2S DMA buffer while playing
+    void i2sState(bool empty) {
+        if (empty && !i2sEmpty) {
+            starvations++;
+        }
+        i2sEmpty = empty;
+    }
+
+    const ProfHist &loops() const { return total; }
+
+    const ProfHist &gaps() const { return audioGap; }
+
+    uint32_t i2sStarvations() const { return starvations; }
+
+    uint32_t since() const { return sinceMs; }
+
+    void reset() {
+        memset(&total, 0, sizeof(total));
+        memset(&audioGap, 0, sizeof(audioGap));
+        starvations = 0;
+        sinceMs = millis();
+    }
+
+private:
+    ProfHist total = {};
+    ProfHist audioGap = {};
+    uint32_t starvations = 0;
+    uint32_t sinceMs = 0;
+
+    uint8_t mhz = 80;
+    uint32_t start = 0;
+    uint32_t lastAudio = 0;
+    bool audioRunning = false;
+    bool i2sEmpty = false;
+};
+
+#endif //ESPARKLE_LOOPPROF_H
@@ -0,0 +1,110 @@
+#ifndef ESPARKLE_MAILBOX_H
+#define ESPARKLE_MAILBOX_H
+
+#include <Arduino.h>
+
+#define MAILBOX_STALL_MS 2000 // A message left incomplete this long is given up
+
+/**
+ * Fixed slots of messages, written part by part by network callbacks, read from a task
+ *
+ * Async server callbacks run in system context, between loop() passes or within a
+ * yield(): they never interrupt the reader mid-statement, so indexes need no lock.
+ * A message becomes visible once complete. One message is assembled at a time,
+ * other writers are turned down meanwhile.
+ */
+template<uint8_t SLOTS, size_t SIZE>
+class Mailbox {
+public:
+    /**
+     * Write len bytes at index of a total bytes message, return false if the message is dropped
+     */
+    bool write(const void *writer, const uint8_t *data, size_t len, size_t index, size_t total) {
+        if (index == 0) {
+            if (owner && owner != writer && millis() - startMs < MAILBOX_STALL_MS) {
+                drops++;
+                return false;
+            }
+            owner = nullptr;
+            if (!total || total > SIZE || count() == SLOTS) {
+                drops++;
+                return false;
+            }
+            owner = writer;
+            startMs = millis();
+            Slot &s = slots[head % SLOTS];
+            s.writer = writer;
+            s.len = total;
+        } else if (owner != writer) {
+            return false;
+        }
+
+        Slot &s = slots[head % SLOTS];
+        if (index + len > s.len) {
+            owner = nullptr;
+            drops++;
+            return false;
+        }
+        memcpy(s.data + index, data, len);
+        if (index + len == s.len) {
+            s.postedUs = micros();
+            owner = nullptr;
+            head++;
+        }
+        return true;
+    }
+
+    // Complete message from writer waiting in a slot
+    bool holds(const void *writer) const {
+        for (uint8_t i = tail; i != head; i++) {
+            if (slots[i % SLOTS].writer == writer) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Oldest message, nullptr if none, valid until pop()
+     */
+    const uint8_t *peek(size_t &len, uint32_t &postedUs) const {
+        if (head == tail) {
+            return nullptr;
+        }
+        const Slot &s = slots[tail % SLOTS];
+        len = s.len;
+        postedUs = s.postedUs;
+        return s.data;
+    }
+
+    void pop() {
+        if (head != tail) {
+            slots[tail % SLOTS].writer = nullptr;
+            tail++;
+        }
+    }
+
+    uint8_t count() const { return head - tail; }
+
+    // Messages turned down: too large, mailbox full, or another one being assembled
+    uint32_t dropped() const { return drops; }
+
+private:
+    static_assert(SLOTS && SLOTS <= 128 && (SLOTS & (SLOTS - 1)) == 0, "Slot indexes are free running 8 bit, SLOTS must divide 256");
+
+    struct Slot {
+        const void *writer;
+        size_t len;
+        uint32_t postedUs;
+        uint8_t data[SIZE];
+    };
+
+    Slot slots[SLOTS] = {};
+    volatile uint8_t head = 0;
+    volatile uint8_t tail = 0;
+    const void *owner = nullptr;
+    uint32_t startMs = 0;
+    uint32_t drops = 0;
+};
+
+#endif //ESPARKLE_MAILBOX_H
@@ -0,0 +1,102 @@
+#ifndef ESPARKLE_MP3PROBE_H
+#define ESPARKLE_MP3PROBE_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+#define MP3_PROBE_SCAN 2048 // Bytes searched for the first frame after ID3 tag
+
+struct Mp3Info {
+    uint32_t durationMs;
+    uint32_t sampleRate;
+    uint16_t bitrate; // kbps, first frame
+    bool vbr;         // Duration from Xing/Info/VBRI frame count
+};
+
+inline uint32_t mp3Be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/**
+ * Estimate MP3 (MPEG audio layer III) duration from its first frame header,
+ * reading a few hundred bytes: frame count from Xing/Info/VBRI header if any,
+ * file size and bitrate otherwise
+ */
+inline bool mp3Probe(File &file, Mp3Info &info) {
+    static const uint16_t BITRATES[2][15] PROGMEM = {
+            {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320}, // MPEG 1
+            {0, 8,  16, 24, 32, 40, 48, 56, 64,  80,  96,  112, 128, 144, 160}  // MPEG 2 and 2.5
+    };
+    static const uint16_t SAMPLE_RATES[3] PROGMEM = {44100, 48000, 32000};
+
+    uint8_t buf[64];
+    uint32_t size = file.size();
+    uint32_t start = 0;
+
+    // Skip ID3v2 tag, its size is syncsafe
+    if (file.read(buf, 10) == 10 && memcmp(buf, "ID3", 3) == 0) {
+        start = 10 + ((uint32_t)(buf[6] & 0x7F) << 21 | (uint32_t)(buf[7] & 0x7F) << 14
+                      | (uint32_t)(buf[8] & 0x7F) << 7 | (buf[9] & 0x7F));
+        if (buf[5] & 0x10) {
+            start += 10; // Footer
+        }
+    }
+
+    // Find frame sync
+    uint32_t limit = start + MP3_PROBE_SCAN;
+    while (start < limit && start + 4 <= size) {
+        file.seek(start);
+        size_t n = file.read(buf, sizeof(buf));
+        size_t i = 0;
+        while (i + 1 < n && !(buf[i] == 0xFF && (buf[i + 1] & 0xE0) == 0xE0)) {
+            i++;
+        }
+        if (i + 1 < n) {
+            start += i;
+            break;
+        }
+        if (n < sizeof(buf)) {
+            return false;
+        }
+        start += n - 1; // Sync may straddle reads
+    }
+
+    file.seek(start);
+    if (file.read(buf, sizeof(buf)) < 48 || buf[0] != 0xFF || (buf[1] & 0xE0) != 0xE0) {
+        return false;
+    }
+
+    uint8_t version = (buf[1] >> 3) & 3; // 3: MPEG 1, 2: MPEG 2, 0: MPEG 2.5
+    uint8_t layer = (buf[1] >> 1) & 3;   // 1: layer III
+    uint8_t bitrateIndex = buf[2] >> 4;
+    uint8_t rateIndex = (buf[2] >> 2) & 3;
+    bool mono = (buf[3] >> 6) == 3;
+    if (version == 1 || layer != 1 || bitrateIndex == 0 || bitrateIndex == 15 || rateIndex == 3) {
+        return false;
+    }
+
+    bool mpeg1 = version == 3;
+    info.bitrate = pgm_read_word(&BITRATES[mpeg1 ? 0 : 1][bitrateIndex]);
+    info.sampleRate = pgm_read_word(&SAMPLE_RATES[rateIndex]) >> (mpeg1 ? 0 : (version == 2 ? 1 : 2));
+    uint32_t samplesPerFrame = mpeg1 ? 1152 : 576;
+
+    // VBR frame count, Xing/Info follows side information, VBRI sits at fixed offset
+    uint8_t side = mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17);
+    const uint8_t *xing = buf + 4 + side;
+    uint32_t frames = 0;
+    if ((memcmp(xing, "Xing", 4) == 0 || memcmp(xing, "Info", 4) == 0) && (xing[7] & 1)) {
+        frames = mp3Be32(xing + 8);
+    } else if (memcmp(buf + 36, "VBRI", 4) == 0 && file.seek(start + 36 + 14) && file.read(buf, 4) == 4) {
+        frames = mp3Be32(buf);
+    }
+
+    info.vbr = frames != 0;
+    if (frames) {
+        info.durationMs = (uint64_t)frames * samplesPerFrame * 1000 / info.sampleRate;
+    } else {
+        info.durationMs = (uint64_t)(size - start) * 8 / info.bitrate;
+    }
+    return true;
+}
+
+#endif //ESPARKLE_MP3PROBE_H
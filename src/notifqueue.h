@@ -0,0 +1,112 @@
+#ifndef ESPARKLE_NOTIFQUEUE_H
+#define ESPARKLE_NOTIFQUEUE_H
+
+#include <stdint.h>
+
+enum NotifPolicy : uint8_t {
+    NOTIF_WAIT, // Lower priority notifications wait for the current one to finish
+    NOTIF_DROP  // Lower priority notifications are dropped while a higher priority one is playing
+};
+
+enum NotifPush : uint8_t {
+    NOTIF_QUEUED,   // Item queued
+    NOTIF_EVICTED,  // Item queued, the lowest priority entry was dropped to make room
+    NOTIF_REJECTED  // Queue full of higher or equal priority entries, item dropped
+};
+
+/**
+ * Fixed capacity, allocation free notification queue
+ *
+ * Entries are kept ordered by priority (highest first), then by arrival.
+ * T must expose a `priority` member.
+ */
+template<typename T, uint8_t N>
+class NotifQueue {
+public:
+    NotifQueue() {
+        for (uint8_t i = 0; i < N; i++) {
+            order[i] = i;
+        }
+    }
+
+    uint8_t size() const { return count; }
+
+    bool empty() const { return count == 0; }
+
+    const T &top() const { return items[order[0]]; }
+
+    /**
+     * Queue item, the entry dropped to make room is copied to evicted if given
+     */
+    NotifPush push(const T &item, T *evicted = nullptr) {
+        NotifPush res = NOTIF_QUEUED;
+        if (count == N) {
+            // Full: the lowest priority, most recent entry goes away
+            if (item.priority <= items[order[count - 1]].priority) {
+                return NOTIF_REJECTED;
+            }
+            count--;
+            if (evicted) {
+                *evicted = items[order[count]];
+            }
+            res = NOTIF_EVICTED;
+        }
+
+        uint8_t slot = order[count];
+        items[slot] = item;
+
+        uint8_t pos = 0;
+        while (pos < count && items[order[pos]].priority >= item.priority) {
+            pos++;
+        }
+        for (uint8_t i = count; i > pos; i--) {
+            order[i] = order[i - 1];
+        }
+        order[pos] = slot;
+        count++;
+        return res;
+    }
+
+    bool pop(T &item) {
+        if (!count) {
+            return false;
+        }
+        uint8_t slot = order[0];
+        item = items[slot];
+        count--;
+        for (uint8_t i = 0; i < count; i++) {
+            order[i] = order[i + 1];
+        }
+        order[count] = slot;
+        return true;
+    }
+
+    /**
+     * Remove the first entry, by rank, match(entry) is true for
+     * Return false if there's none
+     */
+    template<typename Match>
+    bool remove(Match match) {
+        for (uint8_t pos = 0; pos < count; pos++) {
+            uint8_t slot = order[pos];
+            if (match(items[slot])) {
+                count--;
+                for (uint8_t i = pos; i < count; i++) {
+                    order[i] = order[i + 1];
+                }
+                order[count] = slot;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void clear() { count = 0; }
+
+private:
+    T items[N];
+    uint8_t order[N]; // order[0..count-1]: queued slots by rank, order[count..N-1]: free slots
+    uint8_t count = 0;
+};
+
+#endif //ESPARKLE_NOTIFQUEUE_H
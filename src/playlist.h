@@ -0,0 +1,100 @@
+#ifndef ESPARKLE_PLAYLIST_H
+#define ESPARKLE_PLAYLIST_H
+
+#include <Arduino.h>
+#include "cmdparser.h"
+
+/**
+ * Clip list, kept as received (encoded JSON or MessagePack array of strings)
+ * and decoded one item at a time when it's due
+ */
+template<uint16_t POOL>
+class Playlist {
+public:
+    /**
+     * Copy encoded array, return false if it doesn't fit or holds no string
+     */
+    bool load(const uint8_t *data, uint16_t len, CmdFormat format) {
+        stop();
+        count = 0;
+        if (len > POOL) {
+            return false;
+        }
+        memcpy(pool, data, len);
+        used = len;
+        this->format = format;
+        ItemSink sink(UINT8_MAX, nullptr, 0);
+        scan(sink);
+        count = sink.index;
+        return count > 0;
+    }
+
+    /**
+     * Decode i-th item into out, return false if there's no such item
+     */
+    bool item(uint8_t i, char *out, size_t size) const {
+        if (i >= count) {
+            return false;
+        }
+        ItemSink sink(i, out, size);
+        scan(sink);
+        return sink.found;
+    }
+
+    uint8_t size() const { return count; }
+
+    // Position of item being played, -1 when playlist isn't played
+    int16_t position() const { return pos; }
+
+    bool playing() const { return pos >= 0; }
+
+    bool hasNext() const { return playing() && pos + 1 < count; }
+
+    void start() { pos = 0; }
+
+    void advance() { pos++; }
+
+    void stop() { pos = -1; }
+
+private:
+    struct ItemSink {
+        ItemSink(uint8_t want, char *out, size_t size) : want(want), out(out), size(size) {}
+
+        void value(const CmdValue &v) {
+            if (v.depth != 1 || v.type != CMD_STRING) {
+                return;
+            }
+            if (index == want) {
+                v.appendTo(out, size);
+                found = true;
+            }
+            if (v.last && index < UINT8_MAX - 1) {
+                index++;
+            }
+        }
+
+        uint8_t want;
+        char *out;
+        size_t size;
+        uint8_t index = 0;
+        bool found = false;
+    };
+
+    void scan(ItemSink &sink) const {
+        if (format == CMD_MSGPACK) {
+            MsgPackScanner<ItemSink> scanner(sink);
+            scanner.feed(pool, used);
+        } else {
+            JsonScanner<ItemSink> scanner(sink);
+            scanner.feed(pool, used);
+        }
+    }
+
+    uint8_t pool[POOL];
+    uint16_t used = 0;
+    CmdFormat format = CMD_JSON;
+    uint8_t count = 0;
+    int16_t pos = -1;
+};
+
+#endif //ESPARKLE_PLAYLIST_H
@@ -0,0 +1,276 @@
+#ifndef ESPARKLE_REPLYWRITER_H
+#define ESPARKLE_REPLYWRITER_H
+
+#include <Arduino.h>
+#include "cmdparser.h"
+
+#define REPLY_MAX_DEPTH 8
+
+/**
+ * Print that only counts bytes, to size a message before streaming it
+ */
+class CountingPrint : public Print {
+public:
+    size_t write(uint8_t) override {
+        count++;
+        return 1;
+    }
+
+    size_t write(const uint8_t *, size_t len) override {
+        count += len;
+        return len;
+    }
+
+    size_t count = 0;
+};
+
+/**
+ * Print into a fixed size buffer, bytes beyond its end are dropped
+ */
+class MemoryPrint : public Print {
+public:
+    MemoryPrint(uint8_t *buf, size_t size) : buf(buf), size(size) {}
+
+    size_t write(uint8_t c) override {
+        if (len == size) {
+            return 0;
+        }
+        buf[len++] = c;
+        return 1;
+    }
+
+    size_t write(const uint8_t *data, size_t n) override {
+        n = min(n, size - len);
+        memcpy(buf + len, data, n);
+        len += n;
+        return n;
+    }
+
+    size_t length() const { return len; }
+
+private:
+    uint8_t *buf;
+    size_t size;
+    size_t len = 0;
+};
+
+/**
+ * Print gathering small writes, so that the underlying client sends chunks
+ */
+template<size_t N>
+class BufferedPrint : public Print {
+public:
+    explicit BufferedPrint(Print &out) : out(out) {}
+
+    ~BufferedPrint() { flush(); }
+
+    size_t write(uint8_t c) override {
+        if (len == N) {
+            flush();
+        }
+        buf[len++] = c;
+        return 1;
+    }
+
+    size_t write(const uint8_t *data, size_t size) override {
+        for (size_t i = 0; i < size; i++) {
+            write(data[i]);
+        }
+        return size;
+    }
+
+    void flush() override {
+        if (len) {
+            out.write(buf, len);
+            len = 0;
+        }
+    }
+
+private:
+    Print &out;
+    uint8_t buf[N];
+    size_t len = 0;
+};
+
+/**
+ * Compact JSON or MessagePack writer straight into a Print, no document in memory
+ *
+ * MessagePack needs member/item counts up front, JSON ignores them.
+ */
+class ReplyWriter {
+public:
+    ReplyWriter(Print &out, CmdFormat format) : out(out), msgPack(format == CMD_MSGPACK) {}
+
+    void beginObject(uint16_t members) { begin('{', 0x80, 0xDE, members); }
+
+    void beginArray(uint16_t items) { begin('[', 0x90, 0xDC, items); }
+
+    void endObject() { end('}'); }
+
+    void endArray() { end(']'); }
+
+    void key(const __FlashStringHelper *name) {
+        char buf[24];
+        strlcpy_P(buf, (PGM_P)name, sizeof(buf));
+        key(buf);
+    }
+
+    void key(const char *name) {
+        separate();
+        putString(name);
+        if (!msgPack) {
+            out.write(':');
+        }
+        afterKey = true;
+    }
+
+    void value(const char *s) {
+        separate();
+        putString(s);
+    }
+
+    void value(uint32_t n) {
+        separate();
+        if (!msgPack) {
+            out.print((unsigned long)n);
+        } else if (n < 0x80) {
+            out.write((uint8_t)n);
+        } else if (n <= 0xFF) {
+            putHeader(0xCC, n, 1);
+        } else if (n <= 0xFFFF) {
+            putHeader(0xCD, n, 2);
+        } else {
+            putHeader(0xCE, n, 4);
+        }
+    }
+
+    void value(unsigned long n) { value((uint32_t)n); }
+
+    void value(long n) { value((int32_t)n); }
+
+    void value(double d) { value((float)d); }
+
+    void value(int32_t n) {
+        if (n >= 0) {
+            value((uint32_t)n);
+            return;
+        }
+        separate();
+        if (!msgPack) {
+            out.print((long)n);
+        } else if (n >= -32) {
+            out.write((uint8_t)n);
+        } else {
+            putHeader(0xD2, n, 4);
+        }
+    }
+
+    void value(float f) {
+        separate();
+        if (msgPack) {
+            uint32_t u;
+            memcpy(&u, &f, sizeof(u));
+            putHeader(0xCA, u, 4);
+        } else {
+            out.print(f, 3);
+        }
+    }
+
+    void value(bool b) {
+        separate();
+        if (msgPack) {
+            out.write((uint8_t)(b ? 0xC3 : 0xC2));
+        } else {
+            out.print(b ? F("true") : F("false"));
+        }
+    }
+
+    template<typename K, typename T>
+    void member(K name, T v) {
+        key(name);
+        value(v);
+    }
+
+private:
+    void begin(char json, uint8_t fix, uint8_t big, uint16_t count) {
+        separate();
+        if (!msgPack) {
+            out.write(json);
+        } else if (count < 16) {
+            out.write((uint8_t)(fix | count));
+        } else {
+            putHeader(big, count, 2);
+        }
+        if (depth < REPLY_MAX_DEPTH) {
+            first[depth] = true;
+        }
+        depth++;
+    }
+
+    void end(char json) {
+        depth--;
+        if (!msgPack) {
+            out.write(json);
+        }
+    }
+
+    // JSON comma before every member or item but the first
+    void separate() {
+        if (afterKey) {
+            afterKey = false;
+            return;
+        }
+        if (!depth || depth > REPLY_MAX_DEPTH) {
+            return;
+        }
+        if (!first[depth - 1] && !msgPack) {
+            out.write(',');
+        }
+        first[depth - 1] = false;
+    }
+
+    void putHeader(uint8_t type, uint32_t n, uint8_t bytes) {
+        out.write(type);
+        while (bytes--) {
+            out.write((uint8_t)(n >> (8 * bytes)));
+        }
+    }
+
+    void putString(const char *s) {
+        size_t len = strlen(s);
+        if (msgPack) {
+            if (len < 32) {
+                out.write((uint8_t)(0xA0 | len));
+            } else if (len <= 0xFF) {
+                putHeader(0xD9, len, 1);
+            } else {
+                putHeader(0xDA, len, 2);
+            }
+            out.write((const uint8_t *)s, len);
+            return;
+        }
+        out.write('"');
+        for (; *s; s++) {
+            uint8_t c = *s;
+            if (c == '"' || c == '\\') {
+                out.write('\\');
+                out.write(c);
+            } else if (c < 0x20) {
+                char esc[7];
+                snprintf_P(esc, sizeof(esc), PSTR("\\u%04x"), c);
+                out.write((const uint8_t *)esc, 6);
+            } else {
+                out.write(c);
+            }
+        }
+        out.write('"');
+    }
+
+    Print &out;
+    bool msgPack;
+    uint8_t depth = 0;
+    bool first[REPLY_MAX_DEPTH];
+    bool afterKey = false;
+};
+
+#endif //ESPARKLE_REPLYWRITER_H
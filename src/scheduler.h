@@ -0,0 +1,135 @@
+#ifndef ESPARKLE_SCHEDULER_H
+#define ESPARKLE_SCHEDULER_H
+
+#include <Arduino.h>
+#include "loopprof.h"
+
+#define TASK_NONE UINT8_MAX
+
+typedef void (*TaskFn)(uint32_t now);
+typedef bool (*TaskHungry)();
+
+struct Task {
+    const char *name;
+    TaskFn run;
+    uint16_t periodMs; // 0 to run on every pass
+    uint16_t budgetUs; // Expected max run time
+    uint32_t nextMs;
+    uint32_t overruns; // Runs over budget
+    ProfHist hist;     // Run times
+};
+
+/**
+ * Cooperative scheduler, tasks run to completion
+ *
+ * Each pass runs every due task once, earliest deadline first. The urgent task
+ * (audio) runs on every pass, and also between any two tasks while its buffer
+ * is below watermark, so that a slow task delays it by one task at most.
+ * Busy time is measured, idle time is what's left of the window.
+ */
+template<uint8_t N>
+class Scheduler {
+    static_assert(N <= 32, "Tasks are tracked in a 32 bit mask");
+
+public:
+    /**
+     * Add task, return its id, or TASK_NONE when all N are taken
+     */
+    uint8_t add(const char *name, TaskFn run, uint16_t periodMs, uint16_t budgetUs) {
+        if (count >= N) {
+            return TASK_NONE;
+        }
+        Task &t = tasks[count];
+        t = {};
+        t.name = name;
+        t.run = run;
+        t.periodMs = periodMs;
+        t.budgetUs = budgetUs;
+        return count++;
+    }
+
+    void setUrgent(uint8_t id, TaskHungry hungry) {
+        urgent = id;
+        isHungry = hungry;
+    }
+
+    void loop() {
+        uint32_t now = millis();
+        uint32_t ran = 0;
+        if (urgent < count) {
+            runTask(urgent, now);
+            ran |= 1UL << urgent;
+        }
+        for (;;) {
+            int8_t pick = -1;
+            for (uint8_t i = 0; i < count; i++) {
+                if (!(ran & (1UL << i)) && (int32_t)(now - tasks[i].nextMs) >= 0
+                    && (pick < 0 || (int32_t)(tasks[i].nextMs - tasks[pick].nextMs) < 0)) {
+                    pick = i;
+                }
+            }
+            if (pick < 0) {
+                break;
+            }
+            runTask(pick, now);
+            ran |= 1UL << pick;
+            now = millis();
+            if (urgent < count && isHungry()) {
+                urgentRuns++;
+                runTask(urgent, now);
+            }
+        }
+    }
+
+    uint8_t size() const { return count; }
+
+    const Task &task(uint8_t i) const { return tasks[i]; }
+
+    // Extra runs of the urgent task between others
+    uint32_t extraRuns() const { return urgentRuns; }
+
+    uint8_t idlePct() const {
+        uint64_t windowUs = (uint64_t)(millis() - sinceMs) * 1000;
+        return windowUs > busyUs ? (windowUs - busyUs) * 100 / windowUs : 0;
+    }
+
+    uint32_t since() const { return sinceMs; }
+
+    void reset() {
+        for (uint8_t i = 0; i < count; i++) {
+            tasks[i].overruns = 0;
+            tasks[i].hist = {};
+        }
+        urgentRuns = 0;
+        busyUs = 0;
+        sinceMs = millis();
+    }
+
+private:
+    void runTask(uint8_t i, uint32_t now) {
+        Task &t = tasks[i];
+        uint32_t start = micros();
+        t.run(now);
+        uint32_t us = micros() - start;
+        busyUs += us;
+        t.hist.add(us);
+        if (us > t.budgetUs) {
+            t.overruns++;
+        }
+        // Late tasks are not run twice to catch up
+        t.nextMs += t.periodMs;
+        if ((int32_t)(now - t.nextMs) >= 0) {
+            t.nextMs = now + t.periodMs;
+        }
+    }
+
+    Task tasks[N];
+    uint8_t count = 0;
+    uint8_t urgent = TASK_NONE;
+    TaskHungry isHungry = nullptr;
+    uint32_t urgentRuns = 0;
+    uint64_t busyUs = 0;
+    uint32_t sinceMs = 0;
+};
+
+#endif //ESPARKLE_SCHEDULER_H
@@ -0,0 +1,161 @@
+#ifndef ESPARKLE_TIMELINE_H
+#define ESPARKLE_TIMELINE_H
+
+#include <Arduino.h>
+
+#define TIMELINE_ID_SIZE 12
+
+struct TimelineStep {
+    uint32_t due;    // millis() when step is due
+    uint16_t seq;    // Insertion order, steps due at the same time run FIFO
+    uint16_t offset; // Encoded command, in pool
+    uint16_t len;
+    char id[TIMELINE_ID_SIZE];
+};
+
+/**
+ * Scheduled commands, as a fixed min-heap of steps ordered by due time
+ *
+ * Each step holds an encoded command (JSON or MessagePack) copied into a
+ * shared pool of POOL bytes, compacted when steps are removed.
+ */
+template<uint8_t N, uint16_t POOL>
+class Timeline {
+public:
+    /**
+     * Schedule encoded command, return false if steps or pool are full
+     */
+    bool add(const char *id, uint32_t due, const uint8_t *data, uint16_t len) {
+        if (count == N || len > POOL - used) {
+            return false;
+        }
+        TimelineStep &step = heap[count];
+        step.due = due;
+        step.seq = nextSeq++;
+        step.offset = used;
+        step.len = len;
+        strlcpy(step.id, id ? id : "", sizeof(step.id));
+        memcpy(pool + used, data, len);
+        used += len;
+        siftUp(count++);
+        return true;
+    }
+
+    bool due(uint32_t now) const { return count && (int32_t)(now - heap[0].due) >= 0; }
+
+    // Next step, only valid while the timeline is not modified
+    const TimelineStep &top() const { return heap[0]; }
+
+    const uint8_t *data(const TimelineStep &step) const { return pool + step.offset; }
+
+    /**
+     * Remove step by sequence number, if still scheduled
+     */
+    bool remove(uint16_t seq) {
+        for (uint8_t i = 0; i < count; i++) {
+            if (heap[i].seq == seq) {
+                removeAt(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Sequence number of the next step added
+    uint16_t mark() const { return nextSeq; }
+
+    /**
+     * Remove all steps with given id, return number of steps removed
+     */
+    uint8_t cancel(const char *id) { return cancel(id, nextSeq); }
+
+    /**
+     * Remove steps with given id added before mark, return number of steps removed
+     */
+    uint8_t cancel(const char *id, uint16_t mark) {
+        uint8_t removed = 0;
+        for (uint8_t i = 0; i < count;) {
+            if (strcmp(heap[i].id, id) == 0 && (int16_t)(heap[i].seq - mark) < 0) {
+                removeAt(i);
+                removed++;
+            } else {
+                i++;
+            }
+        }
+        return removed;
+    }
+
+    void clear() {
+        count = 0;
+        used = 0;
+    }
+
+    uint8_t size() const { return count; }
+
+    uint16_t bytes() const { return used; }
+
+private:
+    static bool before(const TimelineStep &a, const TimelineStep &b) {
+        int32_t d = a.due - b.due;
+        return d < 0 || (d == 0 && (int16_t)(a.seq - b.seq) < 0);
+    }
+
+    void swap(uint8_t a, uint8_t b) {
+        TimelineStep tmp = heap[a];
+        heap[a] = heap[b];
+        heap[b] = tmp;
+    }
+
+    void siftUp(uint8_t i) {
+        while (i && before(heap[i], heap[(i - 1) / 2])) {
+            swap(i, (i - 1) / 2);
+            i = (i - 1) / 2;
+        }
+    }
+
+    void siftDown(uint8_t i) {
+        for (;;) {
+            uint8_t min = i;
+            uint8_t l = 2 * i + 1;
+            uint8_t r = l + 1;
+            if (l < count && before(heap[l], heap[min])) {
+                min = l;
+            }
+            if (r < count && before(heap[r], heap[min])) {
+                min = r;
+            }
+            if (min == i) {
+                return;
+            }
+            swap(i, min);
+            i = min;
+        }
+    }
+
+    void removeAt(uint8_t i) {
+        uint16_t offset = heap[i].offset;
+        uint16_t len = heap[i].len;
+        memmove(pool + offset, pool + offset + len, used - offset - len);
+        used -= len;
+        for (uint8_t j = 0; j < count; j++) {
+            if (heap[j].offset > offset) {
+                heap[j].offset -= len;
+            }
+        }
+
+        heap[i] = heap[--count];
+        if (i < count) {
+            siftDown(i);
+            siftUp(i);
+        }
+    }
+
+    TimelineStep heap[N];
+    uint8_t count = 0;
+    uint16_t nextSeq = 0;
+
+    uint8_t pool[POOL];
+    uint16_t used = 0;
+};
+
+#endif //ESPARKLE_TIMELINE_H
@@ -0,0 +1,292 @@
+#ifndef ESPARKLE_TTSCLIENT_H
+#define ESPARKLE_TTSCLIENT_H
+
+#include <ESP8266WiFi.h>
+#include <base64.h>
+#include "connpool.h"
+
+#define TTS_HOLD_MS      10000 // Streamed answer not taken for playing within this delay is closed...
+#define TTS_HOLD_EXPIRED (-4)  // ...and the request ends with this status
+
+/**
+ * Non blocking client for the TTS companion script
+ *
+ * A request goes through name lookup, connect, send, headers and body steps,
+ * each one advanced by loop() without waiting for the proxy, as HttpGet does.
+ * The response body is expected to be the URL of the generated MP3 file.
+ *
+ * In stream mode, the proxy answers with the MP3 itself, sent while it's being
+ * synthesized: the request is over as soon as the headers are read, and the
+ * connection is held for the decoder to take() it. A proxy answering with a URL
+ * anyway is still understood.
+ *
+ * Connections come from the pool, a URL answer of known length leaves the
+ * connection there for the next request.
+ */
+class TtsClient {
+public:
+    enum State : uint8_t {
+        IDLE,
+        RESOLVE,
+        CONNECT,
+        SEND,
+        HEADERS,
+        BODY,
+        HELD
+    };
+
+    void begin(ConnPool &connPool, const char *url, const char *user, const char *password, uint32_t timeout, bool stream) {
+        pool = &connPool;
+        strlcpy(path, splitUrl(url, host, sizeof(host), port), sizeof(path));
+        String credentials = String(user) + ':' + password;
+        auth = base64::encode(credentials, false);
+        timeoutMs = timeout;
+        streamMode = stream;
+    }
+
+    bool busy() const { return state != IDLE; }
+
+    /**
+     * Start a request
+     * text and voice must stay valid until loop() reports completion
+     */
+    bool start(const char *text, const char *voice) {
+        if (busy()) {
+            return false;
+        }
+        reqText = text;
+        reqVoice = voice;
+        httpCode = 0;
+        respLen = 0;
+        bodyRead = 0;
+        resp[0] = 0;
+        fresh = false;
+        startMs = millis();
+        state = RESOLVE;
+        return true;
+    }
+
+    /**
+     * Advance current request
+     * Return true once the request is over, successfully or not, and once a held answer expires
+     */
+    bool loop() {
+        if (state == IDLE) {
+            return false;
+        }
+        if (state == HELD) {
+            if (millis() - heldMs > TTS_HOLD_MS) {
+                client.stop();
+                httpCode = TTS_HOLD_EXPIRED;
+                state = IDLE;
+                return true;
+            }
+            return false;
+        }
+        if (millis() - startMs > timeoutMs) {
+            httpCode = -1;
+            return finish();
+        }
+
+        switch (state) {
+            case RESOLVE: {
+                int8_t found = pool->resolveAsync(host, ip);
+                if (found < 0) {
+                    httpCode = -2;
+                    return finish();
+                }
+                if (found) {
+                    state = CONNECT;
+                }
+                break;
+            }
+
+            case CONNECT: {
+                int8_t connected = pool->acquireAsync(ip, port, client, reused, fresh);
+                if (connected < 0) {
+                    httpCode = -2;
+                    return finish();
+                }
+                if (connected) {
+                    state = SEND;
+                }
+                break;
+            }
+
+            case SEND:
+                sendRequest();
+                head.begin();
+                headBytes = 0;
+                state = HEADERS;
+                break;
+
+            case HEADERS:
+                while (client.available()) {
+                    headBytes++;
+                    if (head.feed(client.read())) {
+                        httpCode = head.status ?: -3;
+                        state = BODY;
+                        break;
+                    }
+                }
+                if (state == HEADERS && !client.connected()) {
+                    client.stop();
+                    if (reused && !headBytes) {
+                        // Kept-alive connection closed by the proxy meanwhile
+                        fresh = true;
+                        state = CONNECT;
+                        break;
+                    }
+                    httpCode = -3;
+                    return finish();
+                }
+                if (state == BODY && head.audio && httpCode == HTTP_CODE_OK) {
+                    latency = millis() - startMs;
+                    heldMs = millis();
+                    state = HELD;
+                    return true;
+                }
+                break;
+
+            case BODY:
+                while (client.available() && (!head.length || bodyRead < head.length)) {
+                    char c = client.read();
+                    bodyRead++;
+                    if (respLen < sizeof(resp) - 1) {
+                        resp[respLen++] = c;
+                    }
+                }
+                resp[respLen] = 0;
+                if (head.reusable() && bodyRead == head.length) {
+                    pool->release(client);
+                    return finish();
+                }
+                if (!client.connected()) {
+                    return finish();
+                }
+                break;
+
+            default:
+                break;
+        }
+        return false;
+    }
+
+    State getState() const { return state; }
+
+    // Streamed MP3 answer waiting to be played
+    bool held() const { return state == HELD; }
+
+    /**
+     * Hand the held connection over, positioned at the start of the MP3, with its
+     * length (0 if unknown) and whether it can be kept alive after, the client is left idle
+     */
+    WiFiClient take(uint32_t &size, bool &reusable) {
+        WiFiClient taken = client;
+        client = WiFiClient();
+        size = head.length;
+        reusable = head.reusable();
+        state = IDLE;
+        return taken;
+    }
+
+    int status() const { return httpCode; }
+
+    const char *body() const { return resp; }
+
+    uint32_t latencyMs() const { return latency; }
+
+private:
+    // Form url-encoded length of str
+    static size_t encodedLength(const char *str) {
+        size_t len = 0;
+        for (; *str; str++) {
+            len += isalnum((unsigned char)*str) || strchr("-_.~", *str) ? 1 : 3;
+        }
+        return len;
+    }
+
+    void writeEncoded(const char *str) {
+        char buf[64];
+        size_t n = 0;
+        for (; *str; str++) {
+            unsigned char c = *str;
+            if (isalnum(c) || strchr("-_.~", c)) {
+                buf[n++] = c;
+            } else {
+                n += snprintf(buf + n, 4, "%%%02X", c);
+            }
+            if (n > sizeof(buf) - 4) {
+                client.write((const uint8_t *)buf, n);
+                n = 0;
+            }
+        }
+        client.write((const uint8_t *)buf, n);
+    }
+
+    void sendRequest() {
+        size_t len = 5 + encodedLength(reqText);
+        if (reqVoice && *reqVoice) {
+            len += 7 + encodedLength(reqVoice);
+        }
+        if (streamMode) {
+            len += 9;
+        }
+
+        // HTTP/1.0, so that the body is never chunked: the proxy sends its length to keep the connection alive
+        client.printf_P(PSTR("POST %s HTTP/1.0\r\n"
+                             "Host: %s\r\n"
+                             "Authorization: Basic %s\r\n"
+                             "Connection: keep-alive\r\n"
+                             "Content-Type: application/x-www-form-urlencoded\r\n"
+                             "Content-Length: %u\r\n"
+                             "\r\n"), path, host, auth.c_str(), (unsigned)len);
+        client.print(F("text="));
+        writeEncoded(reqText);
+        if (reqVoice && *reqVoice) {
+            client.print(F("&voice="));
+            writeEncoded(reqVoice);
+        }
+        if (streamMode) {
+            client.print(F("&stream=1"));
+        }
+    }
+
+    bool finish() {
+        if (state == CONNECT) {
+            pool->cancelConnect(ip, port);
+        }
+        client.stop();
+        latency = millis() - startMs;
+        state = IDLE;
+        return true;
+    }
+
+    ConnPool *pool = nullptr;
+    WiFiClient client;
+    char host[CONN_HOST_SIZE] = "";
+    uint16_t port = 80;
+    IPAddress ip;
+    char path[96] = "/";
+    String auth;
+    uint32_t timeoutMs = 15000;
+    bool streamMode = false;
+
+    State state = IDLE;
+    const char *reqText = nullptr;
+    const char *reqVoice = nullptr;
+    uint32_t startMs = 0;
+    uint32_t latency = 0;
+    uint32_t heldMs = 0;
+    int httpCode = 0;
+    bool reused = false;
+    bool fresh = false; // Retry on a new connection
+
+    HttpHead head;
+    uint32_t headBytes = 0;
+    uint32_t bodyRead = 0;
+    char resp[256];
+    size_t respLen = 0;
+};
+
+#endif //ESPARKLE_TTSCLIENT_H
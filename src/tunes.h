@@ -0,0 +1,308 @@
+#ifndef ESPARKLE_TUNES_H
+#define ESPARKLE_TUNES_H
+
+#include <Arduino.h>
+#include <AudioGenerator.h>
+
+#define TUNE_NAME_SIZE 20    // Tune file name is <name>.tune, within LittleFS 31 chars limit
+#define TUNE_NOTE_SIZE 4     // freqHz, durMs, both 16 bit little endian, freqHz 0 for a pause
+#define TUNE_RATE      22050 // Default sample rate, as AudioGeneratorRTTTL
+
+/**
+ * Incremental RTTTL to tune compiler, fed with song chunks of any size
+ *
+ * Notes are written as soon as they're complete, so that songs of any length
+ * are compiled with a few bytes of state. Notes are timed as AudioGeneratorRTTTL
+ * does, same integer maths, same octave range (4 to 7). Parsing stops at the first
+ * invalid note, the song ends there.
+ */
+class RtttlCompiler {
+public:
+    void begin(Print &output) {
+        out = &output;
+        section = SECTION_TITLE;
+        nameLen = 0;
+        tokenLen = 0;
+        name[0] = 0;
+        duration = 4;
+        octave = 6;
+        bpm = 63;
+        notes = 0;
+        totalMs = 0;
+        failed = false;
+        done = false;
+    }
+
+    void feed(const char *str, size_t len) {
+        for (size_t i = 0; i < len && !done; i++) {
+            put(str[i]);
+        }
+    }
+
+    /**
+     * Flush the last note, return false if the song had no valid note
+     */
+    bool end() {
+        if (!done && section == SECTION_NOTES) {
+            token();
+        }
+        done = true;
+        return !failed && notes;
+    }
+
+    // Song title as received, may be empty
+    const char *title() const { return name; }
+
+    uint16_t count() const { return notes; }
+
+    uint32_t lengthMs() const { return totalMs; }
+
+private:
+    enum Section : uint8_t {
+        SECTION_TITLE,
+        SECTION_DEFAULTS,
+        SECTION_NOTES
+    };
+
+    void put(char c) {
+        if (section == SECTION_TITLE) {
+            if (c == ':') {
+                section = SECTION_DEFAULTS;
+            } else if (nameLen < sizeof(name) - 1) {
+                name[nameLen++] = c;
+                name[nameLen] = 0;
+            }
+            return;
+        }
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            return;
+        }
+        if (c == ',' || (c == ':' && section == SECTION_DEFAULTS)) {
+            token();
+            if (c == ':' && !done) {
+                section = SECTION_NOTES;
+                wholeMs = 60UL * 1000 * 4 / bpm;
+            }
+            return;
+        }
+        if (tokenLen == sizeof(tok)) {
+            stop();
+            return;
+        }
+        tok[tokenLen++] = c;
+    }
+
+    void token() {
+        const char *p = tok;
+        const char *end = tok + tokenLen;
+        tokenLen = 0;
+        if (p == end) {
+            return;
+        }
+        if (section == SECTION_DEFAULTS) {
+            char key = *p++ | 0x20;
+            uint32_t v;
+            if (p == end || *p++ != '=' || !readInt(p, end, v) || p != end || !v) {
+                stop();
+            } else if (key == 'd') {
+                duration = v;
+            } else if (key == 'o') {
+                octave = v;
+            } else if (key == 'b') {
+                bpm = v;
+            }
+            return;
+        }
+
+        uint32_t dur;
+        if (!readInt(p, end, dur) || !dur) {
+            dur = duration;
+        }
+        uint32_t ms = wholeMs / dur;
+
+        static const uint8_t SEMITONES[7] = {10, 12, 1, 3, 5, 6, 8}; // a to g, 1 is C
+        char letter = p < end ? *p++ | 0x20 : 0;
+        uint8_t note;
+        if (letter >= 'a' && letter <= 'g') {
+            note = SEMITONES[letter - 'a'];
+        } else if (letter == 'p') {
+            note = 0;
+        } else {
+            stop();
+            return;
+        }
+        if (p < end && *p == '#') {
+            p++;
+            note += note ? 1 : 0;
+        }
+        bool dotted = p < end && *p == '.';
+        if (dotted) {
+            p++;
+        }
+        uint32_t scale;
+        if (!readInt(p, end, scale)) {
+            scale = octave;
+        }
+        // Dot after the octave, as many songs have it
+        if (!dotted && p < end && *p == '.') {
+            p++;
+            dotted = true;
+        }
+        if (p != end) {
+            stop();
+            return;
+        }
+        if (dotted) {
+            ms += ms / 2;
+        }
+        // C4 to B7, same rounding as AudioGeneratorRTTTL
+        static const uint16_t FREQS[48] PROGMEM = {
+                262, 277, 294, 311, 330, 349, 370, 392, 415, 440, 466, 494,
+                523, 554, 587, 622, 659, 698, 740, 784, 831, 880, 932, 988,
+                1047, 1109, 1175, 1245, 1319, 1397, 1480, 1568, 1661, 1760, 1865, 1976,
+                2093, 2217, 2349, 2489, 2637, 2794, 2960, 3136, 3322, 3520, 3729, 3951
+        };
+        scale = constrain(scale, 4U, 7U);
+        emit(note ? pgm_read_word(&FREQS[min<uint32_t>((scale - 4) * 12 + note - 1, 47)]) : 0, ms);
+    }
+
+    // Notes longer than 16 bit are split, there's no audible phase reset of a pause
+    void emit(uint16_t freq, uint32_t ms) {
+        do {
+            uint16_t chunk = min<uint32_t>(ms, UINT16_MAX);
+            const uint8_t rec[TUNE_NOTE_SIZE] = {(uint8_t)freq, (uint8_t)(freq >> 8), (uint8_t)chunk, (uint8_t)(chunk >> 8)};
+            if (out->write(rec, sizeof(rec)) != sizeof(rec)) {
+                failed = true;
+                done = true;
+                return;
+            }
+            notes++;
+            totalMs += chunk;
+            ms -= chunk;
+        } while (ms);
+    }
+
+    static bool readInt(const char *&p, const char *end, uint32_t &v) {
+        if (p == end || *p < '0' || *p > '9') {
+            return false;
+        }
+        v = 0;
+        while (p < end && *p >= '0' && *p <= '9' && v < 100000) {
+            v = v * 10 + *p++ - '0';
+        }
+        return true;
+    }
+
+    // Invalid header fails the song, an invalid note ends it
+    void stop() {
+        if (section != SECTION_NOTES) {
+            failed = true;
+        }
+        done = true;
+    }
+
+    Print *out = nullptr;
+    Section section = SECTION_TITLE;
+    char name[TUNE_NAME_SIZE] = "";
+    uint8_t nameLen = 0;
+    char tok[12];
+    uint8_t tokenLen = 0;
+    uint32_t duration = 4;
+    uint32_t octave = 6;
+    uint32_t bpm = 63;
+    uint32_t wholeMs = 0;
+    uint16_t notes = 0;
+    uint32_t totalMs = 0;
+    bool failed = false;
+    bool done = false;
+};
+
+/**
+ * Square wave synthesizer of compiled tunes, read note by note from the source
+ *
+ * Samples are the same as AudioGeneratorRTTTL's for the same song, without
+ * loading nor parsing the song text.
+ */
+class AudioGeneratorTune : public AudioGenerator {
+public:
+    explicit AudioGeneratorTune(int16_t amplitude = 8192) : amplitude(amplitude) {
+        running = false;
+        file = nullptr;
+        output = nullptr;
+    }
+
+    ~AudioGeneratorTune() override {}
+
+    bool begin(AudioFileSource *source, AudioOutput *out) override {
+        if (!source || !out || !source->isOpen()) {
+            return false;
+        }
+        file = source;
+        output = out;
+        sent = samples = 0;
+        if (!output->SetRate(rate) || !output->SetBitsPerSample(16) || !output->SetChannels(2) || !output->begin()) {
+            return false;
+        }
+        running = true;
+        return true;
+    }
+
+    bool loop() override {
+        while (running) {
+            if (sent == samples && !nextNote()) {
+                running = false;
+                break;
+            }
+            int16_t s[2];
+            if (waveFP10) {
+                int16_t val = ((sent << 10) % waveFP10 > waveFP10 / 2) ? amplitude : -amplitude;
+                s[0] = s[1] = val;
+            } else {
+                s[0] = s[1] = 0;
+            }
+            if (!output->ConsumeSample(s)) {
+                break;
+            }
+            sent++;
+        }
+        file->loop();
+        output->loop();
+        return running;
+    }
+
+    // Also after the end, when loop() already cleared running: the output channel is still open
+    bool stop() override {
+        if (!file || !output) {
+            return false;
+        }
+        running = false;
+        output->stop();
+        return file->close();
+    }
+
+    bool isRunning() override { return running; }
+
+    void SetRate(uint16_t hz) { rate = hz; }
+
+private:
+    bool nextNote() {
+        uint8_t rec[TUNE_NOTE_SIZE];
+        if (file->read(rec, sizeof(rec)) != sizeof(rec)) {
+            return false;
+        }
+        uint16_t freq = rec[0] | rec[1] << 8;
+        uint16_t ms = rec[2] | rec[3] << 8;
+        waveFP10 = freq ? ((uint32_t)rate << 10) / freq : 0;
+        samples = (uint32_t)rate * ms / 1000;
+        sent = 0;
+        return true;
+    }
+
+    int16_t amplitude;
+    uint16_t rate = TUNE_RATE;
+    uint32_t waveFP10 = 0; // Samples per wave, Q10
+    uint32_t samples = 0;  // Samples of current note
+    uint32_t sent = 0;
+};
+
+#endif //ESPARKLE_TUNES_H
@@ -0,0 +1,281 @@
+#include <unity.h>
+#include <chrono>
+#include <vector>
+#include "audiomixer.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define COST_UNIT "cycles"
+static uint64_t costNow() { return __rdtsc(); }
+#else
+#define COST_UNIT "ns"
+static uint64_t costNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+#define DEVICE_MHZ   160
+#define BENCH_BLOCKS 2000
+#define BENCH_RUNS   5 // Best of, against host noise
+
+/**
+ * Output keeping what it's given, up to room frames
+ */
+class CaptureOutput : public AudioOutput {
+public:
+    bool begin() override {
+        running = true;
+        return true;
+    }
+
+    bool ConsumeSample(int16_t sample[2]) override {
+        if (!room) {
+            return false;
+        }
+        room--;
+        frames.push_back(sample[0]);
+        frames.push_back(sample[1]);
+        return true;
+    }
+
+    bool stop() override {
+        running = false;
+        return true;
+    }
+
+    int rate() const { return hertz; }
+
+    int16_t left(size_t i) const { return frames[2 * i]; }
+
+    int16_t right(size_t i) const { return frames[2 * i + 1]; }
+
+    size_t count() const { return frames.size() / 2; }
+
+    std::vector<int16_t> frames;
+    size_t room = SIZE_MAX;
+    bool running = false;
+};
+
+typedef AudioMixer<2> Mixer;
+
+static void feed(MixerChannel<2> &ch, int16_t left, int16_t right, uint16_t frames) {
+    while (frames--) {
+        int16_t s[2] = {left, right};
+        TEST_ASSERT_TRUE(ch.ConsumeSample(s));
+    }
+}
+
+static void start(MixerChannel<2> &ch, int hz) {
+    ch.SetRate(hz);
+    ch.SetBitsPerSample(16);
+    ch.SetChannels(2);
+    TEST_ASSERT_TRUE(ch.begin());
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_single_channel_unchanged() {
+    CaptureOutput out;
+    Mixer mixer(16384);
+    mixer.begin(&out);
+    start(mixer.channel(0), 44100);
+    TEST_ASSERT_TRUE(out.running);
+    TEST_ASSERT_EQUAL_INT(44100, out.rate());
+    feed(mixer.channel(0), 1234, -4321, 100);
+    mixer.pump();
+    TEST_ASSERT_EQUAL_size_t(100, out.count());
+    TEST_ASSERT_EQUAL_INT16(1234, out.left(99));
+    TEST_ASSERT_EQUAL_INT16(-4321, out.right(99));
+    TEST_ASSERT_EQUAL_UINT32(100, mixer.channel(0).played());
+}
+
+// Background ramps down to the duck gain while the overlay plays, and back up after it
+void test_ducking() {
+    CaptureOutput out;
+    Mixer mixer(16384);
+    mixer.begin(&out);
+    start(mixer.channel(0), 22050);
+    start(mixer.channel(1), 22050);
+    TEST_ASSERT_EQUAL_INT(22050, out.rate());
+    uint16_t ramp = (32768 - 16384) / MIXER_DUCK_RAMP;
+    for (uint16_t done = 0; done < ramp + 100; done += 64) {
+        feed(mixer.channel(0), 1000, 1000, 64);
+        feed(mixer.channel(1), 100, -100, 64);
+        mixer.pump();
+    }
+    // Gain steps are 1/256
+    TEST_ASSERT_INT_WITHIN(5, 1000 + 100, out.left(0));
+    TEST_ASSERT_INT_WITHIN(5, 750 + 100, out.left(ramp / 2));
+    TEST_ASSERT_EQUAL_INT16(500 + 100, out.left(ramp));
+    TEST_ASSERT_EQUAL_INT16(500 - 100, out.right(ramp + 50));
+
+    size_t at = out.count();
+    TEST_ASSERT_TRUE(mixer.channel(1).stop());
+    TEST_ASSERT_TRUE(out.running); // Background still plays
+    feed(mixer.channel(0), 1000, 1000, MIXER_FRAMES);
+    mixer.pump();
+    TEST_ASSERT_INT_WITHIN(5, 500, out.left(at));
+    TEST_ASSERT_TRUE(out.left(at + MIXER_FRAMES - 1) > out.left(at));
+}
+
+void test_saturation_and_gain() {
+    CaptureOutput out;
+    Mixer mixer(32768);
+    mixer.begin(&out);
+    start(mixer.channel(0), 44100);
+    start(mixer.channel(1), 44100);
+    feed(mixer.channel(0), 30000, -30000, 4);
+    feed(mixer.channel(1), 30000, -30000, 4);
+    mixer.pump();
+    TEST_ASSERT_EQUAL_INT16(32767, out.left(3));
+    TEST_ASSERT_EQUAL_INT16(-32768, out.right(3));
+
+    mixer.channel(0).SetGain(0.5);
+    mixer.channel(1).SetGain(0.25);
+    feed(mixer.channel(0), 8000, 8000, 1);
+    feed(mixer.channel(1), 8000, 8000, 1);
+    mixer.pump();
+    TEST_ASSERT_EQUAL_INT16(4000 + 2000, out.left(4));
+}
+
+// Frames are mixed only when every active channel has one
+void test_channels_in_sync() {
+    CaptureOutput out;
+    Mixer mixer(32768);
+    mixer.begin(&out);
+    start(mixer.channel(0), 44100);
+    start(mixer.channel(1), 44100);
+    feed(mixer.channel(0), 1, 1, 50);
+    feed(mixer.channel(1), 2, 2, 20);
+    mixer.pump();
+    TEST_ASSERT_EQUAL_size_t(20, out.count());
+    TEST_ASSERT_EQUAL_UINT16(30, mixer.channel(0).available());
+    TEST_ASSERT_EQUAL_UINT16(0, mixer.channel(1).available());
+
+    // Full channel pumps on its own, the generator retries while the output is full
+    out.room = 0;
+    feed(mixer.channel(1), 2, 2, MIXER_FRAMES);
+    feed(mixer.channel(0), 1, 1, MIXER_FRAMES - 30);
+    int16_t s[2] = {1, 1};
+    TEST_ASSERT_FALSE(mixer.channel(0).ConsumeSample(s));
+    out.room = 10;
+    TEST_ASSERT_TRUE(mixer.channel(0).ConsumeSample(s));
+    TEST_ASSERT_EQUAL_size_t(30, out.count());
+}
+
+// Gapless swap: the next generator takes over the held channel, the output never stops
+void test_hold_and_stop() {
+    CaptureOutput out;
+    Mixer mixer(16384);
+    mixer.begin(&out);
+    start(mixer.channel(0), 44100);
+    feed(mixer.channel(0), 5, 5, 10);
+    mixer.channel(0).hold();
+    TEST_ASSERT_TRUE(mixer.channel(0).stop());
+    TEST_ASSERT_TRUE(mixer.channel(0).isActive());
+    TEST_ASSERT_EQUAL_UINT16(10, mixer.channel(0).available());
+    start(mixer.channel(0), 44100);
+    TEST_ASSERT_EQUAL_UINT16(10, mixer.channel(0).available());
+
+    TEST_ASSERT_TRUE(mixer.channel(0).stop());
+    TEST_ASSERT_FALSE(mixer.channel(0).isActive());
+    TEST_ASSERT_FALSE(out.running);
+    TEST_ASSERT_FALSE(mixer.isActive());
+}
+
+// Channel waiting for its next generator keeps output and overlay running on silence
+void test_silence() {
+    CaptureOutput out;
+    Mixer mixer(32768);
+    mixer.begin(&out);
+    start(mixer.channel(0), 44100);
+    start(mixer.channel(1), 44100);
+    feed(mixer.channel(0), 3, 3, 10);
+    feed(mixer.channel(1), 2, 2, 40);
+    out.room = 100;
+    mixer.channel(0).silence();
+    TEST_ASSERT_EQUAL_size_t(40, out.count());
+    TEST_ASSERT_EQUAL_INT16(5, out.left(9));
+    TEST_ASSERT_EQUAL_INT16(2, out.left(10));
+    TEST_ASSERT_EQUAL_UINT16(MIXER_FRAMES, mixer.channel(0).available()); // Overlay ran dry
+
+    // Alone, up to what the output takes
+    mixer.channel(1).stop();
+    mixer.channel(0).silence();
+    TEST_ASSERT_EQUAL_size_t(100, out.count());
+    TEST_ASSERT_EQUAL_INT16(0, out.left(99));
+    TEST_ASSERT_EQUAL_UINT16(MIXER_FRAMES, mixer.channel(0).available());
+    TEST_ASSERT_TRUE(mixer.channel(0).isActive());
+}
+
+/**
+ * Cost of a block of MIXER_FRAMES frames, channels fed and mixed as generators and
+ * the audio task do it, a decoded tone over decoded noise
+ */
+static uint64_t blockCost(uint8_t channels) {
+    std::vector<int16_t> pcm[2];
+    uint32_t seed = 1;
+    for (uint16_t i = 0; i < MIXER_FRAMES * 2; i++) {
+        pcm[0].push_back((int16_t)(sin(i * 0.0627) * 20000));
+        seed = seed * 1103515245 + 12345;
+        pcm[1].push_back((int16_t)(seed >> 16));
+    }
+
+    CaptureOutput out;
+    out.frames.reserve(2 * MIXER_FRAMES);
+    Mixer mixer(16384);
+    mixer.begin(&out);
+    for (uint8_t c = 0; c < channels; c++) {
+        start(mixer.channel(c), 44100);
+    }
+    uint64_t best = UINT64_MAX;
+    for (uint8_t run = 0; run < BENCH_RUNS; run++) {
+        uint64_t cost = 0;
+        for (uint16_t block = 0; block < BENCH_BLOCKS; block++) {
+            out.frames.clear();
+            uint64_t begin = costNow();
+            for (uint8_t c = 0; c < channels; c++) {
+                const int16_t *s = pcm[c].data();
+                for (uint16_t f = 0; f < MIXER_FRAMES; f++, s += 2) {
+                    int16_t frame[2] = {s[0], s[1]};
+                    mixer.channel(c).ConsumeSample(frame);
+                }
+            }
+            mixer.pump();
+            cost += costNow() - begin;
+        }
+        TEST_ASSERT_EQUAL_size_t(MIXER_FRAMES, out.count());
+        best = min(best, cost / BENCH_BLOCKS);
+    }
+    return best;
+}
+
+/**
+ * Host figures, for orders of magnitude against the device budget of a block at 44.1 kHz
+ * A host core does more per cycle than the device's: mixing must take a small part of the budget here
+ */
+void test_block_cost() {
+    uint64_t main = blockCost(1);
+    uint64_t overlay = blockCost(2);
+    uint32_t budget = (uint64_t)DEVICE_MHZ * 1000000 * MIXER_FRAMES / 44100;
+    char msg[160];
+    snprintf(msg, sizeof(msg), "per %u frame block: %llu " COST_UNIT " main only, %llu with overlay (device budget %u cycles)",
+             MIXER_FRAMES, (unsigned long long)main, (unsigned long long)overlay, (unsigned)budget);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_LESS_THAN(budget / 8, (uint32_t)overlay);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_single_channel_unchanged);
+    RUN_TEST(test_ducking);
+    RUN_TEST(test_saturation_and_gain);
+    RUN_TEST(test_channels_in_sync);
+    RUN_TEST(test_hold_and_stop);
+    RUN_TEST(test_silence);
+    RUN_TEST(test_block_cost);
+    return UNITY_END();
+}
@@ -0,0 +1,80 @@
+#include <unity.h>
+#include "backoff.h"
+#include "native.h"
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_due_until_failure() {
+    Backoff b(100, 1000);
+    TEST_ASSERT_TRUE(b.due(millis()));
+    b.failure(millis());
+    TEST_ASSERT_FALSE(b.due(millis()));
+    TEST_ASSERT_FALSE(b.due(millis() + 49));
+    TEST_ASSERT_TRUE(b.due(millis() + 100));
+    b.success();
+    TEST_ASSERT_TRUE(b.due(millis()));
+    TEST_ASSERT_EQUAL_UINT32(0, b.consecutiveFailures());
+}
+
+void test_delay_doubles_up_to_max() {
+    Backoff b(100, 400);
+    uint32_t now = 1000;
+    uint32_t caps[] = {100, 200, 400, 400};
+    for (uint32_t cap : caps) {
+        b.failure(now);
+        TEST_ASSERT_FALSE(b.due(now + cap / 2 - 1));
+        TEST_ASSERT_TRUE(b.due(now + cap));
+        now += cap;
+    }
+    TEST_ASSERT_EQUAL_UINT32(4, b.consecutiveFailures());
+}
+
+// Nothing failed since boot, still due once millis() is past 2^31
+void test_due_late_after_boot() {
+    Backoff b(100, 1000);
+    nativeAdvanceTo(NATIVE_LATE_MS + 5);
+    TEST_ASSERT_TRUE(b.due(millis()));
+}
+
+// Failure then success early on, next drop long after
+void test_due_late_after_success() {
+    Backoff b(100, 1000);
+    b.failure(millis());
+    b.success();
+    nativeAdvanceTo(NATIVE_LATE_MS + 1000);
+    TEST_ASSERT_TRUE(b.due(millis()));
+    b.failure(millis());
+    TEST_ASSERT_FALSE(b.due(millis()));
+    TEST_ASSERT_TRUE(b.due(millis() + 100));
+}
+
+// Failure long ago, not polled since
+void test_due_long_after_failure() {
+    Backoff b(100, 1000);
+    uint32_t now = millis();
+    b.failure(now);
+    TEST_ASSERT_TRUE(b.due(now + NATIVE_LATE_MS + 1));
+}
+
+// Wait spanning the wrap of millis()
+void test_due_across_wrap() {
+    Backoff b(1000, 1000);
+    uint32_t now = 0xFFFFFF00UL;
+    b.failure(now);
+    TEST_ASSERT_FALSE(b.due(now + 0xFF));
+    TEST_ASSERT_FALSE(b.due(now + 500));
+    TEST_ASSERT_TRUE(b.due(now + 1000));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_due_until_failure);
+    RUN_TEST(test_delay_doubles_up_to_max);
+    RUN_TEST(test_due_late_after_boot);
+    RUN_TEST(test_due_late_after_success);
+    RUN_TEST(test_due_long_after_failure);
+    RUN_TEST(test_due_across_wrap);
+    return UNITY_END();
+}
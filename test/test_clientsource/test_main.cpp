@@ -0,0 +1,83 @@
+#include <unity.h>
+#include "clientsource.h"
+#include "native.h"
+
+// Stream cut before its end: the native WiFiClient never connects and DNS
+// never resolves, so each resume attempt sent fails and is backed off
+static ConnPool pool(60000, 5000);
+static HttpGet request(pool);
+
+void setUp() {}
+
+void tearDown() {
+    nativeWifiLink(false);
+}
+
+// Resume attempts sent a backoff apart, the stream ends with its budget
+static void spendBudget() {
+    nativeWifiLink(true);
+    AudioFileSourceClient src(WiFiClient(), 1000, pool, false);
+    src.resumable("http://example.com/clip.mp3", 2, request);
+    TEST_ASSERT_TRUE(src.canResume());
+    TEST_ASSERT_TRUE(src.isOpen());
+
+    src.loop(); // First attempt
+    src.loop();
+    TEST_ASSERT_TRUE(src.isOpen());
+    src.loop(); // Backing off
+    TEST_ASSERT_TRUE(src.isOpen());
+
+    nativeAdvanceTo(millis() + RESUME_MIN_MS);
+    src.loop(); // Last attempt
+    src.loop();
+    TEST_ASSERT_FALSE(src.isOpen());
+    TEST_ASSERT_FALSE(src.stalled());
+}
+
+void test_resume_attempts() {
+    spendBudget();
+}
+
+void test_resume_attempts_late() {
+    nativeAdvanceTo(NATIVE_LATE_MS + 10);
+    spendBudget();
+}
+
+// No attempt spent while WiFi is down, the stream waits up to RESUME_OFFLINE_MS
+void test_offline_wait() {
+    AudioFileSourceClient src(WiFiClient(), 1000, pool, false);
+    src.resumable("http://example.com/clip.mp3", 1, request);
+    for (uint32_t end = millis() + RESUME_OFFLINE_MS; millis() < end; nativeAdvance(1000000UL)) {
+        src.loop();
+        TEST_ASSERT_TRUE(src.isOpen());
+        TEST_ASSERT_FALSE(src.stalled());
+    }
+    nativeAdvance(1000000UL);
+    src.loop();
+    TEST_ASSERT_FALSE(src.isOpen());
+}
+
+// Back online within the wait, the attempt is still there
+void test_offline_then_back() {
+    AudioFileSourceClient src(WiFiClient(), 1000, pool, false);
+    src.resumable("http://example.com/clip.mp3", 1, request);
+    for (int i = 0; i < 20; i++) {
+        src.loop();
+        nativeAdvance(1000000UL);
+    }
+    TEST_ASSERT_TRUE(src.isOpen());
+
+    nativeWifiLink(true);
+    src.loop();
+    src.loop();
+    TEST_ASSERT_FALSE(src.isOpen());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_resume_attempts);
+    RUN_TEST(test_resume_attempts_late);
+    RUN_TEST(test_offline_wait);
+    RUN_TEST(test_offline_then_back);
+    return UNITY_END();
+}
@@ -0,0 +1,141 @@
+#include <unity.h>
+#include <chrono>
+#include <LittleFS.h>
+#include "native.h"
+#include "clipindex.h"
+
+#define CLIP_COUNT  14 // Clips of data/mp3
+#define BENCH_ROUNDS 200
+#define BENCH_RUNS   5 // Best of, against host noise
+
+typedef ClipIndex<48, 768> Index;
+
+static Index *clips; // Built by test_build
+
+static uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+// The repo's own clips, read in place
+void test_build() {
+    nativeFsRoot("data");
+    static Index built;
+    clips = &built;
+    TEST_ASSERT_EQUAL_UINT8(CLIP_COUNT, clips->build());
+    TEST_ASSERT_EQUAL_UINT8(0, clips->dropped());
+
+    // Ids in name order, every clip probed
+    for (uint8_t id = 1; id <= CLIP_COUNT; id++) {
+        if (id > 1) {
+            TEST_ASSERT_TRUE(strcmp(clips->name(id - 1), clips->name(id)) < 0);
+        }
+        const ClipInfo &clip = clips->clip(id);
+        TEST_ASSERT_EQUAL_UINT8(CLIP_MP3, clip.codec);
+        TEST_ASSERT_TRUE(clip.durationMs > 0 && clip.sampleRate > 0 && clip.kbps > 0);
+        char path[64];
+        TEST_ASSERT_TRUE(clips->path(id, path, sizeof(path)));
+        TEST_ASSERT_EQUAL_UINT8(id, clips->find(path));
+    }
+    TEST_ASSERT_EQUAL_STRING("all-eyes-on-me.mp3", clips->name(1));
+    TEST_ASSERT_EQUAL_UINT8(0, clips->find("/mp3/missing.mp3"));
+    TEST_ASSERT_EQUAL_UINT8(0, clips->find("/tunes/bigben.mp3"));
+    char path[8];
+    TEST_ASSERT_FALSE(clips->path(CLIP_COUNT + 1, path, sizeof(path)));
+    TEST_ASSERT_FALSE(clips->path(1, path, sizeof(path))); // Too long for path
+}
+
+void test_full() {
+    nativeFsRoot("data");
+    ClipIndex<4, 768> few;
+    TEST_ASSERT_EQUAL_UINT8(4, few.build());
+    TEST_ASSERT_EQUAL_UINT8(CLIP_COUNT - 4, few.dropped());
+    ClipIndex<48, 40> names;
+    uint8_t count = names.build();
+    TEST_ASSERT_EQUAL_UINT8(CLIP_COUNT, count + names.dropped());
+    size_t used = 0;
+    for (uint8_t id = 1; id <= count; id++) {
+        used += strlen(names.name(id)) + 1;
+    }
+    TEST_ASSERT_TRUE(count && used <= 40);
+}
+
+/**
+ * Host time of the lookup starting a clip needs before opening it, best of runs: without
+ * the index (CLIP_INDEX 0), on LittleFS as pcmResolve() does, or in the index
+ */
+static uint64_t lookupCost(bool indexed) {
+    char paths[CLIP_COUNT][64];
+    for (uint8_t id = 1; id <= CLIP_COUNT; id++) {
+        clips->path(id, paths[id - 1], sizeof(paths[0]));
+    }
+    uint64_t best = UINT64_MAX;
+    for (uint8_t run = 0; run < BENCH_RUNS; run++) {
+        uint64_t start = nowNs();
+        for (uint16_t round = 0; round < BENCH_ROUNDS; round++) {
+            for (const char *path : paths) {
+                TEST_ASSERT_TRUE(indexed ? clips->find(path) != 0 : LittleFS.exists(path));
+            }
+        }
+        best = min(best, (nowNs() - start) / (BENCH_ROUNDS * CLIP_COUNT));
+    }
+    return best;
+}
+
+static uint64_t openCost() {
+    uint64_t best = UINT64_MAX;
+    for (uint8_t run = 0; run < BENCH_RUNS; run++) {
+        uint64_t start = nowNs();
+        for (uint16_t round = 0; round < BENCH_ROUNDS; round++) {
+            for (uint8_t id = 1; id <= CLIP_COUNT; id++) {
+                char path[64];
+                clips->path(id, path, sizeof(path));
+                File f = LittleFS.open(path, "r");
+                TEST_ASSERT_TRUE(f);
+            }
+        }
+        best = min(best, (nowNs() - start) / (BENCH_ROUNDS * CLIP_COUNT));
+    }
+    return best;
+}
+
+// Directory walk probing every clip: the index build at boot, and every list without the index
+static uint64_t walkCost() {
+    uint64_t best = UINT64_MAX;
+    for (uint8_t run = 0; run < BENCH_RUNS; run++) {
+        Index fresh;
+        uint64_t start = nowNs();
+        fresh.build();
+        best = min(best, nowNs() - start);
+    }
+    return best;
+}
+
+/**
+ * Host figures, the host file system in RAM: flash reads make each LittleFS lookup and
+ * walk much slower on the device, the index lookup costs the same
+ */
+void test_lookup_cost() {
+    uint64_t byPath = lookupCost(false);
+    uint64_t byIndex = lookupCost(true);
+    uint64_t open = openCost();
+    uint64_t walk = walkCost();
+    char msg[200];
+    snprintf(msg, sizeof(msg), "host, %u clips: lookup %llu ns on LittleFS, %llu ns in index, then open %llu ns; "
+             "walk and probe %llu us", CLIP_COUNT, (unsigned long long)byPath, (unsigned long long)byIndex,
+             (unsigned long long)open, (unsigned long long)walk / 1000);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_LESS_THAN(byPath, byIndex);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_build);
+    RUN_TEST(test_full);
+    RUN_TEST(test_lookup_cost);
+    return UNITY_END();
+}
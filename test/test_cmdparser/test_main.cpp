@@ -0,0 +1,330 @@
+#include <unity.h>
+#include <ArduinoJson.h>
+#include <chrono>
+#include <string>
+#include "cmdparser.h"
+#include "tracesink.h"
+
+#define BENCH_RUNS 20000
+
+static volatile uint32_t benchSink; // Keeps dispatch from being optimized away
+
+static std::string scan(const char *json, size_t chunk = SIZE_MAX, bool *ok = nullptr) {
+    TraceSink sink;
+    JsonScanner<TraceSink> scanner(sink);
+    size_t len = strlen(json);
+    bool fed = true;
+    for (size_t at = 0; at < len && fed; at += chunk) {
+        fed = scanner.feed((const uint8_t *)json + at, min(chunk, len - at));
+    }
+    bool done = fed && scanner.finish();
+    if (ok) {
+        *ok = done;
+    } else {
+        TEST_ASSERT_TRUE_MESSAGE(done, json);
+    }
+    return sink.trace;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_scan_events() {
+    TEST_ASSERT_EQUAL_STRING("{ cmd=play vol#0.5 n#-3 tags[ =a ?1 ~ } o{ x#1 } } ",
+                             scan("{\"cmd\":\"play\",\"vol\":0.5,\"n\":-3,\"tags\":[\"a\",true,null],\"o\":{\"x\":1}}").c_str());
+    TEST_ASSERT_EQUAL_STRING("#42 ", scan(" 42 ").c_str());
+}
+
+// As ArduinoJson took them
+void test_scan_lenient() {
+    TEST_ASSERT_EQUAL_STRING("{ cmd=break } ", scan("{cmd:'break'}").c_str());
+    TEST_ASSERT_EQUAL_STRING("{ led=Blink color=0xff0000 } ", scan("{ led : \"Blink\" , 'color' : '0xff0000' }").c_str());
+}
+
+void test_scan_escapes() {
+    TEST_ASSERT_EQUAL_STRING("{ s=a\n\"\\/\xC3\xA9 } ", scan("{\"s\":\"a\\n\\\"\\\\\\/\\u00e9\"}").c_str());
+}
+
+void test_scan_chunked() {
+    const char *json = "{\"mp3\":\"/mp3/bullfrog.mp3\",\"led\":\"Pulse\",\"color\":\"0x00ff00\",\"priority\":3,\"gain\":1.25}";
+    std::string whole = scan(json);
+    for (size_t chunk = 1; chunk < 8; chunk++) {
+        TEST_ASSERT_EQUAL_STRING(whole.c_str(), scan(json, chunk).c_str());
+    }
+}
+
+// Songs longer than the scratch buffer stream in chunks
+void test_scan_long_string() {
+    std::string song = "Long:d=4,o=5,b=120:";
+    while (song.size() < 1000) {
+        song += "8c,8e,8g,";
+    }
+    std::string json = "{\"rtttl\":\"" + song + "\"}";
+
+    struct ChunkSink {
+        char text[1200];
+        uint16_t chunks = 0;
+        bool last = false;
+
+        void value(const CmdValue &v) {
+            if (v.type == CMD_STRING) {
+                TEST_ASSERT_TRUE(v.len <= CMD_SCRATCH_SIZE);
+                TEST_ASSERT_EQUAL(chunks == 0, v.first);
+                v.appendTo(text, sizeof(text));
+                chunks++;
+                last = v.last;
+            }
+        }
+    } sink;
+    JsonScanner<ChunkSink> scanner(sink);
+    TEST_ASSERT_TRUE(scanner.feed((const uint8_t *)json.data(), json.size()));
+    TEST_ASSERT_TRUE(scanner.finish());
+    TEST_ASSERT_TRUE(sink.last);
+    TEST_ASSERT_EQUAL_UINT16((song.size() + CMD_SCRATCH_SIZE - 1) / CMD_SCRATCH_SIZE, sink.chunks);
+    TEST_ASSERT_EQUAL_STRING(song.c_str(), sink.text);
+}
+
+void test_scan_errors() {
+    const char *bad[] = {"{\"a\":1,}", "{\"a\":1}x", "{\"a\" 1}", "[1 2]", "{\"a\":tru}", "{\"s\":\"\\q\"}"};
+    for (const char *json : bad) {
+        bool ok = true;
+        scan(json, SIZE_MAX, &ok);
+        TEST_ASSERT_FALSE_MESSAGE(ok, json);
+    }
+
+    // Offset is one past the offending byte
+    TraceSink sink;
+    JsonScanner<TraceSink> scanner(sink);
+    TEST_ASSERT_FALSE(scanner.feed((const uint8_t *)"{\"a\":1,}", 8));
+    TEST_ASSERT_EQUAL_size_t(8, scanner.errorOffset());
+
+    // Incomplete document: no error, not done either
+    scanner.reset();
+    TEST_ASSERT_TRUE(scanner.feed((const uint8_t *)"{\"a\":1", 6));
+    TEST_ASSERT_FALSE(scanner.finish());
+}
+
+void test_value_conversions() {
+    struct Sink {
+        long i = 0;
+        uint32_t u = 0;
+        float f = 0;
+        bool b = false;
+
+        void value(const CmdValue &v) {
+            if (strcmp(v.key, "i") == 0) {
+                i = v.toInt();
+            } else if (strcmp(v.key, "u") == 0) {
+                u = v.toUInt();
+            } else if (strcmp(v.key, "f") == 0) {
+                f = v.toFloat();
+            } else if (strcmp(v.key, "b") == 0) {
+                b = v.toInt();
+            }
+        }
+    } sink;
+    JsonScanner<Sink> scanner(sink);
+    const char *json = "{\"i\":\"010\",\"u\":\" 0xFF8000\",\"f\":-2.5e-1,\"b\":true}";
+    TEST_ASSERT_TRUE(scanner.feed((const uint8_t *)json, strlen(json)));
+    TEST_ASSERT_TRUE(scanner.finish());
+    TEST_ASSERT_EQUAL_INT32(10, sink.i);
+    TEST_ASSERT_EQUAL_UINT32(0xFF8000, sink.u);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, -0.25, sink.f);
+    TEST_ASSERT_TRUE(sink.b);
+}
+
+//############################################################################
+// DISPATCH
+//############################################################################
+
+struct Decoded {
+    char source[128];
+    char action[12];
+    char led[12];
+    uint32_t color;
+    uint8_t priority;
+    float gain;
+    bool overlay;
+};
+
+typedef void (*KeyHandler)(Decoded &cmd, const CmdValue &v);
+
+void keySource(Decoded &cmd, const CmdValue &v) { v.appendTo(cmd.source, sizeof(cmd.source)); }
+
+void keyAction(Decoded &cmd, const CmdValue &v) { v.appendTo(cmd.action, sizeof(cmd.action)); }
+
+void keyLed(Decoded &cmd, const CmdValue &v) { v.appendTo(cmd.led, sizeof(cmd.led)); }
+
+void keyColor(Decoded &cmd, const CmdValue &v) { cmd.color = v.toUInt(); }
+
+void keyPriority(Decoded &cmd, const CmdValue &v) { cmd.priority = v.toInt(); }
+
+void keyGain(Decoded &cmd, const CmdValue &v) { cmd.gain = v.toFloat(); }
+
+void keyOverlay(Decoded &cmd, const CmdValue &v) { cmd.overlay = v.boolean; }
+
+constexpr CmdEntry<KeyHandler> KEYS[] = {
+        {"cmd",      keyAction},
+        {"color",    keyColor},
+        {"gain",     keyGain},
+        {"led",      keyLed},
+        {"mp3",      keySource},
+        {"overlay",  keyOverlay},
+        {"priority", keyPriority},
+        {"rtttl",    keySource},
+        {"tts",      keySource}
+};
+static_assert(cmdTableSorted(KEYS, sizeof(KEYS) / sizeof(KEYS[0])), "KEYS must be sorted");
+
+// Top level members to their handler, by table lookup or by comparing key after key
+template<bool TABLE>
+struct DispatchSink {
+    Decoded cmd = {};
+
+    void value(const CmdValue &v) {
+        if (v.depth != 1) {
+            return;
+        }
+        if (TABLE) {
+            const CmdEntry<KeyHandler> *e = cmdLookup(KEYS, v.key, strlen(v.key));
+            if (e) {
+                e->target(cmd, v);
+            }
+            return;
+        }
+        for (const CmdEntry<KeyHandler> &e : KEYS) {
+            if (strcmp(e.name, v.key) == 0) {
+                e.target(cmd, v);
+                return;
+            }
+        }
+    }
+};
+
+static const char *const COMMANDS[] = {
+        "{\"mp3\":\"/mp3/bullfrog.mp3\",\"led\":\"Blink\",\"color\":\"0xff0000\",\"priority\":2}",
+        "{\"tts\":\"The washing machine is done\",\"gain\":0.8}",
+        "{\"rtttl\":\"Beep:d=8,o=6,b=200:c,e,g\",\"overlay\":true}",
+        "{\"cmd\":\"break\"}",
+        "{\"mp3\":\"http://www.universal-soundbank.com/sounds/7340.mp3\",\"priority\":5,\"led\":\"Pulse\"}",
+        "{\"led\":\"Rainbow\"}"
+};
+static const size_t COMMAND_COUNT = sizeof(COMMANDS) / sizeof(COMMANDS[0]);
+
+void test_lookup() {
+    TEST_ASSERT_EQUAL_PTR(&KEYS[0], cmdLookup(KEYS, "cmd", 3));
+    TEST_ASSERT_EQUAL_PTR(&KEYS[8], cmdLookup(KEYS, "tts", 3));
+    TEST_ASSERT_EQUAL_PTR(&KEYS[4], cmdLookup(KEYS, "mp3x", 3));
+    TEST_ASSERT_NULL(cmdLookup(KEYS, "co", 2));       // Prefix of color
+    TEST_ASSERT_NULL(cmdLookup(KEYS, "colors", 6));
+    TEST_ASSERT_NULL(cmdLookup(KEYS, "", 0));
+    const CmdEntry<int> unsorted[] = {{"b", 0}, {"a", 1}};
+    TEST_ASSERT_FALSE(cmdTableSorted(unsorted, 2));
+}
+
+template<bool TABLE>
+static Decoded dispatch(const char *json, size_t len) {
+    DispatchSink<TABLE> sink;
+    JsonScanner<DispatchSink<TABLE>> scanner(sink);
+    scanner.feed((const uint8_t *)json, len);
+    scanner.finish();
+    return sink.cmd;
+}
+
+// Same decoded as the firmware did before the scanner: whole document, then key after key
+static Decoded decodeDoc(const char *json, size_t len) {
+    Decoded cmd = {};
+    StaticJsonDocument<512> doc;
+    if (deserializeJson(doc, json, len)) {
+        return cmd;
+    }
+    if (doc.containsKey("cmd")) {
+        strlcpy(cmd.action, doc["cmd"], sizeof(cmd.action));
+        return cmd;
+    }
+    if (doc.containsKey("gain")) {
+        cmd.gain = doc["gain"].as<float>();
+    }
+    if (doc.containsKey("mp3")) {
+        strlcpy(cmd.source, doc["mp3"], sizeof(cmd.source));
+    }
+    if (doc.containsKey("tts")) {
+        strlcpy(cmd.source, doc["tts"], sizeof(cmd.source));
+    }
+    if (doc.containsKey("rtttl")) {
+        strlcpy(cmd.source, doc["rtttl"], sizeof(cmd.source));
+    }
+    if (doc.containsKey("overlay")) {
+        cmd.overlay = doc["overlay"].as<bool>();
+    }
+    if (doc.containsKey("priority")) {
+        cmd.priority = doc["priority"].as<uint8_t>();
+    }
+    if (doc.containsKey("led")) {
+        strlcpy(cmd.led, doc["led"], sizeof(cmd.led));
+        if (doc.containsKey("color")) {
+            cmd.color = strtol(doc["color"], nullptr, 0);
+        }
+    }
+    return cmd;
+}
+
+void test_dispatch() {
+    const char *json = COMMANDS[0];
+    Decoded cmd = dispatch<true>(json, strlen(json));
+    TEST_ASSERT_EQUAL_STRING("/mp3/bullfrog.mp3", cmd.source);
+    TEST_ASSERT_EQUAL_STRING("Blink", cmd.led);
+    TEST_ASSERT_EQUAL_UINT32(0xFF0000, cmd.color);
+    TEST_ASSERT_EQUAL_UINT8(2, cmd.priority);
+    for (const char *json : COMMANDS) {
+        Decoded table = dispatch<true>(json, strlen(json));
+        Decoded chain = dispatch<false>(json, strlen(json));
+        Decoded doc = decodeDoc(json, strlen(json));
+        TEST_ASSERT_EQUAL_MEMORY(&chain, &table, sizeof(Decoded));
+        TEST_ASSERT_EQUAL_MEMORY(&doc, &table, sizeof(Decoded));
+    }
+}
+
+typedef Decoded (*Decoder)(const char *json, size_t len);
+
+static double benchNs(Decoder decode) {
+    size_t lens[COMMAND_COUNT];
+    for (size_t i = 0; i < COMMAND_COUNT; i++) {
+        lens[i] = strlen(COMMANDS[i]);
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+        size_t i = run % COMMAND_COUNT;
+        benchSink += decode(COMMANDS[i], lens[i]).priority;
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    return ns / BENCH_RUNS;
+}
+
+// Host figures, for orders of magnitude: a command must parse in microseconds, not a loop pass
+void test_dispatch_bench() {
+    double table = benchNs(dispatch<true>);
+    double chain = benchNs(dispatch<false>);
+    double doc = benchNs(decodeDoc);
+    char msg[160];
+    snprintf(msg, sizeof(msg), "parse+dispatch per command: %.0f ns by key table, %.0f ns by key comparisons, "
+                               "%.0f ns by StaticJsonDocument<512> and containsKey", table, chain, doc);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_LESS_THAN(50000, (uint32_t)table);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_scan_events);
+    RUN_TEST(test_scan_lenient);
+    RUN_TEST(test_scan_escapes);
+    RUN_TEST(test_scan_chunked);
+    RUN_TEST(test_scan_long_string);
+    RUN_TEST(test_scan_errors);
+    RUN_TEST(test_value_conversions);
+    RUN_TEST(test_lookup);
+    RUN_TEST(test_dispatch);
+    RUN_TEST(test_dispatch_bench);
+    return UNITY_END();
+}
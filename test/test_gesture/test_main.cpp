@@ -0,0 +1,178 @@
+#include <unity.h>
+#include <string>
+#include <vector>
+#include "gesture.h"
+
+// As config.h.SAMPLE, MPU at +/-4 g
+static const GestureConfig CONFIG = {200, 8192, 1500, 40, 400, 800, 4, 300, 500};
+
+#define SAMPLE_MS (1000 / 200)
+
+/**
+ * Accelerometer trace as the MPU FIFO delivers it, built segment by segment in mg:
+ * gravity along the side facing up, sensor noise, and the motion of each gesture
+ */
+class Trace {
+public:
+    Trace() { gravity[2] = 1000; }
+
+    Trace &rest(uint32_t ms) {
+        for (uint32_t t = 0; t < ms; t += SAMPLE_MS) {
+            add(0, 0, 0);
+        }
+        return *this;
+    }
+
+    // Knock: a sharp peak, a smaller rebound, then ringing down
+    Trace &tap(uint8_t axis, int32_t mg) {
+        static const int8_t SHAPE[] = {60, 100, -40, 15, -5};
+        for (int8_t pct : SHAPE) {
+            int32_t m[3] = {};
+            m[axis] = mg * pct / 100;
+            add(m[0], m[1], m[2]);
+        }
+        return *this;
+    }
+
+    Trace &shake(uint8_t axis, int32_t mg, uint16_t hz, uint32_t ms) {
+        for (uint32_t t = 0; t < ms; t += SAMPLE_MS) {
+            int32_t m[3] = {};
+            m[axis] = mg * sin(2 * M_PI * hz * t / 1000.0);
+            add(m[0], m[1], m[2]);
+        }
+        return *this;
+    }
+
+    // Turn over ms, until side (gravity in mg per axis) faces up
+    Trace &turn(int32_t x, int32_t y, int32_t z, uint32_t ms) {
+        const int32_t from[3] = {gravity[0], gravity[1], gravity[2]};
+        const int32_t to[3] = {x, y, z};
+        for (uint32_t t = 0; t < ms; t += SAMPLE_MS) {
+            for (uint8_t i = 0; i < 3; i++) {
+                gravity[i] = from[i] + (to[i] - from[i]) * (int32_t)t / (int32_t)ms;
+            }
+            add(0, 0, 0);
+        }
+        for (uint8_t i = 0; i < 3; i++) {
+            gravity[i] = to[i];
+        }
+        return *this;
+    }
+
+    // Steady push, too long for a tap
+    Trace &push(uint8_t axis, int32_t mg, uint32_t ms) {
+        for (uint32_t t = 0; t < ms; t += SAMPLE_MS) {
+            int32_t m[3] = {};
+            m[axis] = mg;
+            add(m[0], m[1], m[2]);
+        }
+        return *this;
+    }
+
+    /**
+     * Replay trace through a new classifier, return gestures found, separated by spaces
+     */
+    std::string replay() const {
+        GestureClassifier classifier(CONFIG);
+        std::string found;
+        for (const Sample &s : samples) {
+            Gesture g;
+            if (classifier.add(s.x, s.y, s.z, g)) {
+                static const char *const TYPES[] = {"none", "tap", "double", "multi", "shake", "tilt"};
+                static const char *const SIDES[] = {"?", "up", "down", "right", "left", "front", "back"};
+                found += found.empty() ? "" : " ";
+                found += TYPES[g.type];
+                if (g.type == GESTURE_MULTI_TAP) {
+                    found += std::to_string(g.count);
+                } else if (g.type == GESTURE_TILT) {
+                    found += std::string(":") + SIDES[g.orientation];
+                }
+            }
+        }
+        return found;
+    }
+
+private:
+    struct Sample {
+        int16_t x;
+        int16_t y;
+        int16_t z;
+    };
+
+    void add(int32_t mx, int32_t my, int32_t mz) {
+        const int32_t m[3] = {mx, my, mz};
+        int16_t raw[3];
+        for (uint8_t i = 0; i < 3; i++) {
+            seed = seed * 1103515245 + 12345;
+            int32_t noise = (int32_t)(seed >> 16) % 41 - 20; // +/-20 mg
+            raw[i] = constrain((gravity[i] + m[i] + noise) * CONFIG.lsbPerG / 1000, -32768, 32767);
+        }
+        samples.push_back({raw[0], raw[1], raw[2]});
+    }
+
+    std::vector<Sample> samples;
+    int32_t gravity[3] = {};
+    uint32_t seed = 1;
+};
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_rest_is_quiet() {
+    TEST_ASSERT_EQUAL_STRING("", Trace().rest(10000).replay().c_str());
+}
+
+void test_taps() {
+    TEST_ASSERT_EQUAL_STRING("tap", Trace().rest(1000).tap(2, 2500).rest(1000).replay().c_str());
+    TEST_ASSERT_EQUAL_STRING("tap", Trace().rest(1000).tap(0, -2000).rest(1000).replay().c_str());
+    TEST_ASSERT_EQUAL_STRING("double", Trace().rest(1000).tap(2, 2500).rest(150).tap(2, 2500).rest(1000).replay().c_str());
+
+    Trace five;
+    five.rest(1000);
+    for (uint8_t i = 0; i < 5; i++) {
+        five.tap(1, 2500).rest(120);
+    }
+    TEST_ASSERT_EQUAL_STRING("multi5", five.rest(1000).replay().c_str());
+
+    // Taps further apart than the window are counted apart
+    TEST_ASSERT_EQUAL_STRING("tap tap", Trace().rest(1000).tap(2, 2500).rest(600).tap(2, 2500).rest(1000).replay().c_str());
+}
+
+void test_light_knock_ignored() {
+    TEST_ASSERT_EQUAL_STRING("", Trace().rest(1000).tap(2, 1000).rest(1000).replay().c_str());
+}
+
+void test_push_is_not_a_tap() {
+    TEST_ASSERT_EQUAL_STRING("", Trace().rest(1000).push(0, 2000, 200).rest(1000).replay().c_str());
+}
+
+// Every shake gesture, and no taps out of it
+void test_shake() {
+    std::string found = Trace().rest(1000).shake(0, 1500, 5, 1000).rest(1000).replay();
+    TEST_ASSERT_TRUE_MESSAGE(found.compare(0, 5, "shake") == 0, found.c_str());
+    TEST_ASSERT_TRUE_MESSAGE(found.find("tap") == std::string::npos && found.find("double") == std::string::npos
+                             && found.find("multi") == std::string::npos, found.c_str());
+}
+
+// Gravity takes a second to settle after a turn, then the side must hold
+void test_tilt() {
+    TEST_ASSERT_EQUAL_STRING("tilt:right", Trace().rest(1000).turn(1000, 0, 0, 300).rest(2000).replay().c_str());
+    TEST_ASSERT_EQUAL_STRING("tilt:down", Trace().rest(1000).turn(0, 0, -1000, 300).rest(2000).replay().c_str());
+    TEST_ASSERT_EQUAL_STRING("tilt:front tilt:up",
+                             Trace().rest(1000).turn(0, 1000, 0, 300).rest(2000).turn(0, 0, 1000, 300).rest(2000).replay().c_str());
+
+    // Not held long enough
+    TEST_ASSERT_EQUAL_STRING("", Trace().rest(1000).turn(1000, 0, 0, 200).rest(200).turn(0, 0, 1000, 200).rest(2000).replay().c_str());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_rest_is_quiet);
+    RUN_TEST(test_taps);
+    RUN_TEST(test_light_knock_ignored);
+    RUN_TEST(test_push_is_not_a_tap);
+    RUN_TEST(test_shake);
+    RUN_TEST(test_tilt);
+    return UNITY_END();
+}
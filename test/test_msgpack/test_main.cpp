@@ -0,0 +1,217 @@
+#include <unity.h>
+#include <chrono>
+#include <string>
+#include "cmdparser.h"
+#include "replywriter.h"
+#include "tracesink.h"
+
+#define BENCH_RUNS 20000
+
+static volatile uint32_t benchSink; // Keeps parsing from being optimized away
+
+template<template<typename> class Scanner>
+static std::string scan(const std::string &data, size_t chunk = SIZE_MAX, bool *ok = nullptr) {
+    TraceSink sink;
+    Scanner<TraceSink> scanner(sink);
+    bool fed = true;
+    for (size_t at = 0; at < data.size() && fed; at += chunk) {
+        fed = scanner.feed((const uint8_t *)data.data() + at, min(chunk, data.size() - at));
+    }
+    bool done = fed && scanner.finish();
+    if (ok) {
+        *ok = done;
+    } else {
+        TEST_ASSERT_TRUE(done);
+    }
+    return sink.trace;
+}
+
+struct StringPrint : public Print {
+    std::string data;
+
+    size_t write(uint8_t c) override {
+        data += (char)c;
+        return 1;
+    }
+};
+
+static std::string longSong(size_t len) {
+    std::string song = "Long:d=4,o=5,b=120:";
+    while (song.size() < len) {
+        song += "8c,8e,8g,";
+    }
+    return song;
+}
+
+// Commands as the backend would send them, written by the reply writer in either format
+static void command(ReplyWriter &w, uint8_t i) {
+    switch (i) {
+        case 0:
+            w.beginObject(4);
+            w.member("mp3", "/mp3/bullfrog.mp3");
+            w.member("led", "Blink");
+            w.member("color", "0xff0000");
+            w.member("priority", (uint32_t)2);
+            w.endObject();
+            break;
+        case 1:
+            w.beginObject(2);
+            w.member("tts", "The washing machine is \"done\"\n");
+            w.member("gain", 0.8f);
+            w.endObject();
+            break;
+        case 2:
+            w.beginObject(2);
+            w.member("rtttl", "Beep:d=8,o=6,b=200:c,e,g");
+            w.member("overlay", true);
+            w.endObject();
+            break;
+        case 3:
+            w.beginObject(1);
+            w.member("cmd", "break");
+            w.endObject();
+            break;
+        case 4:
+            w.beginObject(2);
+            w.member("id", "door");
+            w.key("steps");
+            w.beginArray(2);
+            w.beginObject(1);
+            w.member("mp3", "/mp3/chime.mp3");
+            w.endObject();
+            w.beginObject(2);
+            w.member("after", (uint32_t)1500);
+            w.member("tts", "Door open");
+            w.endObject();
+            w.endArray();
+            w.endObject();
+            break;
+        case 5:
+            w.beginObject(1);
+            w.member("rtttl", longSong(300).c_str()); // str16
+            w.endObject();
+            break;
+        case 6:
+            // map16, every integer width
+            w.beginObject(18);
+            for (uint8_t m = 0; m < 18; m++) {
+                static const int32_t VALUES[6] = {0, 127, 200, 70000, -5, -70000};
+                char key[4];
+                snprintf(key, sizeof(key), "k%u", m);
+                w.member(key, VALUES[m % 6]);
+            }
+            w.endObject();
+            break;
+    }
+}
+
+static const uint8_t COMMAND_COUNT = 7;
+
+static std::string encode(uint8_t i, CmdFormat format) {
+    StringPrint out;
+    ReplyWriter w(out, format);
+    command(w, i);
+    return out.data;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_round_trip() {
+    TEST_ASSERT_EQUAL_STRING("{\"mp3\":\"/mp3/bullfrog.mp3\",\"led\":\"Blink\",\"color\":\"0xff0000\",\"priority\":2}",
+                             encode(0, CMD_JSON).c_str());
+    for (uint8_t i = 0; i < COMMAND_COUNT; i++) {
+        std::string json = encode(i, CMD_JSON);
+        std::string msgPack = encode(i, CMD_MSGPACK);
+        TEST_ASSERT_EQUAL_STRING(scan<JsonScanner>(json).c_str(), scan<MsgPackScanner>(msgPack).c_str());
+        TEST_ASSERT_LESS_THAN(json.size(), msgPack.size());
+    }
+}
+
+void test_chunked() {
+    for (uint8_t i = 0; i < COMMAND_COUNT; i++) {
+        std::string msgPack = encode(i, CMD_MSGPACK);
+        TEST_ASSERT_EQUAL_STRING(scan<MsgPackScanner>(msgPack).c_str(), scan<MsgPackScanner>(msgPack, 1).c_str());
+    }
+}
+
+// Forms the reply writer doesn't produce
+void test_other_types() {
+    const uint8_t data[] = {
+            0x8A,
+            0xA1, 'a', 0xD0, 0x80,                                           // int8 -128
+            0xA1, 'b', 0xD1, 0xFF, 0x00,                                     // int16 -256
+            0xA1, 'c', 0xCF, 0, 0, 0, 1, 0, 0, 0, 0,                         // uint64 2^32
+            0xA1, 'd', 0xCB, 0x3F, 0xF8, 0, 0, 0, 0, 0, 0,                   // float64 1.5
+            0xA1, 'e', 0xC4, 3, 'b', 'i', 'n',                               // bin, as a string
+            0xA1, 'f', 0xD4, 1, 0xAA,                                        // fixext 1, skipped
+            0xA1, 'g', 0xC7, 2, 1, 0xAA, 0xBB,                               // ext 8, skipped
+            0xA1, 'h', 0xC0,                                                 // nil
+            0xA1, 'i', 0xD9, 5, 'h', 'e', 'l', 'l', 'o',                     // str8
+            0x01, 0xA1, 'x'                                                  // non string key
+    };
+    std::string msgPack((const char *)data, sizeof(data));
+    TEST_ASSERT_EQUAL_STRING("{ a#-128 b#-256 c#4.29497e+09 d#1.5 e=bin h~ i=hello ?=x } ",
+                             scan<MsgPackScanner>(msgPack).c_str());
+}
+
+void test_errors() {
+    bool ok = true;
+    scan<MsgPackScanner>(std::string("\x81\xA1" "a\xC1", 4), SIZE_MAX, &ok); // Never used type
+    TEST_ASSERT_FALSE(ok);
+    scan<MsgPackScanner>(encode(0, CMD_MSGPACK).substr(0, 20), SIZE_MAX, &ok);
+    TEST_ASSERT_FALSE(ok);
+    scan<MsgPackScanner>(encode(3, CMD_MSGPACK) + '\x01', SIZE_MAX, &ok); // Trailing byte
+    TEST_ASSERT_FALSE(ok);
+}
+
+template<template<typename> class Scanner>
+static double benchNs(const std::string *docs) {
+    struct CountSink {
+        uint32_t values = 0;
+
+        void value(const CmdValue &) { values++; }
+    } sink;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+        const std::string &doc = docs[run % COMMAND_COUNT];
+        Scanner<CountSink> scanner(sink);
+        scanner.feed((const uint8_t *)doc.data(), doc.size());
+        scanner.finish();
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    benchSink += sink.values;
+    return ns / BENCH_RUNS;
+}
+
+// Host figures, for the ratio between formats
+void test_bench() {
+    std::string json[COMMAND_COUNT];
+    std::string msgPack[COMMAND_COUNT];
+    size_t jsonBytes = 0;
+    size_t msgPackBytes = 0;
+    for (uint8_t i = 0; i < COMMAND_COUNT; i++) {
+        json[i] = encode(i, CMD_JSON);
+        msgPack[i] = encode(i, CMD_MSGPACK);
+        jsonBytes += json[i].size();
+        msgPackBytes += msgPack[i].size();
+    }
+    double jsonNs = benchNs<JsonScanner>(json);
+    double msgPackNs = benchNs<MsgPackScanner>(msgPack);
+    char msg[128];
+    snprintf(msg, sizeof(msg), "per command: JSON %u bytes %.0f ns, MessagePack %u bytes %.0f ns",
+             (unsigned)(jsonBytes / COMMAND_COUNT), jsonNs, (unsigned)(msgPackBytes / COMMAND_COUNT), msgPackNs);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_LESS_THAN(jsonBytes, msgPackBytes);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_chunked);
+    RUN_TEST(test_other_types);
+    RUN_TEST(test_errors);
+    RUN_TEST(test_bench);
+    return UNITY_END();
+}
@@ -0,0 +1,113 @@
+#include <unity.h>
+#include "notifqueue.h"
+
+struct Item {
+    uint8_t priority;
+    uint8_t id;
+};
+
+typedef NotifQueue<Item, 4> Queue;
+
+static uint8_t popId(Queue &q) {
+    Item item = {};
+    TEST_ASSERT_TRUE(q.pop(item));
+    return item.id;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_priority_then_arrival() {
+    Queue q;
+    q.push({1, 1});
+    q.push({3, 2});
+    q.push({1, 3});
+    q.push({3, 4});
+    TEST_ASSERT_EQUAL_UINT8(4, q.size());
+    TEST_ASSERT_EQUAL_UINT8(2, q.top().id);
+    TEST_ASSERT_EQUAL_UINT8(2, popId(q));
+    TEST_ASSERT_EQUAL_UINT8(4, popId(q));
+    TEST_ASSERT_EQUAL_UINT8(1, popId(q));
+    TEST_ASSERT_EQUAL_UINT8(3, popId(q));
+    TEST_ASSERT_TRUE(q.empty());
+    Item item;
+    TEST_ASSERT_FALSE(q.pop(item));
+}
+
+void test_full_evicts_lowest_most_recent() {
+    Queue q;
+    q.push({2, 1});
+    q.push({1, 2});
+    q.push({1, 3});
+    q.push({2, 4});
+    Item evicted = {};
+    TEST_ASSERT_EQUAL(NOTIF_EVICTED, q.push({5, 5}, &evicted));
+    TEST_ASSERT_EQUAL_UINT8(3, evicted.id);
+    TEST_ASSERT_EQUAL_UINT8(4, q.size());
+    TEST_ASSERT_EQUAL_UINT8(5, popId(q));
+    TEST_ASSERT_EQUAL_UINT8(1, popId(q));
+    TEST_ASSERT_EQUAL_UINT8(4, popId(q));
+    TEST_ASSERT_EQUAL_UINT8(2, popId(q));
+}
+
+void test_full_rejects_equal_or_lower() {
+    Queue q;
+    for (uint8_t i = 0; i < 4; i++) {
+        TEST_ASSERT_EQUAL(NOTIF_QUEUED, q.push({2, i}));
+    }
+    TEST_ASSERT_EQUAL(NOTIF_REJECTED, q.push({2, 9}));
+    TEST_ASSERT_EQUAL(NOTIF_REJECTED, q.push({1, 9}));
+    TEST_ASSERT_EQUAL_UINT8(4, q.size());
+    TEST_ASSERT_EQUAL_UINT8(0, popId(q));
+}
+
+// Slots freed by pop() and clear() are reused, whatever the order they were taken in
+void test_slots_reused() {
+    Queue q;
+    for (uint16_t i = 0; i < 1000; i++) {
+        q.push({(uint8_t)(i % 7), (uint8_t)i});
+        if (q.size() == 4) {
+            Item item;
+            q.pop(item);
+            q.pop(item);
+        }
+        if (i % 97 == 0) {
+            q.clear();
+        }
+    }
+    q.clear();
+    for (uint8_t i = 0; i < 4; i++) {
+        TEST_ASSERT_EQUAL(NOTIF_QUEUED, q.push({i, i}));
+    }
+    for (uint8_t i = 4; i--;) {
+        TEST_ASSERT_EQUAL_UINT8(i, popId(q));
+    }
+}
+
+void test_remove() {
+    Queue q;
+    q.push({1, 1});
+    q.push({3, 2});
+    q.push({2, 3});
+    q.push({3, 4});
+    TEST_ASSERT_FALSE(q.remove([](const Item &i) { return i.id == 9; }));
+    TEST_ASSERT_TRUE(q.remove([](const Item &i) { return i.priority == 3; })); // First by rank
+    TEST_ASSERT_EQUAL_UINT8(3, q.size());
+    TEST_ASSERT_TRUE(q.push({0, 5}) == NOTIF_QUEUED); // Slot freed
+    TEST_ASSERT_EQUAL_UINT8(4, popId(q));
+    TEST_ASSERT_EQUAL_UINT8(3, popId(q));
+    TEST_ASSERT_EQUAL_UINT8(1, popId(q));
+    TEST_ASSERT_EQUAL_UINT8(5, popId(q));
+    TEST_ASSERT_TRUE(q.empty());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_priority_then_arrival);
+    RUN_TEST(test_full_evicts_lowest_most_recent);
+    RUN_TEST(test_full_rejects_equal_or_lower);
+    RUN_TEST(test_slots_reused);
+    RUN_TEST(test_remove);
+    return UNITY_END();
+}
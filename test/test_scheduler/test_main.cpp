@@ -0,0 +1,142 @@
+#include <unity.h>
+#include "native.h"
+#include "scheduler.h"
+
+#define DMA_US     11610 // 512 I2S frames at 44.1 kHz
+#define DECODE_PCT 40    // Decoder time per audio time, MP3 at 160 MHz
+#define RUN_MS     20000
+
+/**
+ * I2S DMA buffer drained in virtual time, refilled by the audio task at decoding cost
+ */
+static uint64_t dryAtUs;  // When buffered audio runs out
+static uint32_t underruns;
+static uint32_t maxGapUs; // Longest time between audio runs
+static uint64_t lastAudioUs;
+
+// Heavy MQTT traffic: a burst of large commands parsed, and replies published, on every pass
+static uint32_t mqttCostUs;
+
+static void taskAudio(uint32_t) {
+    uint64_t us = nativeMicros();
+    if (lastAudioUs) {
+        maxGapUs = max<uint32_t>(maxGapUs, us - lastAudioUs);
+        if (us > dryAtUs) {
+            underruns++;
+        }
+    }
+    lastAudioUs = us;
+    uint64_t level = dryAtUs > us ? dryAtUs - us : 0;
+    dryAtUs = us + DMA_US;
+    nativeAdvance((DMA_US - level) * DECODE_PCT / 100);
+}
+
+static bool audioHungry() {
+    uint64_t us = nativeMicros();
+    return dryAtUs < us + DMA_US / 2; // Below half full, as AUDIO_WATERMARK
+}
+
+static void taskMqtt(uint32_t) { nativeAdvance(mqttCostUs); }
+
+static void taskLed(uint32_t) { nativeAdvance(2500); } // 150 LEDs shown
+
+static void taskTts(uint32_t) { nativeAdvance(3000); } // TTS request written
+
+static void taskWifi(uint32_t) { nativeAdvance(500); }
+
+static void taskMpu(uint32_t) { nativeAdvance(400); }  // FIFO burst read
+
+static bool neverHungry() { return false; }
+
+template<uint8_t N>
+static void run(Scheduler<N> &sched, uint32_t ms) {
+    dryAtUs = 0;
+    underruns = 0;
+    maxGapUs = 0;
+    lastAudioUs = 0;
+    sched.reset();
+    uint64_t end = nativeMicros() + (uint64_t)ms * 1000;
+    while (nativeMicros() < end) {
+        sched.loop();
+        yield();
+    }
+}
+
+// Tasks as the firmware declares them
+static void addTasks(Scheduler<8> &sched, TaskHungry hungry) {
+    uint8_t audio = sched.add("audio", taskAudio, 0, 3000);
+    sched.add("wifi", taskWifi, 10, 2000);
+    sched.add("mqtt", taskMqtt, 0, 5000);
+    sched.add("mpu", taskMpu, 5, 1500);
+    sched.add("tts", taskTts, 10, 5000);
+    sched.add("led", taskLed, 20, 1000);
+    sched.setUrgent(audio, hungry);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_audio_deadline_under_mqtt_load() {
+    Scheduler<8> sched;
+    addTasks(sched, audioHungry);
+    mqttCostUs = 6000;
+    run(sched, RUN_MS);
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "audio: %u underruns, longest gap %u us (buffer %u us), %u extra runs, idle %u%%",
+             underruns, maxGapUs, DMA_US, sched.extraRuns(), sched.idlePct());
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_EQUAL_UINT32(0, underruns);
+    TEST_ASSERT_LESS_THAN(DMA_US, maxGapUs);
+    TEST_ASSERT_GREATER_THAN(0, sched.extraRuns());
+    TEST_ASSERT_GREATER_THAN(0, sched.task(2).overruns); // mqtt over its budget, audio kept up anyway
+}
+
+// Same load, audio only once per pass as the former fixed loop(): it runs dry
+void test_same_load_without_watermark() {
+    Scheduler<8> sched;
+    addTasks(sched, neverHungry);
+    mqttCostUs = 6000;
+    run(sched, RUN_MS);
+    TEST_ASSERT_GREATER_THAN(0, underruns);
+    TEST_ASSERT_GREATER_THAN(DMA_US, maxGapUs);
+}
+
+// Periodic tasks keep their period, idle time is what tasks leave of the window
+void test_periods_and_idle() {
+    Scheduler<8> sched;
+    addTasks(sched, audioHungry);
+    mqttCostUs = 0;
+    run(sched, 1000);
+    TEST_ASSERT_UINT_WITHIN(2, 100, sched.task(1).hist.count); // wifi, 10 ms
+    TEST_ASSERT_UINT_WITHIN(2, 50, sched.task(5).hist.count);  // led, 20 ms
+    TEST_ASSERT_EQUAL_UINT32(0, underruns);
+    uint32_t busyUs = 0;
+    for (uint8_t i = 0; i < sched.size(); i++) {
+        busyUs += sched.task(i).hist.totalUs;
+    }
+    TEST_ASSERT_UINT_WITHIN(1, 100 - busyUs / 10000, sched.idlePct());
+}
+
+// One task more than room for is refused, those added keep running
+void test_full() {
+    Scheduler<2> sched;
+    TEST_ASSERT_EQUAL_UINT8(0, sched.add("wifi", taskWifi, 10, 2000));
+    TEST_ASSERT_EQUAL_UINT8(1, sched.add("mpu", taskMpu, 5, 1500));
+    TEST_ASSERT_EQUAL_UINT8(TASK_NONE, sched.add("led", taskLed, 20, 1000));
+    TEST_ASSERT_EQUAL_UINT8(2, sched.size());
+    sched.setUrgent(TASK_NONE, audioHungry);
+    run(sched, 100);
+    TEST_ASSERT_UINT_WITHIN(2, 10, sched.task(0).hist.count);
+    TEST_ASSERT_UINT_WITHIN(2, 20, sched.task(1).hist.count);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_audio_deadline_under_mqtt_load);
+    RUN_TEST(test_same_load_without_watermark);
+    RUN_TEST(test_periods_and_idle);
+    RUN_TEST(test_full);
+    return UNITY_END();
+}
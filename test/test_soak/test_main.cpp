@@ -0,0 +1,106 @@
+/**
+ * Play/stop soak of the firmware's audio pipeline, through its own setup() and loop()
+ *
+ * The host heap can't show the device's largest free block, but what shrinks it can be
+ * seen: heap still held after a clip, and a clip needing more heap than the previous one.
+ * Every allocation is counted by the native stand-ins, both must stay flat over thousands
+ * of clips.
+ */
+
+#include <unity.h>
+#include <ftw.h>
+#include <stdlib.h>
+#include <LittleFS.h>
+#include "native.h"
+
+void setup();
+void loop();
+bool isPlaying();
+
+#define SOAK_CYCLES 3000
+#define SOAK_WARMUP 20   // Cycles before the baseline, first use of each path allocates once
+#define PASS_US     100  // Virtual time of each loop() pass
+
+#define SOAK_ROOT   "/tmp/esparkle-soakXXXXXX" // LittleFS directory of each test, mkdtemp() template
+
+static char root[sizeof(SOAK_ROOT)];
+
+static void command(const char *json) {
+    nativeMqttIn("esparkle/in", (const uint8_t *)json, strlen(json));
+}
+
+static void run(uint32_t passes) {
+    while (passes--) {
+        loop();
+        nativeAdvance(PASS_US);
+    }
+}
+
+// MPEG 1 layer III frames, 128 kbps at 44.1 kHz, with silent payload
+static void writeClip(const char *path, uint16_t frames) {
+    File f = LittleFS.open(path, "w");
+    uint8_t frame[418] = {0xFF, 0xFB, 0x92, 0x64};
+    while (frames--) {
+        f.write(frame, sizeof(frame));
+    }
+    f.close();
+}
+
+static int removeEntry(const char *path, const struct stat *, int, struct FTW *) { return remove(path); }
+
+void setUp() {
+    strcpy(root, SOAK_ROOT);
+    TEST_ASSERT_NOT_NULL(mkdtemp(root));
+    nativeFsRoot(root);
+}
+
+void tearDown() {
+    nftw(root, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+void test_play_stop_heap_flat() {
+    writeClip("/mp3/soak.mp3", 40); // ~1 s
+    setup();
+    run(100);
+
+    size_t baseline = 0;
+    size_t basePeak = 0;
+    uint32_t baseAllocs = 0;
+    for (uint32_t i = 0; i < SOAK_CYCLES; i++) {
+        if (i == SOAK_WARMUP) {
+            baseline = nativeHeapUsed();
+            basePeak = nativeHeapPeak();
+            baseAllocs = nativeHeapAllocs();
+        }
+        command("{\"mp3\":\"/mp3/soak.mp3\"}");
+        run(150); // Notifications start within a 10 ms task period
+        TEST_ASSERT_TRUE(isPlaying());
+        if (i % 3 == 0) {
+            command("{\"rtttl\":\"Soak:d=16,o=6,b=200:c,e\",\"overlay\":true}");
+            run(150);
+        }
+        if (i % 10 == 0) {
+            run(12000); // To its end
+        } else {
+            command("{\"cmd\":\"break\"}");
+            run(20);
+        }
+        TEST_ASSERT_FALSE(isPlaying());
+        if (i >= SOAK_WARMUP) {
+            TEST_ASSERT_EQUAL_UINT32(baseline, nativeHeapUsed());
+        }
+    }
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "%u cycles: %u bytes held at rest, peak %u bytes, %.1f allocations per cycle",
+             SOAK_CYCLES, (unsigned)baseline, (unsigned)nativeHeapPeak(),
+             (double)(nativeHeapAllocs() - baseAllocs) / (SOAK_CYCLES - SOAK_WARMUP));
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_EQUAL_UINT32(basePeak, nativeHeapPeak());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_play_stop_heap_flat);
+    return UNITY_END();
+}
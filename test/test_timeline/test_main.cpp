@@ -0,0 +1,178 @@
+#include <unity.h>
+#include <FastLED.h>
+#include "esparkle.h"
+#include "native.h"
+
+typedef Timeline<8, 64> Steps;
+
+static bool add(Steps &t, const char *id, uint32_t due, const char *cmd) {
+    return t.add(id, due, (const uint8_t *)cmd, strlen(cmd));
+}
+
+// Run due steps in order, return their commands separated by spaces
+static String runDue(Steps &t, uint32_t now) {
+    String ran;
+    while (t.due(now)) {
+        const TimelineStep &step = t.top();
+        ran += String(step.id) + ":";
+        ran.concat((const char *)t.data(step), step.len);
+        ran += " ";
+        t.remove(step.seq);
+    }
+    return ran;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_due_order() {
+    Steps t;
+    add(t, "a", 300, "3");
+    add(t, "a", 100, "1");
+    add(t, "b", 200, "2");
+    add(t, "b", 100, "1b"); // Same time: after the one added first
+    TEST_ASSERT_FALSE(t.due(99));
+    TEST_ASSERT_EQUAL_STRING("a:1 b:1b ", runDue(t, 100).c_str());
+    TEST_ASSERT_EQUAL_STRING("b:2 a:3 ", runDue(t, 1000).c_str());
+    TEST_ASSERT_EQUAL_UINT8(0, t.size());
+    TEST_ASSERT_EQUAL_UINT16(0, t.bytes());
+}
+
+// millis() wraps after 49 days
+void test_due_across_wrap() {
+    Steps t;
+    add(t, "", 5, "after");
+    add(t, "", UINT32_MAX - 5, "before");
+    TEST_ASSERT_FALSE(t.due(UINT32_MAX - 10));
+    TEST_ASSERT_EQUAL_STRING(":before ", runDue(t, UINT32_MAX).c_str());
+    TEST_ASSERT_EQUAL_STRING(":after ", runDue(t, 10).c_str());
+}
+
+void test_cancel_compacts_pool() {
+    Steps t;
+    add(t, "door", 100, "{\"mp3\":\"/mp3/chime.mp3\"}");
+    add(t, "bell", 150, "{\"led\":\"Blink\"}");
+    add(t, "door", 200, "{\"tts\":\"Door\"}");
+    TEST_ASSERT_EQUAL_UINT8(2, t.cancel("door"));
+    TEST_ASSERT_EQUAL_UINT8(0, t.cancel("door"));
+    TEST_ASSERT_EQUAL_UINT16(15, t.bytes());
+    TEST_ASSERT_EQUAL_STRING("bell:{\"led\":\"Blink\"} ", runDue(t, 1000).c_str());
+}
+
+// Steps added from the mark on are kept
+void test_cancel_before_mark() {
+    Steps t;
+    add(t, "door", 100, "1");
+    uint16_t mark = t.mark();
+    add(t, "door", 50, "2");
+    TEST_ASSERT_EQUAL_UINT8(1, t.cancel("door", mark));
+    TEST_ASSERT_EQUAL_STRING("door:2 ", runDue(t, 1000).c_str());
+}
+
+void test_full() {
+    Steps t;
+    for (uint8_t i = 0; i < 8; i++) {
+        TEST_ASSERT_TRUE(add(t, "x", i, "1234567"));
+    }
+    TEST_ASSERT_FALSE(add(t, "x", 9, "1"));
+    t.clear();
+    TEST_ASSERT_TRUE(add(t, "x", 0, "12345678901234567890123456789012"));
+    TEST_ASSERT_TRUE(add(t, "x", 0, "1234567890123456789012345678901"));
+    TEST_ASSERT_FALSE(add(t, "x", 0, "12")); // Pool
+    TEST_ASSERT_TRUE(add(t, "x", 0, "1"));
+}
+
+void test_long_id_truncated() {
+    Steps t;
+    add(t, "a-very-long-step-id", 0, "");
+    TEST_ASSERT_EQUAL_STRING("a-very-long", t.top().id);
+}
+
+// Steps removed in any order keep heap order and pool contents, each command here is its due time
+void test_churn() {
+    Steps t;
+    uint32_t seed = 1;
+    uint32_t now = 0;
+    for (uint16_t i = 0; i < 2000; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t due = now + (seed >> 20) % 50;
+        char cmd[8];
+        snprintf(cmd, sizeof(cmd), "%u", (unsigned)due);
+        add(t, seed & 0x100 ? "odd" : "even", due, cmd);
+        if (i % 5 == 4) {
+            t.cancel("odd");
+        }
+        now += 5;
+        uint32_t last = 0;
+        while (t.due(now)) {
+            const TimelineStep &step = t.top();
+            TEST_ASSERT_TRUE(step.due >= last);
+            char text[8] = {};
+            memcpy(text, t.data(step), min<uint16_t>(step.len, sizeof(text) - 1));
+            TEST_ASSERT_EQUAL_UINT32(step.due, strtoul(text, nullptr, 10));
+            last = step.due;
+            t.remove(step.seq);
+        }
+    }
+    while (t.size()) {
+        t.remove(t.top().seq);
+    }
+    TEST_ASSERT_EQUAL_UINT16(0, t.bytes());
+}
+
+// Run the firmware's due steps until time ms, return brightness set
+static uint8_t runFirmware(uint32_t ms) {
+    while (millis() < ms) {
+        nativeAdvance(1000);
+        taskTimeline(millis());
+    }
+    return FastLED.getBrightness();
+}
+
+/**
+ * Firmware's own timeline: a step replacing the steps of its id, itself included, by new ones
+ * Cancelling moves the pool the step is run from, the new steps must keep their commands
+ */
+void test_step_cancels_and_reschedules() {
+    const char *cmd = "{\"id\":\"door\",\"steps\":[{\"at\":500,\"bright\":9},"
+                      "{\"at\":100,\"cancel\":\"door\",\"id\":\"door\","
+                      "\"steps\":[{\"at\":50,\"bright\":7},{\"at\":60,\"bright\":8}]}]}";
+    const char *bell = "{\"id\":\"bell\",\"steps\":[{\"at\":900,\"bright\":1},{\"at\":901,\"bright\":2},"
+                       "{\"at\":902,\"bright\":3},{\"at\":903,\"bright\":4},{\"at\":904,\"bright\":5}]}";
+    uint32_t start = millis();
+    cmdDispatch((const uint8_t *)cmd, strlen(cmd));
+    cmdDispatch((const uint8_t *)bell, strlen(bell)); // Pool after the step, moved over it by cancel
+    TEST_ASSERT_EQUAL_UINT8(255, runFirmware(start + 120));
+    TEST_ASSERT_EQUAL_UINT8(7, runFirmware(start + 155));
+    TEST_ASSERT_EQUAL_UINT8(8, runFirmware(start + 165));
+    TEST_ASSERT_EQUAL_UINT8(8, runFirmware(start + 600)); // Cancelled
+    TEST_ASSERT_EQUAL_UINT8(5, runFirmware(start + 1000));
+}
+
+// Steps due at the same offset all run in the pass they come due, not a scheduler period apart
+void test_steps_due_together() {
+    const char *cmd = "{\"id\":\"chime\",\"steps\":[{\"at\":0,\"bright\":11},{\"at\":0,\"bright\":12},"
+                      "{\"at\":40,\"bright\":13},{\"at\":40,\"bright\":14},{\"at\":40,\"bright\":15}]}";
+    uint32_t start = millis();
+    cmdDispatch((const uint8_t *)cmd, strlen(cmd));
+    taskTimeline(millis());
+    TEST_ASSERT_EQUAL_UINT8(12, FastLED.getBrightness());
+    nativeAdvance((start + 40 - millis()) * 1000);
+    taskTimeline(millis());
+    TEST_ASSERT_EQUAL_UINT8(15, FastLED.getBrightness());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_due_order);
+    RUN_TEST(test_due_across_wrap);
+    RUN_TEST(test_cancel_compacts_pool);
+    RUN_TEST(test_cancel_before_mark);
+    RUN_TEST(test_full);
+    RUN_TEST(test_long_id_truncated);
+    RUN_TEST(test_churn);
+    RUN_TEST(test_step_cancels_and_reschedules);
+    RUN_TEST(test_steps_due_together);
+    return UNITY_END();
+}
@@ -0,0 +1,248 @@
+#include <unity.h>
+#include <string>
+#include <vector>
+#include "tunes.h"
+
+static const char *const SONGS[] = {
+        "Simpsons:d=4,o=5,b=160:c.6,e6,f#6,8a6,g.6,e6,c6,8a,8f#,8f#,8f#,2g,8p,8p,8f#,8f#,8f#,8g,a#.,8c6,8c6,8c6,c6",
+        "Xfiles:d=4,o=5,b=125:e,b,a,b,d6,2b.,1p,e,b,a,b,e6,2b.,1p,g6,f#6,e6,d6,e6,2b.,1p,g6,f#6,e6,d6,f#6,2b.",
+        "Indiana:d=4,o=5,b=250:e,8p,8f,8g,8p,1c6,8p.,d,8p,8e,1f,p.,g,8p,8a,8b,8p,1f6,p,a,8p,8b,2c6,2d6,2e6,e,8p,8f,"
+        "8g,8p,1c6,p,d6,8p,8e6,1f.6,g,8p,8g,e.6,8p,d6,8p,g,e.6,8p,d6,8p,g,f.6,8p,e6,8p,d6,2c6",
+        "Low:d=16,o=4,b=40:c,c#,d,d#,e,f,f#,g,g#,a,a#,b,32c7,32b7,1p"
+};
+
+struct Note {
+    uint16_t freq; // Hz, 0 for a pause
+    uint32_t ms;
+};
+
+/**
+ * Notes of song as AudioGeneratorRTTTL (ESP8266Audio 1.7) times them: whole note of
+ * 240000 / bpm ms, integer divided by the duration, plus half for a dot before the
+ * octave; equal tempered frequencies rounded to the Hz
+ */
+static std::vector<Note> reference(const char *song) {
+    const char *p = strchr(song, ':') + 1;
+    long duration = 4;
+    long octave = 6;
+    long bpm = 63;
+    while (*p != ':') {
+        char key = *p;
+        long v = strtol(p + 2, (char **)&p, 10);
+        if (key == 'd') {
+            duration = v;
+        } else if (key == 'o') {
+            octave = v;
+        } else if (key == 'b') {
+            bpm = v;
+        }
+        p += *p == ',';
+    }
+    p++;
+    long wholeMs = 60 * 1000L * 4 / bpm;
+
+    std::vector<Note> notes;
+    while (*p) {
+        long dur = isdigit(*p) ? strtol(p, (char **)&p, 10) : duration;
+        long ms = wholeMs / dur;
+        static const int8_t SEMITONES[7] = {10, 12, 1, 3, 5, 6, 8};
+        int note = *p == 'p' ? 0 : SEMITONES[*p - 'a'];
+        p++;
+        if (*p == '#') {
+            note++;
+            p++;
+        }
+        if (*p == '.') {
+            ms += ms / 2;
+            p++;
+        }
+        long scale = isdigit(*p) ? strtol(p, (char **)&p, 10) : octave;
+        p += *p == ',';
+        uint16_t freq = note ? lround(440 * pow(2, (note - 10) / 12.0 + scale - 4)) : 0;
+        notes.push_back({freq, (uint32_t)ms});
+    }
+    return notes;
+}
+
+struct StringPrint : public Print {
+    std::string data;
+
+    size_t write(uint8_t c) override {
+        data += (char)c;
+        return 1;
+    }
+};
+
+static std::string compile(const char *song, size_t chunk = SIZE_MAX, RtttlCompiler *compiler = nullptr) {
+    StringPrint out;
+    RtttlCompiler local;
+    RtttlCompiler &c = compiler ? *compiler : local;
+    c.begin(out);
+    size_t len = strlen(song);
+    for (size_t at = 0; at < len; at += chunk) {
+        c.feed(song + at, min(chunk, len - at));
+    }
+    TEST_ASSERT_TRUE(c.end());
+    return out.data;
+}
+
+static std::vector<Note> decode(const std::string &tune) {
+    std::vector<Note> notes;
+    const uint8_t *rec = (const uint8_t *)tune.data();
+    for (size_t i = 0; i + TUNE_NOTE_SIZE <= tune.size(); i += TUNE_NOTE_SIZE) {
+        notes.push_back({(uint16_t)(rec[i] | rec[i + 1] << 8), (uint32_t)(rec[i + 2] | rec[i + 3] << 8)});
+    }
+    return notes;
+}
+
+class MemorySource : public AudioFileSource {
+public:
+    explicit MemorySource(const std::string &data) : data(data) {}
+
+    uint32_t read(void *buf, uint32_t len) override {
+        len = min<uint32_t>(len, data.size() - pos);
+        memcpy(buf, data.data() + pos, len);
+        pos += len;
+        return len;
+    }
+
+    bool close() override { return true; }
+
+    bool isOpen() override { return true; }
+
+    uint32_t getSize() override { return data.size(); }
+
+    uint32_t getPos() override { return pos; }
+
+private:
+    std::string data;
+    uint32_t pos = 0;
+};
+
+class CaptureOutput : public AudioOutput {
+public:
+    bool begin() override { return true; }
+
+    bool ConsumeSample(int16_t sample[2]) override {
+        samples.push_back(sample[0]);
+        return true;
+    }
+
+    bool stop() override { return true; }
+
+    int rate() const { return hertz; }
+
+    std::vector<int16_t> samples;
+};
+
+static std::vector<int16_t> synthesize(const std::string &tune, uint16_t rate, CaptureOutput &out) {
+    MemorySource src(tune);
+    AudioGeneratorTune gen;
+    gen.SetRate(rate);
+    TEST_ASSERT_TRUE(gen.begin(&src, &out));
+    while (gen.isRunning()) {
+        gen.loop();
+    }
+    gen.stop();
+    return out.samples;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_notes_as_rtttl_generator() {
+    for (const char *song : SONGS) {
+        std::vector<Note> ref = reference(song);
+        RtttlCompiler compiler;
+        std::vector<Note> notes = decode(compile(song, SIZE_MAX, &compiler));
+        TEST_ASSERT_EQUAL_size_t(ref.size(), notes.size());
+        uint32_t totalMs = 0;
+        for (size_t i = 0; i < ref.size(); i++) {
+            TEST_ASSERT_EQUAL_UINT16(ref[i].freq, notes[i].freq);
+            TEST_ASSERT_EQUAL_UINT32(ref[i].ms, notes[i].ms);
+            totalMs += ref[i].ms;
+        }
+        TEST_ASSERT_EQUAL_UINT16(ref.size(), compiler.count());
+        TEST_ASSERT_EQUAL_UINT32(totalMs, compiler.lengthMs());
+    }
+}
+
+// Each note lasts rate * ms / 1000 samples, as AudioGeneratorRTTTL counts them
+void test_samples_as_rtttl_generator() {
+    const uint16_t RATES[] = {TUNE_RATE, 44100, 8000};
+    for (const char *song : SONGS) {
+        std::vector<Note> ref = reference(song);
+        for (uint16_t rate : RATES) {
+            uint32_t expected = 0;
+            for (const Note &n : ref) {
+                expected += (uint32_t)rate * n.ms / 1000;
+            }
+            CaptureOutput out;
+            TEST_ASSERT_EQUAL_size_t(expected, synthesize(compile(song), rate, out).size());
+            TEST_ASSERT_EQUAL_INT(rate, out.rate());
+        }
+    }
+}
+
+// Square wave of samples per wave in Q10, high past its middle, silence for a pause
+void test_waveform() {
+    CaptureOutput out;
+    std::vector<int16_t> s = synthesize(compile("A:d=4,o=5,b=120:8a,8p"), TUNE_RATE, out);
+    uint32_t noteSamples = (uint32_t)TUNE_RATE * 250 / 1000;
+    TEST_ASSERT_EQUAL_size_t(2 * noteSamples, s.size());
+    uint32_t waveFP10 = ((uint32_t)TUNE_RATE << 10) / 880;
+    for (uint32_t i = 0; i < noteSamples; i++) {
+        TEST_ASSERT_EQUAL_INT16(((i << 10) % waveFP10 > waveFP10 / 2) ? 8192 : -8192, s[i]);
+        TEST_ASSERT_EQUAL_INT16(0, s[noteSamples + i]);
+    }
+}
+
+void test_streamed_in_pieces() {
+    for (const char *song : SONGS) {
+        std::string whole = compile(song);
+        for (size_t chunk = 1; chunk < 6; chunk++) {
+            TEST_ASSERT_TRUE(whole == compile(song, chunk));
+        }
+    }
+}
+
+// Longer than any buffer the generator used to read songs into
+void test_long_song() {
+    std::string song = "Long:d=8,o=5,b=180:";
+    while (song.size() < 4000) {
+        song += "c,d,e,f,g,a,b,c6,";
+    }
+    song += "2c6";
+    std::vector<Note> ref = reference(song.c_str());
+    RtttlCompiler compiler;
+    std::vector<Note> compiled = decode(compile(song.c_str(), 64, &compiler));
+    TEST_ASSERT_EQUAL_size_t(ref.size(), compiled.size());
+    TEST_ASSERT_EQUAL_UINT32(ref.back().ms, compiled.back().ms);
+    TEST_ASSERT_EQUAL_STRING("Long", compiler.title());
+}
+
+// Beyond AudioGeneratorRTTTL: dot after the octave, spaces, upper case; an invalid note ends the song
+void test_lenient() {
+    TEST_ASSERT_TRUE(compile("A:d=4,o=5,b=100:e.6,8c#6") == compile("A: d=4, o=5, b=100: E6., 8C#6"));
+    std::vector<Note> notes = decode(compile("A:d=4,o=5,b=100:c,x,d"));
+    TEST_ASSERT_EQUAL_size_t(1, notes.size());
+
+    StringPrint out;
+    RtttlCompiler compiler;
+    compiler.begin(out);
+    const char *bad = "A:d=x,o=5,b=100:c";
+    compiler.feed(bad, strlen(bad));
+    TEST_ASSERT_FALSE(compiler.end()); // Invalid header
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_notes_as_rtttl_generator);
+    RUN_TEST(test_samples_as_rtttl_generator);
+    RUN_TEST(test_waveform);
+    RUN_TEST(test_streamed_in_pieces);
+    RUN_TEST(test_long_song);
+    RUN_TEST(test_lenient);
+    return UNITY_END();
+}
@@ -0,0 +1,220 @@
+/**
+ * Decode cost per clip format, on the host
+ *
+ * This is a build tool for ESParkle
+ * See <https://github.com/CosmicMac/ESParkle>
+ *
+ * BUILD
+ *  - g++ -O2 -Isrc -o decodebench tools/decodebench.cpp -lmad
+ *    libmad is the MP3 decoder ESP8266Audio runs on the device. Without it (no <mad.h>),
+ *    drop -lmad: MP3 clips are skipped.
+ *
+ * USE
+ *  - ./decodebench data/mp3/bullfrog.mp3 .pio/fsdata/mp3/bullfrog.adp ...
+ *    Decode each clip (.mp3, .adp, or 16 bit PCM .wav) a few times and report the cost
+ *    per second of audio: CPU cycles (x86) or nanoseconds. Absolute figures are the host's,
+ *    ratios between formats are what carries over to the device.
+ *
+ * CHANGES
+ *  - 20261017 V1.0 Initial version
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "imaadpcm.h"
+
+#if __has_include(<mad.h>)
+#include <mad.h>
+#define HAVE_MAD 1
+#else
+#define HAVE_MAD 0
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define COST_UNIT "cycles"
+static uint64_t costNow() { return __rdtsc(); }
+#else
+#define COST_UNIT "ns"
+static uint64_t costNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+#define RUNS 5 // Best of, against host noise
+
+static volatile int32_t sink; // Keeps decoded samples from being optimized away
+
+struct Result {
+    uint64_t samples = 0; // Per channel
+    uint32_t rate = 0;
+};
+
+static bool readFile(const char *path, std::vector<uint8_t> &data) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        data.insert(data.end(), buf, buf + n);
+    }
+    fclose(f);
+    return true;
+}
+
+static uint32_t le16(const uint8_t *p) { return p[0] | p[1] << 8; }
+
+static uint32_t le32(const uint8_t *p) { return le16(p) | le16(p + 2) << 16; }
+
+// As AudioGeneratorAdpcm does, block by block
+static bool decodeAdpcm(const std::vector<uint8_t> &data, Result &r) {
+    if (data.size() < ADPCM_HEADER_SIZE || memcmp(data.data(), ADPCM_MAGIC, 4) != 0) {
+        return false;
+    }
+    r.rate = le16(&data[4]);
+    uint32_t blockSamples = le16(&data[6]);
+    uint32_t left = le32(&data[8]);
+    size_t blockSize = ADPCM_BLOCK_HEADER + (blockSamples - 1) / 2;
+    int32_t acc = 0;
+    ImaAdpcm codec;
+    for (size_t at = ADPCM_HEADER_SIZE; left && at + ADPCM_BLOCK_HEADER < data.size(); at += blockSize) {
+        const uint8_t *block = &data[at];
+        size_t len = std::min(blockSize, data.size() - at);
+        codec.predictor = (int16_t)le16(block);
+        codec.index = std::min<uint8_t>(block[2], 88);
+        acc += codec.predictor;
+        left--;
+        r.samples++;
+        for (size_t pos = ADPCM_BLOCK_HEADER; left && pos < len; pos++) {
+            acc += codec.decode(block[pos] & 0x0F);
+            r.samples++;
+            if (--left) {
+                acc += codec.decode(block[pos] >> 4);
+                r.samples++;
+                left--;
+            }
+        }
+    }
+    sink = acc;
+    return true;
+}
+
+// 16 bit PCM: chunks walked, samples read as AudioGeneratorWAV does
+static bool decodeWav(const std::vector<uint8_t> &data, Result &r) {
+    if (data.size() < 12 || memcmp(&data[0], "RIFF", 4) != 0 || memcmp(&data[8], "WAVE", 4) != 0) {
+        return false;
+    }
+    uint32_t channels = 0;
+    for (size_t at = 12; at + 8 <= data.size();) {
+        uint32_t size = le32(&data[at + 4]);
+        if (memcmp(&data[at], "fmt ", 4) == 0 && size >= 16) {
+            if (le16(&data[at + 8]) != 1 || le16(&data[at + 22]) != 16) {
+                return false;
+            }
+            channels = le16(&data[at + 10]);
+            r.rate = le32(&data[at + 12]);
+        } else if (memcmp(&data[at], "data", 4) == 0 && channels) {
+            size = std::min<size_t>(size, data.size() - at - 8);
+            int32_t acc = 0;
+            for (uint32_t i = 0; i + 1 < size; i += 2) {
+                acc += (int16_t)le16(&data[at + 8 + i]);
+            }
+            sink = acc;
+            r.samples = size / 2 / channels;
+            return true;
+        }
+        at += 8 + size + (size & 1);
+    }
+    return false;
+}
+
+#if HAVE_MAD
+// Frame decoding and synthesis, as AudioGeneratorMP3 does with the same library
+static bool decodeMp3(const std::vector<uint8_t> &data, Result &r) {
+    struct mad_stream stream;
+    struct mad_frame frame;
+    struct mad_synth synth;
+    mad_stream_init(&stream);
+    mad_frame_init(&frame);
+    mad_synth_init(&synth);
+    mad_stream_buffer(&stream, data.data(), data.size());
+    int32_t acc = 0;
+    while (true) {
+        if (mad_frame_decode(&frame, &stream)) {
+            if (MAD_RECOVERABLE(stream.error)) {
+                continue;
+            }
+            break;
+        }
+        mad_synth_frame(&synth, &frame);
+        r.rate = synth.pcm.samplerate;
+        r.samples += synth.pcm.length;
+        for (unsigned i = 0; i < synth.pcm.length; i++) {
+            acc += synth.pcm.samples[0][i] >> 13;
+        }
+    }
+    sink = acc;
+    mad_synth_finish(&synth);
+    mad_frame_finish(&frame);
+    mad_stream_finish(&stream);
+    return r.samples > 0;
+}
+#endif
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <clip.mp3|.adp|.wav>...\n", argv[0]);
+        return 1;
+    }
+    printf("%-32s %6s %8s %9s %14s\n", "clip", "format", "rate", "seconds", COST_UNIT "/s");
+    for (int i = 1; i < argc; i++) {
+        const char *path = argv[i];
+        const char *ext = strrchr(path, '.');
+        std::string format = ext ? ext + 1 : "";
+        bool (*decode)(const std::vector<uint8_t> &, Result &) = nullptr;
+        if (format == "adp") {
+            decode = decodeAdpcm;
+        } else if (format == "wav") {
+            decode = decodeWav;
+#if HAVE_MAD
+        } else if (format == "mp3") {
+            decode = decodeMp3;
+#endif
+        }
+        std::vector<uint8_t> data;
+        if (!decode || !readFile(path, data)) {
+            fprintf(stderr, "%s: skipped\n", path);
+            continue;
+        }
+
+        Result r;
+        uint64_t best = UINT64_MAX;
+        for (int run = 0; run < RUNS; run++) {
+            r = Result();
+            uint64_t start = costNow();
+            bool ok = decode(data, r);
+            uint64_t cost = costNow() - start;
+            if (!ok || !r.rate || !r.samples) {
+                best = 0;
+                break;
+            }
+            best = std::min(best, cost);
+        }
+        if (!best) {
+            fprintf(stderr, "%s: not decodable\n", path);
+            continue;
+        }
+        const char *slash = strrchr(path, '/');
+        double seconds = (double)r.samples / r.rate;
+        printf("%-32s %6s %8u %9.2f %14.0f\n", slash ? slash + 1 : path, format.c_str(), r.rate, seconds, best / seconds);
+    }
+    return 0;
+}
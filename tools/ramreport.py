@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+"""
+RAM and IRAM report of the firmware: static reservations against the ESP8266 budgets
+
+This is a build tool for ESParkle
+See <https://github.com/CosmicMac/ESParkle>
+
+USE
+ - As a PlatformIO extra script (see platformio.ini), after each link:
+   DRAM (.data, .rodata, .bss) and IRAM use are printed against their budgets, with
+   the largest static variables. What DRAM they leave is the heap at boot.
+
+ - python3 tools/ramreport.py [--top <n>] [--tools <prefix>] <firmware.elf>
+   Same from the command line, e.g. on .pio/build/d1_mini/firmware.elf, with the
+   toolchain of ~/.platformio/packages/toolchain-xtensa/bin in PATH.
+
+CHANGES
+ - 20261017 V1.0 Initial version
+"""
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+DRAM_SIZE = 80 * 1024  # User data RAM
+IRAM_SIZE = 32 * 1024  # Instruction RAM, cached flash takes the other 16 KB
+DRAM_SECTIONS = ('.data', '.rodata', '.bss')
+IRAM_SECTIONS = ('.iram0.text', '.text', '.text1')
+TOP = 15
+
+
+def sections(elf, size_tool):
+    """Section sizes, by name"""
+    out = subprocess.run([size_tool, '-A', elf], check=True, stdout=subprocess.PIPE, universal_newlines=True).stdout
+    sizes = {}
+    for line in out.splitlines():
+        m = re.match(r'^(\.\S+)\s+(\d+)\s+\d+', line)
+        if m:
+            sizes[m.group(1)] = int(m.group(2))
+    return sizes
+
+
+def symbols(elf, nm_tool):
+    """Static variables as (size, type, name), largest first"""
+    out = subprocess.run([nm_tool, '-S', '-C', '--size-sort', elf], check=True, stdout=subprocess.PIPE,
+                         universal_newlines=True).stdout
+    found = []
+    for line in out.splitlines():
+        parts = line.split(None, 3)
+        if len(parts) == 4 and parts[2] in 'bBdD':
+            found.append((int(parts[1], 16), parts[2], parts[3]))
+    return sorted(found, reverse=True)
+
+
+def report(elf, size_tool, nm_tool, top):
+    sizes = sections(elf, size_tool)
+    dram = sum(sizes.get(s, 0) for s in DRAM_SECTIONS)
+    iram = sum(sizes.get(s, 0) for s in IRAM_SECTIONS)
+    print('RAM report: %s' % elf)
+    print('  DRAM %6d / %d bytes (%d%%): %s' % (dram, DRAM_SIZE, dram * 100 // DRAM_SIZE,
+                                               ', '.join('%s %d' % (s, sizes.get(s, 0)) for s in DRAM_SECTIONS)))
+    print('  IRAM %6d / %d bytes (%d%%)' % (iram, IRAM_SIZE, iram * 100 // IRAM_SIZE))
+    print('  Heap at boot, at most %d bytes' % max(0, DRAM_SIZE - dram))
+    print('  Largest static variables (b/B: .bss, d/D: .data):')
+    for size, kind, name in symbols(elf, nm_tool)[:top]:
+        print('  %8d %s %s' % (size, kind, name))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Report static RAM and IRAM use of the firmware')
+    parser.add_argument('--top', type=int, default=TOP, help='largest variables listed')
+    parser.add_argument('--tools', default='xtensa-lx106-elf-', help='binutils prefix')
+    parser.add_argument('elf')
+    args = parser.parse_args()
+    try:
+        report(args.elf, args.tools + 'size', args.tools + 'nm', args.top)
+    except (OSError, subprocess.CalledProcessError) as e:
+        print('ramreport: %s' % e, file=sys.stderr)
+        return 1
+    return 0
+
+
+def after_link(target, source, env):
+    size_tool = env.subst('$SIZETOOL')
+    report(str(target[0]), size_tool, re.sub(r'size(\.exe)?$', r'nm\1', size_tool), TOP)
+
+
+try:
+    Import('env')  # noqa: F821, defined by PlatformIO
+except NameError:
+    if __name__ == '__main__':
+        sys.exit(main())
+else:
+    env.AddPostAction(os.path.join('$BUILD_DIR', '${PROGNAME}.elf'), after_link)  # noqa: F821
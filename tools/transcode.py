@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+"""
+LittleFS image staging: MP3 clips transcoded to a format cheaper to decode
+
+This is a build tool for ESParkle
+See <https://github.com/CosmicMac/ESParkle>
+
+USE
+ - As a PlatformIO extra script (see platformio.ini), before each build:
+   data/ is copied to the LittleFS image directory (data_dir), its .mp3 files
+   transcoded to ADPCM clips (.adp) or 16 bit PCM WAV (.wav), per custom_clip_format
+   and custom_clip_rate. Files are only redone when their source changed.
+
+ - python3 tools/transcode.py [--format adp|wav] [--rate <hz>] [<src dir>] [<dst dir>]
+   Same from the command line, data/ to .pio/fsdata/ by default.
+
+ESParkle plays /mp3/<name>.mp3 from /mp3/<name>.adp or .wav when only those exist.
+MP3 decoding needs ffmpeg in PATH, clips are copied unchanged without it.
+
+CHANGES
+ - 20261017 V1.0 Initial version
+"""
+
+import argparse
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import wave
+
+ADPCM_BLOCK_SIZE = 256  # Bytes, as ADPCM_MAX_BLOCK in src/imaadpcm.h
+ADPCM_BLOCK_SAMPLES = 1 + (ADPCM_BLOCK_SIZE - 4) * 2
+
+STEPS = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+    12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+]
+INDEXES = [-1, -1, -1, -1, 2, 4, 6, 8]
+
+
+def decode_mp3(path, rate):
+    """Mono 16 bit samples of an MP3 file, None if ffmpeg is missing or fails"""
+    try:
+        pcm = subprocess.run(['ffmpeg', '-v', 'error', '-i', path, '-f', 's16le', '-ac', '1', '-ar', str(rate), '-'],
+                             check=True, stdout=subprocess.PIPE).stdout
+    except (OSError, subprocess.CalledProcessError):
+        return None
+    return struct.unpack('<%dh' % (len(pcm) // 2), pcm[:len(pcm) // 2 * 2])
+
+
+class ImaEncoder:
+    """IMA ADPCM encoder, tracking the decoder state of src/imaadpcm.h"""
+
+    def __init__(self):
+        self.predictor = 0
+        self.index = 0
+
+    def decode(self, code):
+        step = STEPS[self.index]
+        diff = step >> 3
+        if code & 4:
+            diff += step
+        if code & 2:
+            diff += step >> 1
+        if code & 1:
+            diff += step >> 2
+        sample = self.predictor - diff if code & 8 else self.predictor + diff
+        self.predictor = max(-32768, min(32767, sample))
+        self.index = max(0, min(88, self.index + INDEXES[code & 7]))
+
+    def encode(self, sample):
+        step = STEPS[self.index]
+        delta = sample - self.predictor
+        code = 8 if delta < 0 else 0
+        delta = abs(delta)
+        for bit in (4, 2, 1):
+            if delta >= step:
+                code |= bit
+                delta -= step
+            step >>= 1
+        self.decode(code)
+        return code
+
+
+def encode_adpcm(samples, rate):
+    """ADPCM clip bytes, see src/imaadpcm.h"""
+    out = bytearray(b'IMA1' + struct.pack('<HHI', rate, ADPCM_BLOCK_SAMPLES, len(samples)))
+    enc = ImaEncoder()
+    for start in range(0, len(samples), ADPCM_BLOCK_SAMPLES):
+        block = samples[start:start + ADPCM_BLOCK_SAMPLES]
+        # Block header restarts the decoder from the exact first sample
+        enc.predictor = block[0]
+        out += struct.pack('<hBB', block[0], enc.index, 0)
+        codes = [enc.encode(s) for s in block[1:]]
+        if len(codes) % 2:
+            codes.append(0)
+        out += bytes(codes[i] | codes[i + 1] << 4 for i in range(0, len(codes), 2))
+    return bytes(out)
+
+
+def write_wav(path, samples, rate):
+    with wave.open(path, 'wb') as w:
+        w.setnchannels(1)
+        w.setsampwidth(2)
+        w.setframerate(rate)
+        w.writeframes(struct.pack('<%dh' % len(samples), *samples))
+
+
+def stage(src_dir, dst_dir, fmt, rate):
+    """Copy src_dir to dst_dir, MP3 clips transcoded, stale outputs removed"""
+    wanted = set()
+    warned = False
+    for root, _, files in os.walk(src_dir):
+        rel = os.path.relpath(root, src_dir)
+        os.makedirs(os.path.join(dst_dir, rel), exist_ok=True)
+        for name in sorted(files):
+            src = os.path.join(root, name)
+            base, ext = os.path.splitext(name)
+            dst = os.path.join(dst_dir, rel, base + '.' + fmt if ext.lower() == '.mp3' else name)
+            wanted.add(os.path.normpath(dst))
+            if os.path.exists(dst) and os.path.getmtime(dst) >= os.path.getmtime(src):
+                continue
+            samples = decode_mp3(src, rate) if ext.lower() == '.mp3' else None
+            if samples is None:
+                if ext.lower() == '.mp3':
+                    if not warned:
+                        print('transcode: ffmpeg unavailable or failing, MP3 clips copied as they are', file=sys.stderr)
+                        warned = True
+                    dst = os.path.join(dst_dir, rel, name)
+                    wanted.add(os.path.normpath(dst))
+                shutil.copy2(src, dst)
+            elif fmt == 'adp':
+                with open(dst, 'wb') as f:
+                    f.write(encode_adpcm(samples, rate))
+                print('transcode: %s -> %s, %d bytes' % (src, dst, os.path.getsize(dst)))
+            else:
+                write_wav(dst, samples, rate)
+                print('transcode: %s -> %s, %d bytes' % (src, dst, os.path.getsize(dst)))
+
+    for root, _, files in os.walk(dst_dir):
+        for name in files:
+            path = os.path.normpath(os.path.join(root, name))
+            if path not in wanted:
+                os.remove(path)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Stage LittleFS image with MP3 clips transcoded')
+    parser.add_argument('--format', choices=['adp', 'wav'], default='adp')
+    parser.add_argument('--rate', type=int, default=16000)
+    parser.add_argument('src', nargs='?', default='data')
+    parser.add_argument('dst', nargs='?', default=os.path.join('.pio', 'fsdata'))
+    args = parser.parse_args()
+    stage(args.src, args.dst, args.format, args.rate)
+
+
+try:
+    Import('env')  # noqa: F821, defined by PlatformIO
+except NameError:
+    if __name__ == '__main__':
+        main()
+else:
+    stage(os.path.join(env['PROJECT_DIR'], 'data'), env['PROJECT_DATA_DIR'],  # noqa: F821
+          env.GetProjectOption('custom_clip_format', 'adp'), int(env.GetProjectOption('custom_clip_rate', '16000')))  # noqa: F821
@@ -0,0 +1,189 @@
+<?php
+/**
+ * Connection reuse benchmark, and companion host stand-in
+ *
+ * This is a companion script for ESParkle
+ * See <https://github.com/CosmicMac/ESParkle>
+ *
+ * USE
+ *  - php esparkle_connbench.php <url> [<count>]
+ *    GET <url> <count> times the way ESParkle does, and report time to response head:
+ *     - fresh:  name resolution and new TCP connection for every request
+ *     - pooled: name resolved once, HTTP/1.0 keep-alive connection reused while the server keeps it
+ *
+ *  - php esparkle_connbench.php --standin [<port>] [<size>]
+ *    Listen on <port> (default 8082) as a companion host stand-in: any GET is answered with
+ *    <size> bytes (default 16384) and a Content-Length, keeping the connection if asked to
+ *
+ * CHANGES
+ *  - 20261017 V1.0 Initial version
+ */
+
+//############################################################################
+// SETTINGS
+//############################################################################
+
+define('DEFAULT_COUNT', 50);                                                  // Requests sent per test
+define('STANDIN_PORT', 8082);                                                 // Stand-in listening port
+define('STANDIN_SIZE', 16384);                                                // Stand-in body size, bytes
+define('TIMEOUT_S', 5);                                                       // Max wait for an answer
+
+//############################################################################
+
+if (PHP_SAPI != 'cli') {
+    http_response_code(400);
+    die('Command line only');
+}
+
+if (@$argv[1] == '--standin') {
+    standIn((int)(@$argv[2] ?: STANDIN_PORT), (int)(@$argv[3] ?: STANDIN_SIZE));
+    exit;
+}
+
+$url = parse_url(@$argv[1]);
+if (empty($url['host'])) {
+    fwrite(STDERR, "Usage: php {$argv[0]} <url> [<count>] | --standin [<port>] [<size>]\n");
+    exit(1);
+}
+$count = max(1, (int)(@$argv[2] ?: DEFAULT_COUNT));
+
+report('fresh', bench($url, $count, false));
+report('pooled', bench($url, $count, true));
+exit;
+
+/**
+ * GET url count times, body read to its end as the decoder would
+ *
+ * @param array $url parse_url() result
+ * @param int $count
+ * @param bool $pooled Reuse resolved address and connection
+ * @return array [float[] times to response head (ms), int reused connections]
+ */
+function bench($url, $count, $pooled)
+{
+    $host = $url['host'];
+    $port = @$url['port'] ?: 80;
+    $path = (@$url['path'] ?: '/') . (isset($url['query']) ? "?$url[query]" : '');
+    $times = [];
+    $reused = 0;
+    $ip = null;
+    $fp = null;
+
+    for ($i = 0; $i < $count; $i++) {
+        $start = microtime(true);
+        if (!$pooled || !$ip) {
+            $ip = gethostbyname($host);
+        }
+        if ($fp && !feof($fp)) {
+            $reused++;
+        } else {
+            $fp = stream_socket_client("tcp://$ip:$port", $errno, $errstr, TIMEOUT_S);
+            if (!$fp) {
+                fwrite(STDERR, "$errstr\n");
+                break;
+            }
+            stream_set_timeout($fp, TIMEOUT_S);
+        }
+        fwrite($fp, "GET $path HTTP/1.0\r\nHost: $host\r\nConnection: " . ($pooled ? 'keep-alive' : 'close') . "\r\n\r\n");
+
+        $status = fgets($fp);
+        $length = null;
+        $keepAlive = false;
+        while (($line = fgets($fp)) !== false && trim($line) !== '') {
+            if (preg_match('/^Content-Length:\s*(\d+)/i', $line, $m)) {
+                $length = (int)$m[1];
+            } elseif (preg_match('/^Connection:\s*keep-alive/i', $line)) {
+                $keepAlive = true;
+            }
+        }
+        if (strpos($status, ' 200') === false) {
+            fwrite(STDERR, 'http: ' . trim($status) . "\n");
+            break;
+        }
+        $times[] = (microtime(true) - $start) * 1000;
+
+        if ($pooled && $keepAlive && $length !== null) {
+            readExactly($fp, $length);
+        } else {
+            while (!feof($fp) && fread($fp, 8192) !== false) {
+            }
+            fclose($fp);
+            $fp = null;
+        }
+    }
+    if ($fp) {
+        fclose($fp);
+    }
+    return [$times, $reused];
+}
+
+/**
+ * @param string $label
+ * @param array $result bench() result
+ */
+function report($label, $result)
+{
+    list($times, $reused) = $result;
+    if (!$times) {
+        printf("%-6s no result\n", $label);
+        return;
+    }
+    sort($times);
+    $n = count($times);
+    printf("%-6s n=%d reused=%d min=%.1f avg=%.1f p50=%.1f p95=%.1f max=%.1f ms\n", $label, $n, $reused, $times[0],
+        array_sum($times) / $n, $times[(int)($n * 0.5)], $times[min($n - 1, (int)($n * 0.95))], $times[$n - 1]);
+}
+
+/**
+ * @param resource $fp
+ * @param int $len
+ * @return string|false
+ */
+function readExactly($fp, $len)
+{
+    $data = '';
+    while (strlen($data) < $len) {
+        $chunk = fread($fp, $len - strlen($data));
+        if ($chunk === false || $chunk === '') {
+            return false;
+        }
+        $data .= $chunk;
+    }
+    return $data;
+}
+
+/**
+ * Companion host stand-in, one client at a time, keep-alive as Apache does for HTTP/1.0
+ *
+ * @param int $port
+ * @param int $size
+ */
+function standIn($port, $size)
+{
+    $server = stream_socket_server("tcp://0.0.0.0:$port", $errno, $errstr);
+    if (!$server) {
+        fwrite(STDERR, "$errstr\n");
+        exit(1);
+    }
+    echo "Stand-in listening on port $port\n";
+    $body = str_repeat("\xFF", $size);
+    while ($fp = stream_socket_accept($server, -1)) {
+        stream_set_timeout($fp, TIMEOUT_S);
+        while (($request = fgets($fp)) !== false) {
+            $keepAlive = false;
+            while (($line = fgets($fp)) !== false && trim($line) !== '') {
+                if (preg_match('/^Connection:\s*keep-alive/i', $line)) {
+                    $keepAlive = true;
+                }
+            }
+            $found = strpos($request, 'GET ') === 0;
+            fwrite($fp, ($found ? "HTTP/1.1 200 OK\r\nContent-Type: audio/mpeg\r\nContent-Length: $size\r\n"
+                    : "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n")
+                . 'Connection: ' . ($keepAlive ? 'keep-alive' : 'close') . "\r\n\r\n" . ($found ? $body : ''));
+            if (!$keepAlive) {
+                break;
+            }
+        }
+        fclose($fp);
+    }
+}
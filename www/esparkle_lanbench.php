@@ -0,0 +1,275 @@
+<?php
+/**
+ * LAN command endpoint latency benchmark, and device stand-in
+ *
+ * This is a companion script for ESParkle
+ * See <https://github.com/CosmicMac/ESParkle>
+ *
+ * USE
+ *  - php esparkle_lanbench.php <host>[:<port>] [<count>] [<command>]
+ *    Send <count> times <command> (default {"cmd":"heap"}) to ESParkle, and report latencies:
+ *     - http: POST /cmd until "202 Accepted", command queued on the device
+ *     - ws:   WebSocket message until first reply or event back, command executed
+ *    Set LAN_USER and LAN_PASSWORD environment variables if the endpoint requires authentication
+ *
+ *  - php esparkle_lanbench.php --standin [<port>]
+ *    Listen on <port> (default 8081) as a device stand-in: POST /cmd is accepted, WebSocket
+ *    messages are answered at once, to measure the host and network side alone
+ *
+ * CHANGES
+ *  - 20261017 V1.0 Initial version
+ */
+
+//############################################################################
+// SETTINGS
+//############################################################################
+
+define('DEFAULT_COUNT', 50);                                                  // Commands sent per test
+define('DEFAULT_COMMAND', '{"cmd":"heap"}');                                  // Small command with a reply
+define('STANDIN_PORT', 8081);                                                 // Stand-in listening port
+define('TIMEOUT_S', 5);                                                       // Max wait for an answer
+
+//############################################################################
+
+if (PHP_SAPI != 'cli') {
+    http_response_code(400);
+    die('Command line only');
+}
+
+if (@$argv[1] == '--standin') {
+    standIn((int)(@$argv[2] ?: STANDIN_PORT));
+    exit;
+}
+
+if (empty($argv[1])) {
+    fwrite(STDERR, "Usage: php {$argv[0]} <host>[:<port>] [<count>] [<command>] | --standin [<port>]\n");
+    exit(1);
+}
+
+$target = $argv[1] . (strpos($argv[1], ':') === false ? ':80' : '');
+$count = max(1, (int)(@$argv[2] ?: DEFAULT_COUNT));
+$command = @$argv[3] ?: DEFAULT_COMMAND;
+$auth = getenv('LAN_USER') ? 'Authorization: Basic ' . base64_encode(getenv('LAN_USER') . ':' . getenv('LAN_PASSWORD')) . "\r\n" : '';
+
+report('http', benchHttp($target, $count, $command, $auth));
+report('ws', benchWs($target, $count, $command, $auth));
+exit;
+
+/**
+ * POST command, one connection per request as the device closes them
+ *
+ * @param string $target host:port
+ * @param int $count
+ * @param string $command
+ * @param string $auth Authorization header line, or ''
+ * @return float[] Latencies, ms
+ */
+function benchHttp($target, $count, $command, $auth)
+{
+    $times = [];
+    for ($i = 0; $i < $count; $i++) {
+        $start = microtime(true);
+        $fp = stream_socket_client("tcp://$target", $errno, $errstr, TIMEOUT_S);
+        if (!$fp) {
+            fwrite(STDERR, "http: $errstr\n");
+            break;
+        }
+        stream_set_timeout($fp, TIMEOUT_S);
+        fwrite($fp, "POST /cmd HTTP/1.1\r\nHost: $target\r\n{$auth}Content-Type: application/json\r\n"
+            . 'Content-Length: ' . strlen($command) . "\r\nConnection: close\r\n\r\n$command");
+        $status = fgets($fp);
+        if (strpos($status, ' 202') !== false) {
+            $times[] = (microtime(true) - $start) * 1000;
+        } else {
+            fwrite(STDERR, 'http: ' . trim($status) . "\n");
+        }
+        fclose($fp);
+        usleep(20000); // Let the device run the command before next one
+    }
+    return $times;
+}
+
+/**
+ * Send command over a WebSocket, wait for the first message back other than live stats
+ *
+ * @param string $target host:port
+ * @param int $count
+ * @param string $command
+ * @param string $auth Authorization header line, or ''
+ * @return float[] Latencies, ms
+ */
+function benchWs($target, $count, $command, $auth)
+{
+    $fp = stream_socket_client("tcp://$target", $errno, $errstr, TIMEOUT_S);
+    if (!$fp) {
+        fwrite(STDERR, "ws: $errstr\n");
+        return [];
+    }
+    stream_set_timeout($fp, TIMEOUT_S);
+    $key = base64_encode(random_bytes(16));
+    fwrite($fp, "GET /ws HTTP/1.1\r\nHost: $target\r\n{$auth}Upgrade: websocket\r\nConnection: Upgrade\r\n"
+        . "Sec-WebSocket-Key: $key\r\nSec-WebSocket-Version: 13\r\n\r\n");
+    $status = fgets($fp);
+    if (strpos($status, ' 101') === false) {
+        fwrite(STDERR, 'ws: ' . trim($status) . "\n");
+        return [];
+    }
+    while (($line = fgets($fp)) !== false && trim($line) !== '') {
+    }
+
+    $times = [];
+    for ($i = 0; $i < $count; $i++) {
+        $start = microtime(true);
+        wsWrite($fp, $command, true);
+        do {
+            $msg = wsRead($fp);
+        } while ($msg !== false && strpos($msg, '"event":"live"') !== false);
+        if ($msg === false) {
+            fwrite(STDERR, "ws: no answer\n");
+            break;
+        }
+        $times[] = (microtime(true) - $start) * 1000;
+        usleep(20000);
+    }
+    fclose($fp);
+    return $times;
+}
+
+/**
+ * @param string $label
+ * @param float[] $times ms
+ */
+function report($label, $times)
+{
+    if (!$times) {
+        printf("%-5s no result\n", $label);
+        return;
+    }
+    sort($times);
+    $n = count($times);
+    printf("%-5s n=%d min=%.1f avg=%.1f p50=%.1f p95=%.1f max=%.1f ms\n", $label, $n, $times[0],
+        array_sum($times) / $n, $times[(int)($n * 0.5)], $times[min($n - 1, (int)($n * 0.95))], $times[$n - 1]);
+}
+
+/**
+ * Write one WebSocket text frame, masked if sent by a client
+ *
+ * @param resource $fp
+ * @param string $data
+ * @param bool $mask
+ */
+function wsWrite($fp, $data, $mask)
+{
+    $len = strlen($data);
+    $frame = chr(0x81);
+    $bit = $mask ? 0x80 : 0;
+    if ($len < 126) {
+        $frame .= chr($bit | $len);
+    } elseif ($len < 65536) {
+        $frame .= chr($bit | 126) . pack('n', $len);
+    } else {
+        $frame .= chr($bit | 127) . pack('J', $len);
+    }
+    if ($mask) {
+        $key = random_bytes(4);
+        $frame .= $key;
+        $data ^= str_repeat($key, (int)ceil($len / 4));
+    }
+    fwrite($fp, $frame . substr($data, 0, $len));
+}
+
+/**
+ * Read one WebSocket data frame, control frames are skipped
+ *
+ * @param resource $fp
+ * @return string|false Payload, false on error or timeout
+ */
+function wsRead($fp)
+{
+    for (;;) {
+        $head = readExactly($fp, 2);
+        if ($head === false) {
+            return false;
+        }
+        $opcode = ord($head[0]) & 0x0F;
+        $masked = ord($head[1]) & 0x80;
+        $len = ord($head[1]) & 0x7F;
+        if ($len == 126) {
+            $len = unpack('n', readExactly($fp, 2))[1];
+        } elseif ($len == 127) {
+            $len = unpack('J', readExactly($fp, 8))[1];
+        }
+        $key = $masked ? readExactly($fp, 4) : '';
+        $data = $len ? readExactly($fp, $len) : '';
+        if ($data === false) {
+            return false;
+        }
+        if ($masked) {
+            $data ^= str_repeat($key, (int)ceil($len / 4));
+            $data = substr($data, 0, $len);
+        }
+        if ($opcode == 0x8) {
+            return false;
+        }
+        if ($opcode == 0x1 || $opcode == 0x2) {
+            return $data;
+        }
+    }
+}
+
+/**
+ * @param resource $fp
+ * @param int $len
+ * @return string|false
+ */
+function readExactly($fp, $len)
+{
+    $data = '';
+    while (strlen($data) < $len) {
+        $chunk = fread($fp, $len - strlen($data));
+        if ($chunk === false || $chunk === '') {
+            return false;
+        }
+        $data .= $chunk;
+    }
+    return $data;
+}
+
+/**
+ * Device stand-in, one client at a time: accepts POST /cmd, answers WebSocket messages
+ *
+ * @param int $port
+ */
+function standIn($port)
+{
+    $server = stream_socket_server("tcp://0.0.0.0:$port", $errno, $errstr);
+    if (!$server) {
+        fwrite(STDERR, "$errstr\n");
+        exit(1);
+    }
+    echo "Stand-in listening on port $port\n";
+    while ($fp = stream_socket_accept($server, -1)) {
+        stream_set_timeout($fp, TIMEOUT_S);
+        $request = fgets($fp);
+        $headers = [];
+        while (($line = fgets($fp)) !== false && trim($line) !== '') {
+            list($name, $value) = array_map('trim', explode(':', $line, 2)) + [1 => ''];
+            $headers[strtolower($name)] = $value;
+        }
+
+        if (strpos($request, 'POST /cmd') === 0) {
+            readExactly($fp, (int)@$headers['content-length']);
+            fwrite($fp, "HTTP/1.1 202 Accepted\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        } elseif (strpos($request, 'GET /ws') === 0 && isset($headers['sec-websocket-key'])) {
+            $accept = base64_encode(sha1($headers['sec-websocket-key'] . '258EAFA5-E914-47DA-95CA-C5AB0DC11B9E', true));
+            fwrite($fp, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                . "Sec-WebSocket-Accept: $accept\r\n\r\n");
+            while (($msg = wsRead($fp)) !== false) {
+                wsWrite($fp, '{"event":"standin","bytes":' . strlen($msg) . '}', false);
+            }
+        } else {
+            fwrite($fp, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        }
+        fclose($fp);
+    }
+}
@@ -0,0 +1,83 @@
+<?php
+/**
+ * Throttled MP3 server, to reproduce poor network conditions
+ *
+ * This is a companion script for ESParkle
+ * See <https://github.com/CosmicMac/ESParkle>
+ *
+ * USE
+ *  - php -S 0.0.0.0:8080 -t www
+ *    Run it locally with PHP built-in server, on Linux or any other OS
+ *
+ *  - http//<host>:8080/esparkle_throttle.php?file=<file>&kbps=<kbps>
+ *    Stream <file> (relative to script directory) at <kbps> kilobits per second
+ *
+ *  - http//<host>:8080/esparkle_throttle.php?file=<file>&kbps=<kbps>&stall=<ms>&every=<ms>
+ *    Same, and stop sending for <ms> milliseconds every <ms> milliseconds, like a congested network
+ *
+ *  - http//<host>:8080/esparkle_throttle.php?file=<file>&jitter=<pct>
+ *    Vary each chunk delay randomly by up to <pct> percent
+ *
+ * CHANGES
+ *  - 20261017 V1.0 Initial version
+ */
+
+//############################################################################
+// SETTINGS
+//############################################################################
+
+define('DEFAULT_KBPS', 160);                                                  // Default rate, a bit above a 128 kbps MP3
+define('CHUNK_SIZE', 512);                                                    // Bytes sent at once
+
+//############################################################################
+
+$file = __DIR__ . '/' . preg_replace('/^\/+/', '', str_replace('..', '', @$_GET['file']));
+if (!is_file($file)) {
+    http_response_code(404);
+    die('No such file');
+}
+
+$kbps = max(1, (int)(@$_GET['kbps'] ?: DEFAULT_KBPS));
+$stall = max(0, (int)@$_GET['stall']);
+$every = max(0, (int)@$_GET['every']);
+$jitter = min(100, max(0, (int)@$_GET['jitter']));
+
+set_time_limit(0);
+while (ob_get_level()) {
+    ob_end_flush();
+}
+
+header('Content-Type: audio/mpeg');
+header('Content-length: ' . filesize($file));
+
+streamThrottled($file, $kbps, $stall, $every, $jitter);
+exit;
+
+/**
+ * Send file in chunks, paced to the given rate
+ *
+ * @param string $file
+ * @param int $kbps
+ * @param int $stall Stall duration, ms
+ * @param int $every Stall period, ms
+ * @param int $jitter Chunk delay variation, percent
+ */
+function streamThrottled($file, $kbps, $stall, $every, $jitter)
+{
+    $chunkUs = CHUNK_SIZE * 8 * 1000 / $kbps;
+    $start = microtime(true);
+    $lastStall = $start;
+
+    $fp = fopen($file, 'rb');
+    while (!feof($fp) && !connection_aborted()) {
+        echo fread($fp, CHUNK_SIZE);
+        flush();
+
+        if ($stall && $every && (microtime(true) - $lastStall) * 1000 >= $every) {
+            usleep($stall * 1000);
+            $lastStall = microtime(true);
+        }
+        usleep((int)($chunkUs * (1 + mt_rand(-$jitter, $jitter) / 100)));
+    }
+    fclose($fp);
+}
@@ -20,8 +20,15 @@
  *
  *    Parameters may be POSTed as well.
  *
+ *  - http//<host>/<path>/esparkle_tts.php?voice=<voice>&text=<text>&stream=1
+ *    Same, but get the MP3 itself in return, sent while Polly synthesizes it.
+ *
+ *    Set STANDIN_MP3 to stream a local MP3 file at STANDIN_KBPS instead of calling
+ *    Polly, e.g. with "php -S 0.0.0.0:8080", to measure ESParkle side latency.
+ *
  * CHANGES
  *  - 20180329 V1.0 Initial version
+ *  - 20261017 V1.1 Streaming mode
  */
 
 //############################################################################
@@ -43,6 +50,11 @@ define('AWS_SECRET_KEY', 'YOUR_AWS_SECRET_KEY');                              //
 define('AWS_REGION', 'us-west-1');                                            // See https://docs.aws.amazon.com/en_en/general/latest/gr/rande.html#pol_region
 define('AWS_VOICE', 'Matthew');                                               // Default voice, see https://docs.aws.amazon.com/polly/latest/dg/voicelist.html
 
+// STREAMING
+define('STREAM_CHUNK', 1024);                                                 // Bytes sent at once in streaming mode
+define('STANDIN_MP3', '');                                                    // MP3 file sent instead of calling Polly (leave empty to call Polly)
+define('STANDIN_KBPS', 64);                                                   // Stand-in synthesis speed
+
 //############################################################################
 
 // Display error messages (should be disabled in production)
@@ -101,41 +113,100 @@ if (!is_dir(MP3_DIR)) {
     mkdir(MP3_DIR, 0777, true);
 }
 
+// Get optional stream param
+$stream = !empty($_REQUEST['stream']);
+
 // Set mp3 file name
 $filename = md5(strtoupper($voice . $text)) . '.mp3';
 
-// Create mp3 file if it does not exist
-if (!file_exists(MP3_DIR . $filename)) {
+// Create mp3 file if it does not exist, sending it while it's received in streaming mode
+if (STANDIN_MP3 || !file_exists(MP3_DIR . $filename)) {
 
+    $part = MP3_DIR . $filename . '.' . getmypid();
     try {
-        require_once 'aws/aws-autoloader.php';
-
-        $polly = new \Aws\Polly\PollyClient([
-            'version'     => '2016-06-10',
-            'credentials' => new \Aws\Credentials\Credentials(AWS_ACCESS_KEY_ID, AWS_SECRET_KEY),
-            'region'      => AWS_REGION
-        ]);
-
-        $speech = $polly->synthesizeSpeech([
-            'OutputFormat' => 'mp3',
-            'SampleRate'   => '16000',  // 8000, 16000, 22050
-            'Text'         => $text,
-            'TextType'     => strpos($text, '<speak>') === 0 ? 'ssml' : 'text',
-            'VoiceId'      => $voice
-        ]);
-
-        $mp3 = $speech->get('AudioStream')->getContents();
+        $fp = fopen($part, 'wb');
+        foreach (synthesize($text, $voice, $stream) as $chunk) {
+            fwrite($fp, $chunk);
+            if ($stream) {
+                if (!headers_sent()) {
+                    // First bytes: no error can be reported anymore, the answer is the MP3
+                    header('Content-Type: audio/mpeg');
+                    header('X-Accel-Buffering: no');
+                    while (ob_get_level()) {
+                        ob_end_flush();
+                    }
+                }
+                echo $chunk;
+                flush();
+            }
+        }
 
         // Save MP3 file and append file name to catalog, with associated voice and text
-        if (file_put_contents(MP3_DIR . $filename, $mp3)) {
+        if (fclose($fp) && filesize($part) && rename($part, MP3_DIR . $filename) && !STANDIN_MP3) {
             file_put_contents(MP3_DIR . 'catalog.csv', date('c') . "\t$filename\t$voice\t$text\n", FILE_APPEND | LOCK_EX);
         }
+        @unlink($part);
 
     } catch (Exception $e) {
         // Something went wrong...
+        @unlink($part);
         die($e->getMessage());
     }
+
+    if ($stream) {
+        exit;
+    }
+}
+
+if ($stream) {
+    // Send cached mp3 file in HTTP response body
+    header('Content-Type: audio/mpeg');
+    header('Content-Length: ' . filesize(MP3_DIR . $filename));
+    readfile(MP3_DIR . $filename);
+    exit;
 }
 
 // Send mp3 file URL in HTTP response body
 die(MP3_BASE_URL . $filename);
+
+/**
+ * MP3 chunks from Polly, as they're received if streaming
+ *
+ * @param string $text
+ * @param string $voice
+ * @param bool $stream
+ * @return Generator
+ */
+function synthesize($text, $voice, $stream)
+{
+    if (STANDIN_MP3) {
+        $fp = fopen(STANDIN_MP3, 'rb');
+        while ($fp && !feof($fp)) {
+            yield fread($fp, STREAM_CHUNK);
+            usleep(STREAM_CHUNK * 8000 / STANDIN_KBPS);
+        }
+        return;
+    }
+
+    require_once 'aws/aws-autoloader.php';
+
+    $polly = new \Aws\Polly\PollyClient([
+        'version'     => '2016-06-10',
+        'credentials' => new \Aws\Credentials\Credentials(AWS_ACCESS_KEY_ID, AWS_SECRET_KEY),
+        'region'      => AWS_REGION
+    ]);
+
+    $speech = $polly->synthesizeSpeech([
+        'OutputFormat' => 'mp3',
+        'SampleRate'   => '16000',  // 8000, 16000, 22050
+        'Text'         => $text,
+        'TextType'     => strpos($text, '<speak>') === 0 ? 'ssml' : 'text',
+        'VoiceId'      => $voice,
+        '@http'        => ['stream' => $stream]
+    ]);
+
+    $audio = $speech->get('AudioStream');
+    while (!$audio->eof()) {
+        yield $audio->read(STREAM_CHUNK);
+    }
+}